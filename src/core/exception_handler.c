@@ -1,65 +1,108 @@
 #include "core/exception_handler.h"
+#include "core/constructor.h"
 #include "core/core.h"
-#include "core/list.h"
+#include "core/thread.h"
 
-#define MAX_EXCEPTION_HANDLERS 32
+#define MAX_EXCEPTION_HANDLERS 64
 
+/* the platform handler is process-wide, while each emulator instance registers
+   handlers for its own code buffers and memory. every handler claims the
+   address range it's responsible for, and is only invoked for exceptions whose
+   pc or faulting address lies within it, routing each fault to the instance
+   that raised it
+
+   handlers are registered from each instance's own thread, so the slots are
+   allocated under a lock. the exception path runs inside a signal handler and
+   can't take the lock, so it scans the slots directly. a slot's callback is
+   published last when it's added, and cleared first when it's removed */
 struct exception_handler {
   void *data;
-  exception_handler_cb cb;
-  struct list_node it;
+  volatile exception_handler_cb cb;
+  volatile uintptr_t begin;
+  volatile uintptr_t end;
 };
 
 static struct exception_handler handlers[MAX_EXCEPTION_HANDLERS];
-static struct list live_handlers;
-static struct list free_handlers;
-
-static void exception_handler_install() {
-  for (int i = 0; i < MAX_EXCEPTION_HANDLERS; i++) {
-    struct exception_handler *handler = &handlers[i];
-    list_add(&free_handlers, &handler->it);
-  }
+static int num_handlers;
+static mutex_t handlers_mutex;
 
-  int res = exception_handler_install_platform();
-  CHECK(res);
+CONSTRUCTOR(exception_handler_init) {
+  handlers_mutex = mutex_create();
 }
 
-static void exception_handler_uninstall() {
-  exception_handler_uninstall_platform();
+static int exception_handler_claims(struct exception_handler *handler,
+                                    struct exception_state *ex) {
+  uintptr_t begin = handler->begin;
+  uintptr_t end = handler->end;
+
+  return (ex->pc >= begin && ex->pc <= end) ||
+         (ex->fault_addr >= begin && ex->fault_addr <= end);
 }
 
 struct exception_handler *exception_handler_add(void *data,
                                                 exception_handler_cb cb) {
-  if (list_empty(&live_handlers)) {
-    exception_handler_install();
+  mutex_lock(handlers_mutex);
+
+  if (!num_handlers) {
+    int res = exception_handler_install_platform();
+    CHECK(res);
+  }
+
+  struct exception_handler *handler = NULL;
+
+  for (int i = 0; i < MAX_EXCEPTION_HANDLERS; i++) {
+    if (!handlers[i].cb) {
+      handler = &handlers[i];
+      break;
+    }
   }
 
-  /* remove from free list */
-  struct exception_handler *handler =
-      list_first_entry(&free_handlers, struct exception_handler, it);
   CHECK_NOTNULL(handler);
-  list_remove(&free_handlers, &handler->it);
 
-  /* add to live list */
+  /* handlers start out claiming an empty range */
   handler->data = data;
+  handler->begin = 1;
+  handler->end = 0;
   handler->cb = cb;
-  list_add(&live_handlers, &handler->it);
+  num_handlers++;
+
+  mutex_unlock(handlers_mutex);
 
   return handler;
 }
 
 void exception_handler_remove(struct exception_handler *handler) {
-  list_remove(&live_handlers, &handler->it);
-  list_add(&free_handlers, &handler->it);
+  mutex_lock(handlers_mutex);
+
+  handler->cb = NULL;
+  num_handlers--;
 
-  if (list_empty(&live_handlers)) {
-    exception_handler_uninstall();
+  if (!num_handlers) {
+    exception_handler_uninstall_platform();
   }
+
+  mutex_unlock(handlers_mutex);
+}
+
+void exception_handler_set_range(struct exception_handler *handler,
+                                 uintptr_t begin, uintptr_t end) {
+  /* narrow the range before widening it, so the handler never momentarily
+     claims addresses outside of both the old and new ranges */
+  handler->begin = UINTPTR_MAX;
+  handler->end = end;
+  handler->begin = begin;
 }
 
 int exception_handler_handle(struct exception_state *ex) {
-  list_for_each_entry(handler, &live_handlers, struct exception_handler, it) {
-    if (handler->cb(handler->data, ex)) {
+  for (int i = 0; i < MAX_EXCEPTION_HANDLERS; i++) {
+    struct exception_handler *handler = &handlers[i];
+    exception_handler_cb cb = handler->cb;
+
+    if (!cb || !exception_handler_claims(handler, ex)) {
+      continue;
+    }
+
+    if (cb(handler->data, ex)) {
       return 1;
     }
   }
@@ -52,6 +52,10 @@ void exception_handler_uninstall_platform();
 struct exception_handler *exception_handler_add(void *data,
                                                 exception_handler_cb cb);
 void exception_handler_remove(struct exception_handler *handler);
+/* claims the inclusive range [begin, end]. the handler is only invoked for
+   exceptions whose pc or faulting address falls within it */
+void exception_handler_set_range(struct exception_handler *handler,
+                                 uintptr_t begin, uintptr_t end);
 int exception_handler_handle(struct exception_state *ex);
 
 #endif
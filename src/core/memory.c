@@ -1,13 +1,16 @@
 #include <stdlib.h>
 #include "core/memory.h"
+#include "core/constructor.h"
 #include "core/core.h"
 #include "core/exception_handler.h"
 #include "core/interval_tree.h"
 #include "core/list.h"
+#include "core/thread.h"
 
 #define MAX_WATCHES 8192
 
 struct memory_watch {
+  struct memory_watcher *watcher;
   enum memory_watch_type type;
   memory_watch_cb cb;
   void *data;
@@ -16,39 +19,37 @@ struct memory_watch {
 };
 
 struct memory_watcher {
+  enum memory_watch_backend backend;
   struct exception_handler *exc_handler;
   struct rb_tree tree;
   struct memory_watch watches[MAX_WATCHES];
   struct list free_watches;
   struct list live_watches;
-};
-
-static struct memory_watcher *watcher;
-
-static int watcher_handle_exception(void *ctx, struct exception_state *ex);
-
-static void watcher_create() {
-  watcher = calloc(1, sizeof(struct memory_watcher));
 
-  watcher->exc_handler = exception_handler_add(NULL, &watcher_handle_exception);
-
-  for (int i = 0; i < MAX_WATCHES; i++) {
-    struct memory_watch *watch = &watcher->watches[i];
-    list_add(&watcher->free_watches, &watch->list_it);
-  }
-}
-
-static void watcher_destroy() {
-  exception_handler_remove(watcher->exc_handler);
+  /* bounds of the live watches, claimed from the exception handler so only
+     faults on this watcher's pages are routed to it */
+  uintptr_t begin;
+  uintptr_t end;
+};
 
-  free(watcher);
+/* soft-dirty bits are reset for the entire process at once, so only a single
+   watcher can track writes with them */
+static struct memory_watcher *soft_dirty_watcher;
+static mutex_t soft_dirty_mutex;
 
-  watcher = NULL;
+CONSTRUCTOR(memory_watch_init) {
+  soft_dirty_mutex = mutex_create();
 }
 
 static int watcher_handle_exception(void *ctx, struct exception_state *ex) {
+  struct memory_watcher *watcher = ctx;
   int handled = 0;
 
+  /* watched pages are only write-protected by the fault backend */
+  if (watcher->backend != WATCH_BACKEND_FAULT) {
+    return 0;
+  }
+
   struct interval_tree_it it;
   struct interval_node *n = interval_tree_iter_first(
       &watcher->tree, ex->fault_addr, ex->fault_addr, &it);
@@ -74,14 +75,169 @@ static int watcher_handle_exception(void *ctx, struct exception_state *ex) {
     n = next;
   }
 
-  if (watcher && !watcher->tree.root) {
-    watcher_destroy();
+  return handled;
+}
+
+static int watcher_soft_dirty_supported() {
+  /* soft-dirty bits are only available when the kernel is built with
+     CONFIG_MEM_SOFT_DIRTY, and always read back as zero otherwise. probe for
+     support by dirtying a scratch page */
+  size_t page_size = get_page_size();
+  volatile uint8_t *page = reserve_pages(NULL, page_size);
+  int supported = 0;
+
+  if (!page) {
+    return 0;
   }
 
-  return handled;
+  if (protect_pages((void *)page, page_size, ACC_READWRITE) &&
+      reset_dirty_pages()) {
+    uint8_t dirty = 0;
+    page[0] = 1;
+    supported = get_dirty_pages((void *)page, page_size, &dirty) && dirty;
+  }
+
+  release_pages((void *)page, page_size);
+
+  return supported;
+}
+
+static int watcher_range_dirty(uintptr_t begin, uintptr_t end) {
+  size_t page_size = get_page_size();
+  uint8_t dirty[512];
+
+  while (begin < end) {
+    size_t num_pages = MIN((end - begin) / page_size, ARRAY_SIZE(dirty));
+    size_t size = num_pages * page_size;
+
+    /* if the pages can't be queried, assume they've been written */
+    if (!get_dirty_pages((void *)begin, size, dirty)) {
+      return 1;
+    }
+
+    for (size_t i = 0; i < num_pages; i++) {
+      if (dirty[i]) {
+        return 1;
+      }
+    }
+
+    begin += size;
+  }
+
+  return 0;
+}
+
+int poll_dirty_ranges(struct memory_watcher *watcher) {
+  if (watcher->backend != WATCH_BACKEND_SOFT_DIRTY) {
+    return 0;
+  }
+
+  /* clearing the soft-dirty bits walks every page table of the process, don't
+     bother when there's nothing being watched. any range added later is at
+     worst reported dirty spuriously on its first poll */
+  if (list_empty(&watcher->live_watches)) {
+    return 0;
+  }
+
+  int num_dirty = 0;
+
+  list_for_each_entry_safe(watch, &watcher->live_watches, struct memory_watch,
+                           list_it) {
+    struct interval_node *n = &watch->tree_it;
+
+    if (!watcher_range_dirty(n->low, n->high + 1)) {
+      continue;
+    }
+
+    /* call callback for this access watch */
+    watch->cb(NULL, watch->data);
+
+    if (watch->type == WATCH_SINGLE_WRITE) {
+      remove_memory_watch(watch);
+    }
+
+    num_dirty++;
+  }
+
+  /* start tracking writes for the next poll */
+  CHECK(reset_dirty_pages());
+
+  return num_dirty;
+}
+
+enum memory_watch_backend get_memory_watch_backend(
+    struct memory_watcher *watcher) {
+  return watcher->backend;
+}
+
+static int watcher_acquire_soft_dirty(struct memory_watcher *watcher) {
+  mutex_lock(soft_dirty_mutex);
+
+  int acquired = !soft_dirty_watcher || soft_dirty_watcher == watcher;
+  if (acquired) {
+    soft_dirty_watcher = watcher;
+  }
+
+  mutex_unlock(soft_dirty_mutex);
+
+  return acquired;
+}
+
+static void watcher_release_soft_dirty(struct memory_watcher *watcher) {
+  mutex_lock(soft_dirty_mutex);
+
+  if (soft_dirty_watcher == watcher) {
+    soft_dirty_watcher = NULL;
+  }
+
+  mutex_unlock(soft_dirty_mutex);
+}
+
+int set_memory_watch_backend(struct memory_watcher *watcher,
+                             enum memory_watch_backend backend) {
+  if (backend == watcher->backend) {
+    return 1;
+  }
+
+  if (backend == WATCH_BACKEND_SOFT_DIRTY) {
+    if (!watcher_soft_dirty_supported()) {
+      LOG_WARNING("set_memory_watch_backend soft-dirty tracking not supported");
+      return 0;
+    }
+
+    if (!watcher_acquire_soft_dirty(watcher)) {
+      LOG_WARNING("set_memory_watch_backend soft-dirty tracking already in use "
+                  "by another watcher");
+      return 0;
+    }
+  } else {
+    watcher_release_soft_dirty(watcher);
+  }
+
+  /* update the permissions of existing watches for the new backend */
+  enum page_access access =
+      backend == WATCH_BACKEND_FAULT ? ACC_READONLY : ACC_READWRITE;
+
+  list_for_each_entry(watch, &watcher->live_watches, struct memory_watch,
+                      list_it) {
+    struct interval_node *n = &watch->tree_it;
+    uintptr_t aligned_begin = n->low;
+    size_t aligned_size = (n->high - n->low) + 1;
+    CHECK(protect_pages((void *)aligned_begin, aligned_size, access));
+  }
+
+  if (backend == WATCH_BACKEND_SOFT_DIRTY) {
+    CHECK(reset_dirty_pages());
+  }
+
+  watcher->backend = backend;
+
+  return 1;
 }
 
 void remove_memory_watch(struct memory_watch *watch) {
+  struct memory_watcher *watcher = watch->watcher;
+
   /* remove from interval tree */
   interval_tree_remove(&watcher->tree, &watch->tree_it);
 
@@ -91,30 +247,35 @@ void remove_memory_watch(struct memory_watch *watch) {
   /* add to free list */
   list_add(&watcher->free_watches, &watch->list_it);
 
+  /* stop claiming faults once nothing is watched */
   if (!watcher->tree.root) {
-    watcher_destroy();
+    watcher->begin = UINTPTR_MAX;
+    watcher->end = 0;
+    exception_handler_set_range(watcher->exc_handler, watcher->begin,
+                                watcher->end);
   }
 }
 
-struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
+struct memory_watch *add_single_write_watch(struct memory_watcher *watcher,
+                                            const void *ptr, size_t size,
                                             memory_watch_cb cb, void *data) {
-  if (!watcher) {
-    watcher_create();
-  }
-
   /* page align the range to be watched */
   size_t page_size = get_page_size();
   uintptr_t aligned_begin = ALIGN_DOWN((uintptr_t)ptr, page_size);
   uintptr_t aligned_end = ALIGN_UP((uintptr_t)ptr + size, page_size) - 1;
   size_t aligned_size = (aligned_end - aligned_begin) + 1;
 
-  /* disable writing to the pages */
-  CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READONLY));
+  /* disable writing to the pages. when tracking writes with soft-dirty bits,
+     the pages are left writable and checked on the next poll instead */
+  if (watcher->backend == WATCH_BACKEND_FAULT) {
+    CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READONLY));
+  }
 
   /* allocate new access watch */
   struct memory_watch *watch =
       list_first_entry(&watcher->free_watches, struct memory_watch, list_it);
   CHECK_NOTNULL(watch);
+  watch->watcher = watcher;
   watch->type = WATCH_SINGLE_WRITE;
   watch->cb = cb;
   watch->data = data;
@@ -131,5 +292,36 @@ struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
 
   interval_tree_insert(&watcher->tree, &watch->tree_it);
 
+  /* widen the range of faults claimed to cover the new watch */
+  watcher->begin = MIN(watcher->begin, aligned_begin);
+  watcher->end = MAX(watcher->end, aligned_end);
+  exception_handler_set_range(watcher->exc_handler, watcher->begin,
+                              watcher->end);
+
   return watch;
 }
+
+void destroy_memory_watcher(struct memory_watcher *watcher) {
+  watcher_release_soft_dirty(watcher);
+
+  exception_handler_remove(watcher->exc_handler);
+
+  free(watcher);
+}
+
+struct memory_watcher *create_memory_watcher() {
+  struct memory_watcher *watcher = calloc(1, sizeof(struct memory_watcher));
+
+  watcher->backend = WATCH_BACKEND_FAULT;
+  watcher->exc_handler = exception_handler_add(watcher,
+                                               &watcher_handle_exception);
+  watcher->begin = UINTPTR_MAX;
+  watcher->end = 0;
+
+  for (int i = 0; i < MAX_WATCHES; i++) {
+    struct memory_watch *watch = &watcher->watches[i];
+    list_add(&watcher->free_watches, &watch->list_it);
+  }
+
+  return watcher;
+}
@@ -2,6 +2,7 @@
 #define SYS_MEMORY_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct exception_state;
 
@@ -21,6 +22,21 @@ int protect_pages(void *ptr, size_t size, enum page_access access);
 void *reserve_pages(void *ptr, size_t size);
 int release_pages(void *ptr, size_t size);
 
+/*
+ * dirty page tracking
+ */
+int reset_dirty_pages();
+int get_dirty_pages(const void *ptr, size_t size, uint8_t *dirty);
+
+/*
+ * huge pages
+ *
+ * advise_huge_pages asks for the mapping at ptr to be backed by transparent
+ * huge pages. it fails if the host won't back mappings of that kind (shared or
+ * private) with them
+ */
+int advise_huge_pages(void *ptr, size_t size, int shared);
+
 /*
  * shared memory objects
  */
@@ -30,6 +46,10 @@ typedef void *shmem_handle_t;
 
 shmem_handle_t create_shared_memory(const char *filename, size_t size,
                                     enum page_access access);
+/* backs the object with explicitly reserved huge pages, failing if not enough
+   are available to back its entire size */
+shmem_handle_t create_huge_shared_memory(const char *filename, size_t size,
+                                         enum page_access access);
 void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
                         size_t size, enum page_access access);
 int unmap_shared_memory(shmem_handle_t handle, void *start, size_t size);
@@ -39,15 +59,39 @@ int destroy_shared_memory(shmem_handle_t handle);
  * access watches
  */
 struct memory_watch;
+struct memory_watcher;
 
 enum memory_watch_type {
   WATCH_SINGLE_WRITE,
 };
 
+enum memory_watch_backend {
+  /* watched pages are write-protected, and callbacks are invoked from the
+     access violation raised by the first write */
+  WATCH_BACKEND_FAULT,
+  /* watched pages are left writable, with writes being tracked by the kernel's
+     soft-dirty page bits. callbacks are invoked in bulk by poll_dirty_ranges,
+     with a NULL exception state */
+  WATCH_BACKEND_SOFT_DIRTY,
+};
+
 typedef void (*memory_watch_cb)(const struct exception_state *, void *);
 
-struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
+/* each watcher owns its own set of watches and fault routing, so independent
+   emulator instances can watch memory side by side. note, the soft-dirty
+   backend is process-wide and can only be used by one watcher at a time */
+struct memory_watcher *create_memory_watcher();
+void destroy_memory_watcher(struct memory_watcher *watcher);
+
+int set_memory_watch_backend(struct memory_watcher *watcher,
+                             enum memory_watch_backend backend);
+enum memory_watch_backend get_memory_watch_backend(
+    struct memory_watcher *watcher);
+
+struct memory_watch *add_single_write_watch(struct memory_watcher *watcher,
+                                            const void *ptr, size_t size,
                                             memory_watch_cb cb, void *data);
 void remove_memory_watch(struct memory_watch *watch);
+int poll_dirty_ranges(struct memory_watcher *watcher);
 
 #endif
@@ -2,10 +2,12 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "core/constructor.h"
 #include "core/core.h"
 #include "core/filesystem.h"
 #include "core/list.h"
 #include "core/memory.h"
+#include "core/thread.h"
 
 #if PLATFORM_ANDROID
 #include <linux/ashmem.h>
@@ -16,12 +18,46 @@
 struct shmem {
   char filename[PATH_MAX];
   int handle;
+  /* created through memfd_create, with no name to unlink */
+  int anonymous;
   struct list_node free_it;
 };
 
-static int initialized;
+/* shared memory objects are created and destroyed by each emulator instance,
+   possibly on several threads at once */
 static struct shmem shmem_pool[MAX_SHMEM];
 static struct list free_shmem;
+static mutex_t shmem_mutex;
+
+CONSTRUCTOR(shmem_pool_init) {
+  shmem_mutex = mutex_create();
+
+  /* add all entries to free list */
+  for (int i = 0; i < MAX_SHMEM; i++) {
+    struct shmem *shmem = &shmem_pool[i];
+    list_add(&free_shmem, &shmem->free_it);
+  }
+}
+
+static struct shmem *shmem_alloc() {
+  mutex_lock(shmem_mutex);
+
+  /* find unused shmem entry (wrapper for both shmem object name and file
+     handle) and remove it from the free list */
+  struct shmem *shmem = list_first_entry(&free_shmem, struct shmem, free_it);
+  CHECK_NOTNULL(shmem);
+  list_remove(&free_shmem, &shmem->free_it);
+
+  mutex_unlock(shmem_mutex);
+
+  return shmem;
+}
+
+static void shmem_free(struct shmem *shmem) {
+  mutex_lock(shmem_mutex);
+  list_add(&free_shmem, &shmem->free_it);
+  mutex_unlock(shmem_mutex);
+}
 
 static mode_t access_to_mode_flags(enum page_access access) {
   switch (access) {
@@ -91,44 +127,127 @@ int protect_pages(void *ptr, size_t size, enum page_access access) {
   return mprotect(ptr, size, prot) == 0;
 }
 
-size_t get_allocation_granularity() {
-  return get_page_size();
+#if PLATFORM_LINUX
+/* see Documentation/admin-guide/mm/soft-dirty.rst */
+#define PAGEMAP_SOFT_DIRTY (UINT64_C(1) << 55)
+
+static int pagemap_fd = -1;
+
+int reset_dirty_pages() {
+  /* writing 4 clears the soft-dirty bit of each page in the process */
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (fd < 0) {
+    return 0;
+  }
+
+  int res = write(fd, "4", 1) == 1;
+  close(fd);
+
+  return res;
 }
 
-size_t get_page_size() {
-  return getpagesize();
+int get_dirty_pages(const void *ptr, size_t size, uint8_t *dirty) {
+  if (pagemap_fd < 0) {
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+
+    if (pagemap_fd < 0) {
+      return 0;
+    }
+  }
+
+  /* pagemap has a 64-bit entry for each virtual page */
+  size_t page_size = get_page_size();
+  size_t first_page = (uintptr_t)ptr / page_size;
+  size_t num_pages = size / page_size;
+  uint64_t entries[512];
+
+  for (size_t i = 0; i < num_pages;) {
+    size_t n = MIN(num_pages - i, ARRAY_SIZE(entries));
+    ssize_t bytes = n * sizeof(uint64_t);
+    off_t offset = (first_page + i) * sizeof(uint64_t);
+
+    if (pread(pagemap_fd, entries, bytes, offset) != bytes) {
+      return 0;
+    }
+
+    for (size_t j = 0; j < n; j++) {
+      dirty[i + j] = (entries[j] & PAGEMAP_SOFT_DIRTY) != 0;
+    }
+
+    i += n;
+  }
+
+  return 1;
+}
+#else
+int reset_dirty_pages() {
+  return 0;
+}
+
+int get_dirty_pages(const void *ptr, size_t size, uint8_t *dirty) {
+  return 0;
 }
+#endif
 
-static void init_shared_memory_entries() {
-  if (initialized) {
-    return;
+#if PLATFORM_LINUX && defined(MADV_HUGEPAGE)
+/* see Documentation/admin-guide/mm/transhuge.rst */
+static int thp_enabled(const char *path) {
+  char mode[128] = {0};
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
   }
 
-  initialized = 1;
+  int n = read(fd, mode, sizeof(mode) - 1);
+  close(fd);
 
-  /* add all entries to free list */
-  for (int i = 0; i < MAX_SHMEM; i++) {
-    struct shmem *shmem = &shmem_pool[i];
-    list_add(&free_shmem, &shmem->free_it);
+  /* the active mode is bracketed, e.g. "always [madvise] never" */
+  return n > 0 && !strstr(mode, "[never]") && !strstr(mode, "[deny]");
+}
+
+int advise_huge_pages(void *ptr, size_t size, int shared) {
+  const char *path =
+      shared ? "/sys/kernel/mm/transparent_hugepage/shmem_enabled"
+             : "/sys/kernel/mm/transparent_hugepage/enabled";
+
+  if (!thp_enabled(path)) {
+    return 0;
   }
+
+  return madvise(ptr, size, MADV_HUGEPAGE) == 0;
 }
+#else
+int advise_huge_pages(void *ptr, size_t size, int shared) {
+  return 0;
+}
+#endif
 
-int destroy_shared_memory(shmem_handle_t handle) {
-  init_shared_memory_entries();
+size_t get_allocation_granularity() {
+  return get_page_size();
+}
+
+size_t get_page_size() {
+  return getpagesize();
+}
 
+int destroy_shared_memory(shmem_handle_t handle) {
   struct shmem *shmem = (struct shmem *)handle;
   int res = 0;
 
 #if PLATFORM_ANDROID
   res = close(shmem->handle);
 #else
-  int res1 = close(shmem->handle);
-  int res2 = shm_unlink(shmem->filename);
-  res = res1 == 0 && res2 == 0;
+  if (shmem->anonymous) {
+    res = close(shmem->handle) == 0;
+  } else {
+    int res1 = close(shmem->handle);
+    int res2 = shm_unlink(shmem->filename);
+    res = res1 == 0 && res2 == 0;
+  }
 #endif
 
   /* add back to free list */
-  list_add(&free_shmem, &shmem->free_it);
+  shmem_free(shmem);
 
   return res;
 }
@@ -139,8 +258,6 @@ int unmap_shared_memory(shmem_handle_t handle, void *start, size_t size) {
 
 void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
                         size_t size, enum page_access access) {
-  init_shared_memory_entries();
-
   struct shmem *shmem = (struct shmem *)handle;
   int prot = access_to_protect_flags(access);
   int flags = start ? MAP_SHARED | MAP_FIXED : MAP_SHARED;
@@ -155,13 +272,6 @@ void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
 
 shmem_handle_t create_shared_memory(const char *filename, size_t size,
                                     enum page_access access) {
-  init_shared_memory_entries();
-
-  /* find unused shmem entry (wrapper for both shmem object name and file
-     handle) */
-  struct shmem *shmem = list_first_entry(&free_shmem, struct shmem, free_it);
-  CHECK_NOTNULL(shmem);
-
 #if PLATFORM_ANDROID
   int oflag = access_to_open_flags(access);
 
@@ -201,10 +311,48 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
   }
 #endif
 
-  /* update entry, remove from free list */
+  struct shmem *shmem = shmem_alloc();
   strncpy(shmem->filename, filename, sizeof(shmem->filename));
   shmem->handle = handle;
-  list_remove(&free_shmem, &shmem->free_it);
+  shmem->anonymous = 0;
 
   return (shmem_handle_t)shmem;
 }
+
+shmem_handle_t create_huge_shared_memory(const char *filename, size_t size,
+                                         enum page_access access) {
+#if PLATFORM_LINUX && defined(MFD_HUGETLB) && defined(MFD_HUGE_2MB)
+  /* hugetlbfs objects can't be opened by name through shm_open, create an
+     anonymous one instead. note, sealing isn't supported for these */
+  int handle = memfd_create(filename + 1, MFD_HUGETLB | MFD_HUGE_2MB);
+  if (handle == -1) {
+    return SHMEM_INVALID;
+  }
+
+  if (ftruncate(handle, size) == -1) {
+    close(handle);
+    return SHMEM_INVALID;
+  }
+
+  /* huge pages are reserved when the object is first mapped, not when it's
+     sized. map it once up front, such that a lack of reserved pages is caught
+     here, instead of when mapping it into the address space */
+  int prot = access_to_protect_flags(access);
+  void *ptr = mmap(NULL, size, prot, MAP_SHARED, handle, 0);
+  if (ptr == MAP_FAILED) {
+    close(handle);
+    return SHMEM_INVALID;
+  }
+  munmap(ptr, size);
+
+  struct shmem *shmem = shmem_alloc();
+  strncpy(shmem->filename, filename, sizeof(shmem->filename));
+  shmem->handle = handle;
+  shmem->anonymous = 1;
+
+  return (shmem_handle_t)shmem;
+#else
+  return SHMEM_INVALID;
+#endif
+}
+
@@ -52,6 +52,16 @@ int protect_pages(void *ptr, size_t size, enum page_access access) {
   return VirtualProtect(ptr, size, new_protect, &old_protect) != 0;
 }
 
+/* GetWriteWatch only works with memory allocated with MEM_WRITE_WATCH, which
+   file mappings can't be */
+int reset_dirty_pages() {
+  return 0;
+}
+
+int get_dirty_pages(const void *ptr, size_t size, uint8_t *dirty) {
+  return 0;
+}
+
 size_t get_allocation_granularity() {
   SYSTEM_INFO si;
   GetSystemInfo(&si);
@@ -91,6 +101,17 @@ void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
   return ptr;
 }
 
+/* large pages require the SeLockMemoryPrivilege, which regular users don't
+   have, and can't back file mappings which are reserved and later committed */
+int advise_huge_pages(void *ptr, size_t size, int shared) {
+  return 0;
+}
+
+shmem_handle_t create_huge_shared_memory(const char *filename, size_t size,
+                                         enum page_access access) {
+  return SHMEM_INVALID;
+}
+
 shmem_handle_t create_shared_memory(const char *filename, size_t size,
                                     enum page_access access) {
   DWORD protect = access_to_protection_flags(access);
@@ -7,6 +7,7 @@
 struct counter {
   int aggregate;
   int64_t value[2];
+  int64_t total;
 };
 
 static struct {
@@ -56,12 +57,14 @@ void prof_flip(int64_t now) {
 
 void prof_counter_set(prof_token_t tok, int64_t count) {
   struct counter *c = &prof.counters[tok];
+  c->total += count - c->value[1];
   c->value[1] = count;
 }
 
 void prof_counter_add(prof_token_t tok, int64_t count) {
   struct counter *c = &prof.counters[tok];
   c->value[1] += count;
+  c->total += count;
 }
 
 int64_t prof_counter_load(prof_token_t tok) {
@@ -73,3 +76,8 @@ int64_t prof_counter_load(prof_token_t tok) {
     return c->value[1];
   }
 }
+
+int64_t prof_counter_total(prof_token_t tok) {
+  struct counter *c = &prof.counters[tok];
+  return c->total;
+}
@@ -27,6 +27,8 @@ prof_token_t prof_get_counter_token(const char *name);
 prof_token_t prof_get_aggregate_token(const char *name);
 
 int64_t prof_counter_load(prof_token_t tok);
+/* running total since startup, unaffected by aggregate counters flipping */
+int64_t prof_counter_total(prof_token_t tok);
 void prof_counter_add(prof_token_t tok, int64_t count);
 void prof_counter_set(prof_token_t tok, int64_t count);
 
@@ -9,4 +9,7 @@
 
 int64_t time_nanoseconds();
 
+/* cpu time consumed by the calling thread */
+int64_t time_thread_nanoseconds();
+
 #endif
@@ -6,3 +6,9 @@ int64_t time_nanoseconds() {
   clock_gettime(CLOCK_MONOTONIC, &tp);
   return (int64_t)tp.tv_sec * NS_PER_SEC + (int64_t)tp.tv_nsec;
 }
+
+int64_t time_thread_nanoseconds() {
+  struct timespec tp;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp);
+  return (int64_t)tp.tv_sec * NS_PER_SEC + (int64_t)tp.tv_nsec;
+}
@@ -14,3 +14,18 @@ int64_t time_nanoseconds() {
 
   return (int64_t)(result * timebase_info.numer / timebase_info.denom);
 }
+
+int64_t time_thread_nanoseconds() {
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  mach_port_t thread = mach_thread_self();
+  kern_return_t kr =
+      thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count);
+  mach_port_deallocate(mach_task_self(), thread);
+  DCHECK_EQ(kr, KERN_SUCCESS);
+
+  int64_t us = (int64_t)(info.user_time.seconds + info.system_time.seconds) *
+                   1000000 +
+               info.user_time.microseconds + info.system_time.microseconds;
+  return us * 1000;
+}
@@ -16,3 +16,17 @@ int64_t time_nanoseconds() {
 
   return (int64_t)((double)counter.QuadPart / scale);
 }
+
+int64_t time_thread_nanoseconds() {
+  FILETIME creation, exit, kernel, user;
+  CHECK(GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user));
+
+  /* times are in 100 ns intervals */
+  ULARGE_INTEGER k, u;
+  k.LowPart = kernel.dwLowDateTime;
+  k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime;
+  u.HighPart = user.dwHighDateTime;
+
+  return (int64_t)(k.QuadPart + u.QuadPart) * 100;
+}
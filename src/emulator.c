@@ -12,7 +12,10 @@
  */
 
 #include "emulator.h"
-#include "core/memory.h"
+#include <math.h>
+#include "core/filesystem.h"
+#include "core/md5.h"
+#include "core/ringbuf.h"
 #include "core/thread.h"
 #include "core/time.h"
 #include "file/trace.h"
@@ -20,14 +23,18 @@
 #include "guest/arm7/arm7.h"
 #include "guest/bios/bios.h"
 #include "guest/dreamcast.h"
+#include "guest/gdrom/disc.h"
 #include "guest/gdrom/gdrom.h"
 #include "guest/holly/holly.h"
 #include "guest/maple/maple.h"
+#include "guest/memory.h"
 #include "guest/pvr/pvr.h"
 #include "guest/pvr/ta.h"
 #include "guest/pvr/tr.h"
+#include "guest/rewind.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "host/host.h"
 #include "imgui.h"
 #include "options.h"
@@ -40,10 +47,13 @@ enum {
   ASPECT_RATIO_4BY3,
 };
 
+/* number of frame slots handed between the emulation and video threads. one
+   is held by the video thread for drawing, one is being filled by the
+   emulation thread, and one is ready to be picked up next */
+#define EMU_NUM_FRAMES 3
+
 /* emulation thread state */
 enum {
-  EMU_SHUTDOWN,
-  EMU_WAITING,
   EMU_RUNFRAME,
   EMU_DRAWFRAME,
   EMU_ENDFRAME,
@@ -61,16 +71,19 @@ struct emu_framebuffer {
   int height;
 };
 
+struct emu_frame {
+  /* source of the frame's video, EMU_SOURCE_NONE repeats the last frame */
+  int source;
+  int disabled;
+  struct tr_context rc;
+  struct emu_framebuffer fb;
+};
+
 struct emu_texture {
   struct tr_texture;
   struct emu *emu;
   struct list_node free_it;
   struct rb_node live_it;
-
-  struct memory_watch *texture_watch;
-  struct memory_watch *palette_watch;
-  struct list_node modified_it;
-  int modified;
 };
 
 struct emu {
@@ -78,6 +91,7 @@ struct emu {
   struct render_backend *r;
 
   struct dreamcast *dc;
+  struct tr *tr;
   int aspect_ratio;
 
   /* when running with multiple threads, the dreamcast emulation is ran on a
@@ -87,23 +101,44 @@ struct emu {
      upwards of doubles the performance */
   int multi_threaded;
 
-  /* emulation thread synchronization primitives */
-  volatile int state;
+  /* emulation thread synchronization primitives. completed frames are passed
+     to the video thread, and drawn frames passed back, through a pair of
+     lock-free queues of slot indices. this lets the emulation thread run the
+     next frame while the video thread draws the previous one. the mutex and
+     conditions are only used to sleep while waiting on the other thread */
+  volatile int shutdown;
+  volatile int paused;
+  volatile int parked;
+  int state;
   volatile unsigned frame;
   thread_t run_thread;
-  mutex_t req_mutex;
-  cond_t req_cond;
-  mutex_t res_mutex;
-  cond_t res_cond;
-
-  /* latest video state pushed by the dreamcast */
-  volatile int vid_disabled;
-  volatile int vid_source;
-  struct tr_context vid_rc;
-  struct emu_framebuffer vid_fb;
-
-  /* latest context submitted to emu_start_render */
-  struct ta_context *pending_ctx;
+  mutex_t sync_mutex;
+  cond_t emu_cond;
+  cond_t vid_cond;
+
+  struct emu_frame *frames;
+  struct ringbuf *ready_frames;
+  struct ringbuf *free_frames;
+
+  /* slot being filled by the emulation thread */
+  struct emu_frame *cur_frame;
+
+  /* slot being drawn by the video thread */
+  int vid_frame;
+  int vid_disabled;
+
+  /* latest context submitted to emu_start_render, and the slot it's to be
+     converted into */
+  struct ta_context *volatile pending_ctx;
+  struct emu_frame *pending_frame;
+
+  /* frame pacing stats */
+  int64_t emu_stall_time;
+  int64_t vid_stall_time;
+  int64_t last_frame_time;
+  int64_t num_frame_times;
+  double frame_time_mean;
+  double frame_time_m2;
 
   /* texture cache. the dreamcast interface calls into us when new contexts are
      available to be rendered. parsing the contexts, uploading their textures to
@@ -112,15 +147,23 @@ struct emu {
   struct list free_textures;
   struct rb_tree live_textures;
 
-  /* textures for the current context are uploaded to the render backend by the
-     video thread in parallel to the emulation thread executing. normally, this
-     is safe as the real hardware also rendered asynchronously. unfortunately,
-     some games will be naughty and modify a texture before receiving the end of
-     render interrupt. in order to avoid race conditions around accessing the
-     texture's dirty state, textures are not immediately marked dirty by the
-     emulation thread when modified. instead, they are added to this modified
-     list which will be processed the next time the threads are synchronized */
-  struct list modified_textures;
+  /* boot snapshot. when enabled, the machine's state is captured once the
+     disc's bootfile starts executing, and restored on later launches of the
+     same disc in place of running through the bootstrap again */
+  char boot_snapshot_path[PATH_MAX];
+  int capture_boot;
+  int boot_complete;
+
+  /* rewind history. a capture is taken every few frames, and while the rewind
+     key is held the machine steps back through them a frame at a time */
+  struct rewind *rewind;
+  int rewind_frames;
+  volatile int rewinding;
+
+  /* input recording. each controller event is written out along with the
+     number of vblanks since the disc was loaded, for rebench to replay */
+  FILE *input_log;
+  volatile int input_frame;
 
   /* debugging */
   struct trace_writer *trace_writer;
@@ -166,32 +209,39 @@ static void emu_dirty_textures(struct emu *emu) {
 }
 
 static void emu_dirty_modified_textures(struct emu *emu) {
-  list_for_each_entry(tex, &emu->modified_textures, struct emu_texture,
-                      modified_it) {
-    tex->dirty = 1;
-    tex->modified = 0;
+  uint8_t vram_dirty[MEM_DIRTY_VRAM_PAGES];
+  int num_dirty =
+      mem_vram_poll_dirty(emu->dc->mem, MEM_DIRTY_TEXTURES, vram_dirty);
+  int palette_dirty = emu->dc->pvr->palette_dirty;
+
+  emu->dc->pvr->palette_dirty = 0;
+
+  if (!num_dirty && !palette_dirty) {
+    return;
   }
 
-  list_clear(&emu->modified_textures);
-}
+  const uint8_t *vram = mem_vram(emu->dc->mem, 0x0);
+  struct rb_node *it = rb_first(&emu->live_textures);
 
-static void emu_texture_modified(const struct exception_state *ex, void *data) {
-  struct emu_texture *tex = data;
-  tex->texture_watch = NULL;
+  while (it) {
+    struct emu_texture *tex = rb_entry(it, struct emu_texture, live_it);
 
-  if (!tex->modified) {
-    list_add(&tex->emu->modified_textures, &tex->modified_it);
-    tex->modified = 1;
-  }
-}
+    if (tex->palette && palette_dirty) {
+      tex->dirty = 1;
+    }
+
+    if (tex->texture && num_dirty) {
+      uint32_t offset = (uint32_t)(tex->texture - vram);
+      int begin = offset >> MEM_DIRTY_PAGE_SHIFT;
+      int end = (offset + tex->texture_size - 1) >> MEM_DIRTY_PAGE_SHIFT;
+      end = MIN(end, MEM_DIRTY_VRAM_PAGES - 1);
 
-static void emu_palette_modified(const struct exception_state *ex, void *data) {
-  struct emu_texture *tex = data;
-  tex->palette_watch = NULL;
+      for (int i = begin; i <= end && !tex->dirty; i++) {
+        tex->dirty = vram_dirty[i];
+      }
+    }
 
-  if (!tex->modified) {
-    list_add(&tex->emu->modified_textures, &tex->modified_it);
-    tex->modified = 1;
+    it = rb_next(it);
   }
 }
 
@@ -258,21 +308,6 @@ static void emu_register_texture_source(struct emu *emu, union tsp tsp,
                     &entry->palette_size);
   }
 
-#ifdef NDEBUG
-  /* add write callback in order to invalidate on future writes. the callback
-     address will be page aligned, therefore it will be triggered falsely in
-     some cases. over invalidate in these cases */
-  if (!entry->texture_watch) {
-    entry->texture_watch = add_single_write_watch(
-        entry->texture, entry->texture_size, &emu_texture_modified, entry);
-  }
-
-  if (entry->palette && !entry->palette_watch) {
-    entry->palette_watch = add_single_write_watch(
-        entry->palette, entry->palette_size, &emu_palette_modified, entry);
-  }
-#endif
-
   if (emu->trace_writer && entry->dirty && first_registration_this_frame) {
     trace_writer_insert_texture(emu->trace_writer, tsp, tcw, entry->frame,
                                 entry->palette, entry->palette_size,
@@ -280,16 +315,12 @@ static void emu_register_texture_source(struct emu *emu, union tsp tsp,
   }
 }
 
-static void emu_register_texture_sources(struct emu *emu,
-                                         struct ta_context *ctx) {
+static void emu_register_param_textures(struct emu *emu,
+                                        struct ta_context *ctx) {
   const uint8_t *data = ctx->params;
   const uint8_t *end = ctx->params + ctx->size;
   int vert_type = 0;
 
-  if (ctx->bg_isp.texture) {
-    emu_register_texture_source(emu, ctx->bg_tsp, ctx->bg_tcw);
-  }
-
   while (data < end) {
     union pcw pcw = *(union pcw *)data;
 
@@ -313,6 +344,26 @@ static void emu_register_texture_sources(struct emu *emu,
   }
 }
 
+static void emu_register_texture_sources(struct emu *emu,
+                                         struct ta_context *ctx) {
+  if (ctx->bg_isp.texture) {
+    emu_register_texture_source(emu, ctx->bg_tsp, ctx->bg_tcw);
+  }
+
+  /* the ta's set overflowed, find the textures the slow way */
+  if (ctx->textures_overflow) {
+    emu_register_param_textures(emu, ctx);
+    return;
+  }
+
+  /* the ta collects the unique textures used by the context's params as
+     they're written */
+  for (int i = 0; i < ctx->num_textures; i++) {
+    struct ta_texture_ref *ref = &ctx->textures[i];
+    emu_register_texture_source(emu, ref->tsp, ref->tcw);
+  }
+}
+
 /*
  * trace recording
  */
@@ -349,23 +400,207 @@ static void emu_start_tracing(struct emu *emu) {
   LOG_INFO("begin tracing to %s", filename);
 }
 
+/*
+ * input recording
+ */
+static void emu_stop_input_log(struct emu *emu) {
+  if (!emu->input_log) {
+    return;
+  }
+
+  fclose(emu->input_log);
+  emu->input_log = NULL;
+}
+
+static void emu_start_input_log(struct emu *emu, const char *path) {
+  emu_stop_input_log(emu);
+
+  emu->input_log = fopen(path, "w");
+
+  if (!emu->input_log) {
+    LOG_WARNING("emu_start_input_log failed to open %s", path);
+    return;
+  }
+
+  LOG_INFO("recording input to %s", path);
+}
+
+static void emu_log_input(struct emu *emu, int port, int button,
+                          int16_t value) {
+  if (!emu->input_log) {
+    return;
+  }
+
+  fprintf(emu->input_log, "%d %d %d %d\n", emu->input_frame, port, button,
+          value);
+}
+
+/*
+ * frame handoff
+ */
+static void emu_queue_push(struct ringbuf *rb, int slot) {
+  CHECK_GE(ringbuf_remaining(rb), (int)sizeof(int));
+  *(int *)ringbuf_write_ptr(rb) = slot;
+  ringbuf_advance_write_ptr(rb, sizeof(int));
+}
+
+static int emu_queue_pop(struct ringbuf *rb) {
+  if (ringbuf_available(rb) < (int)sizeof(int)) {
+    return -1;
+  }
+  int slot = *(int *)ringbuf_read_ptr(rb);
+  ringbuf_advance_read_ptr(rb, sizeof(int));
+  return slot;
+}
+
+/* sleeps the emulation thread until woken by the video thread. while asleep,
+   the emulation thread is parked, and won't touch the dreamcast's state until
+   it's unpaused. must be called with sync_mutex held */
+static void emu_wait(struct emu *emu) {
+  int64_t start = time_nanoseconds();
+
+  emu->parked = 1;
+  cond_signal(emu->vid_cond);
+  cond_wait(emu->emu_cond, emu->sync_mutex);
+  emu->parked = 0;
+
+  emu->emu_stall_time += time_nanoseconds() - start;
+}
+
+static void emu_wake(struct emu *emu) {
+  mutex_lock(emu->sync_mutex);
+  cond_signal(emu->emu_cond);
+  mutex_unlock(emu->sync_mutex);
+}
+
+/* sleeps the video thread until woken by the emulation thread, converting any
+   context submitted in the meantime. must be called with sync_mutex held */
+static void emu_vid_wait(struct emu *emu) {
+  if (emu->pending_ctx) {
+    /* the emulation thread won't touch the context or its slot until it's
+       been converted, so there's no need to hold the lock while doing so */
+    mutex_unlock(emu->sync_mutex);
+    tr_convert_context(emu->tr, emu->r, emu->pending_ctx,
+                       &emu->pending_frame->rc);
+    mutex_lock(emu->sync_mutex);
+
+    emu->pending_ctx = NULL;
+    cond_signal(emu->emu_cond);
+    return;
+  }
+
+  int64_t start = time_nanoseconds();
+  cond_wait(emu->vid_cond, emu->sync_mutex);
+  emu->vid_stall_time += time_nanoseconds() - start;
+}
+
+static void emu_vid_wake(struct emu *emu) {
+  mutex_lock(emu->sync_mutex);
+  cond_signal(emu->vid_cond);
+  mutex_unlock(emu->sync_mutex);
+}
+
+/* grab a free slot for the next frame to be written to, waiting for the video
+   thread to finish with one if none are available */
+static int emu_acquire_frame(struct emu *emu) {
+  int slot = emu_queue_pop(emu->free_frames);
+
+  if (slot < 0 && emu->multi_threaded) {
+    mutex_lock(emu->sync_mutex);
+    while (!emu->shutdown &&
+           (emu->paused || (slot = emu_queue_pop(emu->free_frames)) < 0)) {
+      emu_wait(emu);
+    }
+    mutex_unlock(emu->sync_mutex);
+  }
+
+  if (slot < 0) {
+    return 0;
+  }
+
+  emu->cur_frame = &emu->frames[slot];
+  emu->cur_frame->source = EMU_SOURCE_NONE;
+  emu->cur_frame->disabled = 0;
+  return 1;
+}
+
+static void emu_publish_frame(struct emu *emu) {
+  int slot = (int)(emu->cur_frame - emu->frames);
+
+  emu->cur_frame = NULL;
+  emu_queue_push(emu->ready_frames, slot);
+
+  if (emu->multi_threaded) {
+    emu_vid_wake(emu);
+  }
+}
+
+static void emu_release_frame(struct emu *emu, int slot) {
+  emu_queue_push(emu->free_frames, slot);
+
+  if (emu->multi_threaded) {
+    emu_wake(emu);
+  }
+}
+
+/* wait for any context pending conversion by the video thread */
+static void emu_wait_converted(struct emu *emu) {
+  if (!emu->multi_threaded) {
+    return;
+  }
+
+  mutex_lock(emu->sync_mutex);
+  while (!emu->shutdown && (emu->paused || emu->pending_ctx)) {
+    emu_wait(emu);
+  }
+  mutex_unlock(emu->sync_mutex);
+}
+
+/* park the emulation thread at its next sync point, such that the video
+   thread is free to access the dreamcast's state */
+static void emu_pause(struct emu *emu) {
+  if (!emu->multi_threaded || emu->shutdown) {
+    return;
+  }
+
+  mutex_lock(emu->sync_mutex);
+  emu->paused = 1;
+  while (!emu->parked) {
+    emu_vid_wait(emu);
+  }
+  mutex_unlock(emu->sync_mutex);
+}
+
+static void emu_unpause(struct emu *emu) {
+  if (!emu->multi_threaded || emu->shutdown) {
+    return;
+  }
+
+  mutex_lock(emu->sync_mutex);
+  emu->paused = 0;
+  cond_signal(emu->emu_cond);
+  mutex_unlock(emu->sync_mutex);
+}
+
 /*
  * dreamcast guest interface
  */
 static void emu_vblank_in(void *userdata, int vid_disabled) {
   struct emu *emu = userdata;
 
-  if (emu->multi_threaded) {
-    mutex_lock(emu->res_mutex);
+  emu->input_frame++;
+
+  if (!emu->cur_frame && !emu_acquire_frame(emu)) {
+    return;
   }
 
+  /* the frame's context must finish being converted before it's drawn */
+  emu_wait_converted(emu);
+
   emu->state = EMU_DRAWFRAME;
-  emu->vid_disabled = vid_disabled;
+  emu->cur_frame->disabled = vid_disabled;
 
-  if (emu->multi_threaded) {
-    cond_signal(emu->res_cond);
-    mutex_unlock(emu->res_mutex);
-  }
+  emu_publish_frame(emu);
 }
 
 static void emu_vblank_out(void *userdata) {
@@ -377,31 +612,33 @@ static void emu_vblank_out(void *userdata) {
 static void emu_finish_render(void *userdata) {
   struct emu *emu = userdata;
 
-  if (emu->multi_threaded) {
-    /* ideally, the video thread has parsed the pending context, uploaded its
-       textures, etc. during the estimated render time. however, if it hasn't
-       finished, the emulation thread must be paused to avoid altering
-       the yet-to-be-uploaded texture memory */
-    mutex_lock(emu->res_mutex);
-
-    /* if pending_ctx is non-NULL here, a frame is being skipped */
-    emu->pending_ctx = NULL;
-    cond_signal(emu->res_cond);
-
-    mutex_unlock(emu->res_mutex);
-  }
+  /* ideally, the video thread has parsed the pending context, uploaded its
+     textures, etc. during the estimated render time. however, if it hasn't
+     finished, the emulation thread must be paused to avoid altering the
+     yet-to-be-uploaded texture memory */
+  emu_wait_converted(emu);
 }
 
 static void emu_start_render(void *userdata, struct ta_context *ctx) {
   struct emu *emu = userdata;
 
+  /* contexts started after vblank in belong to the next frame */
+  if (!emu->cur_frame && !emu_acquire_frame(emu)) {
+    return;
+  }
+
+  /* wait for the previous context to be converted, in case the game didn't
+     wait for it to finish rendering */
+  emu_wait_converted(emu);
+
   /* incement internal frame number. this frame number is assigned to the each
      texture source registered to assert synchronization between the emulator
      and video thread is working as expected */
   emu->frame++;
 
   /* now that the video thread is sure to not be accessing the texture data,
-     mark any textures dirty that were invalidated by a memory watch */
+     mark any textures dirty whose source pages were written since the last
+     frame */
   emu_dirty_modified_textures(emu);
 
   /* register the source of each texture referenced by the context with the
@@ -414,27 +651,35 @@ static void emu_start_render(void *userdata, struct ta_context *ctx) {
     trace_writer_render_context(emu->trace_writer, ctx);
   }
 
+  emu->cur_frame->source = EMU_SOURCE_CTX;
+
   if (emu->multi_threaded) {
     /* save off context and notify video thread that it's available */
-    mutex_lock(emu->res_mutex);
+    mutex_lock(emu->sync_mutex);
 
     emu->pending_ctx = ctx;
-    cond_signal(emu->res_cond);
+    emu->pending_frame = emu->cur_frame;
+    cond_signal(emu->vid_cond);
 
-    mutex_unlock(emu->res_mutex);
+    mutex_unlock(emu->sync_mutex);
   } else {
-    emu->pending_ctx = ctx;
+    tr_convert_context(emu->tr, emu->r, ctx, &emu->cur_frame->rc);
   }
 }
 
 static void emu_push_pixels(void *userdata, const uint8_t *data, int w, int h) {
   struct emu *emu = userdata;
 
-  memcpy(emu->vid_fb.data, data, w * h * 4);
-  emu->vid_fb.width = w;
-  emu->vid_fb.height = h;
+  if (!emu->cur_frame && !emu_acquire_frame(emu)) {
+    return;
+  }
+
+  struct emu_framebuffer *fb = &emu->cur_frame->fb;
+  memcpy(fb->data, data, w * h * 4);
+  fb->width = w;
+  fb->height = h;
 
-  emu->vid_source = EMU_SOURCE_PXL;
+  emu->cur_frame->source = EMU_SOURCE_PXL;
 }
 
 static void emu_push_audio(void *userdata, const int16_t *data, int frames) {
@@ -445,6 +690,14 @@ static void emu_push_audio(void *userdata, const int16_t *data, int frames) {
 /*
  * options
  */
+static void emu_boot_complete(void *userdata) {
+  struct emu *emu = userdata;
+
+  /* called each time the bootfile's entry point is compiled, only the first
+     after a capture has been armed matters */
+  emu->boot_complete = emu->capture_boot;
+}
+
 static void emu_set_aspect_ratio(struct emu *emu, const char *new_ratio) {
   int i;
 
@@ -466,45 +719,216 @@ static void emu_set_aspect_ratio(struct emu *emu, const char *new_ratio) {
   emu->aspect_ratio = i;
 }
 
+/*
+ * boot snapshots
+ */
+static void emu_save_boot_snapshot(struct emu *emu) {
+  struct snapshot *ss = snapshot_create();
+
+  emu->capture_boot = 0;
+  emu->boot_complete = 0;
+
+  dc_snapshot(emu->dc, ss);
+
+  if (snapshot_save(ss, emu->boot_snapshot_path)) {
+    LOG_INFO("emu_save_boot_snapshot path=%s", emu->boot_snapshot_path);
+  } else {
+    LOG_WARNING("emu_save_boot_snapshot failed to write %s",
+                emu->boot_snapshot_path);
+  }
+
+  snapshot_destroy(ss);
+}
+
+static void emu_load_boot_snapshot(struct emu *emu) {
+  struct dreamcast *dc = emu->dc;
+  struct disc *disc = gdrom_get_disc(dc->gdrom);
+
+  /* only discs are booted through the bootstrap */
+  if (!disc) {
+    return;
+  }
+
+  /* key the snapshot by the disc, as well as the boot rom and flash settings
+     it was booted with */
+  char bios_hash[33];
+  bios_boot_hash(dc->bios, bios_hash);
+
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+  MD5_Update(&md5_ctx, disc->uid, strlen(disc->uid));
+  MD5_Update(&md5_ctx, bios_hash, strlen(bios_hash));
+  char key[33];
+  MD5_Final(key, &md5_ctx);
+
+  const char *appdir = fs_appdir();
+  char snapdir[PATH_MAX];
+  snprintf(snapdir, sizeof(snapdir), "%s" PATH_SEPARATOR "snapshots", appdir);
+
+  /* the snapshot is only a cache, boot normally if it can't be stored */
+  if (!fs_mkdir(snapdir)) {
+    LOG_WARNING("emu_load_boot_snapshot failed to create %s, booting without "
+                "a snapshot",
+                snapdir);
+    return;
+  }
+
+  snprintf(emu->boot_snapshot_path, sizeof(emu->boot_snapshot_path),
+           "%s" PATH_SEPARATOR "boot-%s.snap", snapdir, key);
+
+  /* snapshot_load rejects a file whose checksum doesn't match, and dc_restore
+     validates the entire snapshot before touching the machine. on failure
+     it's left as dc_load reset it and boots normally */
+  struct snapshot *ss = snapshot_create();
+  int restored =
+      snapshot_load(ss, emu->boot_snapshot_path) && dc_restore(dc, ss);
+  snapshot_destroy(ss);
+
+  if (restored) {
+    /* the snapshot's clock is as old as the snapshot */
+    bios_sync_clock(dc->bios);
+
+    LOG_INFO("emu_load_boot_snapshot path=%s", emu->boot_snapshot_path);
+    return;
+  }
+
+  LOG_INFO("emu_load_boot_snapshot no valid snapshot for '%s', capturing one "
+           "once booted",
+           disc->uid);
+
+  emu->capture_boot = 1;
+}
+
 /*
  * frame running logic
  */
-static void emu_run_until_vblank(struct emu *emu);
+static void emu_run_until_vblank(struct emu *emu) {
+  const int64_t MACHINE_STEP = HZ_TO_NANO(1000);
+
+  emu->state = EMU_RUNFRAME;
+
+  if (emu->rewind) {
+    /* restoring overwrites the ta contexts and vram, which the video thread
+       may still be converting a context started after vblank in from */
+    emu_wait_converted(emu);
+
+    if (emu->rewinding) {
+      rewind_step(emu->rewind);
+      emu->rewind_frames = 0;
+    } else if (emu->rewind_frames-- <= 0) {
+      rewind_capture(emu->rewind);
+      emu->rewind_frames = OPTION_rewind_interval;
+    }
+  }
+
+  while (!emu->shutdown && dc_running(emu->dc) &&
+         (emu->state == EMU_RUNFRAME || emu->state == EMU_DRAWFRAME)) {
+    dc_tick(emu->dc, MACHINE_STEP);
+
+    /* snapshot in between slices, not from inside the compile callback */
+    if (emu->boot_complete) {
+      emu_save_boot_snapshot(emu);
+    }
+  }
+}
 
 static void *emu_run_thread(void *data) {
   struct emu *emu = data;
 
   while (1) {
-    /* wait for video thread to request a frame to be ran */
-    mutex_lock(emu->req_mutex);
+    /* the frame sync points in the guest callbacks keep the emulation thread
+       at most a frame ahead of the video thread. in between frames, wait for
+       the dreamcast to be running and for the video thread to release it */
+    mutex_lock(emu->sync_mutex);
 
-    while (emu->state == EMU_WAITING) {
-      cond_wait(emu->req_cond, emu->req_mutex);
+    while (!emu->shutdown && (emu->paused || !dc_running(emu->dc))) {
+      emu_wait(emu);
     }
 
-    if (emu->state == EMU_SHUTDOWN) {
-      mutex_unlock(emu->req_mutex);
+    if (emu->shutdown) {
+      mutex_unlock(emu->sync_mutex);
       break;
     }
 
+    mutex_unlock(emu->sync_mutex);
+
     emu_run_until_vblank(emu);
+  }
 
-    emu->state = EMU_WAITING;
+  return NULL;
+}
 
-    mutex_unlock(emu->req_mutex);
+static void emu_update_frame_stats(struct emu *emu) {
+  int64_t now = time_nanoseconds();
+
+  /* running variance of the time between presented frames */
+  if (emu->last_frame_time) {
+    double dt = (now - emu->last_frame_time) / (double)NS_PER_MS;
+    double delta = dt - emu->frame_time_mean;
+    emu->num_frame_times++;
+    emu->frame_time_mean += delta / emu->num_frame_times;
+    emu->frame_time_m2 += delta * (dt - emu->frame_time_mean);
   }
 
-  return NULL;
+  emu->last_frame_time = now;
 }
 
-static void emu_run_until_vblank(struct emu *emu) {
-  const int64_t MACHINE_STEP = HZ_TO_NANO(1000);
+static void emu_log_frame_stats(struct emu *emu) {
+  if (emu->num_frame_times < 2) {
+    return;
+  }
 
-  emu->state = EMU_RUNFRAME;
+  double variance = emu->frame_time_m2 / (emu->num_frame_times - 1);
 
-  while (emu->state == EMU_RUNFRAME || emu->state == EMU_DRAWFRAME) {
-    dc_tick(emu->dc, MACHINE_STEP);
+  LOG_INFO("emu_log_frame_stats frames=%" PRId64
+           " frame_time=%.3fms stddev=%.3fms emu_stall=%.3fms "
+           "vid_stall=%.3fms",
+           emu->num_frame_times, emu->frame_time_mean, sqrt(variance),
+           emu->emu_stall_time / (double)NS_PER_MS,
+           emu->vid_stall_time / (double)NS_PER_MS);
+}
+
+/* pick up the next frame completed by the emulation thread, converting any
+   context it submits in the meantime */
+static void emu_next_frame(struct emu *emu) {
+  int slot = emu_queue_pop(emu->ready_frames);
+
+  if (slot < 0 && emu->multi_threaded) {
+    mutex_lock(emu->sync_mutex);
+
+    /* wake the emulation thread in case the dreamcast was just started */
+    cond_signal(emu->emu_cond);
+
+    while ((slot = emu_queue_pop(emu->ready_frames)) < 0) {
+      /* don't wait on a frame that won't be finished if the dreamcast was
+         suspended part way through it */
+      if (emu->parked && !dc_running(emu->dc)) {
+        break;
+      }
+      emu_vid_wait(emu);
+    }
+
+    mutex_unlock(emu->sync_mutex);
   }
+
+  if (slot < 0) {
+    return;
+  }
+
+  struct emu_frame *frame = &emu->frames[slot];
+  emu->vid_disabled = frame->disabled;
+
+  /* frames without any new video repeat the last one drawn */
+  if (frame->source == EMU_SOURCE_NONE) {
+    emu_release_frame(emu, slot);
+    return;
+  }
+
+  if (emu->vid_frame >= 0) {
+    emu_release_frame(emu, emu->vid_frame);
+  }
+
+  emu->vid_frame = slot;
 }
 
 void emu_render_frame(struct emu *emu) {
@@ -558,91 +982,52 @@ void emu_render_frame(struct emu *emu) {
 
      main thread                        | emulation thread
      ---------------------------------------------------------------------------
-     set EMU_RUNFRAME                   |
+                                        | pop a free slot, start running frame
      ---------------------------------------------------------------------------
-                                        | see EMU_RUNFRAME, start running frame
-     ---------------------------------------------------------------------------
-     wait for EMU_DRAWFRAME / or for    |
-     pending_ctx to be set              |
+     wait for a ready slot, converting  |
+     any pending_ctx set meanwhile      |
      ---------------------------------------------------------------------------
                                         | emu_start_render sets pending_ctx or
                                         | emu_push_pixels copies off framebuffer
      ---------------------------------------------------------------------------
-     convert pending_ctx if set         |
-     ---------------------------------------------------------------------------
-                                        | emu_vblank_in sets EMU_DRAWFRAME
+     convert pending_ctx into its slot  |
      ---------------------------------------------------------------------------
-     see EMU_DRAWFRAME, start drawing   |
+                                        | emu_vblank_in pushes the ready slot
      ---------------------------------------------------------------------------
-                                        | emu_vblank_out sets EMU_ENDFRAME */
-
-  /* request a frame to be ran */
-  if (emu->multi_threaded) {
-    mutex_lock(emu->req_mutex);
-
-    CHECK_EQ(emu->state, EMU_WAITING);
-    emu->state = EMU_RUNFRAME;
-    cond_signal(emu->req_cond);
-
-    mutex_unlock(emu->req_mutex);
-  } else {
-    emu_run_until_vblank(emu);
-  }
-
-  /* process any context submitted during the frame */
-  if (emu->multi_threaded) {
-    mutex_lock(emu->res_mutex);
-
-    while (emu->state == EMU_RUNFRAME && !emu->pending_ctx) {
-      cond_wait(emu->res_cond, emu->res_mutex);
+     pop the ready slot, release the    | pop a free slot, start running the
+     slot drawn last, start drawing     | next frame
+
+     the emulation thread only waits on the main thread when there's no free
+     slot, or when a context it submitted still hasn't been converted by the
+     time it finishes rendering */
+  if (!emu->multi_threaded) {
+    if (!emu->cur_frame) {
+      emu_acquire_frame(emu);
     }
+    emu_run_until_vblank(emu);
   }
 
-  if (emu->pending_ctx) {
-    tr_convert_context(emu->r, emu, &emu_find_texture, emu->pending_ctx,
-                       &emu->vid_rc);
-    emu->pending_ctx = NULL;
-
-    emu->vid_source = EMU_SOURCE_CTX;
-  }
-
-  if (emu->multi_threaded) {
-    mutex_unlock(emu->res_mutex);
-  }
-
-  /* wait for vblank_in */
-  if (emu->multi_threaded) {
-    mutex_lock(emu->res_mutex);
-
-    while (emu->state == EMU_RUNFRAME) {
-      cond_wait(emu->res_cond, emu->res_mutex);
-    }
-
-    mutex_unlock(emu->res_mutex);
-  }
+  emu_next_frame(emu);
+  emu_update_frame_stats(emu);
 
   /* render the latest video source */
-  if (!emu->vid_disabled) {
-    if (emu->vid_source == EMU_SOURCE_PXL) {
-      r_draw_pixels(emu->r, emu->vid_fb.data, 0, 0, emu->vid_fb.width,
-                    emu->vid_fb.height);
-    } else if (emu->vid_source == EMU_SOURCE_CTX) {
-      tr_render_context(emu->r, &emu->vid_rc);
+  if (!emu->vid_disabled && emu->vid_frame >= 0) {
+    struct emu_frame *frame = &emu->frames[emu->vid_frame];
+
+    if (frame->source == EMU_SOURCE_PXL) {
+      r_draw_pixels(emu->r, frame->fb.data, 0, 0, frame->fb.width,
+                    frame->fb.height);
+    } else if (frame->source == EMU_SOURCE_CTX) {
+      tr_render_context(emu->r, &frame->rc);
     }
   }
-
-  /* note, the emulation thread may still be running the code between vblank_in
-     and vblank_out at this point, but there's no need to wait for it */
 }
 
 void emu_debug_menu(struct emu *emu) {
 #ifdef HAVE_IMGUI
-  /* ensure the emulation thread isn't still executing a previous frame */
-  if (emu->multi_threaded) {
-    mutex_lock(emu->req_mutex);
-    CHECK_EQ(emu->state, EMU_WAITING);
-    mutex_unlock(emu->req_mutex);
-  }
+  /* the emulation thread may be running ahead, park it while the menus
+     access the dreamcast's state */
+  emu_pause(emu);
 
   if (igBeginMainMenuBar()) {
     if (igBeginMenu("EMU", 1)) {
@@ -665,6 +1050,8 @@ void emu_debug_menu(struct emu *emu) {
   aica_debug_menu(emu->dc->aica);
   arm7_debug_menu(emu->dc->arm7);
   sh4_debug_menu(emu->dc->sh4);
+  mem_debug_menu(emu->dc->mem);
+  sched_debug_menu(emu->dc->sched);
 
   /* add status */
   if (igBeginMainMenuBar()) {
@@ -675,9 +1062,25 @@ void emu_debug_menu(struct emu *emu) {
     int sh4_instrs = (int)(prof_counter_load(COUNTER_sh4_instrs) / 1000000.0f);
     int arm7_instrs =
         (int)(prof_counter_load(COUNTER_arm7_instrs) / 1000000.0f);
-
-    snprintf(status, sizeof(status), "FPS %3d RPS %3d VBS %3d SH4 %4d ARM %d",
-             frames, ta_renders, pvr_vblanks, sh4_instrs, arm7_instrs);
+    /* percentage of guest time the sh4 spent asleep */
+    int sh4_idle = (int)(prof_counter_load(COUNTER_sh4_idle) / 10000000.0f);
+
+    int len = snprintf(status, sizeof(status),
+                       "FPS %3d RPS %3d VBS %3d SH4 %4d IDLE %3d%% ARM %d",
+                       frames, ta_renders, pvr_vblanks, sh4_instrs, sh4_idle,
+                       arm7_instrs);
+
+    /* percentage of host time spent running devices, in timer callbacks and
+       in the scheduler itself */
+    if (OPTION_sched_stats) {
+      int64_t tick = prof_counter_load(COUNTER_sched_tick_time);
+      int64_t dev = prof_counter_load(COUNTER_sched_device_time);
+      int64_t tmr = prof_counter_load(COUNTER_sched_timer_time);
+      snprintf(status + len, sizeof(status) - len,
+               " DEV %3d%% TMR %3d%% SCHED %3d%%",
+               (int)(dev / 10000000.0f), (int)(tmr / 10000000.0f),
+               (int)((tick - dev - tmr) / 10000000.0f));
+    }
 
     /* right align */
     struct ImVec2 content;
@@ -689,22 +1092,54 @@ void emu_debug_menu(struct emu *emu) {
 
     igEndMainMenuBar();
   }
+
+  emu_unpause(emu);
 #endif
 }
 
 int emu_load(struct emu *emu, const char *path) {
-  return dc_load(emu->dc, path);
+  emu_pause(emu);
+
+  emu->capture_boot = 0;
+  emu->boot_complete = 0;
+  emu->input_frame = 0;
+
+  int res = dc_load(emu->dc, path);
+
+  if (res && OPTION_boot_snapshot) {
+    emu_load_boot_snapshot(emu);
+  }
+
+  /* history from the previous disc doesn't apply to this one */
+  if (emu->rewind) {
+    rewind_reset(emu->rewind);
+    emu->rewind_frames = 0;
+  }
+
+  if (res && OPTION_input_log[0]) {
+    emu_start_input_log(emu, OPTION_input_log);
+  }
+
+  emu_unpause(emu);
+
+  return res;
 }
 
 int emu_keydown(struct emu *emu, int port, int key, int16_t value) {
   if (key >= K_CONT_C && key <= K_CONT_RTRIG) {
     dc_input(emu->dc, port, key - K_CONT_C, value);
+    emu_log_input(emu, port, key - K_CONT_C, value);
+  } else if (key == K_BACKSPACE && emu->rewind) {
+    emu->rewinding = value != 0;
+    return 1;
   }
 
   return 0;
 }
 
 void emu_vid_destroyed(struct emu *emu) {
+  emu_pause(emu);
+
   rb_for_each_entry_safe(tex, &emu->live_textures, struct emu_texture,
                          live_it) {
     r_destroy_texture(emu->r, tex->handle);
@@ -712,6 +1147,8 @@ void emu_vid_destroyed(struct emu *emu) {
   }
 
   emu->r = NULL;
+
+  emu_unpause(emu);
 }
 
 void emu_vid_created(struct emu *emu, struct render_backend *r) {
@@ -721,23 +1158,32 @@ void emu_vid_created(struct emu *emu, struct render_backend *r) {
 void emu_destroy(struct emu *emu) {
   /* shutdown the emulation thread */
   if (emu->multi_threaded) {
-    mutex_lock(emu->req_mutex);
-    emu->state = EMU_SHUTDOWN;
-    cond_signal(emu->req_cond);
-    mutex_unlock(emu->req_mutex);
+    mutex_lock(emu->sync_mutex);
+    emu->shutdown = 1;
+    cond_signal(emu->emu_cond);
+    mutex_unlock(emu->sync_mutex);
 
     void *result;
     thread_join(emu->run_thread, &result);
 
-    mutex_destroy(emu->req_mutex);
-    cond_destroy(emu->req_cond);
-    mutex_destroy(emu->res_mutex);
-    cond_destroy(emu->res_cond);
+    mutex_destroy(emu->sync_mutex);
+    cond_destroy(emu->emu_cond);
+    cond_destroy(emu->vid_cond);
   }
 
+  emu_log_frame_stats(emu);
+
   emu_stop_tracing(emu);
+  emu_stop_input_log(emu);
   emu_vid_destroyed(emu);
+  tr_destroy(emu->tr);
+  if (emu->rewind) {
+    rewind_destroy(emu->rewind);
+  }
   dc_destroy(emu->dc);
+  ringbuf_destroy(emu->ready_frames);
+  ringbuf_destroy(emu->free_frames);
+  free(emu->frames);
   free(emu);
 }
 
@@ -755,6 +1201,22 @@ struct emu *emu_create(struct host *host) {
   emu->dc->finish_render = &emu_finish_render;
   emu->dc->vblank_in = &emu_vblank_in;
   emu->dc->vblank_out = &emu_vblank_out;
+  emu->dc->boot_complete = &emu_boot_complete;
+
+  if (OPTION_rewind > 0) {
+    int64_t budget = (int64_t)OPTION_rewind * 1024 * 1024;
+    int64_t min_budget = rewind_min_budget(emu->dc);
+
+    if (budget <= min_budget) {
+      LOG_WARNING("rewind budget of %d mb leaves no room for history, it must "
+                  "be over %d mb. rewind disabled",
+                  OPTION_rewind, (int)(min_budget / (1024 * 1024)));
+    } else {
+      emu->rewind = rewind_create(emu->dc, budget);
+    }
+  }
+
+  emu->tr = tr_create(emu, &emu_find_texture, OPTION_tr_threads);
 
   /* add all textures to free list by default */
   for (int i = 0; i < ARRAY_SIZE(emu->textures); i++) {
@@ -762,15 +1224,23 @@ struct emu *emu_create(struct host *host) {
     list_add(&emu->free_textures, &tex->free_it);
   }
 
+  /* all frame slots start out free */
+  emu->frames = calloc(EMU_NUM_FRAMES, sizeof(struct emu_frame));
+  emu->ready_frames = ringbuf_create(EMU_NUM_FRAMES * sizeof(int));
+  emu->free_frames = ringbuf_create(EMU_NUM_FRAMES * sizeof(int));
+  emu->vid_frame = -1;
+
+  for (int i = 0; i < EMU_NUM_FRAMES; i++) {
+    emu_queue_push(emu->free_frames, i);
+  }
+
   /* enable the cpu / gpu to be emulated in parallel */
   emu->multi_threaded = 1;
 
   if (emu->multi_threaded) {
-    emu->state = EMU_WAITING;
-    emu->req_mutex = mutex_create();
-    emu->req_cond = cond_create();
-    emu->res_mutex = mutex_create();
-    emu->res_cond = cond_create();
+    emu->sync_mutex = mutex_create();
+    emu->emu_cond = cond_create();
+    emu->vid_cond = cond_create();
 
     emu->run_thread = thread_create(&emu_run_thread, NULL, emu);
     CHECK_NOTNULL(emu->run_thread);
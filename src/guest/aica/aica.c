@@ -1,4 +1,5 @@
 #include "guest/aica/aica.h"
+#include "core/constructor.h"
 #include "core/core.h"
 #include "core/filesystem.h"
 #include "guest/aica/aica_types.h"
@@ -8,6 +9,7 @@
 #include "guest/memory.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
 #include "stats.h"
 
@@ -186,6 +188,10 @@ static void aica_init_tables() {
   }
 }
 
+CONSTRUCTOR(aica_tables_init) {
+  aica_init_tables();
+}
+
 static inline sample_t aica_adjust_master_volume(struct aica *aica,
                                                  sample_t in) {
   sample_t y = mvol_scale[aica->common_data->MVOL];
@@ -868,6 +874,63 @@ static void aica_toggle_recording(struct aica *aica) {
   }
 }
 
+static void aica_load(struct device *dev, struct snapshot *ss) {
+  struct aica *aica = (struct aica *)dev;
+  struct scheduler *sched = aica->dc->sched;
+
+  SNAPSHOT_READ(ss, aica->reg);
+  SNAPSHOT_READ(ss, aica->arm_resetting);
+
+  for (int i = 0; i < ARRAY_SIZE(aica->timers); i++) {
+    aica->timers[i] = sched_read_timer(sched, ss);
+  }
+
+  aica->rtc_timer = sched_read_timer(sched, ss);
+  SNAPSHOT_READ(ss, aica->rtc_write);
+  SNAPSHOT_READ(ss, aica->rtc);
+
+  for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
+    struct aica_channel *ch = &aica->channels[i];
+    struct channel_data *data = ch->data;
+    int32_t base;
+
+    SNAPSHOT_READ(ss, *ch);
+    SNAPSHOT_READ(ss, base);
+    ch->data = data;
+    ch->base = base < 0 ? NULL : &aica->aram[base];
+  }
+
+  aica->sample_timer = sched_read_timer(sched, ss);
+}
+
+static void aica_save(struct device *dev, struct snapshot *ss) {
+  struct aica *aica = (struct aica *)dev;
+  struct scheduler *sched = aica->dc->sched;
+
+  SNAPSHOT_WRITE(ss, aica->reg);
+  SNAPSHOT_WRITE(ss, aica->arm_resetting);
+
+  for (int i = 0; i < ARRAY_SIZE(aica->timers); i++) {
+    sched_write_timer(sched, ss, aica->timers[i]);
+  }
+
+  sched_write_timer(sched, ss, aica->rtc_timer);
+  SNAPSHOT_WRITE(ss, aica->rtc_write);
+  SNAPSHOT_WRITE(ss, aica->rtc);
+
+  /* the channel's pointers are fixed up on load, with the sound source saved
+     as an offset into aram */
+  for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
+    struct aica_channel *ch = &aica->channels[i];
+    int32_t base = ch->base ? (int32_t)(ch->base - aica->aram) : -1;
+
+    SNAPSHOT_WRITE(ss, *ch);
+    SNAPSHOT_WRITE(ss, base);
+  }
+
+  sched_write_timer(sched, ss, aica->sample_timer);
+}
+
 static int aica_init(struct device *dev) {
   struct aica *aica = (struct aica *)dev;
   struct memory *mem = aica->dc->mem;
@@ -907,6 +970,8 @@ static int aica_init(struct device *dev) {
 
 void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
                     uint32_t mask) {
+  mem_count_reg(aica->dc->mem, MEM_REGS_AICA, addr >> 2, 1);
+
   if (addr < 0x2000) {
     aica_channel_reg_write(aica, addr, data, mask);
     return;
@@ -922,6 +987,8 @@ void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
 }
 
 uint32_t aica_reg_read(struct aica *aica, uint32_t addr, uint32_t mask) {
+  mem_count_reg(aica->dc->mem, MEM_REGS_AICA, addr >> 2, 0);
+
   if (addr < 0x2000) {
     return aica_channel_reg_read(aica, addr, mask);
   } else if (addr >= 0x2800 && addr < 0x2d08) {
@@ -935,6 +1002,7 @@ uint32_t aica_reg_read(struct aica *aica, uint32_t addr, uint32_t mask) {
 void aica_mem_write(struct aica *aica, uint32_t addr, uint32_t data,
                     uint32_t mask) {
   WRITE_DATA(&aica->aram[addr]);
+  mem_aram_dirty(aica->dc->mem, addr, 4);
 }
 
 uint32_t aica_mem_read(struct aica *aica, uint32_t addr, uint32_t mask) {
@@ -1039,5 +1107,10 @@ struct aica *aica_create(struct dreamcast *dc) {
     ch->id = i;
   }
 
+  /* setup state interface */
+  aica->stateif.enabled = 1;
+  aica->stateif.save = &aica_save;
+  aica->stateif.load = &aica_load;
+
   return aica;
 }
@@ -4,6 +4,7 @@
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
 #include "guest/scheduler.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
 #include "jit/frontend/armv3/armv3_context.h"
 #include "jit/frontend/armv3/armv3_fallback.h"
@@ -11,6 +12,7 @@
 #include "jit/frontend/armv3/armv3_guest.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
+#include "jit/jit_backend.h"
 #include "stats.h"
 
 #if ARCH_X64
@@ -210,6 +212,9 @@ static struct jit_guest *arm7_guest_create(struct arm7 *arm) {
   guest->w8 = &arm7_write8;
   guest->w16 = &arm7_write16;
   guest->w32 = &arm7_write32;
+  guest->dirty_map = arm7_dirty_map(arm->dc->mem);
+  guest->dirty_shift = MEM_DIRTY_PAGE_SHIFT;
+  guest->dirty_mask = MEM_DIRTY_ARAM_PAGES - 1;
 
   /* runtime interface */
   guest->data = arm;
@@ -227,6 +232,34 @@ static struct jit_guest *arm7_guest_create(struct arm7 *arm) {
   return (struct jit_guest *)guest;
 }
 
+static void arm7_load(struct device *dev, struct snapshot *ss) {
+  struct arm7 *arm = (struct arm7 *)dev;
+
+  SNAPSHOT_READ(ss, arm->ctx.r);
+  SNAPSHOT_READ(ss, arm->ctx.pending_interrupts);
+  SNAPSHOT_READ(ss, arm->ctx.run_cycles);
+  SNAPSHOT_READ(ss, arm->ctx.ran_instrs);
+  SNAPSHOT_READ(ss, arm->requested_interrupts);
+
+  /* point back at the user bank for the restored mode */
+  int mode = arm->ctx.r[CPSR] & M_MASK;
+  for (int n = 0; n < 16; n++) {
+    arm->ctx.rusr[n] = &arm->ctx.r[armv3_reg_table[mode][n]];
+  }
+
+  jit_free_code(arm->jit);
+}
+
+static void arm7_save(struct device *dev, struct snapshot *ss) {
+  struct arm7 *arm = (struct arm7 *)dev;
+
+  SNAPSHOT_WRITE(ss, arm->ctx.r);
+  SNAPSHOT_WRITE(ss, arm->ctx.pending_interrupts);
+  SNAPSHOT_WRITE(ss, arm->ctx.run_cycles);
+  SNAPSHOT_WRITE(ss, arm->ctx.ran_instrs);
+  SNAPSHOT_WRITE(ss, arm->requested_interrupts);
+}
+
 static int arm7_init(struct device *dev) {
   struct arm7 *arm = (struct arm7 *)dev;
 
@@ -234,8 +267,8 @@ static int arm7_init(struct device *dev) {
   arm->guest = arm7_guest_create(arm);
   arm->frontend = armv3_frontend_create(arm->guest);
 #if ARCH_X64
-  DEFINE_JIT_CODE_BUFFER(arm7_code);
-  arm->backend = x64_backend_create(arm->guest, arm7_code, sizeof(arm7_code));
+  uint8_t *code = jit_alloc_code_buffer();
+  arm->backend = x64_backend_create(arm->guest, code, JIT_CODE_BUFFER_SIZE);
 #else
   arm->backend = interp_backend_create(arm->guest, arm->frontend);
 #endif
@@ -264,7 +297,13 @@ void arm7_destroy(struct arm7 *arm) {
   jit_destroy(arm->jit);
   arm7_guest_destroy(arm->guest);
   arm->frontend->destroy(arm->frontend);
+
+  uint8_t *code = arm->backend->code;
   arm->backend->destroy(arm->backend);
+  if (code) {
+    jit_free_code_buffer(code);
+  }
+
   dc_destroy_device((struct device *)arm);
 }
 
@@ -276,5 +315,10 @@ struct arm7 *arm7_create(struct dreamcast *dc) {
   arm->runif.enabled = 1;
   arm->runif.run = &arm7_run;
 
+  /* setup state interface */
+  arm->stateif.enabled = 1;
+  arm->stateif.save = &arm7_save;
+  arm->stateif.load = &arm7_load;
+
   return arm;
 }
@@ -1,5 +1,6 @@
 #include "guest/bios/bios.h"
 #include "core/core.h"
+#include "core/md5.h"
 #include "core/time.h"
 #include "guest/aica/aica.h"
 #include "guest/bios/bios.h"
@@ -12,6 +13,7 @@
 #include "guest/rom/boot.h"
 #include "guest/rom/flash.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "options.h"
 
 /* address of syscall vectors */
@@ -55,6 +57,66 @@ static uint32_t bios_local_time() {
   return (uint32_t)(localtime - gmtdelta + gmtoffset);
 }
 
+void bios_sync_clock(struct bios *bios) {
+  struct dreamcast *dc = bios->dc;
+  struct flash *flash = dc->flash;
+  uint32_t time = bios_local_time();
+
+  LOG_INFO("bios_sync_clock time=0x%08x", time);
+
+  /* the syscfg block is validated and written out with default settings by
+     bios_override_settings before this is ever called */
+  struct flash_syscfg_block syscfg;
+  int res = flash_read_block(flash, FLASH_PT_USER, FLASH_USER_SYSCFG, &syscfg);
+  CHECK_EQ(res, 1);
+
+  syscfg.time_lo = time & 0xffff;
+  syscfg.time_hi = (time & 0xffff0000) >> 16;
+
+  res = flash_write_block(flash, FLASH_PT_USER, FLASH_USER_SYSCFG, &syscfg);
+  CHECK_EQ(res, 1);
+
+  /* overwrite aica clock to match the bios */
+  aica_set_clock(dc->aica, time);
+}
+
+void bios_boot_hash(struct bios *bios, char *hash) {
+  struct dreamcast *dc = bios->dc;
+  struct boot *boot = dc->boot;
+  struct flash *flash = dc->flash;
+
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+
+  uint8_t *rom = malloc(BOOT_ROM_SIZE);
+  boot_rom_read_string(boot, rom, 0, BOOT_ROM_SIZE);
+  MD5_Update(&md5_ctx, rom, BOOT_ROM_SIZE);
+
+  /* the user partition is rewritten with the current time on each launch, so
+     only its system settings are hashed, with the time masked out */
+  for (int i = 0; i < FLASH_PT_NUM; i++) {
+    if (i == FLASH_PT_USER) {
+      continue;
+    }
+
+    int offset, size;
+    flash_partition_info(i, &offset, &size);
+    flash_read(flash, offset, rom, size);
+    MD5_Update(&md5_ctx, rom, size);
+  }
+
+  struct flash_syscfg_block syscfg;
+  if (flash_read_block(flash, FLASH_PT_USER, FLASH_USER_SYSCFG, &syscfg)) {
+    syscfg.time_lo = 0;
+    syscfg.time_hi = 0;
+    MD5_Update(&md5_ctx, &syscfg, sizeof(syscfg));
+  }
+
+  free(rom);
+
+  MD5_Final(hash, &md5_ctx);
+}
+
 static void bios_override_settings(struct bios *bios) {
   struct dreamcast *dc = bios->dc;
   struct flash *flash = dc->flash;
@@ -62,7 +124,6 @@ static void bios_override_settings(struct bios *bios) {
   int region = 0;
   int lang = 0;
   int bcast = 0;
-  uint32_t time = bios_local_time();
 
   for (int i = 0; i < NUM_REGIONS; i++) {
     if (!strcmp(OPTION_region, REGIONS[i])) {
@@ -85,8 +146,8 @@ static void bios_override_settings(struct bios *bios) {
     }
   }
 
-  LOG_INFO("bios_override_settings region=%s lang=%s bcast=%s time=0x%08x",
-           REGIONS[region], LANGUAGES[lang], BROADCASTS[bcast], time);
+  LOG_INFO("bios_override_settings region=%s lang=%s bcast=%s",
+           REGIONS[region], LANGUAGES[lang], BROADCASTS[bcast]);
 
   /* the region, language and broadcast settings exist in two locations:
 
@@ -123,15 +184,12 @@ static void bios_override_settings(struct bios *bios) {
     syscfg.autostart = 1;
   }
 
-  syscfg.time_lo = time & 0xffff;
-  syscfg.time_hi = (time & 0xffff0000) >> 16;
   syscfg.lang = lang;
 
   res = flash_write_block(flash, FLASH_PT_USER, FLASH_USER_SYSCFG, &syscfg);
   CHECK_EQ(res, 1);
 
-  /* overwrite aica clock to match the bios */
-  aica_set_clock(dc->aica, time);
+  bios_sync_clock(bios);
 }
 
 static void bios_validate_flash(struct bios *bios) {
@@ -197,6 +255,26 @@ static void bios_validate_flash(struct bios *bios) {
   }
 }
 
+static void bios_load(struct device *dev, struct snapshot *ss) {
+  struct bios *bios = (struct bios *)dev;
+
+  SNAPSHOT_READ(ss, bios->status);
+  SNAPSHOT_READ(ss, bios->cmd_id);
+  SNAPSHOT_READ(ss, bios->cmd_code);
+  SNAPSHOT_READ(ss, bios->params);
+  SNAPSHOT_READ(ss, bios->result);
+}
+
+static void bios_save(struct device *dev, struct snapshot *ss) {
+  struct bios *bios = (struct bios *)dev;
+
+  SNAPSHOT_WRITE(ss, bios->status);
+  SNAPSHOT_WRITE(ss, bios->cmd_id);
+  SNAPSHOT_WRITE(ss, bios->cmd_code);
+  SNAPSHOT_WRITE(ss, bios->params);
+  SNAPSHOT_WRITE(ss, bios->result);
+}
+
 static int bios_post_init(struct device *dev) {
   struct bios *bios = (struct bios *)dev;
 
@@ -374,5 +452,11 @@ void bios_destroy(struct bios *bios) {
 struct bios *bios_create(struct dreamcast *dc) {
   struct bios *bios =
       dc_create_device(dc, sizeof(struct bios), "bios", NULL, &bios_post_init);
+
+  /* setup state interface */
+  bios->stateif.enabled = 1;
+  bios->stateif.save = &bios_save;
+  bios->stateif.load = &bios_load;
+
   return bios;
 }
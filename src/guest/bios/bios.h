@@ -21,4 +21,10 @@ void bios_destroy(struct bios *bios);
 int bios_invalid_instr(struct bios *bios);
 void bios_boot(struct bios *bios);
 
+/* writes the host's current time to the system settings and aica clock */
+void bios_sync_clock(struct bios *bios);
+/* md5 of the boot rom and flash settings a boot depends on, excluding the
+   system time which changes each launch */
+void bios_boot_hash(struct bios *bios, char *hash);
+
 #endif
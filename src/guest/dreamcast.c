@@ -1,5 +1,6 @@
 #include "guest/dreamcast.h"
 #include "core/core.h"
+#include "core/version.h"
 #include "guest/aica/aica.h"
 #include "guest/arm7/arm7.h"
 #include "guest/bios/bios.h"
@@ -14,6 +15,35 @@
 #include "guest/rom/flash.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
+
+#define DC_SNAPSHOT_MAGIC 0x53534452 /* RDSS */
+#define DC_SNAPSHOT_VERSION 3
+
+struct dc_snapshot_header {
+  uint32_t magic;
+  uint32_t version;
+  char build[64];
+  /* distance between two functions in separate translation units, telling
+     apart snapshots from different builds sharing the same version string */
+  int64_t layout;
+  /* guest memory is left out of device-only snapshots */
+  int32_t memory;
+};
+
+/* host pointer, stored as an offset into the device it points into */
+struct dc_ref {
+  int32_t device;
+  int32_t offset;
+};
+
+void dc_boot_complete(struct dreamcast *dc) {
+  if (!dc->boot_complete) {
+    return;
+  }
+
+  dc->boot_complete(dc->userdata);
+}
 
 void dc_vblank_out(struct dreamcast *dc) {
   if (!dc->vblank_out) {
@@ -84,6 +114,7 @@ void *dc_create_device(struct dreamcast *dc, size_t size, const char *name,
 
   dev->dc = dc;
   dev->name = name;
+  dev->size = size;
   dev->init = init;
   dev->post_init = post_init;
 
@@ -92,6 +123,195 @@ void *dc_create_device(struct dreamcast *dc, size_t size, const char *name,
   return dev;
 }
 
+static int64_t dc_snapshot_layout() {
+  return (int64_t)((intptr_t)&dc_create - (intptr_t)&snapshot_create);
+}
+
+void *dc_read_ref(struct dreamcast *dc, struct snapshot *ss) {
+  struct dc_ref ref;
+  SNAPSHOT_READ(ss, ref);
+
+  if (ref.device < 0) {
+    return NULL;
+  }
+
+  int n = 0;
+  list_for_each_entry(dev, &dc->devices, struct device, it) {
+    if (n++ == ref.device) {
+      CHECK_LT(ref.offset, (int32_t)dev->size);
+      return (uint8_t *)dev + ref.offset;
+    }
+  }
+
+  LOG_FATAL("dc_read_ref invalid device %d", ref.device);
+}
+
+void dc_write_ref(struct dreamcast *dc, struct snapshot *ss, const void *ptr) {
+  struct dc_ref ref = {-1, 0};
+
+  if (ptr) {
+    int n = 0;
+    list_for_each_entry(dev, &dc->devices, struct device, it) {
+      const uint8_t *base = (const uint8_t *)dev;
+
+      if ((const uint8_t *)ptr >= base &&
+          (const uint8_t *)ptr < base + dev->size) {
+        ref.device = n;
+        ref.offset = (int32_t)((const uint8_t *)ptr - base);
+        break;
+      }
+
+      n++;
+    }
+
+    CHECK_NE(ref.device, -1, "dc_write_ref pointer isn't inside a device");
+  }
+
+  SNAPSHOT_WRITE(ss, ref);
+}
+
+static int dc_restore_section(struct snapshot *ss, const char *name, int load,
+                              void (*cb)(void *, struct snapshot *),
+                              void *data) {
+  int size = snapshot_read_section(ss, name);
+
+  if (size < 0) {
+    LOG_WARNING("dc_restore missing section '%s'", name);
+    return 0;
+  }
+
+  int end = snapshot_tell(ss) + size;
+
+  if (load) {
+    cb(data, ss);
+    CHECK_EQ(snapshot_tell(ss), end, "dc_restore section '%s' size mismatch",
+             name);
+  } else {
+    snapshot_seek(ss, end);
+  }
+
+  return 1;
+}
+
+static void dc_load_scheduler(void *data, struct snapshot *ss) {
+  sched_load(data, ss);
+}
+
+static void dc_load_memory(void *data, struct snapshot *ss) {
+  mem_load(data, ss);
+}
+
+static void dc_load_device(void *data, struct snapshot *ss) {
+  struct device *dev = data;
+  SNAPSHOT_READ(ss, dev->runif.running);
+  dev->stateif.load(dev, ss);
+}
+
+static int dc_restore_sections(struct dreamcast *dc, struct snapshot *ss,
+                               int memory, int load) {
+  if (memory &&
+      !dc_restore_section(ss, "memory", load, &dc_load_memory, dc->mem)) {
+    return 0;
+  }
+
+  if (!dc_restore_section(ss, "scheduler", load, &dc_load_scheduler,
+                          dc->sched)) {
+    return 0;
+  }
+
+  list_for_each_entry(dev, &dc->devices, struct device, it) {
+    if (!dev->stateif.enabled) {
+      continue;
+    }
+
+    if (!dc_restore_section(ss, dev->name, load, &dc_load_device, dev)) {
+      return 0;
+    }
+  }
+
+  return !snapshot_error(ss);
+}
+
+int dc_restore(struct dreamcast *dc, struct snapshot *ss) {
+  struct dc_snapshot_header header;
+
+  snapshot_rewind(ss);
+  SNAPSHOT_READ(ss, header);
+
+  if (snapshot_error(ss) || header.magic != DC_SNAPSHOT_MAGIC) {
+    LOG_WARNING("dc_restore not a snapshot");
+    return 0;
+  }
+
+  if (header.version != DC_SNAPSHOT_VERSION ||
+      strncmp(header.build, GIT_VERSION, sizeof(header.build)) ||
+      header.layout != dc_snapshot_layout()) {
+    LOG_WARNING("dc_restore snapshot is from a different build");
+    return 0;
+  }
+
+  /* validate the layout of every section before touching any state, as a
+     partially restored machine can't be recovered */
+  int start = snapshot_tell(ss);
+
+  if (!dc_restore_sections(dc, ss, header.memory, 0)) {
+    return 0;
+  }
+
+  snapshot_seek(ss, start);
+
+  int res = dc_restore_sections(dc, ss, header.memory, 1);
+  CHECK(res);
+
+  return 1;
+}
+
+static void dc_write_snapshot(struct dreamcast *dc, struct snapshot *ss,
+                              int memory) {
+  struct dc_snapshot_header header = {0};
+  header.magic = DC_SNAPSHOT_MAGIC;
+  header.version = DC_SNAPSHOT_VERSION;
+  strncpy(header.build, GIT_VERSION, sizeof(header.build) - 1);
+  header.layout = dc_snapshot_layout();
+  header.memory = memory;
+
+  snapshot_reset(ss);
+  SNAPSHOT_WRITE(ss, header);
+
+  /* memory and the scheduler are restored first, so devices can resolve the
+     timers they hold */
+  int section;
+
+  if (memory) {
+    section = snapshot_begin_section(ss, "memory");
+    mem_save(dc->mem, ss);
+    snapshot_end_section(ss, section);
+  }
+
+  section = snapshot_begin_section(ss, "scheduler");
+  sched_save(dc->sched, ss);
+  snapshot_end_section(ss, section);
+
+  list_for_each_entry(dev, &dc->devices, struct device, it) {
+    if (!dev->stateif.enabled) {
+      continue;
+    }
+
+    section = snapshot_begin_section(ss, dev->name);
+    SNAPSHOT_WRITE(ss, dev->runif.running);
+    dev->stateif.save(dev, ss);
+    snapshot_end_section(ss, section);
+  }
+}
+
+void dc_snapshot_devices(struct dreamcast *dc, struct snapshot *ss) {
+  dc_write_snapshot(dc, ss, 0);
+}
+
+void dc_snapshot(struct dreamcast *dc, struct snapshot *ss) {
+  dc_write_snapshot(dc, ss, 1);
+}
+
 void dc_remove_serial_device(struct dreamcast *dc) {
   dc->serial = NULL;
 }
@@ -22,6 +22,7 @@ struct memory;
 struct pvr;
 struct scheduler;
 struct sh4;
+struct snapshot;
 struct ta;
 struct ta_context;
 
@@ -74,11 +75,29 @@ struct dbgif {
 
 /* run interface */
 typedef void (*device_run_cb)(struct device *, int64_t);
+typedef int64_t (*device_remaining_cb)(struct device *);
 
 struct runif {
   int enabled;
   int running;
   device_run_cb run;
+  /* optional, returns the guest time left in the slice currently being ran.
+     lets other devices observe how far into the slice the device is */
+  device_remaining_cb remaining;
+};
+
+/* state interface */
+typedef void (*device_save_cb)(struct device *, struct snapshot *);
+typedef void (*device_load_cb)(struct device *, struct snapshot *);
+
+struct stateif {
+  int enabled;
+  /* host pointers must not be written as-is, as the snapshot may be restored
+     by another process. pointers into devices are written with dc_write_ref,
+     and timers with sched_write_timer */
+  device_save_cb save;
+  /* called after memory and the scheduler have been restored */
+  device_load_cb load;
 };
 
 /*
@@ -90,6 +109,7 @@ typedef int (*device_post_init_cb)(struct device *);
 struct device {
   struct dreamcast *dc;
   const char *name;
+  size_t size;
 
   /* called for each device during dc_init. at this point each device should
      initialize their own state, but not depend on the state of others */
@@ -103,6 +123,7 @@ struct device {
   /* optional interfaces */
   struct dbgif dbgif;
   struct runif runif;
+  struct stateif stateif;
 
   struct list_node it;
 };
@@ -116,6 +137,7 @@ typedef void (*start_render_cb)(void *, struct ta_context *);
 typedef void (*finish_render_cb)(void *);
 typedef void (*vblank_in_cb)(void *, int);
 typedef void (*vblank_out_cb)(void *);
+typedef void (*boot_complete_cb)(void *);
 
 struct dreamcast {
   int running;
@@ -148,6 +170,7 @@ struct dreamcast {
   finish_render_cb finish_render;
   vblank_in_cb vblank_in;
   vblank_out_cb vblank_out;
+  boot_complete_cb boot_complete;
 };
 
 struct dreamcast *dc_create();
@@ -163,6 +186,17 @@ void dc_input(struct dreamcast *dc, int port, int button, int16_t value);
 void dc_add_serial_device(struct dreamcast *dc, struct serial *serial);
 void dc_remove_serial_device(struct dreamcast *dc);
 
+/* full machine state, excluding the loaded disc and host-side state such as
+   the input of attached maple devices. snapshots are only valid for the build
+   that took them */
+void dc_snapshot(struct dreamcast *dc, struct snapshot *ss);
+/* snapshot excluding guest memory, for callers tracking it themselves.
+   restoring one leaves memory untouched */
+void dc_snapshot_devices(struct dreamcast *dc, struct snapshot *ss);
+int dc_restore(struct dreamcast *dc, struct snapshot *ss);
+void dc_write_ref(struct dreamcast *dc, struct snapshot *ss, const void *ptr);
+void *dc_read_ref(struct dreamcast *dc, struct snapshot *ss);
+
 /* device registration */
 void *dc_create_device(struct dreamcast *dc, size_t size, const char *name,
                        device_init_cb init, device_post_init_cb post_init);
@@ -176,5 +210,6 @@ void dc_start_render(struct dreamcast *dc, struct ta_context *ctx);
 void dc_finish_render(struct dreamcast *dc);
 void dc_vblank_in(struct dreamcast *dc, int video_disabled);
 void dc_vblank_out(struct dreamcast *dc);
+void dc_boot_complete(struct dreamcast *dc);
 
 #endif
@@ -4,6 +4,7 @@
 #include "guest/gdrom/gdrom_replies.inc"
 #include "guest/gdrom/gdrom_types.h"
 #include "guest/holly/holly.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
 
 #if 0
@@ -605,6 +606,28 @@ static void gdrom_event(struct gdrom *gd, enum gd_event ev, int arg) {
   cb(gd, arg);
 }
 
+/* everything after the disc is plain data */
+#define GDROM_STATE_BEGIN offsetof(struct gdrom, error)
+#define GDROM_STATE_SIZE (sizeof(struct gdrom) - GDROM_STATE_BEGIN)
+
+static void gdrom_load(struct device *dev, struct snapshot *ss) {
+  struct gdrom *gd = (struct gdrom *)dev;
+
+  SNAPSHOT_READ(ss, gd->state);
+  SNAPSHOT_READ(ss, gd->hw_info);
+  snapshot_read(ss, (uint8_t *)gd + GDROM_STATE_BEGIN, GDROM_STATE_SIZE);
+}
+
+static void gdrom_save(struct device *dev, struct snapshot *ss) {
+  struct gdrom *gd = (struct gdrom *)dev;
+
+  /* the disc itself isn't saved, the snapshot must be restored with the same
+     disc inserted */
+  SNAPSHOT_WRITE(ss, gd->state);
+  SNAPSHOT_WRITE(ss, gd->hw_info);
+  snapshot_write(ss, (uint8_t *)gd + GDROM_STATE_BEGIN, GDROM_STATE_SIZE);
+}
+
 static int gdrom_init(struct device *dev) {
   struct gdrom *gd = (struct gdrom *)dev;
 
@@ -860,6 +883,12 @@ void gdrom_destroy(struct gdrom *gd) {
 struct gdrom *gdrom_create(struct dreamcast *dc) {
   struct gdrom *gd =
       dc_create_device(dc, sizeof(struct gdrom), "gdrom", &gdrom_init, NULL);
+
+  /* setup state interface */
+  gd->stateif.enabled = 1;
+  gd->stateif.save = &gdrom_save;
+  gd->stateif.load = &gdrom_load;
+
   return gd;
 }
 
@@ -5,6 +5,7 @@
 #include "guest/memory.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
 
 #if 0
@@ -18,71 +19,114 @@ struct reg_cb holly_cb[NUM_HOLLY_REGS];
 /*
  * ch2 dma
  */
+static void holly_ch2_dma_done(void *data) {
+  struct holly *hl = data;
+
+  *hl->SB_C2DLEN = 0;
+  *hl->SB_C2DST = 0;
+  holly_raise_interrupt(hl, HOLLY_INT_DTDE2INT);
+}
+
 static void holly_ch2_dma(struct holly *hl) {
   struct sh4 *sh4 = hl->dc->sh4;
 
+  /* the transfer completes asynchronously, with SB_C2DST remaining set until
+     the sh4 dmac has finished its final burst */
   struct sh4_dtr dtr = {0};
   dtr.channel = 2;
   dtr.dir = SH4_DMA_TO_ADDR;
   dtr.addr = *hl->SB_C2DSTAT;
+  dtr.done = &holly_ch2_dma_done;
+  dtr.done_data = hl;
   sh4_dmac_ddt(sh4, &dtr);
-
-  *hl->SB_C2DLEN = 0;
-  *hl->SB_C2DST = 0;
-  holly_raise_interrupt(hl, HOLLY_INT_DTDE2INT);
 }
 
 /*
  * gdrom dma
  */
-static void holly_gdrom_dma(struct holly *hl) {
-  if (!*hl->SB_GDEN) {
-    *hl->SB_GDST = 0;
-    return;
-  }
-
+static void holly_gdrom_dma_timer(void *data) {
+  struct holly *hl = data;
   struct gdrom *gd = hl->dc->gdrom;
   struct sh4 *sh4 = hl->dc->sh4;
-
-  /* only gdrom -> sh4 supported for now */
-  CHECK_EQ(*hl->SB_GDDIR, 1);
-
-  int transfer_size = *hl->SB_GDLEN;
-  int remaining = transfer_size;
-  uint32_t addr = *hl->SB_GDSTAR;
+  struct scheduler *sched = hl->dc->sched;
   uint8_t sector_data[DISC_MAX_SECTOR_SIZE];
 
-  gdrom_dma_begin(gd);
+  hl->gdrom_timer = NULL;
 
-  while (1) {
-    /* read a single sector at a time from the gdrom */
-    int n = MIN(remaining, (int)sizeof(sector_data));
-    n = gdrom_dma_read(gd, sector_data, n);
-
-    if (!n) {
-      break;
-    }
+  /* read a single sector at a time from the gdrom */
+  int remaining = *hl->SB_GDLEN - *hl->SB_GDLEND;
+  int n = MIN(remaining, (int)sizeof(sector_data));
+  n = gdrom_dma_read(gd, sector_data, n);
 
+  if (n) {
     struct sh4_dtr dtr = {0};
     dtr.channel = 0;
     dtr.dir = SH4_DMA_TO_ADDR;
     dtr.data = sector_data;
-    dtr.addr = addr;
+    dtr.addr = *hl->SB_GDSTARD;
     dtr.size = n;
     sh4_dmac_ddt(sh4, &dtr);
 
-    remaining -= n;
-    addr += n;
+    /* progress is visible to the cpu through SB_GDSTARD / SB_GDLEND while the
+       transfer is running */
+    *hl->SB_GDSTARD += n;
+    *hl->SB_GDLEND += n;
+  }
+
+  if (n && *hl->SB_GDLEND < *hl->SB_GDLEN) {
+    /* g1 bus runs at 16-bits x 25mhz, loosely simulate this */
+    int64_t end = CYCLES_TO_NANO(n / 2, UINT64_C(25000000));
+    hl->gdrom_timer =
+        sched_start_timer(sched, &holly_gdrom_dma_timer, hl, end);
+    return;
   }
 
   gdrom_dma_end(gd);
 
-  *hl->SB_GDSTARD = addr;
-  *hl->SB_GDLEND = transfer_size;
   *hl->SB_GDST = 0;
   holly_raise_interrupt(hl, HOLLY_INT_G1DEINT);
 }
 
+/* abandon the in-flight transfer, leaving SB_GDSTARD / SB_GDLEND reflecting
+   the sectors which had already been transferred */
+static void holly_gdrom_dma_stop(struct holly *hl) {
+  struct gdrom *gd = hl->dc->gdrom;
+  struct scheduler *sched = hl->dc->sched;
+
+  if (!hl->gdrom_timer) {
+    return;
+  }
+
+  sched_cancel_timer(sched, hl->gdrom_timer);
+  hl->gdrom_timer = NULL;
+
+  gdrom_dma_end(gd);
+}
+
+static void holly_gdrom_dma(struct holly *hl) {
+  if (!*hl->SB_GDEN) {
+    *hl->SB_GDST = 0;
+    return;
+  }
+
+  struct gdrom *gd = hl->dc->gdrom;
+
+  /* only gdrom -> sh4 supported for now */
+  CHECK_EQ(*hl->SB_GDDIR, 1);
+
+  /* the guest is free to restart a busy transfer, the new request replaces
+     the in-flight one */
+  holly_gdrom_dma_stop(hl);
+
+  *hl->SB_GDSTARD = *hl->SB_GDSTAR;
+  *hl->SB_GDLEND = 0;
+
+  gdrom_dma_begin(gd);
+
+  /* kick off async dma */
+  holly_gdrom_dma_timer(hl);
+}
+
 /*
  * maple dma
  */
@@ -277,6 +321,22 @@ static uint32_t *holly_interrupt_status(struct holly *hl,
   }
 }
 
+static void holly_load(struct device *dev, struct snapshot *ss) {
+  struct holly *hl = (struct holly *)dev;
+
+  SNAPSHOT_READ(ss, hl->reg);
+  SNAPSHOT_READ(ss, hl->dma);
+  hl->gdrom_timer = sched_read_timer(hl->dc->sched, ss);
+}
+
+static void holly_save(struct device *dev, struct snapshot *ss) {
+  struct holly *hl = (struct holly *)dev;
+
+  SNAPSHOT_WRITE(ss, hl->reg);
+  SNAPSHOT_WRITE(ss, hl->dma);
+  sched_write_timer(hl->dc->sched, ss, hl->gdrom_timer);
+}
+
 static int holly_init(struct device *dev) {
   struct holly *hl = (struct holly *)dev;
   return 1;
@@ -312,6 +372,8 @@ void holly_reg_write(struct holly *hl, uint32_t addr, uint32_t data,
   uint32_t offset = addr >> 2;
   reg_write_cb write = holly_cb[offset].write;
 
+  mem_count_reg(hl->dc->mem, MEM_REGS_HOLLY, offset, 1);
+
   if (hl->log_regs) {
     LOG_INFO("holly_reg_write addr=0x%08x data=0x%x", addr, data & mask);
   }
@@ -328,6 +390,8 @@ uint32_t holly_reg_read(struct holly *hl, uint32_t addr, uint32_t mask) {
   uint32_t offset = addr >> 2;
   reg_read_cb read = holly_cb[offset].read;
 
+  mem_count_reg(hl->dc->mem, MEM_REGS_HOLLY, offset, 0);
+
   uint32_t data;
   if (read) {
     data = read(hl->dc);
@@ -395,6 +459,11 @@ struct holly *holly_create(struct dreamcast *dc) {
 #include "guest/holly/holly_regs.inc"
 #undef HOLLY_REG
 
+  /* setup state interface */
+  hl->stateif.enabled = 1;
+  hl->stateif.save = &holly_save;
+  hl->stateif.load = &holly_load;
+
   return hl;
 }
 
@@ -549,6 +618,18 @@ REG_W32(holly_cb, SB_GDST) {
   }
 }
 
+REG_W32(holly_cb, SB_GDEN) {
+  struct holly *hl = dc->holly;
+
+  *hl->SB_GDEN = value;
+
+  /* disabling the channel halts it part way through */
+  if (!*hl->SB_GDEN) {
+    holly_gdrom_dma_stop(hl);
+    *hl->SB_GDST = 0;
+  }
+}
+
 REG_W32(holly_cb, SB_ADST) {
   struct holly *hl = dc->holly;
 
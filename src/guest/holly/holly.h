@@ -7,6 +7,7 @@
 struct gdrom;
 struct maple;
 struct sh4;
+struct timer;
 
 #define HOLLY_G2_NUM_CHAN 4
 #define HOLLY_G2_NUM_REGS 8
@@ -27,6 +28,7 @@ struct holly {
 #undef HOLLY_REG
 
   struct holly_g2_dma dma[HOLLY_G2_NUM_CHAN];
+  struct timer *gdrom_timer;
 
   /* debug */
   int log_regs;
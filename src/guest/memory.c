@@ -22,12 +22,23 @@
  * *_write_bytes if a segfault occurs
  */
 
+#include <math.h>
 #include <stdint.h>
 #include "guest/memory.h"
 #include "core/core.h"
+#include "core/filesystem.h"
+#include "guest/aica/aica.h"
 #include "guest/arm7/arm7.h"
 #include "guest/dreamcast.h"
+#include "guest/holly/holly.h"
+#include "guest/pvr/pvr.h"
+#include "guest/rom/boot.h"
+#include "guest/rom/flash.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
+#include "imgui.h"
+#include "options.h"
+#include "stats.h"
 
 /* physical memory constants */
 #define RAM_SIZE 16 * 1024 * 1024
@@ -45,6 +56,36 @@
 #define MEM_PAGE_SHIFT MEM_OFFSET_BITS
 #define MEM_OFFSET_MASK ((1 << MEM_OFFSET_BITS) - 1)
 
+/* mmio pages shared by multiple devices are split into 4kb subpages, each
+   dispatching straight to the device mapped there, rather than the page-level
+   handler demultiplexing every access through a cascade of range checks */
+#define MEM_SUBPAGE_BITS 9
+#define MEM_SUBPAGE_SHIFT (MEM_OFFSET_BITS - MEM_SUBPAGE_BITS)
+#define MEM_SUBPAGE_MASK ((1 << MEM_SUBPAGE_BITS) - 1)
+#define MEM_MAX_DEVICES 32
+
+struct mmio_device {
+  void *userdata;
+  /* handlers are passed the device-relative offset (addr & addr_mask) - base.
+     a NULL handler defers to the page-level handler */
+  uint32_t addr_mask;
+  uint32_t base;
+  mmio_read_cb read;
+  mmio_write_cb write;
+};
+
+/* access counts for each 4kb subpage of an mmio page */
+struct page_stats {
+  uint64_t reads[1 << MEM_SUBPAGE_BITS];
+  uint64_t writes[1 << MEM_SUBPAGE_BITS];
+};
+
+/* access counts for each 32-bit register of a register block */
+struct reg_stats {
+  uint64_t *reads;
+  uint64_t *writes;
+};
+
 /* address spaces provide different views of the same physical memory */
 struct address_space {
   uint8_t *base;
@@ -55,6 +96,21 @@ struct address_space {
   mmio_write_cb write[MEM_MAX_PAGES];
   mmio_read_string_cb read_string[MEM_MAX_PAGES];
   mmio_write_string_cb write_string[MEM_MAX_PAGES];
+
+  /* second-level table of device indices for each subpage, index 0 meaning
+     no device has been mapped over the page-level handler */
+  uint8_t *subpages[MEM_MAX_PAGES];
+  struct mmio_device devices[MEM_MAX_DEVICES];
+  int num_devices;
+
+  /* access counts for each mmio page, allocated on first access when
+     instrumentation is enabled */
+  struct page_stats *stats[MEM_MAX_PAGES];
+
+  /* dirty map marked by writes to directly mapped memory, indexed by
+     (addr >> MEM_DIRTY_PAGE_SHIFT) & dirty_mask */
+  uint8_t *dirty;
+  uint32_t dirty_mask;
 };
 
 struct memory {
@@ -64,6 +120,10 @@ struct memory {
   /* shared memory object that backs the ram / vram / aram when using
      fastmem */
   shmem_handle_t shmem;
+  /* object is backed by reserved huge pages, else each mapping of it is
+     advised to use transparent huge pages */
+  int shmem_huge;
+  int shmem_thp_failed;
 #endif
 
   /* the machine's physical memory */
@@ -74,8 +134,33 @@ struct memory {
   /* each cpu has a different address space */
   struct address_space arm7;
   struct address_space sh4;
+
+  /* dirty flag for each page of the sh4 physical address space */
+  uint8_t dirty[MEM_DIRTY_PAGES];
+
+  /* mmio access instrumentation, enabled with --mmio_stats */
+  int stats;
+  int show_stats;
+  struct reg_stats regs[MEM_NUM_REG_BLOCKS];
 };
 
+#ifdef HAVE_FASTMEM
+static void *mem_map_physical(struct memory *mem, size_t offset, void *target,
+                              size_t size) {
+  void *ptr =
+      map_shared_memory(mem->shmem, offset, target, size, ACC_READWRITE);
+
+  /* random accesses to guest memory from compiled code otherwise thrash the
+     dtlb with 4kb pages */
+  if (ptr != SHMEM_MAP_FAILED && OPTION_hugepages && !mem->shmem_huge &&
+      !advise_huge_pages(ptr, size, 1)) {
+    mem->shmem_thp_failed = 1;
+  }
+
+  return ptr;
+}
+#endif
+
 static int reserve_address_space(uint8_t **base) {
   /* find a contiguous 32-bit range of memory to map an address space to */
   const uint64_t ADDRESS_SPACE_SIZE = UINT64_C(1) << 32;
@@ -113,6 +198,38 @@ static void mem_unhandled_write(struct memory *mem, uint32_t addr,
   LOG_WARNING("mem_unhandled_write addr=0x%08x", addr);
 }
 
+/*
+ * mmio string helpers
+ */
+void mmio_read_string(void *userdata, mmio_read_cb read, uint8_t *dst,
+                      uint32_t src, int size) {
+  uint32_t end = src + size;
+
+  while (src < end) {
+    int n = mmio_access_size(src, end - src);
+    uint32_t mask = (UINT64_C(1) << (n * 8)) - 1;
+    uint32_t data = read(userdata, src, mask);
+    memcpy(dst, &data, n);
+    dst += n;
+    src += n;
+  }
+}
+
+void mmio_write_string(void *userdata, mmio_write_cb write, uint32_t dst,
+                       const uint8_t *src, int size) {
+  uint32_t end = dst + size;
+
+  while (dst < end) {
+    int n = mmio_access_size(dst, end - dst);
+    uint32_t mask = (UINT64_C(1) << (n * 8)) - 1;
+    uint32_t data = 0;
+    memcpy(&data, src, n);
+    write(userdata, dst, data, mask);
+    src += n;
+    dst += n;
+  }
+}
+
 /*
  * address space common
  */
@@ -123,6 +240,35 @@ enum {
   MAP_ARAM,
 };
 
+static void as_count_access(struct address_space *space, uint32_t addr,
+                            int write) {
+  int page = addr >> MEM_PAGE_SHIFT;
+  int subpage = (addr >> MEM_SUBPAGE_SHIFT) & MEM_SUBPAGE_MASK;
+  struct page_stats *stats = space->stats[page];
+
+  if (!stats) {
+    stats = space->stats[page] = calloc(1, sizeof(struct page_stats));
+  }
+
+  if (write) {
+    stats->writes[subpage]++;
+    prof_counter_add(COUNTER_mmio_write, 1);
+  } else {
+    stats->reads[subpage]++;
+    prof_counter_add(COUNTER_mmio_read, 1);
+  }
+}
+
+static inline void as_mark_dirty(struct address_space *space, uint32_t addr,
+                                 int size) {
+  uint32_t begin = addr >> MEM_DIRTY_PAGE_SHIFT;
+  uint32_t end = (addr + size - 1) >> MEM_DIRTY_PAGE_SHIFT;
+
+  for (uint32_t page = begin; page <= end; page++) {
+    space->dirty[page & space->dirty_mask] = MEM_DIRTY_ALL;
+  }
+}
+
 #define DEFINE_ADDRESS_SPACE(space)             \
   define_lookup_ex(space);                      \
   define_lookup(space);                         \
@@ -135,7 +281,8 @@ enum {
   define_read_bytes(space, read32, uint32_t);   \
   define_read_bytes(space, read16, uint16_t);   \
   define_read_bytes(space, read8, uint8_t);     \
-  define_base(space);
+  define_base(space);                           \
+  define_dirty_map(space);
 
 #define define_lookup_ex(space)                                               \
   static void space##_lookup_ex(                                              \
@@ -184,6 +331,10 @@ enum {
     mmio_read_string_cb read_string = NULL;                                    \
     space##_lookup_ex(mem, src, NULL, &psrc, &read, NULL, &read_string, NULL); \
                                                                                \
+    if (pdst) {                                                                \
+      as_mark_dirty(&mem->space, dst, size);                                   \
+    }                                                                          \
+                                                                               \
     if (pdst && psrc) {                                                        \
       memcpy(pdst, psrc, size);                                                \
     } else if (pdst && read_string) {                                          \
@@ -191,26 +342,18 @@ enum {
     } else if (psrc && write_string) {                                         \
       write_string(mem->dc->space, dst, psrc, size);                           \
     } else if (pdst) {                                                         \
-      uint32_t end = src + size;                                               \
-      while (src < end) {                                                      \
-        *pdst = read(mem->dc->space, src, 0xff);                               \
-        pdst++;                                                                \
-        src++;                                                                 \
-      }                                                                        \
+      mmio_read_string(mem->dc->space, read, pdst, src, size);                 \
     } else if (psrc) {                                                         \
-      uint32_t end = dst + size;                                               \
-      while (dst < end) {                                                      \
-        write(mem->dc->space, dst, *psrc, 0xff);                               \
-        psrc++;                                                                \
-        dst++;                                                                 \
-      }                                                                        \
+      mmio_write_string(mem->dc->space, write, dst, psrc, size);               \
     } else {                                                                   \
       uint32_t end = src + size;                                               \
       while (src < end) {                                                      \
-        uint8_t data = read(mem->dc->space, src, 0xff);                        \
-        write(mem->dc->space, dst, data, 0xff);                                \
-        src++;                                                                 \
-        dst++;                                                                 \
+        int n = mmio_access_size(src | dst, end - src);                        \
+        uint32_t mask = (UINT64_C(1) << (n * 8)) - 1;                          \
+        uint32_t data = read(mem->dc->space, src, mask);                       \
+        write(mem->dc->space, dst, data, mask);                                \
+        src += n;                                                              \
+        dst += n;                                                              \
       }                                                                        \
     }                                                                          \
   }
@@ -229,12 +372,7 @@ enum {
     } else if (read_string) {                                                  \
       read_string(mem->dc->space, pdst, src, size);                            \
     } else {                                                                   \
-      uint32_t end = src + size;                                               \
-      while (src < end) {                                                      \
-        *pdst = read(mem->dc->space, src, 0xff);                               \
-        pdst++;                                                                \
-        src++;                                                                 \
-      }                                                                        \
+      mmio_read_string(mem->dc->space, read, pdst, src, size);                 \
     }                                                                          \
   }
 
@@ -249,16 +387,12 @@ enum {
                       &write_string);                            \
                                                                  \
     if (pdst) {                                                  \
+      as_mark_dirty(&mem->space, dst, size);                     \
       memcpy(pdst, psrc, size);                                  \
     } else if (write_string) {                                   \
       write_string(mem->dc->space, dst, psrc, size);             \
     } else {                                                     \
-      uint32_t end = dst + size;                                 \
-      while (dst < end) {                                        \
-        write(mem->dc->space, dst, *psrc, 0xff);                 \
-        psrc++;                                                  \
-        dst++;                                                   \
-      }                                                          \
+      mmio_write_string(mem->dc->space, write, dst, psrc, size); \
     }                                                            \
   }
 
@@ -267,11 +401,25 @@ enum {
     int page = addr >> MEM_PAGE_SHIFT;                                       \
     uint8_t *ptr = mem->space.ptrs[page];                                    \
     if (ptr) {                                                               \
+      as_mark_dirty(&mem->space, addr, sizeof(data_type));                   \
       addr &= MEM_OFFSET_MASK;                                               \
       *(data_type *)(ptr + addr) = data;                                     \
       return;                                                                \
     }                                                                        \
+    if (mem->stats) {                                                        \
+      as_count_access(&mem->space, addr, 1);                                 \
+    }                                                                        \
     const uint32_t data_mask = (UINT64_C(1) << (sizeof(data_type) * 8)) - 1; \
+    uint8_t *subpages = mem->space.subpages[page];                           \
+    if (subpages) {                                                          \
+      int i = subpages[(addr >> MEM_SUBPAGE_SHIFT) & MEM_SUBPAGE_MASK];      \
+      struct mmio_device *dev = &mem->space.devices[i];                      \
+      if (dev->write) {                                                      \
+        uint32_t offset = (addr & dev->addr_mask) - dev->base;               \
+        dev->write(dev->userdata, offset, data, data_mask);                  \
+        return;                                                              \
+      }                                                                      \
+    }                                                                        \
     mmio_write_cb write = mem->space.write[page];                            \
     write(mem->dc->space, addr, data, data_mask);                            \
   }
@@ -284,7 +432,19 @@ enum {
       addr &= MEM_OFFSET_MASK;                                               \
       return *(data_type *)(ptr + addr);                                     \
     }                                                                        \
+    if (mem->stats) {                                                        \
+      as_count_access(&mem->space, addr, 0);                                 \
+    }                                                                        \
     const uint32_t data_mask = (UINT64_C(1) << (sizeof(data_type) * 8)) - 1; \
+    uint8_t *subpages = mem->space.subpages[page];                           \
+    if (subpages) {                                                          \
+      int i = subpages[(addr >> MEM_SUBPAGE_SHIFT) & MEM_SUBPAGE_MASK];      \
+      struct mmio_device *dev = &mem->space.devices[i];                      \
+      if (dev->read) {                                                       \
+        uint32_t offset = (addr & dev->addr_mask) - dev->base;               \
+        return dev->read(dev->userdata, offset, data_mask);                  \
+      }                                                                      \
+    }                                                                        \
     mmio_read_cb read = mem->space.read[page];                               \
     return read(mem->dc->space, addr, data_mask);                            \
   }
@@ -294,6 +454,11 @@ enum {
     return mem->space.base;                   \
   }
 
+#define define_dirty_map(space)                    \
+  uint8_t *space##_dirty_map(struct memory *mem) { \
+    return mem->space.dirty;                       \
+  }
+
 static void as_map(struct memory *mem, struct address_space *space,
                    uint32_t begin, uint32_t size, int type, mmio_read_cb read,
                    mmio_write_cb write, mmio_read_string_cb read_string,
@@ -310,8 +475,10 @@ static void as_map(struct memory *mem, struct address_space *space,
       ptr = mem->ram;
       break;
     case MAP_VRAM:
+      /* vram is only directly mapped for fastmem access, the page table still
+         routes it through the mmio callbacks such that writes made from the
+         slow path mark it dirty */
       offset = VRAM_OFFSET;
-      ptr = mem->vram;
       break;
     case MAP_ARAM:
       offset = ARAM_OFFSET;
@@ -326,6 +493,10 @@ static void as_map(struct memory *mem, struct address_space *space,
     uint32_t addr = begin + page_offset;
     int page = addr >> MEM_PAGE_SHIFT;
 
+    /* drop any devices previously mapped over the page */
+    free(space->subpages[page]);
+    space->subpages[page] = NULL;
+
     if (ptr) {
       space->ptrs[page] = ptr + page_offset;
       space->read[page] = NULL;
@@ -347,7 +518,7 @@ static void as_map(struct memory *mem, struct address_space *space,
 
   if (offset >= 0) {
     /* map physical memory into the address space */
-    res = map_shared_memory(mem->shmem, offset, target, size, ACC_READWRITE);
+    res = mem_map_physical(mem, offset, target, size);
   } else {
     /* disable access to mmio areas */
     res = map_shared_memory(mem->shmem, 0x0, target, size, ACC_NONE);
@@ -359,6 +530,51 @@ static void as_map(struct memory *mem, struct address_space *space,
 #endif
 }
 
+/* registers a device whose handlers are called directly with the
+   device-relative offset for the subpages later mapped to it */
+static int as_add_device(struct address_space *space, void *userdata,
+                         uint32_t addr_mask, uint32_t base, mmio_read_cb read,
+                         mmio_write_cb write) {
+  CHECK_LT(space->num_devices, MEM_MAX_DEVICES);
+
+  int i = space->num_devices++;
+  struct mmio_device *dev = &space->devices[i];
+  dev->userdata = userdata;
+  dev->addr_mask = addr_mask;
+  dev->base = base;
+  dev->read = read;
+  dev->write = write;
+
+  return i;
+}
+
+/* maps a device over the subpages of an existing mmio mapping */
+static void as_map_device(struct address_space *space, uint32_t begin,
+                          uint32_t size, int device) {
+  uint32_t subpage_size = 1 << MEM_SUBPAGE_SHIFT;
+  CHECK(begin % subpage_size == 0 && size % subpage_size == 0);
+
+  for (uint32_t offset = 0; offset < size; offset += subpage_size) {
+    uint32_t addr = begin + offset;
+    int page = addr >> MEM_PAGE_SHIFT;
+    CHECK(!space->ptrs[page]);
+
+    if (!space->subpages[page]) {
+      space->subpages[page] = calloc(1 << MEM_SUBPAGE_BITS, 1);
+    }
+
+    int subpage = (addr >> MEM_SUBPAGE_SHIFT) & MEM_SUBPAGE_MASK;
+    space->subpages[page][subpage] = device;
+  }
+}
+
+static void as_destroy(struct address_space *space) {
+  for (int i = 0; i < MEM_MAX_PAGES; i++) {
+    free(space->subpages[i]);
+    free(space->stats[i]);
+  }
+}
+
 static int as_init(struct address_space *space) {
   /* bind default handler */
   for (int i = 0; i < MEM_MAX_PAGES; i++) {
@@ -366,6 +582,9 @@ static int as_init(struct address_space *space) {
     space->write[i] = (mmio_write_cb)&mem_unhandled_write;
   }
 
+  /* device 0 is reserved to signal the page-level handler */
+  space->num_devices = 1;
+
 #ifdef HAVE_FASTMEM
   if (!reserve_address_space(&space->base)) {
     return 0;
@@ -387,6 +606,11 @@ int arm7_init(struct memory *mem) {
     return 0;
   }
 
+  /* aram is the only memory directly mapped, mark its pages where the sh4
+     sees it */
+  space->dirty = &mem->dirty[SH4_AICA_MEM_BEGIN >> MEM_DIRTY_PAGE_SHIFT];
+  space->dirty_mask = MEM_DIRTY_ARAM_PAGES - 1;
+
   uint32_t ARM7_AICA_MEM_SIZE = ARM7_AICA_MEM_END - ARM7_AICA_MEM_BEGIN + 1;
   uint32_t ARM7_AICA_REG_SIZE = ARM7_AICA_REG_END - ARM7_AICA_REG_BEGIN + 1;
 
@@ -453,6 +677,41 @@ static void sh4_map(struct memory *mem, uint32_t begin, uint32_t end,
   }
 }
 
+/* helper to map a device over the subpages of a region in each of its logical
+   mirrors. the device is passed offsets relative to begin, with addr_mask
+   first applied to strip the mirror bits */
+static void sh4_map_device(struct memory *mem, uint32_t begin, uint32_t end,
+                           int regions, void *userdata, uint32_t addr_mask,
+                           mmio_read_cb read, mmio_write_cb write) {
+  struct address_space *space = &mem->sh4;
+  uint32_t size = end - begin + 1;
+  int dev = as_add_device(space, userdata, addr_mask, begin & addr_mask, read,
+                          write);
+
+  if (regions & P0) {
+    as_map_device(space, SH4_P0_00_BEGIN | begin, size, dev);
+    as_map_device(space, SH4_P0_01_BEGIN | begin, size, dev);
+    as_map_device(space, SH4_P0_10_BEGIN | begin, size, dev);
+    as_map_device(space, SH4_P0_11_BEGIN | begin, size, dev);
+  }
+
+  if (regions & P1) {
+    as_map_device(space, SH4_P1_BEGIN | begin, size, dev);
+  }
+
+  if (regions & P2) {
+    as_map_device(space, SH4_P2_BEGIN | begin, size, dev);
+  }
+
+  if (regions & P3) {
+    as_map_device(space, SH4_P3_BEGIN | begin, size, dev);
+  }
+
+  if (regions & P4) {
+    as_map_device(space, SH4_P4_BEGIN | begin, size, dev);
+  }
+}
+
 int sh4_init(struct memory *mem) {
   struct address_space *space = &mem->sh4;
 
@@ -460,6 +719,9 @@ int sh4_init(struct memory *mem) {
     return 0;
   }
 
+  space->dirty = mem->dirty;
+  space->dirty_mask = MEM_DIRTY_PAGE_MASK;
+
   /* note, p0-p3 map to the entire external address space, while p4 only maps to
      the external regions in between the gaps in its own internal regions. these
      gaps map to areas 1-3 (0xe4000000-0xefffffff) and 6-7 (0xf8000000-
@@ -468,25 +730,57 @@ int sh4_init(struct memory *mem) {
   /* area 0 */
   sh4_map(mem, SH4_AREA0_BEGIN, SH4_AICA_MEM_BEGIN - 1, P0 | P1 | P2 | P3,
           MAP_MMIO, (mmio_read_cb)&sh4_area0_read,
-          (mmio_write_cb)&sh4_area0_write, NULL, NULL);
+          (mmio_write_cb)&sh4_area0_write,
+          (mmio_read_string_cb)&sh4_area0_read_string,
+          (mmio_write_string_cb)&sh4_area0_write_string);
   sh4_map(mem, SH4_AICA_MEM_BEGIN, SH4_AICA_MEM_END, P0 | P1 | P2 | P3,
           MAP_ARAM, NULL, NULL, NULL, NULL);
   sh4_map(mem, SH4_AICA_MEM_END + 1, SH4_AREA0_END, P0 | P1 | P2 | P3, MAP_MMIO,
-          (mmio_read_cb)&sh4_area0_read, (mmio_write_cb)&sh4_area0_write, NULL,
-          NULL);
+          (mmio_read_cb)&sh4_area0_read, (mmio_write_cb)&sh4_area0_write,
+          (mmio_read_string_cb)&sh4_area0_read_string,
+          (mmio_write_string_cb)&sh4_area0_write_string);
+
+  /* dispatch the devices sharing area 0's pages directly. boot / flash rom
+     aren't accessible in the area 0 mirror, and the boot rom's write handler
+     is left to the page-level handler which ignores it */
+  struct dreamcast *dc = mem->dc;
+  int area0 = P0 | P1 | P2 | P3;
+  uint32_t mirror = SH4_AREA0_ADDR_MASK + 1;
+
+  sh4_map_device(mem, SH4_BOOT_ROM_BEGIN, SH4_BOOT_ROM_END, area0, dc->boot,
+                 SH4_ADDR_MASK, (mmio_read_cb)&boot_rom_read, NULL);
+  sh4_map_device(mem, SH4_FLASH_ROM_BEGIN, SH4_FLASH_ROM_END, area0, dc->flash,
+                 SH4_ADDR_MASK, (mmio_read_cb)&flash_rom_read,
+                 (mmio_write_cb)&flash_rom_write);
+
+  for (uint32_t base = 0; base <= SH4_AREA0_END; base += mirror) {
+    sh4_map_device(mem, base | SH4_HOLLY_REG_BEGIN, base | SH4_HOLLY_REG_END,
+                   area0, dc->holly, SH4_AREA0_ADDR_MASK,
+                   (mmio_read_cb)&holly_reg_read,
+                   (mmio_write_cb)&holly_reg_write);
+    sh4_map_device(mem, base | SH4_PVR_REG_BEGIN, base | SH4_PVR_REG_END,
+                   area0, dc->pvr, SH4_AREA0_ADDR_MASK,
+                   (mmio_read_cb)&pvr_reg_read, (mmio_write_cb)&pvr_reg_write);
+    sh4_map_device(mem, base | SH4_AICA_REG_BEGIN, base | SH4_AICA_REG_END,
+                   area0, dc->aica, SH4_AREA0_ADDR_MASK,
+                   (mmio_read_cb)&aica_reg_read,
+                   (mmio_write_cb)&aica_reg_write);
+  }
 
   /* area 1 */
   sh4_map(mem, SH4_AREA1_BEGIN, SH4_AREA1_END, P0 | P1 | P2 | P3 | P4, MAP_MMIO,
-          (mmio_read_cb)&sh4_area1_read, (mmio_write_cb)&sh4_area1_write, NULL,
-          NULL);
-#if 0
-  /* TODO make texture watches monitor all mirrors such that the 64-bit access
-     area can be directly mapped, no callback */
-  sh4_map(mem, 0x04000000, 0x047fffff, P0 | P1 | P2 | P3, MAP_VRAM, NULL,
-          NULL, NULL, NULL);
-  sh4_map(mem, 0x06000000, 0x067fffff, P0 | P1 | P2 | P3, MAP_VRAM, NULL,
-          NULL, NULL, NULL);
-#endif
+          (mmio_read_cb)&sh4_area1_read, (mmio_write_cb)&sh4_area1_write,
+          (mmio_read_string_cb)&sh4_area1_read_string,
+          (mmio_write_string_cb)&sh4_area1_write_string);
+  sh4_map(mem, SH4_PVR_VRAM64_BEGIN, SH4_PVR_VRAM64_END, P0 | P1 | P2 | P3,
+          MAP_VRAM, (mmio_read_cb)&sh4_area1_read,
+          (mmio_write_cb)&sh4_area1_write,
+          (mmio_read_string_cb)&sh4_area1_read_string,
+          (mmio_write_string_cb)&sh4_area1_write_string);
+  sh4_map(mem, 0x06000000, 0x067fffff, P0 | P1 | P2 | P3, MAP_VRAM,
+          (mmio_read_cb)&sh4_area1_read, (mmio_write_cb)&sh4_area1_write,
+          (mmio_read_string_cb)&sh4_area1_read_string,
+          (mmio_write_string_cb)&sh4_area1_write_string);
 
   /* area 2 */
 
@@ -532,10 +826,89 @@ int sh4_init(struct memory *mem) {
   return 1;
 }
 
+void mem_load(struct memory *mem, struct snapshot *ss) {
+  snapshot_read(ss, mem->ram, RAM_SIZE);
+  snapshot_read(ss, mem->vram, VRAM_SIZE);
+  snapshot_read(ss, mem->aram, ARAM_SIZE);
+
+  /* any page may have changed */
+  mem_ram_dirty(mem, 0, RAM_SIZE);
+  mem_vram_dirty(mem, 0, VRAM_SIZE);
+  mem_aram_dirty(mem, 0, ARAM_SIZE);
+}
+
+void mem_save(struct memory *mem, struct snapshot *ss) {
+  snapshot_write(ss, mem->ram, RAM_SIZE);
+  snapshot_write(ss, mem->vram, VRAM_SIZE);
+  snapshot_write(ss, mem->aram, ARAM_SIZE);
+}
+
 uint8_t *mem_vram(struct memory *mem, uint32_t offset) {
   return mem->vram + offset;
 }
 
+static int mem_poll_dirty(struct memory *mem, int consumer, uint8_t *dirty,
+                          uint32_t addr, int num_pages, int num_mirrors,
+                          uint32_t mirror_size) {
+  int num_dirty = 0;
+
+  memset(dirty, 0, num_pages);
+
+  for (int i = 0; i < num_mirrors; i++) {
+    uint8_t *mirror =
+        &mem->dirty[(addr + i * mirror_size) >> MEM_DIRTY_PAGE_SHIFT];
+
+    for (int j = 0; j < num_pages; j++) {
+      dirty[j] |= (mirror[j] & consumer) != 0;
+      mirror[j] &= ~consumer;
+    }
+  }
+
+  for (int i = 0; i < num_pages; i++) {
+    num_dirty += dirty[i];
+  }
+
+  return num_dirty;
+}
+
+static void mem_mark_dirty(struct memory *mem, uint32_t addr, int size) {
+  uint32_t begin = addr >> MEM_DIRTY_PAGE_SHIFT;
+  uint32_t end = (addr + size - 1) >> MEM_DIRTY_PAGE_SHIFT;
+
+  for (uint32_t page = begin; page <= end; page++) {
+    mem->dirty[page & MEM_DIRTY_PAGE_MASK] = MEM_DIRTY_ALL;
+  }
+}
+
+int mem_aram_poll_dirty(struct memory *mem, int consumer, uint8_t *dirty) {
+  return mem_poll_dirty(mem, consumer, dirty, SH4_AICA_MEM_BEGIN,
+                        MEM_DIRTY_ARAM_PAGES, 1, ARAM_SIZE);
+}
+
+int mem_vram_poll_dirty(struct memory *mem, int consumer, uint8_t *dirty) {
+  /* the 64-bit access area is mirrored at 0x04000000 and 0x06000000 */
+  return mem_poll_dirty(mem, consumer, dirty, SH4_PVR_VRAM64_BEGIN,
+                        MEM_DIRTY_VRAM_PAGES, 2, 0x02000000);
+}
+
+int mem_ram_poll_dirty(struct memory *mem, int consumer, uint8_t *dirty) {
+  /* area 3 mirrors ram every 16mb */
+  return mem_poll_dirty(mem, consumer, dirty, SH4_AREA3_RAM0_BEGIN,
+                        MEM_DIRTY_RAM_PAGES, 4, RAM_SIZE);
+}
+
+void mem_aram_dirty(struct memory *mem, uint32_t offset, int size) {
+  mem_mark_dirty(mem, SH4_AICA_MEM_BEGIN + offset, size);
+}
+
+void mem_vram_dirty(struct memory *mem, uint32_t offset, int size) {
+  mem_mark_dirty(mem, SH4_PVR_VRAM64_BEGIN + offset, size);
+}
+
+void mem_ram_dirty(struct memory *mem, uint32_t offset, int size) {
+  mem_mark_dirty(mem, SH4_AREA3_RAM0_BEGIN + offset, size);
+}
+
 uint8_t *mem_aram(struct memory *mem, uint32_t offset) {
   return mem->aram + offset;
 }
@@ -544,29 +917,355 @@ uint8_t *mem_ram(struct memory *mem, uint32_t offset) {
   return mem->ram + offset;
 }
 
+/*
+ * mmio access instrumentation
+ */
+#define MEM_STATS_TOP_REGS 32
+#define MEM_HEATMAP_COLS 32
+#define MEM_HEATMAP_CELL 8.0f
+
+struct reg_block {
+  const char *name;
+  int num_regs;
+  const char **reg_names;
+};
+
+struct reg_count {
+  int block;
+  int reg;
+  uint64_t reads;
+  uint64_t writes;
+};
+
+static const char *sh4_reg_names[SH4_NUM_REGS] = {
+#define SH4_REG(addr, name, default, type) [name] = #name,
+#include "guest/sh4/sh4_regs.inc"
+#undef SH4_REG
+};
+
+static const char *holly_reg_names[NUM_HOLLY_REGS] = {
+#define HOLLY_REG(addr, name, default, type) [name] = #name,
+#include "guest/holly/holly_regs.inc"
+#undef HOLLY_REG
+};
+
+static const char *pvr_reg_names[PVR_NUM_REGS] = {
+#define PVR_REG(addr, name, default, type) [name] = #name,
+#include "guest/pvr/pvr_regs.inc"
+#undef PVR_REG
+};
+
+static const struct reg_block reg_blocks[MEM_NUM_REG_BLOCKS] = {
+    {"sh4", SH4_NUM_REGS, sh4_reg_names},
+    {"holly", NUM_HOLLY_REGS, holly_reg_names},
+    {"pvr", PVR_NUM_REGS, pvr_reg_names},
+    {"aica", (SH4_AICA_REG_END - SH4_AICA_REG_BEGIN + 1) >> 2, NULL},
+};
+
+static uint32_t mem_reg_addr(int block, int reg) {
+  switch (block) {
+    case MEM_REGS_SH4:
+      /* inverse of SH4_REG_OFFSET, reporting the p4 address */
+      return 0xfe000000 | ((reg & 0x3fc0) << 11) | ((reg & 0x3f) << 2);
+    case MEM_REGS_HOLLY:
+      return SH4_HOLLY_REG_BEGIN + (reg << 2);
+    case MEM_REGS_PVR:
+      return SH4_PVR_REG_BEGIN + (reg << 2);
+    case MEM_REGS_AICA:
+      return SH4_AICA_REG_BEGIN + (reg << 2);
+    default:
+      LOG_FATAL("mem_reg_addr unexpected block %d", block);
+  }
+}
+
+static uint64_t reg_count_total(const struct reg_count *count) {
+  return count->reads + count->writes;
+}
+
+/* fills top with the most accessed registers across all blocks, returning the
+   number found */
+static int mem_top_regs(struct memory *mem, struct reg_count *top, int max) {
+  int n = 0;
+
+  for (int block = 0; block < MEM_NUM_REG_BLOCKS; block++) {
+    struct reg_stats *stats = &mem->regs[block];
+
+    for (int reg = 0; reg < reg_blocks[block].num_regs; reg++) {
+      struct reg_count count = {block, reg, stats->reads[reg],
+                                stats->writes[reg]};
+      uint64_t total = reg_count_total(&count);
+
+      if (!total) {
+        continue;
+      }
+
+      if (n == max && total <= reg_count_total(&top[max - 1])) {
+        continue;
+      }
+
+      /* insert into the list, sorted by descending total */
+      int i = n < max ? n++ : max - 1;
+      while (i > 0 && reg_count_total(&top[i - 1]) < total) {
+        top[i] = top[i - 1];
+        i--;
+      }
+      top[i] = count;
+    }
+  }
+
+  return n;
+}
+
+static void mem_dump_page_stats(FILE *fp, struct address_space *space,
+                                const char *name) {
+  for (int page = 0; page < MEM_MAX_PAGES; page++) {
+    struct page_stats *stats = space->stats[page];
+
+    if (!stats) {
+      continue;
+    }
+
+    for (int i = 0; i < (1 << MEM_SUBPAGE_BITS); i++) {
+      if (!stats->reads[i] && !stats->writes[i]) {
+        continue;
+      }
+
+      uint32_t addr = ((uint32_t)page << MEM_PAGE_SHIFT) |
+                      ((uint32_t)i << MEM_SUBPAGE_SHIFT);
+      fprintf(fp, "%s_page,0x%08x,,%" PRIu64 ",%" PRIu64 "\n", name, addr,
+              stats->reads[i], stats->writes[i]);
+    }
+  }
+}
+
+static void mem_dump_stats(struct memory *mem) {
+  const char *appdir = fs_appdir();
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "mmio_stats.csv",
+           appdir);
+
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    LOG_WARNING("mem_dump_stats failed to open %s", filename);
+    return;
+  }
+
+  fprintf(fp, "type,address,name,reads,writes\n");
+
+  for (int block = 0; block < MEM_NUM_REG_BLOCKS; block++) {
+    const struct reg_block *info = &reg_blocks[block];
+    struct reg_stats *stats = &mem->regs[block];
+
+    for (int reg = 0; reg < info->num_regs; reg++) {
+      if (!stats->reads[reg] && !stats->writes[reg]) {
+        continue;
+      }
+
+      const char *reg_name = info->reg_names ? info->reg_names[reg] : NULL;
+      fprintf(fp, "%s_reg,0x%08x,%s,%" PRIu64 ",%" PRIu64 "\n", info->name,
+              mem_reg_addr(block, reg), reg_name ? reg_name : "",
+              stats->reads[reg], stats->writes[reg]);
+    }
+  }
+
+  mem_dump_page_stats(fp, &mem->sh4, "sh4");
+  mem_dump_page_stats(fp, &mem->arm7, "arm7");
+
+  fclose(fp);
+
+  LOG_INFO("mem_dump_stats wrote %s", filename);
+}
+
+void mem_count_reg(struct memory *mem, int block, int reg, int write) {
+  if (!mem->stats || reg >= reg_blocks[block].num_regs) {
+    return;
+  }
+
+  struct reg_stats *stats = &mem->regs[block];
+
+  if (write) {
+    stats->writes[reg]++;
+  } else {
+    stats->reads[reg]++;
+  }
+}
+
+#ifdef HAVE_IMGUI
+static uint32_t mem_heat_color(float heat) {
+  /* colors are packed abgr, fading from dark blue to red */
+  if (heat <= 0.0f) {
+    return 0xff303030;
+  }
+  uint32_t r = (uint32_t)(heat * 255.0f);
+  uint32_t b = (uint32_t)((1.0f - heat) * 160.0f);
+  return 0xff000000 | (b << 16) | r;
+}
+
+static void mem_page_heatmap(struct address_space *space, const char *name) {
+  const int num_subpages = 1 << MEM_SUBPAGE_BITS;
+  const int num_rows = num_subpages / MEM_HEATMAP_COLS;
+
+  /* each mmio page is drawn as a grid of its 4kb subpages, shaded by the log
+     of their access count relative to the busiest subpage */
+  uint64_t max_total = 1;
+  for (int page = 0; page < MEM_MAX_PAGES; page++) {
+    struct page_stats *stats = space->stats[page];
+    if (!stats) {
+      continue;
+    }
+    for (int i = 0; i < num_subpages; i++) {
+      max_total = MAX(max_total, stats->reads[i] + stats->writes[i]);
+    }
+  }
+  float log_max = logf((float)max_total + 1.0f);
+
+  for (int page = 0; page < MEM_MAX_PAGES; page++) {
+    struct page_stats *stats = space->stats[page];
+    if (!stats) {
+      continue;
+    }
+
+    uint32_t page_addr = (uint32_t)page << MEM_PAGE_SHIFT;
+    igText("%s 0x%08x", name, page_addr);
+
+    struct ImDrawList *list = igGetWindowDrawList();
+    struct ImVec2 origin;
+    igGetCursorScreenPos(&origin);
+
+    for (int i = 0; i < num_subpages; i++) {
+      uint64_t total = stats->reads[i] + stats->writes[i];
+      float heat = total ? logf((float)total + 1.0f) / log_max : 0.0f;
+      float x = origin.x + (i % MEM_HEATMAP_COLS) * MEM_HEATMAP_CELL;
+      float y = origin.y + (i / MEM_HEATMAP_COLS) * MEM_HEATMAP_CELL;
+      struct ImVec2 min = {x, y};
+      struct ImVec2 max = {x + MEM_HEATMAP_CELL - 1.0f,
+                           y + MEM_HEATMAP_CELL - 1.0f};
+      ImDrawList_AddRectFilled(list, min, max, mem_heat_color(heat), 0.0f, 0);
+    }
+
+    struct ImVec2 size = {MEM_HEATMAP_COLS * MEM_HEATMAP_CELL,
+                          num_rows * MEM_HEATMAP_CELL};
+    igPushIDPtr(stats);
+    igDummy(&size);
+    igPopID();
+
+    if (igIsItemHovered()) {
+      struct ImVec2 mouse;
+      igGetMousePos(&mouse);
+      int col = (int)((mouse.x - origin.x) / MEM_HEATMAP_CELL);
+      int row = (int)((mouse.y - origin.y) / MEM_HEATMAP_CELL);
+      int i = MIN(MAX(row, 0), num_rows - 1) * MEM_HEATMAP_COLS +
+              MIN(MAX(col, 0), MEM_HEATMAP_COLS - 1);
+      igSetTooltip("0x%08x reads %" PRIu64 " writes %" PRIu64,
+                   page_addr | ((uint32_t)i << MEM_SUBPAGE_SHIFT),
+                   stats->reads[i], stats->writes[i]);
+    }
+  }
+}
+
+static void mem_stats_window(struct memory *mem) {
+  if (igBegin("mmio stats", NULL, 0)) {
+    struct reg_count top[MEM_STATS_TOP_REGS];
+    int num_top = mem_top_regs(mem, top, MEM_STATS_TOP_REGS);
+
+    igColumns(5, NULL, 0);
+
+    igText("addr");
+    igNextColumn();
+    igText("block");
+    igNextColumn();
+    igText("name");
+    igNextColumn();
+    igText("reads");
+    igNextColumn();
+    igText("writes");
+    igNextColumn();
+
+    for (int i = 0; i < num_top; i++) {
+      const struct reg_block *info = &reg_blocks[top[i].block];
+      const char *reg_name =
+          info->reg_names ? info->reg_names[top[i].reg] : NULL;
+
+      igText("0x%08x", mem_reg_addr(top[i].block, top[i].reg));
+      igNextColumn();
+      igText("%s", info->name);
+      igNextColumn();
+      igText("%s", reg_name ? reg_name : "");
+      igNextColumn();
+      igText("%" PRIu64, top[i].reads);
+      igNextColumn();
+      igText("%" PRIu64, top[i].writes);
+      igNextColumn();
+    }
+
+    igColumns(1, NULL, 0);
+    igSeparator();
+
+    mem_page_heatmap(&mem->sh4, "sh4");
+    mem_page_heatmap(&mem->arm7, "arm7");
+
+    igEnd();
+  }
+}
+
+void mem_debug_menu(struct memory *mem) {
+  if (igBeginMainMenuBar()) {
+    if (igBeginMenu("MEM", 1)) {
+      if (igMenuItem("mmio stats", NULL, mem->show_stats, mem->stats)) {
+        mem->show_stats = !mem->show_stats;
+      }
+
+      igEndMenu();
+    }
+
+    igEndMainMenuBar();
+  }
+
+  if (mem->show_stats) {
+    mem_stats_window(mem);
+  }
+}
+#endif
+
 int mem_init(struct memory *mem) {
 #ifdef HAVE_FASTMEM
   /* create the shared memory object to back the physical memory. note, because
      mmio regions also map this shared memory object when disabling permissions,
      the object has to at least be the size of an entire mmio region */
   size_t shmem_size = MAX(PHYSICAL_SIZE, SH4_AREA_SIZE);
-  mem->shmem = create_shared_memory("/redream", shmem_size, ACC_READWRITE);
+
+  /* each instance needs its own shared memory object, as creating one first
+     unlinks any existing object of the same name */
+  char shmem_name[128];
+  snprintf(shmem_name, sizeof(shmem_name), "/redream_%p", mem);
+
+  if (OPTION_hugepages) {
+    mem->shmem =
+        create_huge_shared_memory(shmem_name, shmem_size, ACC_READWRITE);
+    mem->shmem_huge = mem->shmem != SHMEM_INVALID;
+
+    if (!mem->shmem_huge) {
+      LOG_INFO("mem_init no reserved huge pages available, falling back to "
+               "transparent huge pages");
+    }
+  }
+
+  if (mem->shmem == SHMEM_INVALID) {
+    mem->shmem = create_shared_memory(shmem_name, shmem_size, ACC_READWRITE);
+  }
 
   if (mem->shmem == SHMEM_INVALID) {
     LOG_WARNING("mem_init failed to create shared memory object");
     return 0;
   }
 
-  mem->ram =
-      map_shared_memory(mem->shmem, RAM_OFFSET, NULL, RAM_SIZE, ACC_READWRITE);
+  mem->ram = mem_map_physical(mem, RAM_OFFSET, NULL, RAM_SIZE);
   CHECK_NE(mem->ram, SHMEM_MAP_FAILED);
 
-  mem->vram = map_shared_memory(mem->shmem, VRAM_OFFSET, NULL, VRAM_SIZE,
-                                ACC_READWRITE);
+  mem->vram = mem_map_physical(mem, VRAM_OFFSET, NULL, VRAM_SIZE);
   CHECK_NE(mem->vram, SHMEM_MAP_FAILED);
 
-  mem->aram = map_shared_memory(mem->shmem, ARAM_OFFSET, NULL, ARAM_SIZE,
-                                ACC_READWRITE);
+  mem->aram = mem_map_physical(mem, ARAM_OFFSET, NULL, ARAM_SIZE);
   CHECK_NE(mem->aram, SHMEM_MAP_FAILED);
 #else
   mem->ram = calloc(RAM_SIZE, 1);
@@ -582,10 +1281,39 @@ int mem_init(struct memory *mem) {
     return 0;
   }
 
+  if (OPTION_mmio_stats) {
+    mem->stats = 1;
+
+    for (int i = 0; i < MEM_NUM_REG_BLOCKS; i++) {
+      int num_regs = reg_blocks[i].num_regs;
+      mem->regs[i].reads = calloc(num_regs, sizeof(uint64_t));
+      mem->regs[i].writes = calloc(num_regs, sizeof(uint64_t));
+    }
+  }
+
+#ifdef HAVE_FASTMEM
+  if (mem->shmem_thp_failed) {
+    LOG_INFO("mem_init transparent huge pages unavailable for shared memory, "
+             "falling back to 4kb pages");
+  }
+#endif
+
   return 1;
 }
 
 void mem_destroy(struct memory *mem) {
+  if (mem->stats) {
+    mem_dump_stats(mem);
+  }
+
+  for (int i = 0; i < MEM_NUM_REG_BLOCKS; i++) {
+    free(mem->regs[i].reads);
+    free(mem->regs[i].writes);
+  }
+
+  as_destroy(&mem->sh4);
+  as_destroy(&mem->arm7);
+
 #ifdef HAVE_FASTMEM
   destroy_shared_memory(mem->shmem);
 #else
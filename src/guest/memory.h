@@ -6,6 +6,7 @@
 
 struct dreamcast;
 struct memory;
+struct snapshot;
 
 /*
  * mmio callbacks and helpers
@@ -20,8 +21,28 @@ typedef void (*mmio_write_cb)(void *, uint32_t, uint32_t, uint32_t);
 typedef void (*mmio_read_string_cb)(void *, uint8_t *, uint32_t, int);
 typedef void (*mmio_write_string_cb)(void *, uint32_t, const uint8_t *, int);
 
+/* widest access (up to 32-bit) that can be made at addr without overrunning
+   size bytes. callers or-ing together multiple addresses get the widest size
+   aligned for all of them */
+static inline int mmio_access_size(uint32_t addr, int size) {
+  if (!(addr & 0x3) && size >= 4) {
+    return 4;
+  } else if (!(addr & 0x1) && size >= 2) {
+    return 2;
+  }
+  return 1;
+}
+
+/* service a string access through a device's scalar callback, issuing the
+   widest aligned accesses possible rather than one per byte */
+void mmio_read_string(void *userdata, mmio_read_cb read, uint8_t *dst,
+                      uint32_t src, int size);
+void mmio_write_string(void *userdata, mmio_write_cb write, uint32_t dst,
+                       const uint8_t *src, int size);
+
 #define DECLARE_ADDRESS_SPACE(space)                                       \
   uint8_t *space##_base(struct memory *mem);                               \
+  uint8_t *space##_dirty_map(struct memory *mem);                          \
   uint8_t space##_read8(struct memory *mem, uint32_t addr);                \
   uint16_t space##_read16(struct memory *mem, uint32_t addr);              \
   uint32_t space##_read32(struct memory *mem, uint32_t addr);              \
@@ -45,9 +66,68 @@ struct memory *mem_create(struct dreamcast *dc);
 void mem_destroy(struct memory *mem);
 
 int mem_init(struct memory *mem);
+void mem_save(struct memory *mem, struct snapshot *ss);
+void mem_load(struct memory *mem, struct snapshot *ss);
+
+void mem_debug_menu(struct memory *mem);
 
 uint8_t *mem_ram(struct memory *mem, uint32_t offset);
 uint8_t *mem_aram(struct memory *mem, uint32_t offset);
 uint8_t *mem_vram(struct memory *mem, uint32_t offset);
 
+/*
+ * dirty page tracking
+ *
+ * rather than write-protecting guest memory to detect modifications, each
+ * write to it marks the 4kb page written in a map indexed by the sh4 physical
+ * address. the fast paths emitted by the jit mark the map inline, while the
+ * slow paths mark it as they write through the page table or from their device
+ * handlers
+ *
+ * each consumer of the map owns a bit of every page's flags. writes set all of
+ * them, letting each consumer poll and reset its own bit independently
+ */
+#define MEM_DIRTY_PAGE_SHIFT 12
+#define MEM_DIRTY_PAGE_SIZE (1 << MEM_DIRTY_PAGE_SHIFT)
+#define MEM_DIRTY_PAGE_MASK 0x1ffff
+#define MEM_DIRTY_PAGES (MEM_DIRTY_PAGE_MASK + 1)
+#define MEM_DIRTY_RAM_PAGES ((16 * 1024 * 1024) >> MEM_DIRTY_PAGE_SHIFT)
+#define MEM_DIRTY_VRAM_PAGES ((8 * 1024 * 1024) >> MEM_DIRTY_PAGE_SHIFT)
+#define MEM_DIRTY_ARAM_PAGES ((2 * 1024 * 1024) >> MEM_DIRTY_PAGE_SHIFT)
+#define MEM_DIRTY_ALL 0xff
+
+enum {
+  MEM_DIRTY_TEXTURES = 0x1,
+  MEM_DIRTY_REWIND = 0x2,
+};
+
+void mem_ram_dirty(struct memory *mem, uint32_t offset, int size);
+void mem_vram_dirty(struct memory *mem, uint32_t offset, int size);
+void mem_aram_dirty(struct memory *mem, uint32_t offset, int size);
+
+/* folds the dirty state of each mirror of the memory into dirty, indexed by
+   page offset into it (for vram, offset into the 64-bit access area), and
+   resets the consumer's bit. returns the number of dirty pages */
+int mem_ram_poll_dirty(struct memory *mem, int consumer, uint8_t *dirty);
+int mem_vram_poll_dirty(struct memory *mem, int consumer, uint8_t *dirty);
+int mem_aram_poll_dirty(struct memory *mem, int consumer, uint8_t *dirty);
+
+/*
+ * mmio access instrumentation
+ *
+ * when enabled with --mmio_stats, each access taking the mmio path is counted
+ * per 4kb subpage, and each register block's handlers count accesses per
+ * 32-bit register. results are shown in the debug menu and written to
+ * mmio_stats.csv in the application directory on exit
+ */
+enum {
+  MEM_REGS_SH4,
+  MEM_REGS_HOLLY,
+  MEM_REGS_PVR,
+  MEM_REGS_AICA,
+  MEM_NUM_REG_BLOCKS,
+};
+
+void mem_count_reg(struct memory *mem, int block, int reg, int write);
+
 #endif
@@ -6,6 +6,7 @@
 #include "guest/pvr/ta.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "stats.h"
 
 static struct reg_cb pvr_cb[PVR_NUM_REGS];
@@ -83,6 +84,7 @@ static void pvr_mark_framebuffer(struct pvr *pvr, uint32_t addr) {
   }
 
   *(uint32_t *)&pvr->vram[VRAM64(addr)] = PVR_FB_COOKIE;
+  mem_vram_dirty(pvr->dc->mem, VRAM64(addr), 4);
 
   /* it's not enough to just mark the starting address of this framebuffer. next
      frame, this framebuffer could be used as field 2, in which case FB_R_SOF2
@@ -96,6 +98,7 @@ static void pvr_mark_framebuffer(struct pvr *pvr, uint32_t addr) {
       for (int k = 0; k < ARRAY_SIZE(line_scale); k++) {
         uint32_t next_line = addr + line_width[i] * line_bpp[j] * line_scale[k];
         *(uint32_t *)&pvr->vram[VRAM64(next_line)] = PVR_FB_COOKIE;
+        mem_vram_dirty(pvr->dc->mem, VRAM64(next_line), 4);
       }
     }
   }
@@ -227,13 +230,17 @@ static void pvr_vblank_in(struct pvr *pvr) {
   dc_vblank_in(pvr->dc, pvr->VO_CONTROL->blank_video);
 }
 
-static void pvr_next_scanline(void *data) {
-  struct pvr *pvr = data;
+static int pvr_line_vsync(struct pvr *pvr, uint32_t line) {
+  if (pvr->SPG_VBLANK->vbstart < pvr->SPG_VBLANK->vbend) {
+    return line >= pvr->SPG_VBLANK->vbstart && line < pvr->SPG_VBLANK->vbend;
+  }
+  return line >= pvr->SPG_VBLANK->vbstart || line < pvr->SPG_VBLANK->vbend;
+}
+
+static void pvr_enter_line(struct pvr *pvr, uint32_t line) {
   struct holly *hl = pvr->dc->holly;
-  struct scheduler *sched = pvr->dc->sched;
 
-  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
-  pvr->current_line = (pvr->current_line + 1) % num_lines;
+  pvr->current_line = line;
 
   /* hblank in */
   switch (pvr->SPG_HBLANK_INT->hblank_int_mode) {
@@ -261,13 +268,7 @@ static void pvr_next_scanline(void *data) {
   }
 
   int was_vsync = pvr->SPG_STATUS->vsync;
-  if (pvr->SPG_VBLANK->vbstart < pvr->SPG_VBLANK->vbend) {
-    pvr->SPG_STATUS->vsync = pvr->current_line >= pvr->SPG_VBLANK->vbstart &&
-                             pvr->current_line < pvr->SPG_VBLANK->vbend;
-  } else {
-    pvr->SPG_STATUS->vsync = pvr->current_line >= pvr->SPG_VBLANK->vbstart ||
-                             pvr->current_line < pvr->SPG_VBLANK->vbend;
-  }
+  pvr->SPG_STATUS->vsync = pvr_line_vsync(pvr, pvr->current_line);
   pvr->SPG_STATUS->scanline = pvr->current_line;
 
   if (!was_vsync && pvr->SPG_STATUS->vsync) {
@@ -275,14 +276,137 @@ static void pvr_next_scanline(void *data) {
   } else if (was_vsync && !pvr->SPG_STATUS->vsync) {
     pvr_vblank_out(pvr);
   }
+}
+
+/* returns the number of lines after the current line until the next one which
+   raises an interrupt or toggles vsync, or 0 if no line does */
+static uint32_t pvr_next_event_line(struct pvr *pvr) {
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+
+  if (pvr->SPG_HBLANK_INT->hblank_int_mode == 0x2) {
+    return 1;
+  }
+
+  /* vsync can also toggle when wrapping around to the first line, in the
+     case vbstart or vbend are past the end of the frame */
+  uint32_t lines[] = {
+      0,
+      pvr->SPG_VBLANK_INT->vblank_in_line_number,
+      pvr->SPG_VBLANK_INT->vblank_out_line_number,
+      pvr->SPG_VBLANK->vbstart,
+      pvr->SPG_VBLANK->vbend,
+      pvr->SPG_HBLANK_INT->hblank_int_mode == 0x0
+          ? pvr->SPG_HBLANK_INT->line_comp_val
+          : num_lines,
+  };
+  uint32_t next = 0;
+
+  for (int i = 0; i < ARRAY_SIZE(lines); i++) {
+    /* lines past the end of the frame are never reached */
+    if (lines[i] >= num_lines) {
+      continue;
+    }
+
+    uint32_t dist = (lines[i] + num_lines - pvr->current_line) % num_lines;
+    if (!dist) {
+      dist = num_lines;
+    }
+
+    if (!next || dist < next) {
+      next = dist;
+    }
+  }
+
+  return next;
+}
+
+static uint32_t pvr_lines_elapsed(struct pvr *pvr, int64_t now) {
+  return (uint32_t)(MAX(now - pvr->line_time, 0) / pvr->line_ns);
+}
+
+/* process each line with an event between the current line and now */
+static void pvr_advance_spg(struct pvr *pvr, int64_t now) {
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+  uint32_t lines = pvr_lines_elapsed(pvr, now);
+
+  while (lines) {
+    uint32_t next = pvr_next_event_line(pvr);
+
+    if (!next || next > lines) {
+      break;
+    }
+
+    pvr->line_time += next * pvr->line_ns;
+    lines -= next;
+
+    pvr_enter_line(pvr, (pvr->current_line + next) % num_lines);
+  }
+
+  /* skip over the remaining uneventful lines */
+  pvr->line_time += lines * pvr->line_ns;
+  pvr->current_line = (pvr->current_line + lines) % num_lines;
+  pvr->SPG_STATUS->scanline = pvr->current_line;
+}
+
+static void pvr_next_event(void *data);
+
+static void pvr_schedule_spg(struct pvr *pvr) {
+  struct scheduler *sched = pvr->dc->sched;
+
+  if (pvr->spg_timer) {
+    sched_cancel_timer(sched, pvr->spg_timer);
+    pvr->spg_timer = NULL;
+  }
+
+  uint32_t next = pvr_next_event_line(pvr);
+
+  if (!next) {
+    return;
+  }
+
+  /* when rescheduled part way through a slice, the timer can't fire until
+     the slice ends. pvr_advance_spg catches up on any lines passed by then */
+  int64_t now = sched_current_time(sched);
+  int64_t expire = pvr->line_time + next * pvr->line_ns;
+
+  pvr->spg_timer =
+      sched_start_timer(sched, &pvr_next_event, pvr, MAX(expire - now, 0));
+}
+
+static void pvr_next_event(void *data) {
+  struct pvr *pvr = data;
+  struct scheduler *sched = pvr->dc->sched;
+
+  pvr->spg_timer = NULL;
+
+  pvr_advance_spg(pvr, sched_current_time(sched));
+
+  pvr_schedule_spg(pvr);
+}
+
+/* process any events passed since the last one under the current comparison
+   values, before they're changed */
+static void pvr_sync_spg(struct pvr *pvr) {
+  struct scheduler *sched = pvr->dc->sched;
+
+  if (!pvr->line_ns) {
+    return;
+  }
 
-  /* reschedule */
-  pvr->line_timer = sched_start_timer(sched, &pvr_next_scanline, pvr,
-                                      HZ_TO_NANO(pvr->line_clock));
+  pvr_advance_spg(pvr, sched_current_time(sched));
 }
 
 static void pvr_reconfigure_spg(struct pvr *pvr) {
   struct scheduler *sched = pvr->dc->sched;
+  int64_t now = sched_current_time(sched);
+
+  /* carry the current line over to the new timing, restarting it from now */
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+  if (pvr->line_ns) {
+    pvr->current_line += pvr_lines_elapsed(pvr, now);
+  }
+  pvr->current_line %= num_lines;
+  pvr->line_time = now;
 
   /* scale pixel clock frequency */
   int pixel_clock = 13500000;
@@ -295,6 +419,7 @@ static void pvr_reconfigure_spg(struct pvr *pvr) {
   if (pvr->SPG_CONTROL->interlace) {
     pvr->line_clock *= 2;
   }
+  pvr->line_ns = HZ_TO_NANO(pvr->line_clock);
 
   const char *mode = "vga";
   if (pvr->SPG_CONTROL->NTSC == 1) {
@@ -310,13 +435,45 @@ static void pvr_reconfigure_spg(struct pvr *pvr) {
       pvr->SPG_LOAD->hcount, pvr->SPG_HBLANK->hbstart, pvr->SPG_HBLANK->hbend,
       pvr->SPG_LOAD->vcount, pvr->SPG_VBLANK->vbstart, pvr->SPG_VBLANK->vbend);
 
-  if (pvr->line_timer) {
-    sched_cancel_timer(sched, pvr->line_timer);
-    pvr->line_timer = NULL;
-  }
+  pvr_schedule_spg(pvr);
+}
+
+static int pvr_framebuffer_bytes(struct pvr *pvr) {
+  int size = pvr->framebuffer_w * pvr->framebuffer_h * 3;
+  return MIN(MAX(size, 0), (int)sizeof(pvr->framebuffer));
+}
+
+static void pvr_load(struct device *dev, struct snapshot *ss) {
+  struct pvr *pvr = (struct pvr *)dev;
+
+  SNAPSHOT_READ(ss, pvr->reg);
+  pvr->spg_timer = sched_read_timer(pvr->dc->sched, ss);
+  SNAPSHOT_READ(ss, pvr->line_clock);
+  SNAPSHOT_READ(ss, pvr->line_ns);
+  SNAPSHOT_READ(ss, pvr->current_line);
+  SNAPSHOT_READ(ss, pvr->line_time);
+  SNAPSHOT_READ(ss, pvr->framebuffer_w);
+  SNAPSHOT_READ(ss, pvr->framebuffer_h);
+  snapshot_read(ss, pvr->framebuffer, pvr_framebuffer_bytes(pvr));
+  SNAPSHOT_READ(ss, pvr->got_startrender);
+
+  /* palette ram was restored along with the registers */
+  pvr->palette_dirty = 1;
+}
+
+static void pvr_save(struct device *dev, struct snapshot *ss) {
+  struct pvr *pvr = (struct pvr *)dev;
 
-  pvr->line_timer = sched_start_timer(sched, &pvr_next_scanline, pvr,
-                                      HZ_TO_NANO(pvr->line_clock));
+  SNAPSHOT_WRITE(ss, pvr->reg);
+  sched_write_timer(pvr->dc->sched, ss, pvr->spg_timer);
+  SNAPSHOT_WRITE(ss, pvr->line_clock);
+  SNAPSHOT_WRITE(ss, pvr->line_ns);
+  SNAPSHOT_WRITE(ss, pvr->current_line);
+  SNAPSHOT_WRITE(ss, pvr->line_time);
+  SNAPSHOT_WRITE(ss, pvr->framebuffer_w);
+  SNAPSHOT_WRITE(ss, pvr->framebuffer_h);
+  snapshot_write(ss, pvr->framebuffer, pvr_framebuffer_bytes(pvr));
+  SNAPSHOT_WRITE(ss, pvr->got_startrender);
 }
 
 static int pvr_init(struct device *dev) {
@@ -342,6 +499,7 @@ void pvr_vram32_write(struct pvr *pvr, uint32_t addr, uint32_t data,
                       uint32_t mask) {
   addr = VRAM64(addr);
   WRITE_DATA(&pvr->vram[addr]);
+  mem_vram_dirty(pvr->dc->mem, addr, DATA_SIZE());
 }
 
 uint32_t pvr_vram32_read(struct pvr *pvr, uint32_t addr, uint32_t mask) {
@@ -349,29 +507,91 @@ uint32_t pvr_vram32_read(struct pvr *pvr, uint32_t addr, uint32_t mask) {
   return READ_DATA(&pvr->vram[addr]);
 }
 
+/* the 32-bit area interleaves its two banks every 4 bytes, so strings are
+   copied a word at a time, each to its own location in the 64-bit area */
+void pvr_vram32_write_string(struct pvr *pvr, uint32_t addr,
+                             const uint8_t *src, int size) {
+  const uint32_t bank_size = 0x00400000;
+  uint32_t end = addr + size;
+
+  /* mark each bank's span as dirty up front. the span covers the other bank's
+     interleaved words as well, which only over-invalidates */
+  while (addr < end) {
+    uint32_t bank_end = MIN((addr & ~(bank_size - 1)) + bank_size, end);
+    uint32_t first = VRAM64(addr);
+    uint32_t last = VRAM64(bank_end - 1);
+    mem_vram_dirty(pvr->dc->mem, first, last - first + 1);
+
+    while (addr < bank_end) {
+      uint32_t n = MIN(4 - (addr & 0x3), bank_end - addr);
+      /* constant size copy for the common case gets inlined */
+      if (n == 4) {
+        memcpy(&pvr->vram[VRAM64(addr)], src, 4);
+      } else {
+        memcpy(&pvr->vram[VRAM64(addr)], src, n);
+      }
+      addr += n;
+      src += n;
+    }
+  }
+}
+
+void pvr_vram32_read_string(struct pvr *pvr, uint8_t *dst, uint32_t addr,
+                            int size) {
+  uint32_t end = addr + size;
+
+  while (addr < end) {
+    uint32_t n = MIN(4 - (addr & 0x3), end - addr);
+    if (n == 4) {
+      memcpy(dst, &pvr->vram[VRAM64(addr)], 4);
+    } else {
+      memcpy(dst, &pvr->vram[VRAM64(addr)], n);
+    }
+    addr += n;
+    dst += n;
+  }
+}
+
 void pvr_vram64_write(struct pvr *pvr, uint32_t addr, uint32_t data,
                       uint32_t mask) {
   WRITE_DATA(&pvr->vram[addr]);
+  mem_vram_dirty(pvr->dc->mem, addr, DATA_SIZE());
 }
 
 uint32_t pvr_vram64_read(struct pvr *pvr, uint32_t addr, uint32_t mask) {
-  /* note, the video ram can't be directly accessed through fastmem, or texture
-     cache invalidations will break. this is because textures cache entries
-     only watch the physical video ram address, not all of its mirrors */
   return READ_DATA(&pvr->vram[addr]);
 }
 
+void pvr_vram64_write_string(struct pvr *pvr, uint32_t addr,
+                             const uint8_t *src, int size) {
+  memcpy(&pvr->vram[addr], src, size);
+  mem_vram_dirty(pvr->dc->mem, addr, size);
+}
+
+void pvr_vram64_read_string(struct pvr *pvr, uint8_t *dst, uint32_t addr,
+                            int size) {
+  memcpy(dst, &pvr->vram[addr], size);
+}
+
 void pvr_reg_write(struct pvr *pvr, uint32_t addr, uint32_t data,
                    uint32_t mask) {
   uint32_t offset = addr >> 2;
   reg_write_cb write = pvr_cb[offset].write;
 
+  mem_count_reg(pvr->dc->mem, MEM_REGS_PVR, offset, 1);
+
   /* ID register is read-only, and the bios will fail to boot if a write
      goes through to this register */
   if (offset == ID) {
     return;
   }
 
+  /* palette ram isn't backed by vram, track its modifications separately for
+     the texture cache */
+  if (offset >= PALETTE_RAM000 && offset <= PALETTE_RAMFFC) {
+    pvr->palette_dirty = 1;
+  }
+
   if (write) {
     write(pvr->dc, data);
     return;
@@ -384,6 +604,8 @@ uint32_t pvr_reg_read(struct pvr *pvr, uint32_t addr, uint32_t mask) {
   uint32_t offset = addr >> 2;
   reg_read_cb read = pvr_cb[offset].read;
 
+  mem_count_reg(pvr->dc->mem, MEM_REGS_PVR, offset, 0);
+
   if (read) {
     return read(pvr->dc);
   }
@@ -427,6 +649,11 @@ struct pvr *pvr_create(struct dreamcast *dc) {
   struct pvr *pvr =
       dc_create_device(dc, sizeof(struct pvr), "pvr", &pvr_init, NULL);
 
+  /* setup state interface */
+  pvr->stateif.enabled = 1;
+  pvr->stateif.save = &pvr_save;
+  pvr->stateif.load = &pvr_load;
+
   return pvr;
 }
 
@@ -502,3 +729,50 @@ REG_W32(pvr_cb, FB_R_CTRL) {
 
   pvr_reconfigure_spg(pvr);
 }
+
+REG_W32(pvr_cb, SPG_HBLANK_INT) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr_sync_spg(pvr);
+
+  pvr->SPG_HBLANK_INT->full = value;
+
+  pvr_schedule_spg(pvr);
+}
+
+REG_W32(pvr_cb, SPG_VBLANK_INT) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr_sync_spg(pvr);
+
+  pvr->SPG_VBLANK_INT->full = value;
+
+  pvr_schedule_spg(pvr);
+}
+
+REG_W32(pvr_cb, SPG_VBLANK) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr_sync_spg(pvr);
+
+  pvr->SPG_VBLANK->full = value;
+
+  pvr_schedule_spg(pvr);
+}
+
+REG_R32(pvr_cb, SPG_STATUS) {
+  struct pvr *pvr = dc->pvr;
+  struct scheduler *sched = dc->sched;
+
+  /* the scanline isn't stepped through, derive it from the current time.
+     fieldnum is only flipped when vblank in is processed */
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+  int64_t now = sched_current_time(sched);
+  uint32_t line =
+      (pvr->current_line + pvr_lines_elapsed(pvr, now)) % num_lines;
+
+  union spg_status status = *pvr->SPG_STATUS;
+  status.scanline = line;
+  status.vsync = pvr_line_vsync(pvr, line);
+  return status.full;
+}
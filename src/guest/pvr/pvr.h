@@ -15,10 +15,15 @@ struct pvr {
   uint8_t *vram;
   uint32_t reg[PVR_NUM_REGS];
 
-  /* raster progress */
-  struct timer *line_timer;
+  /* raster progress. rather than stepping through each line, only lines which
+   raise an interrupt or toggle vsync are scheduled, with the scanline in
+   SPG_STATUS derived from the scheduler's time when read */
+  struct timer *spg_timer;
   int line_clock;
+  int64_t line_ns;
+  /* last line processed, and the guest time it began at */
   uint32_t current_line;
+  int64_t line_time;
 
   /* copy of deinterlaced framebuffer from texture memory */
   uint8_t framebuffer[PVR_FRAMEBUFFER_SIZE];
@@ -28,6 +33,9 @@ struct pvr {
   /* tracks if a STARTRENDER was received for the current frame */
   int got_startrender;
 
+  /* set when palette ram is written, polled by the texture cache */
+  int palette_dirty;
+
 #define PVR_REG(offset, name, default, type) type *name;
 #include "guest/pvr/pvr_regs.inc"
 #undef PVR_REG
@@ -45,9 +53,17 @@ void pvr_reg_write(struct pvr *pvr, uint32_t addr, uint32_t data,
 uint32_t pvr_vram64_read(struct pvr *pvr, uint32_t addr, uint32_t mask);
 void pvr_vram64_write(struct pvr *pvr, uint32_t addr, uint32_t data,
                       uint32_t mask);
+void pvr_vram64_read_string(struct pvr *pvr, uint8_t *dst, uint32_t addr,
+                            int size);
+void pvr_vram64_write_string(struct pvr *pvr, uint32_t addr,
+                             const uint8_t *src, int size);
 
 uint32_t pvr_vram32_read(struct pvr *pvr, uint32_t addr, uint32_t mask);
 void pvr_vram32_write(struct pvr *pvr, uint32_t addr, uint32_t data,
                       uint32_t mask);
+void pvr_vram32_read_string(struct pvr *pvr, uint8_t *dst, uint32_t addr,
+                            int size);
+void pvr_vram32_write_string(struct pvr *pvr, uint32_t addr,
+                             const uint8_t *src, int size);
 
 #endif
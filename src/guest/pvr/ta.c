@@ -19,9 +19,11 @@
  */
 
 #include "guest/pvr/ta.h"
+#include "core/constructor.h"
 #include "core/core.h"
 #include "core/exception_handler.h"
 #include "core/filesystem.h"
+#include "core/hash.h"
 #include "core/list.h"
 #include "guest/holly/holly.h"
 #include "guest/memory.h"
@@ -29,6 +31,7 @@
 #include "guest/pvr/tr.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "stats.h"
 
 struct ta {
@@ -386,10 +389,46 @@ static void ta_init_context(struct ta *ta, struct ta_context *ctx) {
 
   ctx->cursor = 0;
   ctx->size = 0;
+  ctx->num_textures = 0;
+  ctx->textures_overflow = 0;
+  memset(ctx->texture_set, 0, sizeof(ctx->texture_set));
   ctx->list_type = TA_NUM_LISTS;
   ctx->vert_type = TA_NUM_VERTS;
 }
 
+static void ta_add_texture(struct ta_context *ctx, union tsp tsp,
+                           union tcw tcw) {
+  if (ctx->textures_overflow) {
+    return;
+  }
+
+  tr_texture_key_t key = tr_texture_key(tsp, tcw);
+  uint32_t mask = ARRAY_SIZE(ctx->texture_set) - 1;
+  uint32_t i = (uint32_t)hash_key(key, HASH_BITS(ctx->texture_set));
+
+  /* most global params reuse a texture seen earlier in the frame, so lookups
+     typically hit on the first probe */
+  while (ctx->texture_set[i]) {
+    struct ta_texture_ref *ref = &ctx->textures[ctx->texture_set[i] - 1];
+
+    if (ref->tsp.full == tsp.full && ref->tcw.full == tcw.full) {
+      return;
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  if (ctx->num_textures == ARRAY_SIZE(ctx->textures)) {
+    ctx->textures_overflow = 1;
+    return;
+  }
+
+  struct ta_texture_ref *ref = &ctx->textures[ctx->num_textures++];
+  ref->tsp = tsp;
+  ref->tcw = tcw;
+  ctx->texture_set[i] = ctx->num_textures;
+}
+
 static void ta_write_context(struct ta *ta, struct ta_context *ctx,
                              const void *ptr, int size) {
   struct holly *hl = ta->dc->holly;
@@ -399,16 +438,16 @@ static void ta_write_context(struct ta *ta, struct ta_context *ctx,
   ctx->size += size;
 
   /* each TA command is either 32 or 64 bytes, with the pcw being in the first
-     32 bytes always. check every 32 bytes to see if the command has been
-     completely received or not */
-  if (ctx->size % 32 == 0) {
+     32 bytes always. rather than checking after every 32 bytes, parse each
+     command completely received once the entire burst has been copied in */
+  while (ctx->cursor < ctx->size) {
     void *param = &ctx->params[ctx->cursor];
     union pcw pcw = *(union pcw *)param;
 
-    int size = ta_param_size(pcw, ctx->vert_type);
+    int param_size = ta_param_size(pcw, ctx->vert_type);
     int recv = ctx->size - ctx->cursor;
 
-    if (recv < size) {
+    if (recv < param_size) {
       /* wait for the entire command */
       return;
     }
@@ -438,9 +477,17 @@ static void ta_write_context(struct ta *ta, struct ta_context *ctx,
 
       /* global params */
       case TA_PARAM_POLY_OR_VOL:
-      case TA_PARAM_SPRITE:
+      case TA_PARAM_SPRITE: {
+        const union poly_param *poly = param;
+
         ctx->vert_type = ta_vert_type(pcw);
-        break;
+
+        /* collect the textures used while the params are already being
+           decoded, saving the client a second pass over the stream */
+        if (pcw.texture) {
+          ta_add_texture(ctx, poly->type0.tsp, poly->type0.tcw);
+        }
+      } break;
 
       /* vertex params */
       case TA_PARAM_VERTEX:
@@ -451,7 +498,7 @@ static void ta_write_context(struct ta *ta, struct ta_context *ctx,
         break;
     }
 
-    ctx->cursor += recv;
+    ctx->cursor += param_size;
   }
 }
 
@@ -658,6 +705,10 @@ static void ta_yuv_process_macroblock(struct ta *ta, const void *data) {
       (pvr->TA_YUV_TEX_CNT->num / (pvr->TA_YUV_TEX_CTRL->u_size + 1)) * 16;
   uint8_t *out = &ta->yuv_data[(out_y * ta->yuv_width + out_x) << 1];
 
+  /* the reencoded macroblock spans 16 lines of the output texture */
+  mem_vram_dirty(ta->dc->mem, (uint32_t)(out - ta->vram),
+                 (15 * ta->yuv_width + 16) << 1);
+
   /* process each 8x8 subblock individually */
   /* (0, 0) */
   ta_yuv_process_block(ta, &in[0], &in[128], &out[0]);
@@ -682,6 +733,106 @@ static void ta_yuv_process_macroblock(struct ta *ta, const void *data) {
 /*
  * ta device interface
  */
+/* pvr state latched into the context when it's rendered */
+#define TA_CONTEXT_STATE_BEGIN offsetof(struct ta_context, autosort)
+#define TA_CONTEXT_STATE_SIZE \
+  (offsetof(struct ta_context, params) - TA_CONTEXT_STATE_BEGIN)
+
+static void ta_load_context(struct ta *ta, struct snapshot *ss,
+                            struct ta_context *ctx) {
+  SNAPSHOT_READ(ss, ctx->addr);
+  SNAPSHOT_READ(ss, ctx->rendering);
+  snapshot_read(ss, (uint8_t *)ctx + TA_CONTEXT_STATE_BEGIN,
+                TA_CONTEXT_STATE_SIZE);
+
+  SNAPSHOT_READ(ss, ctx->cursor);
+  SNAPSHOT_READ(ss, ctx->size);
+  CHECK_LE(ctx->size, (int)sizeof(ctx->params));
+  snapshot_read(ss, ctx->params, ctx->size);
+
+  SNAPSHOT_READ(ss, ctx->num_textures);
+  SNAPSHOT_READ(ss, ctx->textures_overflow);
+  CHECK_LE(ctx->num_textures, ARRAY_SIZE(ctx->textures));
+  snapshot_read(ss, ctx->textures,
+                ctx->num_textures * (int)sizeof(ctx->textures[0]));
+  SNAPSHOT_READ(ss, ctx->texture_set);
+
+  SNAPSHOT_READ(ss, ctx->list_type);
+  SNAPSHOT_READ(ss, ctx->vert_type);
+
+  /* only used by the pending ta_render_context_end timer */
+  ctx->userdata = ta;
+}
+
+static void ta_save_context(struct snapshot *ss, struct ta_context *ctx) {
+  SNAPSHOT_WRITE(ss, ctx->addr);
+  SNAPSHOT_WRITE(ss, ctx->rendering);
+  snapshot_write(ss, (uint8_t *)ctx + TA_CONTEXT_STATE_BEGIN,
+                 TA_CONTEXT_STATE_SIZE);
+
+  /* only the used portion of the param buffer is saved */
+  SNAPSHOT_WRITE(ss, ctx->cursor);
+  SNAPSHOT_WRITE(ss, ctx->size);
+  snapshot_write(ss, ctx->params, ctx->size);
+
+  SNAPSHOT_WRITE(ss, ctx->num_textures);
+  SNAPSHOT_WRITE(ss, ctx->textures_overflow);
+  snapshot_write(ss, ctx->textures,
+                 ctx->num_textures * (int)sizeof(ctx->textures[0]));
+  SNAPSHOT_WRITE(ss, ctx->texture_set);
+
+  SNAPSHOT_WRITE(ss, ctx->list_type);
+  SNAPSHOT_WRITE(ss, ctx->vert_type);
+}
+
+static void ta_load(struct device *dev, struct snapshot *ss) {
+  struct ta *ta = (struct ta *)dev;
+  int32_t yuv_offset, curr_context;
+
+  SNAPSHOT_READ(ss, yuv_offset);
+  ta->yuv_data = yuv_offset < 0 ? NULL : &ta->vram[yuv_offset];
+  SNAPSHOT_READ(ss, ta->yuv_width);
+  SNAPSHOT_READ(ss, ta->yuv_height);
+  SNAPSHOT_READ(ss, ta->yuv_macroblock_size);
+  SNAPSHOT_READ(ss, ta->yuv_macroblock_count);
+
+  SNAPSHOT_READ(ss, ta->num_contexts);
+  CHECK_LE(ta->num_contexts, ARRAY_SIZE(ta->contexts));
+
+  for (int i = 0; i < ta->num_contexts; i++) {
+    ta_load_context(ta, ss, &ta->contexts[i]);
+  }
+
+  /* contexts past the restored ones are reinitialized once demanded */
+  for (int i = ta->num_contexts; i < ARRAY_SIZE(ta->contexts); i++) {
+    ta->contexts[i].rendering = 0;
+  }
+
+  SNAPSHOT_READ(ss, curr_context);
+  ta->curr_context = curr_context < 0 ? NULL : &ta->contexts[curr_context];
+}
+
+static void ta_save(struct device *dev, struct snapshot *ss) {
+  struct ta *ta = (struct ta *)dev;
+  int32_t yuv_offset = ta->yuv_data ? (int32_t)(ta->yuv_data - ta->vram) : -1;
+  int32_t curr_context =
+      ta->curr_context ? (int32_t)(ta->curr_context - ta->contexts) : -1;
+
+  SNAPSHOT_WRITE(ss, yuv_offset);
+  SNAPSHOT_WRITE(ss, ta->yuv_width);
+  SNAPSHOT_WRITE(ss, ta->yuv_height);
+  SNAPSHOT_WRITE(ss, ta->yuv_macroblock_size);
+  SNAPSHOT_WRITE(ss, ta->yuv_macroblock_count);
+
+  SNAPSHOT_WRITE(ss, ta->num_contexts);
+
+  for (int i = 0; i < ta->num_contexts; i++) {
+    ta_save_context(ss, &ta->contexts[i]);
+  }
+
+  SNAPSHOT_WRITE(ss, curr_context);
+}
+
 static int ta_init(struct device *dev) {
   struct ta *ta = (struct ta *)dev;
   struct dreamcast *dc = ta->dc;
@@ -732,6 +883,12 @@ void ta_init_tables() {
   }
 }
 
+/* build the tables up front, rather than racing to lazily build them from
+   multiple emulator instances */
+CONSTRUCTOR(ta_tables_init) {
+  ta_init_tables();
+}
+
 /* ta data handlers
  *
  * three types of data are written to the ta:
@@ -747,6 +904,7 @@ void ta_texture_write(struct ta *ta, uint32_t dst, const uint8_t *src,
 
   dst &= 0xeeffffff;
   memcpy(&ta->vram[dst], src, size);
+  mem_vram_dirty(ta->dc->mem, dst, size);
 }
 
 void ta_yuv_write(struct ta *ta, uint32_t dst, const uint8_t *src, int size) {
@@ -768,11 +926,7 @@ void ta_poly_write(struct ta *ta, uint32_t dst, const uint8_t *src, int size) {
   CHECK(*hl->SB_LMMODE0 == 0);
   CHECK(size % 32 == 0);
 
-  const uint8_t *end = src + size;
-  while (src < end) {
-    ta_write_context(ta, ta->curr_context, src, 32);
-    src += 32;
-  }
+  ta_write_context(ta, ta->curr_context, src, size);
 }
 
 void ta_texture_info(struct ta *ta, union tsp tsp, union tcw tcw,
@@ -828,5 +982,10 @@ struct ta *ta_create(struct dreamcast *dc) {
 
   struct ta *ta = dc_create_device(dc, sizeof(struct ta), "ta", &ta_init, NULL);
 
+  /* setup state interface */
+  ta->stateif.enabled = 1;
+  ta->stateif.save = &ta_save;
+  ta->stateif.load = &ta_load;
+
   return ta;
 }
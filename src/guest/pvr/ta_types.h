@@ -5,6 +5,7 @@
 #include "core/list.h"
 
 #define TA_MAX_PARAMS 0x10000
+#define TA_MAX_TEXTURES 0x1000
 
 /* worst case background vertex size, see ISP_BACKGND_T field */
 #define TA_BG_VERTEX_SIZE ((0b111 * 2 + 3) * 4 * 3)
@@ -416,6 +417,11 @@ union vert_param {
   } sprite1;
 };
 
+struct ta_texture_ref {
+  union tsp tsp;
+  union tcw tcw;
+};
+
 struct ta_context {
   uint32_t addr;
   void *userdata;
@@ -439,6 +445,16 @@ struct ta_context {
   int cursor;
   int size;
 
+  /* unique textures referenced by the param buffer's global params, in order
+     of first use. texture_set is an open-addressed hash set of indices + 1
+     into textures, sized to never be more than half full. if more unique
+     textures are referenced than fit, textures_overflow is set and the
+     params need to be walked to find them all */
+  struct ta_texture_ref textures[TA_MAX_TEXTURES];
+  int num_textures;
+  int textures_overflow;
+  uint16_t texture_set[TA_MAX_TEXTURES * 2];
+
   /* current global state */
   int list_type;
   int vert_type;
@@ -1,4 +1,5 @@
 #include "guest/pvr/tex.h"
+#include "core/constructor.h"
 #include "core/core.h"
 #include "render/render_backend.h"
 
@@ -325,6 +326,10 @@ void pvr_init_twiddle_table() {
   }
 }
 
+CONSTRUCTOR(pvr_twiddle_table_init) {
+  pvr_init_twiddle_table();
+}
+
 static int pvr_twiddle_pos(int x, int y) {
   return (twitbl[x] << 1) | twitbl[y];
 }
@@ -8,15 +8,23 @@
 #include "guest/pvr/tr.h"
 #include "core/core.h"
 #include "core/sort.h"
+#include "core/thread.h"
 #include "guest/pvr/ta.h"
 #include "guest/pvr/tex.h"
 
-struct tr {
-  struct render_backend *r;
-  void *userdata;
-  tr_find_texture_cb find_texture;
+/* the param stream is split into at most one chunk per thread, and only when
+   each chunk is large enough to be worth waking the workers for */
+#define TR_MAX_WORKERS 7
+#define TR_MIN_CHUNK_SIZE (16 * 1024)
+
+/* key used to sort a surface by its minimum depth */
+struct tr_sort_key {
+  float minz;
+  int surf;
+};
 
-  /* current global state */
+/* global state tracked while parsing the param stream */
+struct tr_state {
   const union vert_param *last_vertex;
   int list_type;
   int vert_type;
@@ -26,6 +34,68 @@ struct tr {
   /* sprite params */
   uint8_t sprite_color[4];
   uint8_t sprite_offset_color[4];
+
+  /* set if a surface had to be copied from one committed by a previous chunk */
+  int missing_prev;
+};
+
+/* run of params converted independently from the rest of the stream. chunks
+   always start at a global param or end of list, so no surface straddles two
+   chunks */
+struct tr_chunk {
+  const uint8_t *begin;
+  const uint8_t *end;
+  int first_param;
+
+  /* global state before the chunk's first param */
+  struct tr_state start;
+
+  /* the first chunk is converted directly to the output context, the others
+     to scratch contexts which are appended to it in order afterwards */
+  struct tr_context *rc;
+  int missing_prev;
+};
+
+typedef void (*tr_task_cb)(struct tr *, int);
+
+struct tr {
+  struct render_backend *r;
+  void *userdata;
+  tr_find_texture_cb find_texture;
+
+  /* context currently being converted */
+  const struct ta_context *ctx;
+  struct tr_context *rc;
+
+  /* texture for each global param, converted up front on the calling thread
+     as the render backend may only be used from it */
+  texture_handle_t textures[TA_MAX_PARAMS];
+
+  struct tr_chunk chunks[TR_MAX_WORKERS + 1];
+  int num_chunks;
+  struct tr_context *scratch[TR_MAX_WORKERS];
+
+  /* offset of each list's indices in the output context */
+  int first_index[TA_NUM_LISTS];
+
+  /* worker threads, each pulling tasks until none are left */
+  int num_workers;
+  thread_t workers[TR_MAX_WORKERS];
+  mutex_t task_mutex;
+  cond_t task_cond;
+  cond_t done_cond;
+  int shutdown;
+  tr_task_cb task_fn;
+  int num_tasks;
+  int next_task;
+  int num_done;
+
+  /* scratch buffers, kept per instance so multiple contexts can be converted
+     at once. the translucent and punch-through lists are sorted in parallel,
+     so each has its own keys */
+  struct tr_sort_key sort_keys[2][TR_MAX_SURFS];
+  struct tr_sort_key sort_tmp[2][TR_MAX_SURFS];
+  uint8_t converted[1024 * 1024 * 4];
 };
 
 static int compressed_mipmap_offsets[] = {
@@ -130,7 +200,7 @@ static texture_handle_t tr_convert_texture(struct tr *tr,
     entry->handle = 0;
   }
 
-  static uint8_t converted[1024 * 1024 * 4];
+  uint8_t *converted = tr->converted;
   const uint8_t *palette = entry->palette;
   const uint8_t *texture = entry->texture;
 
@@ -143,7 +213,7 @@ static texture_handle_t tr_convert_texture(struct tr *tr,
 
   /* figure out the texture format */
   pvr_tex_decode(texture, width, height, stride, texture_fmt, tcw.pixel_fmt,
-                 palette, ctx->palette_fmt, converted, sizeof(converted));
+                 palette, ctx->palette_fmt, converted, sizeof(tr->converted));
 
   /* ignore trilinear filtering for now */
   enum filter_mode filter =
@@ -168,15 +238,20 @@ static texture_handle_t tr_convert_texture(struct tr *tr,
   return entry->handle;
 }
 
-static struct ta_surface *tr_reserve_surf(struct tr *tr, struct tr_context *rc,
+static struct ta_surface *tr_reserve_surf(struct tr_state *st,
+                                          struct tr_context *rc,
                                           int copy_from_prev) {
   int surf_index = rc->num_surfs;
 
   CHECK_LT(surf_index, ARRAY_SIZE(rc->surfs));
   struct ta_surface *surf = &rc->surfs[surf_index];
 
-  if (copy_from_prev) {
-    CHECK(rc->num_surfs);
+  if (copy_from_prev && !rc->num_surfs) {
+    /* the previous surface belongs to an earlier chunk, flag the chunk so it's
+       converted again once the earlier chunks have been appended */
+    st->missing_prev = 1;
+    memset(surf, 0, sizeof(*surf));
+  } else if (copy_from_prev) {
     *surf = rc->surfs[rc->num_surfs - 1];
   } else {
     memset(surf, 0, sizeof(*surf));
@@ -188,7 +263,8 @@ static struct ta_surface *tr_reserve_surf(struct tr *tr, struct tr_context *rc,
   return surf;
 }
 
-static struct ta_vertex *tr_reserve_vert(struct tr *tr, struct tr_context *rc) {
+static struct ta_vertex *tr_reserve_vert(struct tr_state *st,
+                                         struct tr_context *rc) {
   struct ta_surface *curr_surf = &rc->surfs[rc->num_surfs];
 
   int vert_index = rc->num_verts + curr_surf->num_verts;
@@ -202,16 +278,16 @@ static struct ta_vertex *tr_reserve_vert(struct tr *tr, struct tr_context *rc) {
   return vert;
 }
 
-static void tr_commit_surf(struct tr *tr, struct tr_context *rc) {
-  struct tr_list *list = &rc->lists[tr->list_type];
+static void tr_commit_surf(struct tr_state *st, struct tr_context *rc) {
+  struct tr_list *list = &rc->lists[st->list_type];
   struct ta_surface *new_surf = &rc->surfs[rc->num_surfs];
 
   /* track original number of surfaces, before sorting, merging, etc. */
   list->num_orig_surfs++;
 
   /* for translucent lists, commit a surf for each tri to make sorting easier */
-  if (tr->list_type == TA_LIST_TRANSLUCENT ||
-      tr->list_type == TA_LIST_PUNCH_THROUGH) {
+  if (st->list_type == TA_LIST_TRANSLUCENT ||
+      st->list_type == TA_LIST_PUNCH_THROUGH) {
     /* ignore the last two verts as polygons are fed to the TA as tristrips */
     int num_verts = new_surf->num_verts;
 
@@ -220,7 +296,7 @@ static void tr_commit_surf(struct tr *tr, struct tr_context *rc) {
       if (i == 0) {
         surf = new_surf;
       } else {
-        surf = tr_reserve_surf(tr, rc, 1);
+        surf = tr_reserve_surf(st, rc, 1);
       }
 
       /* track triangle strip offset so winding order can be consistent when
@@ -315,10 +391,10 @@ static inline uint8_t fmulu8(uint8_t a, uint8_t b) {
   }
 
 #define PARSE_BASE_INTENSITY(base_intensity, out) \
-  PARSE_INTENSITY(tr->face_color, base_intensity, out)
+  PARSE_INTENSITY(st->face_color, base_intensity, out)
 
 #define PARSE_OFFSET_INTENSITY(offset_intensity, out) \
-  PARSE_INTENSITY(tr->face_offset_color, offset_intensity, out)
+  PARSE_INTENSITY(st->face_offset_color, offset_intensity, out)
 
 static int tr_parse_bg_vert(const struct ta_context *ctx, struct tr_context *rc,
                             int offset, struct ta_vertex *v) {
@@ -344,12 +420,12 @@ static int tr_parse_bg_vert(const struct ta_context *ctx, struct tr_context *rc,
   return offset;
 }
 
-static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
-                        struct tr_context *rc) {
-  tr->list_type = TA_LIST_OPAQUE;
+static void tr_parse_bg(struct tr *tr, struct tr_state *st,
+                        const struct ta_context *ctx, struct tr_context *rc) {
+  st->list_type = TA_LIST_OPAQUE;
 
   /* translate the surface */
-  struct ta_surface *surf = tr_reserve_surf(tr, rc, 0);
+  struct ta_surface *surf = tr_reserve_surf(st, rc, 0);
 
   surf->params.texture =
       ctx->bg_isp.texture
@@ -363,10 +439,10 @@ static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
   surf->params.dst_blend = BLEND_NONE;
 
   /* translate the first 3 vertices */
-  struct ta_vertex *va = tr_reserve_vert(tr, rc);
-  struct ta_vertex *vb = tr_reserve_vert(tr, rc);
-  struct ta_vertex *vd = tr_reserve_vert(tr, rc);
-  struct ta_vertex *vc = tr_reserve_vert(tr, rc);
+  struct ta_vertex *va = tr_reserve_vert(st, rc);
+  struct ta_vertex *vb = tr_reserve_vert(st, rc);
+  struct ta_vertex *vd = tr_reserve_vert(st, rc);
+  struct ta_vertex *vc = tr_reserve_vert(st, rc);
 
   int offset = 0;
   offset = tr_parse_bg_vert(ctx, rc, offset, va);
@@ -437,26 +513,22 @@ static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
   vd->color = va->color;
   vd->offset_color = va->offset_color;
 
-  tr_commit_surf(tr, rc);
+  tr_commit_surf(st, rc);
 
-  tr->list_type = TA_NUM_LISTS;
+  st->list_type = TA_NUM_LISTS;
 }
 
-/* this offset color implementation is not correct at all, see the
-   Texture/Shading Instruction in the union tsp instruction word */
-static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
-                                struct tr_context *rc, const uint8_t *data) {
-  const union poly_param *param = (const union poly_param *)data;
-
+static int tr_parse_poly_state(struct tr_state *st,
+                               const union poly_param *param) {
   /* reset state */
-  tr->last_vertex = NULL;
-  tr->vert_type = ta_vert_type(param->type0.pcw);
+  st->last_vertex = NULL;
+  st->vert_type = ta_vert_type(param->type0.pcw);
 
   int poly_type = ta_poly_type(param->type0.pcw);
 
   if (poly_type == 6) {
     /* FIXME handle modifier volumes */
-    return;
+    return poly_type;
   }
 
   switch (poly_type) {
@@ -466,17 +538,17 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
     } break;
 
     case 1: {
-      PARSE_FLOAT_COLOR(param->type1.face_color, &tr->face_color);
+      PARSE_FLOAT_COLOR(param->type1.face_color, &st->face_color);
     } break;
 
     case 2: {
-      PARSE_FLOAT_COLOR(param->type2.face_color, &tr->face_color);
-      PARSE_FLOAT_COLOR(param->type2.face_offset_color, &tr->face_offset_color);
+      PARSE_FLOAT_COLOR(param->type2.face_color, &st->face_color);
+      PARSE_FLOAT_COLOR(param->type2.face_offset_color, &st->face_offset_color);
     } break;
 
     case 5: {
-      PARSE_PACKED_COLOR(param->sprite.base_color, &tr->sprite_color);
-      PARSE_PACKED_COLOR(param->sprite.offset_color, &tr->sprite_offset_color);
+      PARSE_PACKED_COLOR(param->sprite.base_color, &st->sprite_color);
+      PARSE_PACKED_COLOR(param->sprite.offset_color, &st->sprite_offset_color);
     } break;
 
     default:
@@ -484,12 +556,29 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
       break;
   }
 
+  return poly_type;
+}
+
+/* this offset color implementation is not correct at all, see the
+   Texture/Shading Instruction in the union tsp instruction word */
+static void tr_parse_poly_param(struct tr_state *st,
+                                const struct ta_context *ctx,
+                                struct tr_context *rc, const uint8_t *data,
+                                texture_handle_t texture) {
+  const union poly_param *param = (const union poly_param *)data;
+
+  int poly_type = tr_parse_poly_state(st, param);
+
+  if (poly_type == 6) {
+    return;
+  }
+
   /* setup the new surface
 
      note, bits 0-3 of the global pcw override the respective bits in the global
      isp/tsp instruction word, so use the pcw for the uv_16bit, gouraud, offset,
      and texture settings */
-  struct ta_surface *surf = tr_reserve_surf(tr, rc, 0);
+  struct ta_surface *surf = tr_reserve_surf(st, rc, 0);
   surf->params.depth_write = !param->type0.isp.z_write_disable;
   surf->params.depth_func =
       translate_depth_func(param->type0.isp.depth_compare_mode);
@@ -503,33 +592,31 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
   surf->params.ignore_alpha = !param->type0.tsp.use_alpha;
   surf->params.ignore_texture_alpha = param->type0.tsp.ignore_tex_alpha;
   surf->params.offset_color = param->type0.pcw.offset;
-  surf->params.alpha_test = tr->list_type == TA_LIST_PUNCH_THROUGH;
+  surf->params.alpha_test = st->list_type == TA_LIST_PUNCH_THROUGH;
   surf->params.alpha_ref = ctx->alpha_ref;
 
   /* override a few surface parameters based on the list type */
-  if (tr->list_type != TA_LIST_TRANSLUCENT &&
-      tr->list_type != TA_LIST_TRANSLUCENT_MODVOL) {
+  if (st->list_type != TA_LIST_TRANSLUCENT &&
+      st->list_type != TA_LIST_TRANSLUCENT_MODVOL) {
     surf->params.src_blend = BLEND_NONE;
     surf->params.dst_blend = BLEND_NONE;
-  } else if ((tr->list_type == TA_LIST_TRANSLUCENT ||
-              tr->list_type == TA_LIST_TRANSLUCENT_MODVOL) &&
+  } else if ((st->list_type == TA_LIST_TRANSLUCENT ||
+              st->list_type == TA_LIST_TRANSLUCENT_MODVOL) &&
              ctx->autosort) {
     surf->params.depth_func = DEPTH_LEQUAL;
-  } else if (tr->list_type == TA_LIST_PUNCH_THROUGH) {
+  } else if (st->list_type == TA_LIST_PUNCH_THROUGH) {
     surf->params.depth_func = DEPTH_GEQUAL;
   }
 
-  surf->params.texture =
-      param->type0.pcw.texture
-          ? tr_convert_texture(tr, ctx, param->type0.tsp, param->type0.tcw)
-          : 0;
+  surf->params.texture = texture;
 }
 
-static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
+static void tr_parse_vert_param(struct tr_state *st,
+                                const struct ta_context *ctx,
                                 struct tr_context *rc, const uint8_t *data) {
   const union vert_param *param = (const union vert_param *)data;
 
-  if (tr->vert_type == 17) {
+  if (st->vert_type == 17) {
     /* FIXME handle modifier volumes */
     return;
   }
@@ -537,32 +624,32 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
   /* if there is no need to change the Global Parameters, a Vertex Parameter
      for the next polygon may be input immediately after inputting a Vertex
      Parameter for which "End of Strip" was specified */
-  if (tr->last_vertex && tr->last_vertex->type0.pcw.end_of_strip) {
-    tr_reserve_surf(tr, rc, 1);
+  if (st->last_vertex && st->last_vertex->type0.pcw.end_of_strip) {
+    tr_reserve_surf(st, rc, 1);
   }
-  tr->last_vertex = param;
+  st->last_vertex = param;
 
-  switch (tr->vert_type) {
+  switch (st->vert_type) {
     case 0: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type0.xyz, vert->xyz);
       PARSE_PACKED_COLOR(param->type0.base_color, &vert->color);
     } break;
 
     case 1: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type1.xyz, vert->xyz);
       PARSE_FLOAT_COLOR(param->type1.base_color, &vert->color);
     } break;
 
     case 2: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type2.xyz, vert->xyz);
       PARSE_BASE_INTENSITY(param->type2.base_intensity, &vert->color);
     } break;
 
     case 3: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type3.xyz, vert->xyz);
       PARSE_UV(param->type3.uv, vert->uv);
       PARSE_PACKED_COLOR(param->type3.base_color, &vert->color);
@@ -570,7 +657,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
     } break;
 
     case 4: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type4.xyz, vert->xyz);
       PARSE_UV16(param->type4.uv, vert->uv);
       PARSE_PACKED_COLOR(param->type4.base_color, &vert->color);
@@ -578,7 +665,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
     } break;
 
     case 5: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type5.xyz, vert->xyz);
       PARSE_UV(param->type5.uv, vert->uv);
       PARSE_FLOAT_COLOR(param->type5.base_color, &vert->color);
@@ -586,7 +673,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
     } break;
 
     case 6: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type6.xyz, vert->xyz);
       PARSE_UV16(param->type6.uv, vert->uv);
       PARSE_FLOAT_COLOR(param->type6.base_color, &vert->color);
@@ -594,7 +681,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
     } break;
 
     case 7: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type7.xyz, vert->xyz);
       PARSE_UV(param->type7.uv, vert->uv);
       PARSE_BASE_INTENSITY(param->type7.base_intensity, &vert->color);
@@ -603,7 +690,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
     } break;
 
     case 8: {
-      struct ta_vertex *vert = tr_reserve_vert(tr, rc);
+      struct ta_vertex *vert = tr_reserve_vert(st, rc);
       PARSE_XYZ(param->type8.xyz, vert->xyz);
       PARSE_UV16(param->type8.uv, vert->uv);
       PARSE_BASE_INTENSITY(param->type8.base_intensity, &vert->color);
@@ -629,30 +716,30 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
        * these need to be calculated, and the quad needs to be converted into a
        * tristrip to match the rest of the ta input
        */
-      struct ta_vertex *va = tr_reserve_vert(tr, rc); /* bottom left */
-      struct ta_vertex *vb = tr_reserve_vert(tr, rc); /* top left */
-      struct ta_vertex *vd = tr_reserve_vert(tr, rc); /* bottom right */
-      struct ta_vertex *vc = tr_reserve_vert(tr, rc); /* top right */
+      struct ta_vertex *va = tr_reserve_vert(st, rc); /* bottom left */
+      struct ta_vertex *vb = tr_reserve_vert(st, rc); /* top left */
+      struct ta_vertex *vd = tr_reserve_vert(st, rc); /* bottom right */
+      struct ta_vertex *vc = tr_reserve_vert(st, rc); /* top right */
 
       PARSE_XYZ(param->sprite1.xyz[0], va->xyz);
       PARSE_UV16(param->sprite1.uv[0], va->uv);
-      va->color = *(uint32_t *)&tr->sprite_color;
-      va->offset_color = *(uint32_t *)&tr->sprite_offset_color;
+      va->color = *(uint32_t *)&st->sprite_color;
+      va->offset_color = *(uint32_t *)&st->sprite_offset_color;
 
       PARSE_XYZ(param->sprite1.xyz[1], vb->xyz);
       PARSE_UV16(param->sprite1.uv[1], vb->uv);
-      vb->color = *(uint32_t *)&tr->sprite_color;
-      vb->offset_color = *(uint32_t *)&tr->sprite_offset_color;
+      vb->color = *(uint32_t *)&st->sprite_color;
+      vb->offset_color = *(uint32_t *)&st->sprite_offset_color;
 
       PARSE_XYZ(param->sprite1.xyz[2], vc->xyz);
       PARSE_UV16(param->sprite1.uv[2], vc->uv);
-      vc->color = *(uint32_t *)&tr->sprite_color;
-      vc->offset_color = *(uint32_t *)&tr->sprite_offset_color;
+      vc->color = *(uint32_t *)&st->sprite_color;
+      vc->offset_color = *(uint32_t *)&st->sprite_offset_color;
 
       vd->xyz[0] = param->sprite1.xyz[3][0];
       vd->xyz[1] = param->sprite1.xyz[3][1];
-      vd->color = *(uint32_t *)&tr->sprite_color;
-      vd->offset_color = *(uint32_t *)&tr->sprite_offset_color;
+      vd->color = *(uint32_t *)&st->sprite_color;
+      vd->offset_color = *(uint32_t *)&st->sprite_offset_color;
 
       /* calculate the sprite's plane from the three complete vertices */
       float xyz_ba[3], xyz_bc[3];
@@ -690,7 +777,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
     } break;
 
     default:
-      LOG_FATAL("unsupported vertex type %d", tr->vert_type);
+      LOG_FATAL("unsupported vertex type %d", st->vert_type);
       break;
   }
 
@@ -700,15 +787,15 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
      Parameters were input, the polygon data in question is ignored and
      an interrupt signal is output */
   if (param->type0.pcw.end_of_strip) {
-    tr_commit_surf(tr, rc);
+    tr_commit_surf(st, rc);
   }
 }
 
-static void tr_parse_eol(struct tr *tr, const struct ta_context *ctx,
+static void tr_parse_eol(struct tr_state *st, const struct ta_context *ctx,
                          struct tr_context *rc, const uint8_t *data) {
-  tr->last_vertex = NULL;
-  tr->list_type = TA_NUM_LISTS;
-  tr->vert_type = TA_NUM_VERTS;
+  st->last_vertex = NULL;
+  st->list_type = TA_NUM_LISTS;
+  st->vert_type = TA_NUM_VERTS;
 }
 
 static inline int tr_can_merge_surfs(struct ta_surface *a,
@@ -716,6 +803,18 @@ static inline int tr_can_merge_surfs(struct ta_surface *a,
   return a->params.full == b->params.full;
 }
 
+static int tr_count_indices(struct tr_context *rc, int list_type) {
+  struct tr_list *list = &rc->lists[list_type];
+  int num_indices = 0;
+
+  for (int i = 0; i < list->num_surfs; i++) {
+    struct ta_surface *surf = &rc->surfs[list->surfs[i]];
+    num_indices += MAX(surf->num_verts - 2, 0) * 3;
+  }
+
+  return num_indices;
+}
+
 static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
                                 int list_type) {
   /* polygons are fed to the TA as triangle strips, with the vertices being fed
@@ -732,11 +831,14 @@ static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
      match OpenGL defaults */
   struct tr_list *list = &rc->lists[list_type];
 
+  /* each list writes to its own range of indices, so lists can be processed
+     in parallel */
+  int num_indices = tr->first_index[list_type];
   int num_merged = 0;
 
   for (int i = 0, j = 0; i < list->num_surfs; i = j) {
     struct ta_surface *root = &rc->surfs[list->surfs[i]];
-    int first_index = rc->num_indices;
+    int first_index = num_indices;
 
     /* merge adjacent surfaces at this time */
     for (j = i; j < list->num_surfs; j++) {
@@ -750,29 +852,26 @@ static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
         num_merged++;
       }
 
-      int num_indices = (surf->num_verts - 2) * 3;
-      CHECK_LT(rc->num_indices + num_indices, ARRAY_SIZE(rc->indices));
-
       for (int j = 0; j < surf->num_verts - 2; j++) {
         int strip_offset = surf->strip_offset + j;
         int vertex_offset = surf->first_vert + j;
 
         /* be careful to maintain a CCW winding order */
         if (strip_offset & 1) {
-          rc->indices[rc->num_indices++] = vertex_offset + 0;
-          rc->indices[rc->num_indices++] = vertex_offset + 1;
-          rc->indices[rc->num_indices++] = vertex_offset + 2;
+          rc->indices[num_indices++] = vertex_offset + 0;
+          rc->indices[num_indices++] = vertex_offset + 1;
+          rc->indices[num_indices++] = vertex_offset + 2;
         } else {
-          rc->indices[rc->num_indices++] = vertex_offset + 0;
-          rc->indices[rc->num_indices++] = vertex_offset + 2;
-          rc->indices[rc->num_indices++] = vertex_offset + 1;
+          rc->indices[num_indices++] = vertex_offset + 0;
+          rc->indices[num_indices++] = vertex_offset + 2;
+          rc->indices[num_indices++] = vertex_offset + 1;
         }
       }
     }
 
     /* update to point at triangle indices instead of the raw tristrip verts */
     root->first_vert = first_index;
-    root->num_verts = rc->num_indices - first_index;
+    root->num_verts = num_indices - first_index;
 
     /* shift the list to account for merges */
     list->surfs[j - num_merged - 1] = list->surfs[i];
@@ -781,47 +880,48 @@ static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
   list->num_surfs -= num_merged;
 }
 
-static int sort_tmp[TR_MAX_SURFS];
-static float sort_minz[TR_MAX_SURFS];
-
 static int tr_compare_surf(const void *a, const void *b) {
-  int i = *(const int *)a;
-  int j = *(const int *)b;
-  return sort_minz[i] <= sort_minz[j];
+  const struct tr_sort_key *i = a;
+  const struct tr_sort_key *j = b;
+  return i->minz <= j->minz;
 }
 
 static void tr_sort_surfaces(struct tr *tr, struct tr_context *rc,
                              int list_type) {
   struct tr_list *list = &rc->lists[list_type];
+  int n = list_type == TA_LIST_PUNCH_THROUGH;
+  struct tr_sort_key *keys = tr->sort_keys[n];
+  struct tr_sort_key *tmp = tr->sort_tmp[n];
 
   /* sort each surface from back to front based on its minz */
   for (int i = 0; i < list->num_surfs; i++) {
     int surf_index = list->surfs[i];
     struct ta_surface *surf = &rc->surfs[surf_index];
-    float *minz = &sort_minz[surf_index];
+    struct tr_sort_key *key = &keys[i];
 
     struct ta_vertex *verts = &rc->verts[surf->first_vert];
     CHECK_EQ(surf->num_verts, 3);
 
-    *minz = MIN(verts[0].xyz[2], verts[1].xyz[2]);
-    *minz = MIN(*minz, verts[2].xyz[2]);
+    key->surf = surf_index;
+    key->minz = MIN(verts[0].xyz[2], verts[1].xyz[2]);
+    key->minz = MIN(key->minz, verts[2].xyz[2]);
   }
 
-  msort_noalloc(list->surfs, sort_tmp, list->num_surfs, sizeof(int),
+  msort_noalloc(keys, tmp, list->num_surfs, sizeof(struct tr_sort_key),
                 &tr_compare_surf);
+
+  for (int i = 0; i < list->num_surfs; i++) {
+    list->surfs[i] = keys[i].surf;
+  }
 }
 
-static void tr_reset(struct tr *tr, struct tr_context *rc) {
-  /* reset global state */
-  tr->last_vertex = NULL;
-  tr->list_type = TA_NUM_LISTS;
-  tr->vert_type = TA_NUM_VERTS;
-  memset(tr->face_color, 0, sizeof(tr->face_color));
-  memset(tr->face_offset_color, 0, sizeof(tr->face_offset_color));
-  memset(tr->sprite_color, 0, sizeof(tr->sprite_color));
-  memset(tr->sprite_offset_color, 0, sizeof(tr->sprite_offset_color));
+static void tr_reset_state(struct tr_state *st) {
+  memset(st, 0, sizeof(*st));
+  st->list_type = TA_NUM_LISTS;
+  st->vert_type = TA_NUM_VERTS;
+}
 
-  /* reset render context state */
+static void tr_reset_context(struct tr_context *rc) {
   rc->num_params = 0;
   rc->num_surfs = 0;
   rc->num_verts = 0;
@@ -874,37 +974,162 @@ void tr_render_context(struct render_backend *r, const struct tr_context *rc) {
   tr_render_context_until(r, rc, -1);
 }
 
-void tr_convert_context(struct render_backend *r, void *userdata,
-                        tr_find_texture_cb find_texture,
-                        const struct ta_context *ctx, struct tr_context *rc) {
-  struct tr tr;
-  tr.r = r;
-  tr.userdata = userdata;
-  tr.find_texture = find_texture;
+static void *tr_worker_thread(void *data) {
+  struct tr *tr = data;
 
+  mutex_lock(tr->task_mutex);
+
+  while (!tr->shutdown) {
+    if (tr->next_task >= tr->num_tasks) {
+      cond_wait(tr->task_cond, tr->task_mutex);
+      continue;
+    }
+
+    int i = tr->next_task++;
+
+    mutex_unlock(tr->task_mutex);
+    tr->task_fn(tr, i);
+    mutex_lock(tr->task_mutex);
+
+    if (++tr->num_done == tr->num_tasks) {
+      cond_signal(tr->done_cond);
+    }
+  }
+
+  mutex_unlock(tr->task_mutex);
+
+  return NULL;
+}
+
+static void tr_run_tasks(struct tr *tr, tr_task_cb fn, int num_tasks) {
+  if (!tr->num_workers || num_tasks == 1) {
+    for (int i = 0; i < num_tasks; i++) {
+      fn(tr, i);
+    }
+    return;
+  }
+
+  mutex_lock(tr->task_mutex);
+
+  tr->task_fn = fn;
+  tr->num_tasks = num_tasks;
+  tr->next_task = 0;
+  tr->num_done = 0;
+
+  /* each signal wakes at most one waiting worker */
+  for (int i = 0; i < tr->num_workers; i++) {
+    cond_signal(tr->task_cond);
+  }
+
+  /* help out on the calling thread */
+  while (tr->next_task < tr->num_tasks) {
+    int i = tr->next_task++;
+
+    mutex_unlock(tr->task_mutex);
+    fn(tr, i);
+    mutex_lock(tr->task_mutex);
+
+    tr->num_done++;
+  }
+
+  while (tr->num_done < tr->num_tasks) {
+    cond_wait(tr->done_cond, tr->task_mutex);
+  }
+
+  mutex_unlock(tr->task_mutex);
+}
+
+static void tr_split_params(struct tr *tr, struct tr_state *st,
+                            int max_chunks) {
+  const struct ta_context *ctx = tr->ctx;
   const uint8_t *data = ctx->params;
   const uint8_t *end = ctx->params + ctx->size;
+  int chunk_size = ctx->size / max_chunks;
+  int n = 0;
+
+  struct tr_chunk *chunk = &tr->chunks[0];
+  chunk->begin = data;
+  chunk->first_param = 0;
+  chunk->start = *st;
+  chunk->rc = tr->rc;
+  tr->num_chunks = 1;
+
+  /* walk the global params, tracking the state each chunk starts with and
+     converting their textures in the same order a serial parse would */
+  while (data < end) {
+    union pcw pcw = *(union pcw *)data;
 
-  ta_init_tables();
+    int global = pcw.para_type == TA_PARAM_END_OF_LIST ||
+                 pcw.para_type == TA_PARAM_POLY_OR_VOL ||
+                 pcw.para_type == TA_PARAM_SPRITE;
 
-  tr_reset(&tr, rc);
+    if (global && tr->num_chunks < max_chunks &&
+        (int)(data - chunk->begin) >= chunk_size) {
+      chunk->end = data;
 
-  rc->width = ctx->video_width;
-  rc->height = ctx->video_height;
+      chunk = &tr->chunks[tr->num_chunks];
+      chunk->begin = data;
+      chunk->first_param = n;
+      chunk->start = *st;
+      chunk->rc = tr->scratch[tr->num_chunks - 1];
+      tr->num_chunks++;
+    }
 
-  tr_parse_bg(&tr, ctx, rc);
+    if (ta_pcw_list_type_valid(pcw, st->list_type)) {
+      st->list_type = pcw.list_type;
+    }
 
-  while (data < end) {
+    switch (pcw.para_type) {
+      case TA_PARAM_END_OF_LIST:
+        tr_parse_eol(st, ctx, tr->rc, data);
+        break;
+
+      case TA_PARAM_POLY_OR_VOL:
+      case TA_PARAM_SPRITE: {
+        const union poly_param *param = (const union poly_param *)data;
+        int poly_type = tr_parse_poly_state(st, param);
+
+        tr->textures[n] =
+            poly_type != 6 && param->type0.pcw.texture
+                ? tr_convert_texture(tr, ctx, param->type0.tsp,
+                                     param->type0.tcw)
+                : 0;
+      } break;
+    }
+
+    data += ta_param_size(pcw, st->vert_type);
+    n++;
+  }
+
+  chunk->end = data;
+
+  tr->rc->num_params = n;
+}
+
+static void tr_convert_chunk(struct tr *tr, int i) {
+  const struct ta_context *ctx = tr->ctx;
+  struct tr_chunk *chunk = &tr->chunks[i];
+  struct tr_context *rc = chunk->rc;
+  struct tr_state st = chunk->start;
+
+  const uint8_t *data = chunk->begin;
+  int n = chunk->first_param;
+
+  if (rc != tr->rc) {
+    tr_reset_context(rc);
+  }
+
+  while (data < chunk->end) {
     union pcw pcw = *(union pcw *)data;
 
-    if (ta_pcw_list_type_valid(pcw, tr.list_type)) {
-      tr.list_type = pcw.list_type;
+    if (ta_pcw_list_type_valid(pcw, st.list_type)) {
+      st.list_type = pcw.list_type;
     }
 
     switch (pcw.para_type) {
       /* control params */
       case TA_PARAM_END_OF_LIST:
-        tr_parse_eol(&tr, ctx, rc, data);
+        tr_parse_eol(&st, ctx, rc, data);
         break;
 
       case TA_PARAM_USER_TILE_CLIP:
@@ -917,33 +1142,191 @@ void tr_convert_context(struct render_backend *r, void *userdata,
       /* global params */
       case TA_PARAM_POLY_OR_VOL:
       case TA_PARAM_SPRITE:
-        tr_parse_poly_param(&tr, ctx, rc, data);
+        tr_parse_poly_param(&st, ctx, rc, data, tr->textures[n]);
         break;
 
       /* vertex params */
       case TA_PARAM_VERTEX:
-        tr_parse_vert_param(&tr, ctx, rc, data);
+        tr_parse_vert_param(&st, ctx, rc, data);
         break;
     }
 
-    /* track info about the parse state for tracer debugging */
-    struct tr_param *rp = &rc->params[rc->num_params++];
+    /* track info about the parse state for tracer debugging. for chunks
+       converted to scratch contexts, the surf and vert are rebased once the
+       chunk is appended */
+    struct tr_param *rp = &tr->rc->params[n++];
     rp->offset = (int)(data - ctx->params);
-    rp->list_type = tr.list_type;
-    rp->vert_type = tr.vert_type;
+    rp->list_type = st.list_type;
+    rp->vert_type = st.vert_type;
     rp->last_surf = rc->num_surfs - 1;
     rp->last_vert = rc->num_verts - 1;
 
-    data += ta_param_size(pcw, tr.vert_type);
+    data += ta_param_size(pcw, st.vert_type);
   }
 
+  chunk->missing_prev = st.missing_prev;
+}
+
+static void tr_append_chunk(struct tr *tr, int i) {
+  struct tr_chunk *chunk = &tr->chunks[i];
+  struct tr_context *rc = tr->rc;
+  const struct tr_context *src = chunk->rc;
+  int first_surf = rc->num_surfs;
+  int first_vert = rc->num_verts;
+
+  CHECK_LE(first_surf + src->num_surfs, ARRAY_SIZE(rc->surfs));
+  CHECK_LE(first_vert + src->num_verts, ARRAY_SIZE(rc->verts));
+
+  for (int j = 0; j < src->num_surfs; j++) {
+    struct ta_surface *surf = &rc->surfs[first_surf + j];
+    *surf = src->surfs[j];
+    surf->first_vert += first_vert;
+  }
+
+  memcpy(&rc->verts[first_vert], src->verts,
+         src->num_verts * sizeof(struct ta_vertex));
+
+  for (int j = 0; j < TA_NUM_LISTS; j++) {
+    struct tr_list *list = &rc->lists[j];
+    const struct tr_list *src_list = &src->lists[j];
+
+    for (int k = 0; k < src_list->num_surfs; k++) {
+      list->surfs[list->num_surfs++] = first_surf + src_list->surfs[k];
+    }
+
+    list->num_orig_surfs += src_list->num_orig_surfs;
+  }
+
+  int end_param =
+      i + 1 < tr->num_chunks ? tr->chunks[i + 1].first_param : rc->num_params;
+
+  for (int j = chunk->first_param; j < end_param; j++) {
+    struct tr_param *rp = &rc->params[j];
+    rp->last_surf += first_surf;
+    rp->last_vert += first_vert;
+  }
+
+  rc->num_surfs += src->num_surfs;
+  rc->num_verts += src->num_verts;
+}
+
+static void tr_finish_list(struct tr *tr, int list_type) {
   /* sort surfaces if requested */
-  if (ctx->autosort) {
-    tr_sort_surfaces(&tr, rc, TA_LIST_TRANSLUCENT);
-    tr_sort_surfaces(&tr, rc, TA_LIST_PUNCH_THROUGH);
+  if (tr->ctx->autosort && (list_type == TA_LIST_TRANSLUCENT ||
+                            list_type == TA_LIST_PUNCH_THROUGH)) {
+    tr_sort_surfaces(tr, tr->rc, list_type);
+  }
+
+  tr_generate_indices(tr, tr->rc, list_type);
+}
+
+void tr_convert_context(struct tr *tr, struct render_backend *r,
+                        const struct ta_context *ctx, struct tr_context *rc) {
+  struct tr_state st;
+
+  tr->r = r;
+  tr->ctx = ctx;
+  tr->rc = rc;
+
+  ta_init_tables();
+
+  tr_reset_state(&st);
+  tr_reset_context(rc);
+
+  rc->width = ctx->video_width;
+  rc->height = ctx->video_height;
+
+  tr_parse_bg(tr, &st, ctx, rc);
+
+  /* split the param stream into chunks, converting textures along the way,
+     and convert each chunk in parallel */
+  int max_chunks = MIN(tr->num_workers + 1, ctx->size / TR_MIN_CHUNK_SIZE);
+  tr_split_params(tr, &st, MAX(max_chunks, 1));
+
+  tr_run_tasks(tr, &tr_convert_chunk, tr->num_chunks);
+
+  /* stitch the chunks together in order. if a chunk depended on a surface
+     from an earlier chunk, convert it again now that the surface is in
+     place */
+  for (int i = 1; i < tr->num_chunks; i++) {
+    struct tr_chunk *chunk = &tr->chunks[i];
+
+    if (chunk->missing_prev) {
+      chunk->rc = rc;
+      tr_convert_chunk(tr, i);
+    } else {
+      tr_append_chunk(tr, i);
+    }
   }
 
+  /* lay out each list's indices ahead of time, so lists can be sorted and
+     have their indices generated in parallel */
+  int num_indices = 0;
+
   for (int i = 0; i < TA_NUM_LISTS; i++) {
-    tr_generate_indices(&tr, rc, i);
+    tr->first_index[i] = num_indices;
+    num_indices += tr_count_indices(rc, i);
+  }
+
+  CHECK_LT(num_indices, ARRAY_SIZE(rc->indices));
+
+  if (tr->num_chunks > 1) {
+    tr_run_tasks(tr, &tr_finish_list, TA_NUM_LISTS);
+  } else {
+    for (int i = 0; i < TA_NUM_LISTS; i++) {
+      tr_finish_list(tr, i);
+    }
   }
+
+  rc->num_indices = num_indices;
+}
+
+void tr_destroy(struct tr *tr) {
+  if (tr->num_workers) {
+    mutex_lock(tr->task_mutex);
+    tr->shutdown = 1;
+    for (int i = 0; i < tr->num_workers; i++) {
+      cond_signal(tr->task_cond);
+    }
+    mutex_unlock(tr->task_mutex);
+
+    for (int i = 0; i < tr->num_workers; i++) {
+      void *result;
+      thread_join(tr->workers[i], &result);
+    }
+
+    cond_destroy(tr->done_cond);
+    cond_destroy(tr->task_cond);
+    mutex_destroy(tr->task_mutex);
+  }
+
+  for (int i = 0; i < tr->num_workers; i++) {
+    free(tr->scratch[i]);
+  }
+
+  free(tr);
+}
+
+struct tr *tr_create(void *userdata, tr_find_texture_cb find_texture,
+                     int num_threads) {
+  struct tr *tr = calloc(1, sizeof(struct tr));
+
+  tr->userdata = userdata;
+  tr->find_texture = find_texture;
+
+  tr->num_workers = CLAMP(num_threads, 0, TR_MAX_WORKERS);
+
+  if (tr->num_workers) {
+    tr->task_mutex = mutex_create();
+    tr->task_cond = cond_create();
+    tr->done_cond = cond_create();
+
+    for (int i = 0; i < tr->num_workers; i++) {
+      tr->scratch[i] = calloc(1, sizeof(struct tr_context));
+      tr->workers[i] = thread_create(&tr_worker_thread, "tr", tr);
+      CHECK_NOTNULL(tr->workers[i]);
+    }
+  }
+
+  return tr;
 }
@@ -82,8 +82,11 @@ static inline tr_texture_key_t tr_texture_key(union tsp tsp, union tcw tcw) {
 
 typedef struct tr_texture *(*tr_find_texture_cb)(void *, union tsp, union tcw);
 
-void tr_convert_context(struct render_backend *r, void *userdata,
-                        tr_find_texture_cb find_texture,
+struct tr *tr_create(void *userdata, tr_find_texture_cb find_texture,
+                     int num_threads);
+void tr_destroy(struct tr *tr);
+
+void tr_convert_context(struct tr *tr, struct render_backend *r,
                         const struct ta_context *ctx, struct tr_context *rc);
 void tr_render_context(struct render_backend *r, const struct tr_context *rc);
 void tr_render_context_until(struct render_backend *r,
@@ -0,0 +1,465 @@
+#include "guest/rewind.h"
+#include "core/core.h"
+#include "core/list.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/snapshot.h"
+
+/* differences are encoded a 64-bit word at a time */
+#define REWIND_PAGE_WORDS (MEM_DIRTY_PAGE_SIZE / 8)
+/* worst case encoded size of n words, each differing word alternating with an
+   equal one and costing a pair of varints */
+#define REWIND_ENCODE_BOUND(n) ((n)*8 + ((n) + 1) * 6 + 16)
+
+enum {
+  REWIND_RAM,
+  REWIND_VRAM,
+  REWIND_ARAM,
+  REWIND_NUM_REGIONS,
+};
+
+typedef int (*rewind_poll_cb)(struct memory *, int, uint8_t *);
+typedef void (*rewind_dirty_cb)(struct memory *, uint32_t, int);
+
+struct rewind_region {
+  uint8_t *mem;
+  /* contents of mem as of the latest capture */
+  uint8_t *shadow;
+  int num_pages;
+  rewind_poll_cb poll;
+  rewind_dirty_cb dirty;
+};
+
+/* difference between a capture and the one before it. applying it to the
+   later capture produces the earlier one */
+struct rewind_delta {
+  struct list_node it;
+  int size;
+  uint8_t data[];
+};
+
+struct rewind {
+  struct dreamcast *dc;
+  int64_t budget;
+
+  struct rewind_region regions[REWIND_NUM_REGIONS];
+  uint8_t dirty[MEM_DIRTY_RAM_PAGES];
+  int captured;
+
+  /* device state as of the latest capture, zero-padded to a whole number of
+     words */
+  struct snapshot *ss;
+  uint8_t *state;
+  int state_size;
+  int state_capacity;
+  uint8_t *next_state;
+  int next_capacity;
+
+  /* deltas ordered oldest to newest */
+  struct list deltas;
+  int num_deltas;
+  int64_t deltas_size;
+
+  uint8_t *scratch;
+  int scratch_size;
+  int scratch_capacity;
+};
+
+static int rewind_grow_capacity(int capacity, int size) {
+  int new_capacity = MAX(capacity, 64 * 1024);
+  while (new_capacity < size) {
+    new_capacity *= 2;
+  }
+  return new_capacity;
+}
+
+static void rewind_reserve(uint8_t **buf, int *capacity, int size) {
+  if (size <= *capacity) {
+    return;
+  }
+
+  int new_capacity = rewind_grow_capacity(*capacity, size);
+
+  *buf = realloc(*buf, new_capacity);
+  *capacity = new_capacity;
+}
+
+static int rewind_state_words(int a, int b) {
+  return (MAX(a, b) + 7) / 8;
+}
+
+static void rewind_pad_state(uint8_t **buf, int *capacity, int size,
+                             int words) {
+  rewind_reserve(buf, capacity, words * 8);
+  memset(*buf + size, 0, words * 8 - size);
+}
+
+/*
+ * delta codec. the difference between two buffers is written as a series of
+ * (equal words, differing words) varint pairs, each followed by the xor of the
+ * differing words. xor makes the codec symmetric, so decoding a delta into
+ * either side of it produces the other
+ */
+static uint8_t *rewind_write_varint(uint8_t *out, uint32_t v) {
+  while (v >= 0x80) {
+    *out++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *out++ = (uint8_t)v;
+  return out;
+}
+
+static const uint8_t *rewind_read_varint(const uint8_t *in, uint32_t *v) {
+  int shift = 0;
+  *v = 0;
+  while (*in & 0x80) {
+    *v |= (uint32_t)(*in++ & 0x7f) << shift;
+    shift += 7;
+  }
+  *v |= (uint32_t)*in++ << shift;
+  return in;
+}
+
+static const uint8_t *rewind_decode(const uint8_t *in, uint8_t *dst,
+                                    int num_words) {
+  int i = 0;
+
+  while (i < num_words) {
+    uint32_t equal, differ;
+    in = rewind_read_varint(in, &equal);
+    in = rewind_read_varint(in, &differ);
+    i += equal;
+
+    for (uint32_t j = 0; j < differ; j++, i++) {
+      uint64_t a, x;
+      memcpy(&a, dst + i * 8, 8);
+      memcpy(&x, in, 8);
+      a ^= x;
+      memcpy(dst + i * 8, &a, 8);
+      in += 8;
+    }
+  }
+
+  return in;
+}
+
+static int rewind_encode(uint8_t **out, const uint8_t *a, const uint8_t *b,
+                         int num_words) {
+  const uint64_t *wa = (const uint64_t *)a;
+  const uint64_t *wb = (const uint64_t *)b;
+  uint8_t *ptr = *out;
+  int num_differ = 0;
+  int i = 0;
+
+  while (i < num_words) {
+    int start = i;
+    while (i < num_words && wa[i] == wb[i]) {
+      i++;
+    }
+    int equal = i - start;
+
+    start = i;
+    while (i < num_words && wa[i] != wb[i]) {
+      i++;
+    }
+    int differ = i - start;
+
+    ptr = rewind_write_varint(ptr, equal);
+    ptr = rewind_write_varint(ptr, differ);
+
+    for (int j = start; j < i; j++) {
+      uint64_t x = wa[j] ^ wb[j];
+      memcpy(ptr, &x, 8);
+      ptr += 8;
+    }
+
+    num_differ += differ;
+  }
+
+  *out = ptr;
+  return num_differ;
+}
+
+/*
+ * history management
+ */
+static void rewind_free_delta(struct rewind *rw, struct rewind_delta *delta) {
+  list_remove(&rw->deltas, &delta->it);
+  rw->num_deltas--;
+  rw->deltas_size -= delta->size;
+  free(delta);
+}
+
+static int64_t rewind_base_size(struct rewind *rw) {
+  int64_t size = rw->state_capacity + rw->next_capacity;
+
+  for (int i = 0; i < REWIND_NUM_REGIONS; i++) {
+    size += (int64_t)rw->regions[i].num_pages * MEM_DIRTY_PAGE_SIZE;
+  }
+
+  return size;
+}
+
+int64_t rewind_min_budget(struct dreamcast *dc) {
+  struct snapshot *ss = snapshot_create();
+  dc_snapshot_devices(dc, ss);
+  int words = rewind_state_words(snapshot_size(ss), 0);
+  snapshot_destroy(ss);
+
+  /* the shadow copies, plus the pair of state buffers as sized by the first
+     capture */
+  int64_t size = 2 * (int64_t)rewind_grow_capacity(0, words * 8);
+  size += (int64_t)(MEM_DIRTY_RAM_PAGES + MEM_DIRTY_VRAM_PAGES +
+                    MEM_DIRTY_ARAM_PAGES) *
+          MEM_DIRTY_PAGE_SIZE;
+  return size;
+}
+
+int64_t rewind_size(struct rewind *rw) {
+  return rewind_base_size(rw) + rw->deltas_size;
+}
+
+int rewind_depth(struct rewind *rw) {
+  return rw->num_deltas;
+}
+
+int rewind_step(struct rewind *rw) {
+  if (!rw->num_deltas) {
+    return 0;
+  }
+
+  struct memory *mem = rw->dc->mem;
+  struct rewind_delta *delta =
+      list_last_entry(&rw->deltas, struct rewind_delta, it);
+  const uint8_t *in = delta->data;
+
+  /* revert anything written since the latest capture */
+  for (int i = 0; i < REWIND_NUM_REGIONS; i++) {
+    struct rewind_region *region = &rw->regions[i];
+    region->poll(mem, MEM_DIRTY_REWIND, rw->dirty);
+
+    for (int page = 0; page < region->num_pages; page++) {
+      if (!rw->dirty[page]) {
+        continue;
+      }
+
+      uint32_t offset = page * MEM_DIRTY_PAGE_SIZE;
+      memcpy(region->mem + offset, region->shadow + offset,
+             MEM_DIRTY_PAGE_SIZE);
+      region->dirty(mem, offset, MEM_DIRTY_PAGE_SIZE);
+    }
+  }
+
+  /* and then step back past it to the capture before */
+  int32_t prev_size;
+  memcpy(&prev_size, in, sizeof(prev_size));
+  in += sizeof(prev_size);
+
+  for (int i = 0; i < REWIND_NUM_REGIONS; i++) {
+    struct rewind_region *region = &rw->regions[i];
+    int32_t num_pages;
+    memcpy(&num_pages, in, sizeof(num_pages));
+    in += sizeof(num_pages);
+
+    for (int j = 0; j < num_pages; j++) {
+      int32_t page;
+      memcpy(&page, in, sizeof(page));
+      in += sizeof(page);
+
+      uint32_t offset = page * MEM_DIRTY_PAGE_SIZE;
+      in = rewind_decode(in, region->shadow + offset, REWIND_PAGE_WORDS);
+      memcpy(region->mem + offset, region->shadow + offset,
+             MEM_DIRTY_PAGE_SIZE);
+      region->dirty(mem, offset, MEM_DIRTY_PAGE_SIZE);
+    }
+  }
+
+  int words = rewind_state_words(prev_size, rw->state_size);
+  rewind_pad_state(&rw->state, &rw->state_capacity, rw->state_size, words);
+  in = rewind_decode(in, rw->state, words);
+  CHECK_EQ((int)(in - delta->data), delta->size);
+  rw->state_size = prev_size;
+
+  snapshot_reset(rw->ss);
+  snapshot_write(rw->ss, rw->state, rw->state_size);
+  int res = dc_restore(rw->dc, rw->ss);
+  CHECK(res);
+
+  /* memory now matches the capture, drop the bits set restoring it */
+  for (int i = 0; i < REWIND_NUM_REGIONS; i++) {
+    rw->regions[i].poll(mem, MEM_DIRTY_REWIND, rw->dirty);
+  }
+
+  rewind_free_delta(rw, delta);
+
+  return 1;
+}
+
+static void rewind_capture_base(struct rewind *rw) {
+  struct memory *mem = rw->dc->mem;
+
+  for (int i = 0; i < REWIND_NUM_REGIONS; i++) {
+    struct rewind_region *region = &rw->regions[i];
+    region->poll(mem, MEM_DIRTY_REWIND, rw->dirty);
+    memcpy(region->shadow, region->mem,
+           region->num_pages * MEM_DIRTY_PAGE_SIZE);
+  }
+
+  dc_snapshot_devices(rw->dc, rw->ss);
+  rw->state_size = snapshot_size(rw->ss);
+  int words = rewind_state_words(rw->state_size, 0);
+  rewind_pad_state(&rw->state, &rw->state_capacity, rw->state_size, words);
+  memcpy(rw->state, snapshot_data(rw->ss), rw->state_size);
+
+  rw->captured = 1;
+}
+
+void rewind_capture(struct rewind *rw) {
+  struct memory *mem = rw->dc->mem;
+
+  if (!rw->captured) {
+    rewind_capture_base(rw);
+    return;
+  }
+
+  /* the delta is built up in scratch, applying it to this capture's state must
+     produce the previous capture's */
+  int32_t prev_size = rw->state_size;
+  rw->scratch_size = 0;
+  rewind_reserve(&rw->scratch, &rw->scratch_capacity, sizeof(prev_size));
+  memcpy(rw->scratch, &prev_size, sizeof(prev_size));
+  rw->scratch_size += sizeof(prev_size);
+
+  for (int i = 0; i < REWIND_NUM_REGIONS; i++) {
+    struct rewind_region *region = &rw->regions[i];
+    int num_dirty = region->poll(mem, MEM_DIRTY_REWIND, rw->dirty);
+    int count_offset = rw->scratch_size;
+    int32_t num_pages = 0;
+
+    rewind_reserve(&rw->scratch, &rw->scratch_capacity,
+                   rw->scratch_size + sizeof(num_pages) +
+                       num_dirty * (sizeof(int32_t) +
+                                    REWIND_ENCODE_BOUND(REWIND_PAGE_WORDS)));
+    rw->scratch_size += sizeof(num_pages);
+
+    for (int32_t page = 0; num_dirty && page < region->num_pages; page++) {
+      if (!rw->dirty[page]) {
+        continue;
+      }
+
+      num_dirty--;
+
+      uint32_t offset = page * MEM_DIRTY_PAGE_SIZE;
+      uint8_t *start = rw->scratch + rw->scratch_size;
+      uint8_t *out = start;
+      memcpy(out, &page, sizeof(page));
+      out += sizeof(page);
+
+      /* pages written with the same data don't need to be recorded */
+      if (!rewind_encode(&out, region->mem + offset, region->shadow + offset,
+                         REWIND_PAGE_WORDS)) {
+        continue;
+      }
+
+      memcpy(region->shadow + offset, region->mem + offset,
+             MEM_DIRTY_PAGE_SIZE);
+      rw->scratch_size += (int)(out - start);
+      num_pages++;
+    }
+
+    memcpy(rw->scratch + count_offset, &num_pages, sizeof(num_pages));
+  }
+
+  /* device state is small enough to diff in its entirety */
+  dc_snapshot_devices(rw->dc, rw->ss);
+  int next_size = snapshot_size(rw->ss);
+  int words = rewind_state_words(prev_size, next_size);
+  rewind_pad_state(&rw->state, &rw->state_capacity, prev_size, words);
+  rewind_pad_state(&rw->next_state, &rw->next_capacity, next_size, words);
+  memcpy(rw->next_state, snapshot_data(rw->ss), next_size);
+
+  rewind_reserve(&rw->scratch, &rw->scratch_capacity,
+                 rw->scratch_size + REWIND_ENCODE_BOUND(words));
+  uint8_t *out = rw->scratch + rw->scratch_size;
+  rewind_encode(&out, rw->next_state, rw->state, words);
+  rw->scratch_size = (int)(out - rw->scratch);
+
+  uint8_t *tmp = rw->state;
+  int tmp_capacity = rw->state_capacity;
+  rw->state = rw->next_state;
+  rw->state_capacity = rw->next_capacity;
+  rw->state_size = next_size;
+  rw->next_state = tmp;
+  rw->next_capacity = tmp_capacity;
+
+  /* push the delta, dropping the oldest to stay in budget */
+  struct rewind_delta *delta =
+      malloc(sizeof(struct rewind_delta) + rw->scratch_size);
+  delta->size = rw->scratch_size;
+  memcpy(delta->data, rw->scratch, rw->scratch_size);
+  list_add(&rw->deltas, &delta->it);
+  rw->num_deltas++;
+  rw->deltas_size += delta->size;
+
+  while (rw->num_deltas && rewind_size(rw) > rw->budget) {
+    struct rewind_delta *oldest =
+        list_first_entry(&rw->deltas, struct rewind_delta, it);
+    rewind_free_delta(rw, oldest);
+  }
+}
+
+void rewind_reset(struct rewind *rw) {
+  list_for_each_entry_safe(delta, &rw->deltas, struct rewind_delta, it) {
+    rewind_free_delta(rw, delta);
+  }
+
+  rw->captured = 0;
+}
+
+void rewind_destroy(struct rewind *rw) {
+  rewind_reset(rw);
+
+  for (int i = 0; i < REWIND_NUM_REGIONS; i++) {
+    free(rw->regions[i].shadow);
+  }
+
+  snapshot_destroy(rw->ss);
+  free(rw->state);
+  free(rw->next_state);
+  free(rw->scratch);
+  free(rw);
+}
+
+struct rewind *rewind_create(struct dreamcast *dc, int64_t budget) {
+  struct rewind *rw = calloc(1, sizeof(struct rewind));
+  struct memory *mem = dc->mem;
+
+  rw->dc = dc;
+  rw->budget = budget;
+  rw->ss = snapshot_create();
+
+  struct rewind_region *ram = &rw->regions[REWIND_RAM];
+  ram->mem = mem_ram(mem, 0);
+  ram->num_pages = MEM_DIRTY_RAM_PAGES;
+  ram->poll = &mem_ram_poll_dirty;
+  ram->dirty = &mem_ram_dirty;
+
+  struct rewind_region *vram = &rw->regions[REWIND_VRAM];
+  vram->mem = mem_vram(mem, 0);
+  vram->num_pages = MEM_DIRTY_VRAM_PAGES;
+  vram->poll = &mem_vram_poll_dirty;
+  vram->dirty = &mem_vram_dirty;
+
+  struct rewind_region *aram = &rw->regions[REWIND_ARAM];
+  aram->mem = mem_aram(mem, 0);
+  aram->num_pages = MEM_DIRTY_ARAM_PAGES;
+  aram->poll = &mem_aram_poll_dirty;
+  aram->dirty = &mem_aram_dirty;
+
+  for (int i = 0; i < REWIND_NUM_REGIONS; i++) {
+    struct rewind_region *region = &rw->regions[i];
+    region->shadow = malloc(region->num_pages * MEM_DIRTY_PAGE_SIZE);
+  }
+
+  return rw;
+}
@@ -0,0 +1,37 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+
+/*
+ * history of machine states to step back through
+ *
+ * a full copy of guest memory and device state is kept as of the latest
+ * capture. each capture after that only visits the pages the dirty map says
+ * were written since, and pushes the difference between the two captures onto
+ * the history. the differences are mostly zero, and packed with a zero-run
+ * encoding rather than a general purpose compressor which can't keep up
+ */
+
+struct dreamcast;
+struct rewind;
+
+/* budget covers the copy of the latest capture as well as the history, the
+   oldest captures being dropped to stay within it */
+struct rewind *rewind_create(struct dreamcast *dc, int64_t budget);
+/* budget taken up by the copy of the latest capture alone. anything at or
+   below it leaves no room for history */
+int64_t rewind_min_budget(struct dreamcast *dc);
+void rewind_destroy(struct rewind *rw);
+
+/* drops all history, for when the machine's state has been replaced */
+void rewind_reset(struct rewind *rw);
+void rewind_capture(struct rewind *rw);
+/* restores the capture before the latest one, returning 0 if there's no
+   history left to step back through */
+int rewind_step(struct rewind *rw);
+
+int rewind_depth(struct rewind *rw);
+int64_t rewind_size(struct rewind *rw);
+
+#endif
@@ -6,7 +6,7 @@
 
 struct boot {
   struct device;
-  uint8_t rom[0x00200000];
+  uint8_t rom[BOOT_ROM_SIZE];
 };
 
 static const char *boot_bin_path() {
@@ -97,6 +97,12 @@ uint32_t boot_rom_read(struct boot *boot, uint32_t addr, uint32_t mask) {
   return READ_DATA(&boot->rom[addr]);
 }
 
+void boot_rom_read_string(struct boot *boot, uint8_t *dst, uint32_t addr,
+                          int size) {
+  CHECK_LE(addr + size, sizeof(boot->rom));
+  memcpy(dst, &boot->rom[addr], size);
+}
+
 void boot_destroy(struct boot *boot) {
   dc_destroy_device((struct device *)boot);
 }
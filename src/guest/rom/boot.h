@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#define BOOT_ROM_SIZE 0x00200000
+
 struct dreamcast;
 struct boot;
 
@@ -10,6 +12,8 @@ struct boot *boot_create(struct dreamcast *dc);
 void boot_destroy(struct boot *boot);
 
 uint32_t boot_rom_read(struct boot *boot, uint32_t addr, uint32_t mask);
+void boot_rom_read_string(struct boot *boot, uint8_t *dst, uint32_t addr,
+                          int size);
 void boot_rom_write(struct boot *boot, uint32_t addr, uint32_t data,
                     uint32_t mask);
 
@@ -2,6 +2,7 @@
 #include "core/filesystem.h"
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
+#include "guest/snapshot.h"
 
 #define FLASH_SECTOR_SIZE 0x4000
 
@@ -97,6 +98,22 @@ static void flash_cmd_erase_sector(struct flash *flash, uint32_t addr) {
   flash_erase(flash, addr, FLASH_SECTOR_SIZE);
 }
 
+static void flash_load(struct device *dev, struct snapshot *ss) {
+  struct flash *flash = (struct flash *)dev;
+
+  SNAPSHOT_READ(ss, flash->rom);
+  SNAPSHOT_READ(ss, flash->cmd);
+  SNAPSHOT_READ(ss, flash->cmd_state);
+}
+
+static void flash_save(struct device *dev, struct snapshot *ss) {
+  struct flash *flash = (struct flash *)dev;
+
+  SNAPSHOT_WRITE(ss, flash->rom);
+  SNAPSHOT_WRITE(ss, flash->cmd);
+  SNAPSHOT_WRITE(ss, flash->cmd_state);
+}
+
 static int flash_init(struct device *dev) {
   struct flash *flash = (struct flash *)dev;
 
@@ -194,6 +211,12 @@ uint32_t flash_rom_read(struct flash *flash, uint32_t addr, uint32_t mask) {
   return flash_cmd_read(flash, addr, mask);
 }
 
+void flash_rom_read_string(struct flash *flash, uint8_t *dst, uint32_t addr,
+                           int size) {
+  CHECK_EQ(flash->cmd_state, 0);
+  flash_read(flash, addr, dst, size);
+}
+
 void flash_destroy(struct flash *flash) {
   flash_save_rom(flash);
   dc_destroy_device((struct device *)flash);
@@ -203,5 +226,10 @@ struct flash *flash_create(struct dreamcast *dc) {
   struct flash *flash =
       dc_create_device(dc, sizeof(struct flash), "flash", &flash_init, NULL);
 
+  /* setup state interface */
+  flash->stateif.enabled = 1;
+  flash->stateif.save = &flash_save;
+  flash->stateif.load = &flash_load;
+
   return flash;
 }
@@ -10,6 +10,8 @@ struct flash *flash_create(struct dreamcast *dc);
 void flash_destroy(struct flash *flash);
 
 uint32_t flash_rom_read(struct flash *flash, uint32_t addr, uint32_t mask);
+void flash_rom_read_string(struct flash *flash, uint8_t *dst, uint32_t addr,
+                           int size);
 void flash_rom_write(struct flash *flash, uint32_t addr, uint32_t data,
                      uint32_t mask);
 
@@ -3,12 +3,38 @@
 #include "core/core.h"
 #include "core/list.h"
 #include "guest/dreamcast.h"
+#include "guest/snapshot.h"
+#include "imgui.h"
+#include "options.h"
+#include "stats.h"
 
-#define MAX_TIMERS 128
+/* timers are allocated in chunks so pointers handed out remain stable as the
+   pool grows */
+#define TIMER_CHUNK_SIZE 128
+
+#define SCHED_MAX_DEVICE_STATS 16
+#define SCHED_MAX_TIMER_STATS 64
+/* slice lengths are bucketed by their log2 in nanoseconds */
+#define SCHED_SLICE_BUCKETS 32
+
+/* host time spent inside a device's run callback or a timer's callback */
+struct sched_stat {
+  const char *name;
+  const void *key;
+  int64_t calls;
+  int64_t time;
+};
 
 struct timer {
   int active;
   int64_t expire;
+  /* breaks ties between timers with the same expire time, keeping them in
+     the order they were started */
+  uint64_t seq;
+  /* index into the heap while active */
+  int slot;
+  /* index into the timer stats, or -1 when not collecting them */
+  int stat;
   timer_cb cb;
   void *data;
   struct list_node it;
@@ -16,64 +42,250 @@ struct timer {
 
 struct scheduler {
   struct dreamcast *dc;
-  struct timer timers[MAX_TIMERS];
+
+  /* pool of timers */
+  struct timer **chunks;
+  int num_chunks;
   struct list free_timers;
-  struct list live_timers;
+
+  /* binary min-heap of active timers, ordered by expire time */
+  struct timer **heap;
+  int num_live;
+  int max_live;
+  uint64_t next_seq;
+
   int64_t base_time;
+  /* device currently running its slice */
+  struct device *running_dev;
+
+  /* host time accounting */
+  int stats, show_stats;
+  struct sched_stat device_stats[SCHED_MAX_DEVICE_STATS];
+  int num_device_stats;
+  struct sched_stat timer_stats[SCHED_MAX_TIMER_STATS];
+  int num_timer_stats;
+  int64_t slices[SCHED_SLICE_BUCKETS];
+  int64_t tick_time;
 };
 
+static int sched_timer_stat(struct scheduler *sched, timer_cb cb,
+                            const char *name) {
+  for (int i = 0; i < sched->num_timer_stats; i++) {
+    if (sched->timer_stats[i].key == cb) {
+      return i;
+    }
+  }
+
+  if (sched->num_timer_stats >= SCHED_MAX_TIMER_STATS) {
+    return -1;
+  }
+
+  int i = sched->num_timer_stats++;
+  struct sched_stat *stat = &sched->timer_stats[i];
+  /* names are the stringified callback expression */
+  stat->name = name[0] == '&' ? name + 1 : name;
+  stat->key = cb;
+  return i;
+}
+
+static inline int sched_timer_before(struct timer *a, struct timer *b) {
+  if (a->expire != b->expire) {
+    return a->expire < b->expire;
+  }
+  return a->seq < b->seq;
+}
+
+static inline void sched_heap_set(struct scheduler *sched, int i,
+                                  struct timer *timer) {
+  sched->heap[i] = timer;
+  timer->slot = i;
+}
+
+static void sched_heap_up(struct scheduler *sched, int i) {
+  struct timer *timer = sched->heap[i];
+
+  while (i > 0) {
+    int parent = (i - 1) >> 1;
+
+    if (!sched_timer_before(timer, sched->heap[parent])) {
+      break;
+    }
+
+    sched_heap_set(sched, i, sched->heap[parent]);
+    i = parent;
+  }
+
+  sched_heap_set(sched, i, timer);
+}
+
+static void sched_heap_down(struct scheduler *sched, int i) {
+  struct timer *timer = sched->heap[i];
+
+  while (1) {
+    int child = (i << 1) + 1;
+
+    if (child >= sched->num_live) {
+      break;
+    }
+
+    if (child + 1 < sched->num_live &&
+        sched_timer_before(sched->heap[child + 1], sched->heap[child])) {
+      child++;
+    }
+
+    if (!sched_timer_before(sched->heap[child], timer)) {
+      break;
+    }
+
+    sched_heap_set(sched, i, sched->heap[child]);
+    i = child;
+  }
+
+  sched_heap_set(sched, i, timer);
+}
+
+static void sched_grow_pool(struct scheduler *sched) {
+  int n = sched->num_chunks++;
+  sched->chunks =
+      realloc(sched->chunks, sched->num_chunks * sizeof(struct timer *));
+  sched->chunks[n] = calloc(TIMER_CHUNK_SIZE, sizeof(struct timer));
+
+  for (int i = 0; i < TIMER_CHUNK_SIZE; i++) {
+    struct timer *timer = &sched->chunks[n][i];
+    list_add(&sched->free_timers, &timer->it);
+  }
+
+  sched->max_live = sched->num_chunks * TIMER_CHUNK_SIZE;
+  sched->heap = realloc(sched->heap, sched->max_live * sizeof(struct timer *));
+}
+
 void sched_cancel_timer(struct scheduler *sched, struct timer *timer) {
   if (!timer->active) {
     return;
   }
 
   timer->active = 0;
-  list_remove(&sched->live_timers, &timer->it);
+
+  /* move the last timer into the vacated slot and restore the heap */
+  int i = timer->slot;
+  struct timer *last = sched->heap[--sched->num_live];
+
+  if (last != timer) {
+    sched_heap_set(sched, i, last);
+
+    if (i > 0 && sched_timer_before(last, sched->heap[(i - 1) >> 1])) {
+      sched_heap_up(sched, i);
+    } else {
+      sched_heap_down(sched, i);
+    }
+  }
+
   list_add(&sched->free_timers, &timer->it);
 }
 
+int64_t sched_current_time(struct scheduler *sched) {
+  /* base time is advanced to the end of the slice before devices are ran */
+  struct device *dev = sched->running_dev;
+
+  if (dev && dev->runif.remaining) {
+    return sched->base_time - dev->runif.remaining(dev);
+  }
+
+  return sched->base_time;
+}
+
 int64_t sched_remaining_time(struct scheduler *sched, struct timer *timer) {
   return timer->expire - sched->base_time;
 }
 
-struct timer *sched_start_timer(struct scheduler *sched, timer_cb cb,
-                                void *data, int64_t ns) {
+struct timer *sched_start_timer_named(struct scheduler *sched, timer_cb cb,
+                                      const char *name, void *data,
+                                      int64_t ns) {
+  if (list_empty(&sched->free_timers)) {
+    sched_grow_pool(sched);
+  }
+
   struct timer *timer = list_first_entry(&sched->free_timers, struct timer, it);
-  CHECK_NOTNULL(timer);
   timer->active = 1;
   timer->expire = sched->base_time + ns;
+  timer->seq = sched->next_seq++;
+  timer->stat = sched->stats ? sched_timer_stat(sched, cb, name) : -1;
   timer->cb = cb;
   timer->data = data;
 
   /* remove from free list */
   list_remove(&sched->free_timers, &timer->it);
 
-  /* add to sorted live list */
-  struct list_node *after = NULL;
+  /* add to heap */
+  int i = sched->num_live++;
+  sched_heap_set(sched, i, timer);
+  sched_heap_up(sched, i);
+
+  return timer;
+}
+
+static void sched_run_slice_stats(struct scheduler *sched, int64_t slice) {
+  int bucket = 0;
+  while (bucket < SCHED_SLICE_BUCKETS - 1 && (slice >> (bucket + 1))) {
+    bucket++;
+  }
+  sched->slices[bucket]++;
 
-  list_for_each(&sched->live_timers, it) {
-    struct timer *entry = list_entry(it, struct timer, it);
+  /* devices are never added after the machine is created, so their position
+     in the list identifies them */
+  int n = 0;
+  int64_t start = time_nanoseconds();
 
-    if (entry->expire > timer->expire) {
+  list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
+    if (n >= SCHED_MAX_DEVICE_STATS) {
       break;
     }
 
-    after = it;
+    struct sched_stat *stat = &sched->device_stats[n++];
+    sched->num_device_stats = MAX(sched->num_device_stats, n);
+
+    if (dev->runif.enabled && dev->runif.running) {
+      sched->running_dev = dev;
+      dev->runif.run(dev, slice);
+      sched->running_dev = NULL;
+
+      int64_t end = time_nanoseconds();
+      stat->name = dev->name;
+      stat->calls++;
+      stat->time += end - start;
+      prof_counter_add(COUNTER_sched_device_time, end - start);
+      start = end;
+    }
   }
+}
 
-  list_add_after(&sched->live_timers, after, &timer->it);
+static void sched_run_timer_stats(struct scheduler *sched,
+                                  struct timer *timer) {
+  /* the timer is back on the free list by now, and may be reused by one the
+     callback schedules */
+  int index = timer->stat;
+  int64_t start = time_nanoseconds();
 
-  return timer;
+  timer->cb(timer->data);
+
+  int64_t end = time_nanoseconds();
+  prof_counter_add(COUNTER_sched_timer_time, end - start);
+
+  if (index >= 0) {
+    struct sched_stat *stat = &sched->timer_stats[index];
+    stat->calls++;
+    stat->time += end - start;
+  }
 }
 
 void sched_tick(struct scheduler *sched, int64_t ns) {
   int64_t target_time = sched->base_time + ns;
+  int64_t tick_start = sched->stats ? time_nanoseconds() : 0;
 
   while (sched->dc->running && sched->base_time < target_time) {
     /* run devices up to the next timer */
     int64_t next_time = target_time;
-    struct timer *next_timer =
-        list_first_entry(&sched->live_timers, struct timer, it);
+    struct timer *next_timer = sched->num_live ? sched->heap[0] : NULL;
 
     if (next_timer && next_timer->expire < next_time) {
       next_time = next_timer->expire;
@@ -85,43 +297,314 @@ void sched_tick(struct scheduler *sched, int64_t ns) {
     sched->base_time += slice;
 
     /* execute each device */
-    list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
-      if (dev->runif.enabled && dev->runif.running) {
-        dev->runif.run(dev, slice);
+    if (sched->stats) {
+      sched_run_slice_stats(sched, slice);
+    } else {
+      list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
+        if (dev->runif.enabled && dev->runif.running) {
+          sched->running_dev = dev;
+          dev->runif.run(dev, slice);
+          sched->running_dev = NULL;
+        }
       }
     }
 
     /* execute expired timers */
-    while (1) {
-      struct timer *timer =
-          list_first_entry(&sched->live_timers, struct timer, it);
+    while (sched->num_live) {
+      struct timer *timer = sched->heap[0];
 
-      if (!timer || timer->expire > sched->base_time) {
+      if (timer->expire > sched->base_time) {
         break;
       }
 
       sched_cancel_timer(sched, timer);
 
       /* run the timer */
-      timer->cb(timer->data);
+      if (sched->stats) {
+        sched_run_timer_stats(sched, timer);
+      } else {
+        timer->cb(timer->data);
+      }
+    }
+  }
+
+  if (sched->stats) {
+    int64_t elapsed = time_nanoseconds() - tick_start;
+    sched->tick_time += elapsed;
+    prof_counter_add(COUNTER_sched_tick_time, elapsed);
+  }
+}
+
+static struct timer *sched_timer(struct scheduler *sched, int id) {
+  if (id < 0) {
+    return NULL;
+  }
+
+  CHECK_LT(id, sched->max_live);
+  return &sched->chunks[id / TIMER_CHUNK_SIZE][id % TIMER_CHUNK_SIZE];
+}
+
+static int sched_timer_id(struct scheduler *sched, struct timer *timer) {
+  if (!timer) {
+    return -1;
+  }
+
+  for (int i = 0; i < sched->num_chunks; i++) {
+    struct timer *chunk = sched->chunks[i];
+
+    if (timer >= chunk && timer < chunk + TIMER_CHUNK_SIZE) {
+      return i * TIMER_CHUNK_SIZE + (int)(timer - chunk);
+    }
+  }
+
+  LOG_FATAL("sched_timer_id timer isn't from the pool");
+}
+
+struct timer *sched_read_timer(struct scheduler *sched, struct snapshot *ss) {
+  int32_t id;
+  SNAPSHOT_READ(ss, id);
+  return sched_timer(sched, id);
+}
+
+void sched_write_timer(struct scheduler *sched, struct snapshot *ss,
+                       struct timer *timer) {
+  int32_t id = sched_timer_id(sched, timer);
+  SNAPSHOT_WRITE(ss, id);
+}
+
+void sched_load(struct scheduler *sched, struct snapshot *ss) {
+  struct dreamcast *dc = sched->dc;
+
+  SNAPSHOT_READ(ss, sched->base_time);
+  SNAPSHOT_READ(ss, sched->next_seq);
+
+  int32_t max_live;
+  SNAPSHOT_READ(ss, max_live);
+
+  while (sched->max_live < max_live) {
+    sched_grow_pool(sched);
+  }
+
+  for (int i = 0; i < max_live; i++) {
+    struct timer *timer = sched_timer(sched, i);
+
+    SNAPSHOT_READ(ss, timer->active);
+
+    if (!timer->active) {
+      continue;
+    }
+
+    SNAPSHOT_READ(ss, timer->expire);
+    SNAPSHOT_READ(ss, timer->seq);
+    timer->cb = (timer_cb)snapshot_read_fn(ss);
+    timer->data = dc_read_ref(dc, ss);
+    /* the callback's name isn't known, so restored timers go unaccounted
+       until they're restarted */
+    timer->stat = -1;
+  }
+
+  /* the heap is restored as-is rather than rebuilt, keeping the order timers
+     with the same expire time fire in */
+  SNAPSHOT_READ(ss, sched->num_live);
+
+  for (int i = 0; i < sched->num_live; i++) {
+    sched_heap_set(sched, i, sched_read_timer(sched, ss));
+  }
+
+  list_clear(&sched->free_timers);
+
+  for (int i = sched->num_live; i < max_live; i++) {
+    struct timer *timer = sched_read_timer(sched, ss);
+    list_add(&sched->free_timers, &timer->it);
+  }
+
+  /* the pool may have grown larger than the one saved */
+  for (int i = max_live; i < sched->max_live; i++) {
+    struct timer *timer = sched_timer(sched, i);
+    timer->active = 0;
+    list_add(&sched->free_timers, &timer->it);
+  }
+}
+
+void sched_save(struct scheduler *sched, struct snapshot *ss) {
+  struct dreamcast *dc = sched->dc;
+
+  SNAPSHOT_WRITE(ss, sched->base_time);
+  SNAPSHOT_WRITE(ss, sched->next_seq);
+
+  int32_t max_live = sched->max_live;
+  SNAPSHOT_WRITE(ss, max_live);
+
+  for (int i = 0; i < max_live; i++) {
+    struct timer *timer = sched_timer(sched, i);
+
+    SNAPSHOT_WRITE(ss, timer->active);
+
+    if (!timer->active) {
+      continue;
+    }
+
+    SNAPSHOT_WRITE(ss, timer->expire);
+    SNAPSHOT_WRITE(ss, timer->seq);
+    snapshot_write_fn(ss, (snapshot_fn)timer->cb);
+    dc_write_ref(dc, ss, timer->data);
+  }
+
+  SNAPSHOT_WRITE(ss, sched->num_live);
+
+  for (int i = 0; i < sched->num_live; i++) {
+    sched_write_timer(sched, ss, sched->heap[i]);
+  }
+
+  list_for_each_entry(timer, &sched->free_timers, struct timer, it) {
+    sched_write_timer(sched, ss, timer);
+  }
+}
+
+#ifdef HAVE_IMGUI
+static void sched_stats_table(struct scheduler *sched, const char *label,
+                              struct sched_stat *stats, int num_stats) {
+  igColumns(5, label, 0);
+
+  igText("%s", label);
+  igNextColumn();
+  igText("calls");
+  igNextColumn();
+  igText("host ms");
+  igNextColumn();
+  igText("%% of tick");
+  igNextColumn();
+  igText("avg us");
+  igNextColumn();
+
+  for (int i = 0; i < num_stats; i++) {
+    struct sched_stat *stat = &stats[i];
+
+    if (!stat->calls) {
+      continue;
+    }
+
+    igText("%s", stat->name);
+    igNextColumn();
+    igText("%" PRId64, stat->calls);
+    igNextColumn();
+    igText("%.3f", stat->time / (float)NS_PER_MS);
+    igNextColumn();
+    igText("%.2f", sched->tick_time
+                       ? (stat->time * 100.0f) / (float)sched->tick_time
+                       : 0.0f);
+    igNextColumn();
+    igText("%.3f", stat->time / (stat->calls * 1000.0f));
+    igNextColumn();
+  }
+
+  igColumns(1, NULL, 0);
+}
+
+static void sched_stats_window(struct scheduler *sched) {
+  if (igBegin("scheduler stats", NULL, 0)) {
+    struct ImVec2 btn_size = {0.0f, 0.0f};
+    if (igButton("reset", btn_size)) {
+      for (int i = 0; i < sched->num_device_stats; i++) {
+        sched->device_stats[i].calls = 0;
+        sched->device_stats[i].time = 0;
+      }
+      for (int i = 0; i < sched->num_timer_stats; i++) {
+        sched->timer_stats[i].calls = 0;
+        sched->timer_stats[i].time = 0;
+      }
+      memset(sched->slices, 0, sizeof(sched->slices));
+      sched->tick_time = 0;
+    }
+
+    /* time inside sched_tick not spent in a device or timer is the cost of
+       the scheduler itself */
+    int64_t accounted = 0;
+    for (int i = 0; i < sched->num_device_stats; i++) {
+      accounted += sched->device_stats[i].time;
     }
+    for (int i = 0; i < sched->num_timer_stats; i++) {
+      accounted += sched->timer_stats[i].time;
+    }
+    igText("tick %.3f ms, overhead %.3f ms",
+           sched->tick_time / (float)NS_PER_MS,
+           (sched->tick_time - accounted) / (float)NS_PER_MS);
+    igSeparator();
+
+    sched_stats_table(sched, "device", sched->device_stats,
+                      sched->num_device_stats);
+    igSeparator();
+    sched_stats_table(sched, "timer", sched->timer_stats,
+                      sched->num_timer_stats);
+    igSeparator();
+
+    /* slice length histogram */
+    float slices[SCHED_SLICE_BUCKETS];
+    int num_buckets = 0;
+    float max_slices = 0.0f;
+    for (int i = 0; i < SCHED_SLICE_BUCKETS; i++) {
+      slices[i] = (float)sched->slices[i];
+      max_slices = MAX(max_slices, slices[i]);
+      if (sched->slices[i]) {
+        num_buckets = i + 1;
+      }
+    }
+
+    struct ImVec2 graph_size = {0.0f, 80.0f};
+    igText("slice length, log2 ns");
+    igPlotHistogram("##slices", slices, num_buckets, 0, NULL, 0.0f,
+                    max_slices, graph_size, sizeof(float));
+
+    if (igIsItemHovered() && num_buckets) {
+      struct ImVec2 min, max, mouse;
+      igGetItemRectMin(&min);
+      igGetItemRectMax(&max);
+      igGetMousePos(&mouse);
+      int i = (int)((mouse.x - min.x) / (max.x - min.x) * num_buckets);
+      i = MIN(MAX(i, 0), num_buckets - 1);
+      igSetTooltip("%" PRId64 "-%" PRId64 " ns: %" PRId64 " slices",
+                   (int64_t)1 << i, ((int64_t)2 << i) - 1, sched->slices[i]);
+    }
+
+    igEnd();
   }
 }
 
-void sched_destroy(struct scheduler *sch) {
-  free(sch);
+void sched_debug_menu(struct scheduler *sched) {
+  if (igBeginMainMenuBar()) {
+    if (igBeginMenu("SCHED", 1)) {
+      if (igMenuItem("host time", NULL, sched->show_stats, sched->stats)) {
+        sched->show_stats = !sched->show_stats;
+      }
+
+      igEndMenu();
+    }
+
+    igEndMainMenuBar();
+  }
+
+  if (sched->show_stats) {
+    sched_stats_window(sched);
+  }
+}
+#endif
+
+void sched_destroy(struct scheduler *sched) {
+  for (int i = 0; i < sched->num_chunks; i++) {
+    free(sched->chunks[i]);
+  }
+  free(sched->chunks);
+  free(sched->heap);
+  free(sched);
 }
 
 struct scheduler *sched_create(struct dreamcast *dc) {
   struct scheduler *sched = calloc(1, sizeof(struct scheduler));
 
   sched->dc = dc;
+  sched->stats = OPTION_sched_stats;
 
-  /* add all timers to the free list initially */
-  for (int i = 0; i < MAX_TIMERS; i++) {
-    struct timer *timer = &sched->timers[i];
-    list_add(&sched->free_timers, &timer->it);
-  }
+  sched_grow_pool(sched);
 
   return sched;
 }
@@ -5,8 +5,9 @@
 #include "core/time.h"
 
 struct dreamcast;
-struct timer;
 struct scheduler;
+struct snapshot;
+struct timer;
 
 #define HZ_TO_NANO(hz) (int64_t)(NS_PER_SEC / (float)(hz))
 #define NANO_TO_CYCLES(ns, hz) (int64_t)(((ns) / (float)NS_PER_SEC) * (hz))
@@ -18,11 +19,30 @@ typedef void (*timer_cb)(void *);
 struct scheduler *sched_create(struct dreamcast *dc);
 void sched_destroy(struct scheduler *sch);
 
+void sched_debug_menu(struct scheduler *sch);
+
 void sched_tick(struct scheduler *sch, int64_t ns);
 
-struct timer *sched_start_timer(struct scheduler *sch, timer_cb cb, void *data,
-                                int64_t ns);
+/* returns the current guest time, including how far the running device has
+   progressed through its slice */
+int64_t sched_current_time(struct scheduler *sch);
+
+/* timers are named after their callback for the host time stats */
+#define sched_start_timer(sch, cb, data, ns) \
+  sched_start_timer_named(sch, cb, #cb, data, ns)
+
+struct timer *sched_start_timer_named(struct scheduler *sch, timer_cb cb,
+                                      const char *name, void *data,
+                                      int64_t ns);
 int64_t sched_remaining_time(struct scheduler *sch, struct timer *);
 void sched_cancel_timer(struct scheduler *sch, struct timer *);
 
+/* the timer pool is restored exactly, so devices can save the timers they hold
+   by their index in it */
+void sched_save(struct scheduler *sch, struct snapshot *ss);
+void sched_load(struct scheduler *sch, struct snapshot *ss);
+void sched_write_timer(struct scheduler *sch, struct snapshot *ss,
+                       struct timer *timer);
+struct timer *sched_read_timer(struct scheduler *sch, struct snapshot *ss);
+
 #endif
@@ -4,11 +4,14 @@
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
 #include "guest/scheduler.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
 #include "jit/frontend/sh4/sh4_fallback.h"
 #include "jit/frontend/sh4/sh4_frontend.h"
 #include "jit/frontend/sh4/sh4_guest.h"
 #include "jit/jit.h"
+#include "jit/jit_backend.h"
+#include "options.h"
 #include "stats.h"
 
 #if ARCH_X64
@@ -45,6 +48,27 @@ static void sh4_sr_updated(struct sh4 *sh4, uint32_t old_sr) {
       (ctx->sr & BL_MASK) != (old_sr & BL_MASK)) {
     sh4_intc_update_pending(sh4);
   }
+
+  /* cached translations were checked against the old privilege level */
+  if ((ctx->sr & MD_MASK) != (old_sr & MD_MASK) && sh4->MMUCR->AT) {
+    sh4_mmu_flush(sh4);
+  }
+}
+
+static void sh4_update_fpenv(struct sh4 *sh4) {
+  struct sh4_context *ctx = &sh4->ctx;
+
+  /* mirror the rounding and denormalization modes on the host such that the
+     compiled code's float ops match the guest's without any fixups */
+  int fpenv = 0;
+  if ((ctx->fpscr & RM_MASK) == 1) {
+    fpenv |= JIT_FPENV_ROUND_ZERO;
+  }
+  if (ctx->fpscr & DN_MASK) {
+    fpenv |= JIT_FPENV_FLUSH_DENORMALS;
+  }
+
+  jit_set_fpenv(sh4->jit, fpenv);
 }
 
 static void sh4_fpscr_updated(struct sh4 *sh4, uint32_t old_fpscr) {
@@ -57,6 +81,10 @@ static void sh4_fpscr_updated(struct sh4 *sh4, uint32_t old_fpscr) {
   if ((ctx->fpscr & FR_MASK) != (old_fpscr & FR_MASK)) {
     sh4_swap_fpr_bank(ctx);
   }
+
+  if ((ctx->fpscr & (RM_MASK | DN_MASK)) != (old_fpscr & (RM_MASK | DN_MASK))) {
+    sh4_update_fpenv(sh4);
+  }
 }
 
 static void sh4_sleep(void *data) {
@@ -66,11 +94,20 @@ static void sh4_sleep(void *data) {
   CHECK_EQ(sh4->STBCR->STBY, 0);
   CHECK_EQ(sh4->STBCR2->DSLP, 0);
 
-  /* do nothing but spin on the current pc until an interrupt is raised */
+  /* the block bit is ignored while sleeping, recompute the pending interrupts
+     in case one was already requested */
   sh4->ctx.sleep_mode = 1;
+  sh4_intc_update_pending(sh4);
+
+  /* if nothing can wake the cpu up yet, end the current slice instead of
+     spinning on the sleep instruction. sh4_run will fast-forward through the
+     remaining slices until an interrupt is raised */
+  if (!sh4->ctx.pending_interrupts) {
+    sh4->ctx.run_cycles = MIN(sh4->ctx.run_cycles, -1);
+  }
 }
 
-static void sh4_exception(struct sh4 *sh4, enum sh4_exception exc) {
+void sh4_raise_exception(struct sh4 *sh4, enum sh4_exception exc) {
   struct sh4_exception_info *exc_info = &sh4_exceptions[exc];
 
   /* let the custom exception handler have a first chance */
@@ -118,6 +155,18 @@ static void sh4_link_code(struct sh4 *sh4, void *branch, uint32_t target) {
 }
 
 static void sh4_compile_code(struct sh4 *sh4, uint32_t addr) {
+  /* both the real and hle bootstraps finish by jumping to the bootfile, which
+     is always loaded to 0x8c010000 */
+  if ((addr & 0x1fffffff) == 0x0c010000) {
+    dc_boot_complete(sh4->dc);
+  }
+
+  /* if the block can't be fetched, raise the fault instead of compiling it.
+     dispatch then continues on to the guest's exception handler */
+  if (sh4->guest->tlb_enabled && !sh4_mmu_fetch(sh4, addr)) {
+    return;
+  }
+
   jit_compile_code(sh4->jit, addr);
 }
 
@@ -158,7 +207,7 @@ static void sh4_invalid_instr(struct sh4 *sh4) {
 
   CHECK_EQ(def->op, SH4_OP_INVALID);
 
-  sh4_exception(sh4, exc);
+  sh4_raise_exception(sh4, exc);
 }
 
 static void sh4_run(struct device *dev, int64_t ns) {
@@ -166,6 +215,14 @@ static void sh4_run(struct device *dev, int64_t ns) {
   struct sh4_context *ctx = &sh4->ctx;
   struct jit *jit = sh4->jit;
 
+  /* while asleep with no interrupt pending there is nothing to execute. the
+     scheduler ends each slice at the next timer, which is the earliest point
+     an interrupt could be raised, so skip straight to it */
+  if (ctx->sleep_mode && !ctx->pending_interrupts) {
+    prof_counter_add(COUNTER_sh4_idle, ns);
+    return;
+  }
+
   int cycles = (int)NANO_TO_CYCLES(ns, SH4_CLOCK_FREQ);
   cycles = MAX(cycles, 1);
 
@@ -174,6 +231,15 @@ static void sh4_run(struct device *dev, int64_t ns) {
   prof_counter_add(COUNTER_sh4_instrs, sh4->ctx.ran_instrs);
 }
 
+static int64_t sh4_remaining(struct device *dev) {
+  struct sh4 *sh4 = (struct sh4 *)dev;
+
+  /* run_cycles is decremented as each block is entered */
+  int cycles = MAX(sh4->ctx.run_cycles, 0);
+
+  return CYCLES_TO_NANO(cycles, SH4_CLOCK_FREQ);
+}
+
 static void sh4_guest_destroy(struct jit_guest *guest) {
   free((struct sh4_guest *)guest);
 }
@@ -195,6 +261,20 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
   guest->w8 = &sh4_write8;
   guest->w16 = &sh4_write16;
   guest->w32 = &sh4_write32;
+  /* resolving mmio at compile time bypasses the access counters, leave it
+     disabled while they're being collected */
+  if (!OPTION_mmio_stats) {
+    guest->lookup_mmio = (mem_lookup_mmio_cb)&sh4_mem_lookup_mmio;
+  }
+  guest->dirty_map = sh4_dirty_map(sh4->dc->mem);
+  guest->dirty_shift = MEM_DIRTY_PAGE_SHIFT;
+  guest->dirty_mask = MEM_DIRTY_PAGE_MASK;
+  guest->tlb_read = sh4->tlb_read;
+  guest->tlb_write = sh4->tlb_write;
+  guest->tlb_shift = SH4_SOFT_TLB_SHIFT;
+  guest->tlb_mask = SH4_SOFT_TLB_SIZE - 1;
+  guest->translate = (jit_translate_cb)&sh4_mmu_translate;
+  guest->fault = (jit_fault_cb)&sh4_mmu_fault;
 
   /* runtime interface */
   guest->data = sh4;
@@ -203,6 +283,8 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
   guest->offset_instrs = (int)offsetof(struct sh4_context, ran_instrs);
   guest->offset_interrupts =
       (int)offsetof(struct sh4_context, pending_interrupts);
+  guest->offset_mode = (int)offsetof(struct sh4_context, fpscr);
+  guest->mode_mask = PR_MASK | SZ_MASK;
   guest->compile_code = (jit_compile_cb)&sh4_compile_code;
   guest->link_code = (jit_link_cb)&sh4_link_code;
   guest->check_interrupts = (jit_interrupt_cb)&sh4_check_interrupts;
@@ -216,6 +298,94 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
   return (struct jit_guest *)guest;
 }
 
+static void sh4_load(struct device *dev, struct snapshot *ss) {
+  struct sh4 *sh4 = (struct sh4 *)dev;
+  struct dreamcast *dc = sh4->dc;
+
+  SNAPSHOT_READ(ss, sh4->ctx);
+  SNAPSHOT_READ(ss, sh4->reg);
+  SNAPSHOT_READ(ss, sh4->sq);
+
+  for (int i = 0; i < ARRAY_SIZE(sh4->dmac); i++) {
+    struct sh4_dmac_channel *ch = &sh4->dmac[i];
+    ch->timer = sched_read_timer(dc->sched, ss);
+    SNAPSHOT_READ(ss, ch->src);
+    SNAPSHOT_READ(ss, ch->dst);
+    ch->done = (sh4_dtr_cb)snapshot_read_fn(ss);
+    ch->done_data = dc_read_ref(dc, ss);
+  }
+
+  SNAPSHOT_READ(ss, sh4->sorted_interrupts);
+  SNAPSHOT_READ(ss, sh4->sort_id);
+  SNAPSHOT_READ(ss, sh4->priority_mask);
+  SNAPSHOT_READ(ss, sh4->requested_interrupts);
+
+  SNAPSHOT_READ(ss, sh4->utlb_sq_map);
+  SNAPSHOT_READ(ss, sh4->utlb);
+  SNAPSHOT_READ(ss, sh4->itlb);
+  SNAPSHOT_READ(ss, sh4->itlb_src);
+  SNAPSHOT_READ(ss, sh4->itlb_next);
+
+  SNAPSHOT_READ(ss, sh4->SCFSR2_last_read);
+  SNAPSHOT_READ(ss, sh4->receive_fifo);
+  SNAPSHOT_READ(ss, sh4->transmit_fifo);
+
+  for (int i = 0; i < ARRAY_SIZE(sh4->tmu_timers); i++) {
+    sh4->tmu_timers[i] = sched_read_timer(dc->sched, ss);
+  }
+
+  /* compiled code was generated from the old memory contents and mmu state,
+     rebuild everything derived from the restored registers */
+  jit_free_code(sh4->jit);
+  sh4_update_fpenv(sh4);
+  sh4_ccn_sq_remap(sh4);
+
+  sh4->guest->tlb_enabled = sh4->MMUCR->AT;
+  sh4->utlb_code = 0;
+  sh4->itlb_code = 0;
+  sh4->asid_code = 0;
+  sh4_mmu_flush(sh4);
+
+  sh4_intc_update_pending(sh4);
+}
+
+static void sh4_save(struct device *dev, struct snapshot *ss) {
+  struct sh4 *sh4 = (struct sh4 *)dev;
+  struct dreamcast *dc = sh4->dc;
+
+  SNAPSHOT_WRITE(ss, sh4->ctx);
+  SNAPSHOT_WRITE(ss, sh4->reg);
+  SNAPSHOT_WRITE(ss, sh4->sq);
+
+  for (int i = 0; i < ARRAY_SIZE(sh4->dmac); i++) {
+    struct sh4_dmac_channel *ch = &sh4->dmac[i];
+    sched_write_timer(dc->sched, ss, ch->timer);
+    SNAPSHOT_WRITE(ss, ch->src);
+    SNAPSHOT_WRITE(ss, ch->dst);
+    snapshot_write_fn(ss, (snapshot_fn)ch->done);
+    dc_write_ref(dc, ss, ch->done_data);
+  }
+
+  SNAPSHOT_WRITE(ss, sh4->sorted_interrupts);
+  SNAPSHOT_WRITE(ss, sh4->sort_id);
+  SNAPSHOT_WRITE(ss, sh4->priority_mask);
+  SNAPSHOT_WRITE(ss, sh4->requested_interrupts);
+
+  SNAPSHOT_WRITE(ss, sh4->utlb_sq_map);
+  SNAPSHOT_WRITE(ss, sh4->utlb);
+  SNAPSHOT_WRITE(ss, sh4->itlb);
+  SNAPSHOT_WRITE(ss, sh4->itlb_src);
+  SNAPSHOT_WRITE(ss, sh4->itlb_next);
+
+  SNAPSHOT_WRITE(ss, sh4->SCFSR2_last_read);
+  SNAPSHOT_WRITE(ss, sh4->receive_fifo);
+  SNAPSHOT_WRITE(ss, sh4->transmit_fifo);
+
+  for (int i = 0; i < ARRAY_SIZE(sh4->tmu_timers); i++) {
+    sched_write_timer(dc->sched, ss, sh4->tmu_timers[i]);
+  }
+}
+
 static int sh4_init(struct device *dev) {
   struct sh4 *sh4 = (struct sh4 *)dev;
   struct dreamcast *dc = sh4->dc;
@@ -224,8 +394,8 @@ static int sh4_init(struct device *dev) {
   sh4->guest = sh4_guest_create(sh4);
   sh4->frontend = sh4_frontend_create(sh4->guest);
 #if ARCH_X64
-  DEFINE_JIT_CODE_BUFFER(sh4_code);
-  sh4->backend = x64_backend_create(sh4->guest, sh4_code, sizeof(sh4_code));
+  uint8_t *code = jit_alloc_code_buffer();
+  sh4->backend = x64_backend_create(sh4->guest, code, JIT_CODE_BUFFER_SIZE);
 #else
   sh4->backend = interp_backend_create(sh4->guest, sh4->frontend);
 #endif
@@ -261,6 +431,7 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc) {
   sh4->ctx.sr = 0x700000f0;
   sh4->ctx.fpscr = 0x00040001;
   sh4_explode_sr(&sh4->ctx);
+  sh4_update_fpenv(sh4);
 
 /* initialize registers */
 #define SH4_REG(addr, name, default, type) \
@@ -270,8 +441,13 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc) {
 #undef SH4_REG
 
   /* reset tlb */
-  memset(sh4->utlb_sq_map, 0, sizeof(sh4->utlb_sq_map));
-  memset(sh4->utlb, 0, sizeof(sh4->utlb));
+  sh4_mmu_reset(sh4);
+
+  /* cancel in-flight transfers */
+  sh4_dmac_reset(sh4);
+
+  /* reset store queue destinations */
+  sh4_ccn_sq_remap(sh4);
 
   /* reset interrupts */
   sh4_intc_reprioritize(sh4);
@@ -280,6 +456,42 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc) {
 }
 
 #ifdef HAVE_IMGUI
+static int sh4_fault_cmp(const void *a, const void *b) {
+  const struct jit_fault *fa = a;
+  const struct jit_fault *fb = b;
+  return fb->count - fa->count;
+}
+
+static void sh4_fastmem_debug_menu(struct sh4 *sh4) {
+  struct jit *jit = sh4->jit;
+
+  if (igBegin("fastmem faults", NULL, 0)) {
+    /* sort a copy, the jit appends to its list as new faults occur */
+    int num_faults = jit->num_faults;
+    struct jit_fault *faults = malloc(num_faults * sizeof(struct jit_fault));
+    memcpy(faults, jit->faults, num_faults * sizeof(struct jit_fault));
+    qsort(faults, num_faults, sizeof(struct jit_fault), &sh4_fault_cmp);
+
+    igColumns(2, NULL, 0);
+
+    igText("addr");
+    igNextColumn();
+    igText("faults");
+    igNextColumn();
+
+    for (int i = 0; i < num_faults; i++) {
+      igText("0x%08x", faults[i].guest_addr);
+      igNextColumn();
+      igText("%d", faults[i].count);
+      igNextColumn();
+    }
+
+    free(faults);
+
+    igEnd();
+  }
+}
+
 void sh4_debug_menu(struct sh4 *sh4) {
   struct jit *jit = sh4->jit;
 
@@ -308,6 +520,11 @@ void sh4_debug_menu(struct sh4 *sh4) {
         sh4->tmu_stats = !sh4->tmu_stats;
       }
 
+      if (igMenuItem("fastmem faults", NULL, sh4->fastmem_stats,
+                     OPTION_mmio_stats)) {
+        sh4->fastmem_stats = !sh4->fastmem_stats;
+      }
+
       igEndMenu();
     }
 
@@ -317,6 +534,10 @@ void sh4_debug_menu(struct sh4 *sh4) {
   if (sh4->tmu_stats) {
     sh4_tmu_debug_menu(sh4);
   }
+
+  if (sh4->fastmem_stats) {
+    sh4_fastmem_debug_menu(sh4);
+  }
 }
 #endif
 
@@ -324,7 +545,13 @@ void sh4_destroy(struct sh4 *sh4) {
   jit_destroy(sh4->jit);
   sh4_guest_destroy(sh4->guest);
   sh4->frontend->destroy(sh4->frontend);
+
+  uint8_t *code = sh4->backend->code;
   sh4->backend->destroy(sh4->backend);
+  if (code) {
+    jit_free_code_buffer(code);
+  }
+
   dc_destroy_device((struct device *)sh4);
 }
 
@@ -344,6 +571,12 @@ struct sh4 *sh4_create(struct dreamcast *dc) {
   /* setup run interface */
   sh4->runif.enabled = 1;
   sh4->runif.run = &sh4_run;
+  sh4->runif.remaining = &sh4_remaining;
+
+  /* setup state interface */
+  sh4->stateif.enabled = 1;
+  sh4->stateif.save = &sh4_save;
+  sh4->stateif.load = &sh4_load;
 
   return sh4;
 }
@@ -46,10 +46,15 @@ struct sh4 {
   /* dbg */
   int log_regs;
   int tmu_stats;
+  int fastmem_stats;
   struct list breakpoints;
 
   /* ccn */
   uint32_t sq[2][8];
+  struct sh4_sq_dst sq_dst[2];
+
+  /* dmac */
+  struct sh4_dmac_channel dmac[4];
 
   /* intc */
   enum sh4_interrupt sorted_interrupts[SH4_NUM_INTERRUPTS];
@@ -61,6 +66,17 @@ struct sh4 {
   /* mmu */
   uint32_t utlb_sq_map[64];
   struct sh4_tlb_entry utlb[64];
+  struct sh4_tlb_entry itlb[4];
+  int itlb_src[4];
+  int itlb_next;
+  /* software tlb caching translations for data accesses while AT is set */
+  struct jit_tlb_entry tlb_read[SH4_SOFT_TLB_SIZE];
+  struct jit_tlb_entry tlb_write[SH4_SOFT_TLB_SIZE];
+  /* tlb entries compiled code has been fetched through, and whether any of
+     them were private to the current asid */
+  uint64_t utlb_code;
+  uint32_t itlb_code;
+  int asid_code;
 
   /* scif */
   uint32_t SCFSR2_last_read;
@@ -83,6 +99,7 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc);
 void sh4_set_exception_handler(struct sh4 *sh4,
                                sh4_exception_handler_cb handler, void *data);
 
+void sh4_raise_exception(struct sh4 *sh4, enum sh4_exception exc);
 void sh4_raise_interrupt(struct sh4 *sh4, enum sh4_interrupt intr);
 void sh4_clear_interrupt(struct sh4 *sh4, enum sh4_interrupt intr);
 
@@ -29,35 +29,65 @@ static void sh4_ccn_reset(struct sh4 *sh4) {
   jit_invalidate_code(sh4->jit);
 }
 
+static void sh4_ccn_sq_resolve(struct sh4 *sh4, struct sh4_sq_dst *dst,
+                               uint32_t qacr) {
+  struct dreamcast *dc = sh4->dc;
+
+  /* upper 6 bits come from the QACR register */
+  dst->base = (qacr & 0x1c) << 24;
+  dst->ptr = NULL;
+  dst->ptr_mask = 0;
+  dst->write = NULL;
+  dst->data = NULL;
+
+  if (dst->base == SH4_AREA3_BEGIN) {
+    /* system ram, mirrored every 16mb */
+    dst->ptr = mem_ram(dc->mem, 0);
+    dst->ptr_mask = SH4_AREA3_ADDR_MASK;
+  } else if (dst->base == SH4_AREA4_BEGIN) {
+    /* ta fifos, the common case for geometry */
+    dst->write = (mmio_write_string_cb)&sh4_area4_write;
+    dst->data = sh4;
+  }
+}
+
+void sh4_ccn_sq_remap(struct sh4 *sh4) {
+  sh4_ccn_sq_resolve(sh4, &sh4->sq_dst[0], *sh4->QACR0);
+  sh4_ccn_sq_resolve(sh4, &sh4->sq_dst[1], *sh4->QACR1);
+}
+
 void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr) {
   struct memory *mem = sh4->dc->mem;
 
   /* make sure this is a sq related prefetch */
   DCHECK(addr >= 0xe0000000 && addr <= 0xe3ffffff);
 
-  uint32_t dst = 0x0;
   uint32_t sqi = (addr & 0x20) >> 5;
 
   if (sh4->MMUCR->AT) {
     /* get upper 12 bits from UTLB */
     uint32_t vpn = addr >> 20;
-    dst = sh4->utlb_sq_map[vpn & 0x3f];
+    uint32_t dst = sh4->utlb_sq_map[vpn & 0x3f];
 
     /* get lower 20 bits from original address */
     dst |= addr & 0xfffe0;
-  } else {
-    /* get upper 6 bits from QACR* registers */
-    if (sqi) {
-      dst = (*sh4->QACR1 & 0x1c) << 24;
-    } else {
-      dst = (*sh4->QACR0 & 0x1c) << 24;
-    }
-
-    /* get lower 26 bits from original address */
-    dst |= addr & 0x3ffffe0;
+
+    sh4_memcpy_to_guest(mem, dst, sh4->sq[sqi], 32);
+    return;
   }
 
-  sh4_memcpy_to_guest(mem, dst, sh4->sq[sqi], 32);
+  /* get lower 26 bits from original address */
+  struct sh4_sq_dst *sq_dst = &sh4->sq_dst[sqi];
+  uint32_t dst = sq_dst->base | (addr & 0x3ffffe0);
+
+  if (sq_dst->ptr) {
+    memcpy(sq_dst->ptr + (dst & sq_dst->ptr_mask), sh4->sq[sqi], 32);
+    mem_ram_dirty(mem, dst & sq_dst->ptr_mask, 32);
+  } else if (sq_dst->write) {
+    sq_dst->write(sq_dst->data, dst, (const uint8_t *)sh4->sq[sqi], 32);
+  } else {
+    sh4_memcpy_to_guest(mem, dst, sh4->sq[sqi], 32);
+  }
 }
 
 uint32_t sh4_ccn_cache_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
@@ -127,14 +157,16 @@ void sh4_ccn_ocache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
   /* ignore */
 }
 
-REG_W32(sh4_cb, MMUCR) {
+REG_W32(sh4_cb, QACR0) {
   struct sh4 *sh4 = dc->sh4;
+  *sh4->QACR0 = value;
+  sh4_ccn_sq_resolve(sh4, &sh4->sq_dst[0], value);
+}
 
-  sh4->MMUCR->full = value;
-
-  if (sh4->MMUCR->AT) {
-    LOG_WARNING("MMU not fully supported");
-  }
+REG_W32(sh4_cb, QACR1) {
+  struct sh4 *sh4 = dc->sh4;
+  *sh4->QACR1 = value;
+  sh4_ccn_sq_resolve(sh4, &sh4->sq_dst[1], value);
 }
 
 REG_W32(sh4_cb, CCR) {
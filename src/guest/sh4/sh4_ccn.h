@@ -1,6 +1,23 @@
 #ifndef SH4_CCN_H
 #define SH4_CCN_H
 
+#include "guest/memory.h"
+
+struct sh4;
+
+/* destination of a store queue flush, resolved whenever the QACR registers
+   are written rather than on each pref */
+struct sh4_sq_dst {
+  uint32_t base;
+  /* host memory directly backing the destination area, if any */
+  uint8_t *ptr;
+  uint32_t ptr_mask;
+  /* else, the handler servicing it */
+  mmio_write_string_cb write;
+  void *data;
+};
+
+void sh4_ccn_sq_remap(struct sh4 *sh4);
 void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr);
 uint32_t sh4_ccn_cache_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_ccn_cache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
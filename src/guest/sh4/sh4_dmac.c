@@ -1,39 +1,164 @@
 #include "guest/memory.h"
+#include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 
-static void sh4_dmac_check(struct sh4 *sh4, int channel) {
-  union chcr *chcr = NULL;
+/* dual address mode transfers are split into bursts, each landing once the
+   time it would have taken on the hardware has elapsed. this lets the cpu run
+   alongside the transfer as it does on the real hardware, polling DMATCR or
+   waiting on DMTE, instead of stalling for the entire transfer at once */
+#define SH4_DMAC_BURST_SIZE 0x2000
+
+/* the dmac moves 32-byte blocks across the 64-bit x 100mhz system bus */
+#define SH4_DMAC_BUS_FREQ INT64_C(100000000)
+#define SH4_DMAC_BUS_WIDTH 8
 
+static void sh4_dmac_channel_regs(struct sh4 *sh4, int channel, uint32_t **sar,
+                                  uint32_t **dar, uint32_t **dmatcr,
+                                  union chcr **chcr,
+                                  enum sh4_interrupt *dmte) {
   switch (channel) {
     case 0:
-      chcr = sh4->CHCR0;
+      *sar = sh4->SAR0;
+      *dar = sh4->DAR0;
+      *dmatcr = sh4->DMATCR0;
+      *chcr = sh4->CHCR0;
+      *dmte = SH4_INT_DMTE0;
       break;
     case 1:
-      chcr = sh4->CHCR1;
+      *sar = sh4->SAR1;
+      *dar = sh4->DAR1;
+      *dmatcr = sh4->DMATCR1;
+      *chcr = sh4->CHCR1;
+      *dmte = SH4_INT_DMTE1;
       break;
     case 2:
-      chcr = sh4->CHCR2;
+      *sar = sh4->SAR2;
+      *dar = sh4->DAR2;
+      *dmatcr = sh4->DMATCR2;
+      *chcr = sh4->CHCR2;
+      *dmte = SH4_INT_DMTE2;
       break;
     case 3:
-      chcr = sh4->CHCR3;
+      *sar = sh4->SAR3;
+      *dar = sh4->DAR3;
+      *dmatcr = sh4->DMATCR3;
+      *chcr = sh4->CHCR3;
+      *dmte = SH4_INT_DMTE3;
       break;
     default:
-      LOG_FATAL("sh4_dmac_check unexpected channel %d", channel);
+      LOG_FATAL("Unexpected DMA channel");
       break;
   }
+}
+
+/* abandon the channel's in-flight transfer. SAR / DAR / DMATCR are left
+   reflecting the bursts which had already landed */
+static void sh4_dmac_stop(struct sh4 *sh4, int channel) {
+  struct scheduler *sched = sh4->dc->sched;
+  struct sh4_dmac_channel *ch = &sh4->dmac[channel];
+
+  if (!ch->timer) {
+    return;
+  }
 
-  CHECK(sh4->DMAOR->DDT || !sh4->DMAOR->DME || !chcr->DE,
-        "sh4_dmac_check only DDT DMA unsupported");
+  sched_cancel_timer(sched, ch->timer);
+  ch->timer = NULL;
+  ch->done = NULL;
+  ch->done_data = NULL;
 }
 
-void sh4_dmac_ddt(struct sh4 *sh4, struct sh4_dtr *dtr) {
+static void sh4_dmac_check(struct sh4 *sh4, int channel) {
+  uint32_t *sar, *dar, *dmatcr;
+  union chcr *chcr;
+  enum sh4_interrupt dmte;
+  sh4_dmac_channel_regs(sh4, channel, &sar, &dar, &dmatcr, &chcr, &dmte);
+
+  /* clearing either enable bit halts the channel part way through */
+  if (!sh4->DMAOR->DME || !chcr->DE) {
+    sh4_dmac_stop(sh4, channel);
+    return;
+  }
+
+  CHECK(sh4->DMAOR->DDT, "sh4_dmac_check only DDT DMA unsupported");
+}
+
+static int64_t sh4_dmac_burst_time(uint32_t dmatcr) {
+  int size = MIN(dmatcr * 32, SH4_DMAC_BURST_SIZE);
+  return CYCLES_TO_NANO(size / SH4_DMAC_BUS_WIDTH, SH4_DMAC_BUS_FREQ);
+}
+
+static void sh4_dmac_burst(struct sh4 *sh4, int channel);
+
+static void sh4_dmac_burst_0(void *data) {
+  sh4_dmac_burst(data, 0);
+}
+
+static void sh4_dmac_burst_1(void *data) {
+  sh4_dmac_burst(data, 1);
+}
+
+static void sh4_dmac_burst_2(void *data) {
+  sh4_dmac_burst(data, 2);
+}
+
+static void sh4_dmac_burst_3(void *data) {
+  sh4_dmac_burst(data, 3);
+}
+
+static timer_cb sh4_dmac_timers[4] = {
+    &sh4_dmac_burst_0, &sh4_dmac_burst_1, &sh4_dmac_burst_2, &sh4_dmac_burst_3,
+};
+
+static void sh4_dmac_burst(struct sh4 *sh4, int channel) {
   struct memory *mem = sh4->dc->mem;
+  struct scheduler *sched = sh4->dc->sched;
+  struct sh4_dmac_channel *ch = &sh4->dmac[channel];
+
+  uint32_t *sar, *dar, *dmatcr;
+  union chcr *chcr;
+  enum sh4_interrupt dmte;
+  sh4_dmac_channel_regs(sh4, channel, &sar, &dar, &dmatcr, &chcr, &dmte);
+
+  ch->timer = NULL;
+
+  /* ram -> ram and ram -> ta bursts resolve to a single memcpy / write_string
+     call inside of sh4_memcpy */
+  int n = MIN(*dmatcr * 32, SH4_DMAC_BURST_SIZE);
+  sh4_memcpy(mem, ch->dst, ch->src, n);
+
+  /* update src / dst addresses as well as remaining count */
+  ch->src += n;
+  ch->dst += n;
+  *sar = ch->src;
+  *dar = ch->dst;
+  *dmatcr -= n / 32;
+
+  if (*dmatcr) {
+    ch->timer = sched_start_timer(sched, sh4_dmac_timers[channel], sh4,
+                                  sh4_dmac_burst_time(*dmatcr));
+    return;
+  }
 
-  /* FIXME this should be made asynchronous, at which point the significance
-     of the registers / interrupts should be more obvious */
+  /* signal transfer end */
+  chcr->TE = 1;
+
+  /* raise interrupt if requested */
+  if (chcr->IE) {
+    sh4_raise_interrupt(sh4, dmte);
+  }
+
+  if (ch->done) {
+    ch->done(ch->done_data);
+  }
+}
+
+void sh4_dmac_ddt(struct sh4 *sh4, struct sh4_dtr *dtr) {
+  struct memory *mem = sh4->dc->mem;
+  struct scheduler *sched = sh4->dc->sched;
 
   if (dtr->data) {
-    /* single address mode transfer */
+    /* single address mode transfer. these are driven by the external device,
+       which paces each call itself */
     if (dtr->dir == SH4_DMA_FROM_ADDR) {
       sh4_memcpy_to_host(mem, dtr->data, dtr->addr, dtr->size);
     } else {
@@ -41,63 +166,41 @@ void sh4_dmac_ddt(struct sh4 *sh4, struct sh4_dtr *dtr) {
     }
   } else {
     /* dual address mode transfer */
-    uint32_t *sar;
-    uint32_t *dar;
-    uint32_t *dmatcr;
+    uint32_t *sar, *dar, *dmatcr;
     union chcr *chcr;
     enum sh4_interrupt dmte;
+    sh4_dmac_channel_regs(sh4, dtr->channel, &sar, &dar, &dmatcr, &chcr,
+                          &dmte);
 
-    switch (dtr->channel) {
-      case 0:
-        sar = sh4->SAR0;
-        dar = sh4->DAR0;
-        dmatcr = sh4->DMATCR0;
-        chcr = sh4->CHCR0;
-        dmte = SH4_INT_DMTE0;
-        break;
-      case 1:
-        sar = sh4->SAR1;
-        dar = sh4->DAR1;
-        dmatcr = sh4->DMATCR1;
-        chcr = sh4->CHCR1;
-        dmte = SH4_INT_DMTE1;
-        break;
-      case 2:
-        sar = sh4->SAR2;
-        dar = sh4->DAR2;
-        dmatcr = sh4->DMATCR2;
-        chcr = sh4->CHCR2;
-        dmte = SH4_INT_DMTE2;
-        break;
-      case 3:
-        sar = sh4->SAR3;
-        dar = sh4->DAR3;
-        dmatcr = sh4->DMATCR3;
-        chcr = sh4->CHCR3;
-        dmte = SH4_INT_DMTE3;
-        break;
-      default:
-        LOG_FATAL("Unexpected DMA channel");
-        break;
-    }
+    struct sh4_dmac_channel *ch = &sh4->dmac[dtr->channel];
 
-    uint32_t src = dtr->dir == SH4_DMA_FROM_ADDR ? dtr->addr : *sar;
-    uint32_t dst = dtr->dir == SH4_DMA_FROM_ADDR ? *dar : dtr->addr;
-    int size = *dmatcr * 32;
-    sh4_memcpy(mem, dst, src, size);
+    /* the guest is free to restart a busy channel, the new request replaces
+       the in-flight one */
+    sh4_dmac_stop(sh4, dtr->channel);
 
-    /* update src / addresses as well as remaining count */
-    *sar = src + size;
-    *dar = dst + size;
-    *dmatcr = 0;
+    /* latch transfer state */
+    ch->src = dtr->dir == SH4_DMA_FROM_ADDR ? dtr->addr : *sar;
+    ch->dst = dtr->dir == SH4_DMA_FROM_ADDR ? *dar : dtr->addr;
+    ch->done = dtr->done;
+    ch->done_data = dtr->done_data;
 
-    /* signal transfer end */
-    chcr->TE = 1;
+    /* kick off async dma */
+    ch->timer = sched_start_timer(sched, sh4_dmac_timers[dtr->channel], sh4,
+                                  sh4_dmac_burst_time(*dmatcr));
+  }
+}
+
+void sh4_dmac_reset(struct sh4 *sh4) {
+  struct scheduler *sched = sh4->dc->sched;
 
-    /* raise interrupt if requested */
-    if (chcr->IE) {
-      sh4_raise_interrupt(sh4, dmte);
+  for (int i = 0; i < ARRAY_SIZE(sh4->dmac); i++) {
+    struct sh4_dmac_channel *ch = &sh4->dmac[i];
+
+    if (ch->timer) {
+      sched_cancel_timer(sched, ch->timer);
     }
+
+    memset(ch, 0, sizeof(*ch));
   }
 }
 
@@ -1,11 +1,16 @@
 #ifndef SH4_DMAC_H
 #define SH4_DMAC_H
 
+struct sh4;
+struct timer;
+
 enum {
   SH4_DMA_FROM_ADDR,
   SH4_DMA_TO_ADDR,
 };
 
+typedef void (*sh4_dtr_cb)(void *);
+
 struct sh4_dtr {
   int channel;
   int dir;
@@ -19,8 +24,22 @@ struct sh4_dtr {
   /* size is only valid for single address mode transfers, dual address mode
      transfers honor DMATCR */
   int size;
+  /* dual address mode transfers complete asynchronously, done is called once
+     the final burst has been transferred and DMTE raised */
+  sh4_dtr_cb done;
+  void *done_data;
+};
+
+/* state for an in-flight dual address mode transfer */
+struct sh4_dmac_channel {
+  struct timer *timer;
+  uint32_t src;
+  uint32_t dst;
+  sh4_dtr_cb done;
+  void *done_data;
 };
 
+void sh4_dmac_reset(struct sh4 *sh4);
 void sh4_dmac_ddt(struct sh4 *sh, struct sh4_dtr *dtr);
 
 #endif
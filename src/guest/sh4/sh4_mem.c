@@ -11,6 +11,8 @@ static uint32_t sh4_reg_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
   uint32_t offset = SH4_REG_OFFSET(addr);
   reg_read_cb read = sh4_cb[offset].read;
 
+  mem_count_reg(sh4->dc->mem, MEM_REGS_SH4, offset, 0);
+
   uint32_t data;
   if (read) {
     data = read(sh4->dc);
@@ -30,6 +32,8 @@ static void sh4_reg_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
   uint32_t offset = SH4_REG_OFFSET(addr);
   reg_write_cb write = sh4_cb[offset].write;
 
+  mem_count_reg(sh4->dc->mem, MEM_REGS_SH4, offset, 1);
+
   if (sh4->log_regs) {
     LOG_INFO("sh4_reg_write addr=0x%08x data=0x%x", addr, data & mask);
   }
@@ -174,6 +178,46 @@ uint32_t sh4_area1_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
   }
 }
 
+void sh4_area1_write_string(struct sh4 *sh4, uint32_t addr,
+                            const uint8_t *src, int size) {
+  struct dreamcast *dc = sh4->dc;
+
+  addr &= SH4_ADDR_MASK;
+
+  /* create the mirror */
+  addr &= SH4_AREA1_ADDR_MASK;
+
+  uint32_t last = addr + size - 1;
+
+  if (addr >= SH4_PVR_VRAM64_BEGIN && last <= SH4_PVR_VRAM64_END) {
+    pvr_vram64_write_string(dc->pvr, addr - SH4_PVR_VRAM64_BEGIN, src, size);
+  } else if (addr >= SH4_PVR_VRAM32_BEGIN && last <= SH4_PVR_VRAM32_END) {
+    pvr_vram32_write_string(dc->pvr, addr - SH4_PVR_VRAM32_BEGIN, src, size);
+  } else {
+    mmio_write_string(sh4, (mmio_write_cb)&sh4_area1_write, addr, src, size);
+  }
+}
+
+void sh4_area1_read_string(struct sh4 *sh4, uint8_t *dst, uint32_t addr,
+                           int size) {
+  struct dreamcast *dc = sh4->dc;
+
+  addr &= SH4_ADDR_MASK;
+
+  /* create the mirror */
+  addr &= SH4_AREA1_ADDR_MASK;
+
+  uint32_t last = addr + size - 1;
+
+  if (addr >= SH4_PVR_VRAM64_BEGIN && last <= SH4_PVR_VRAM64_END) {
+    pvr_vram64_read_string(dc->pvr, dst, addr - SH4_PVR_VRAM64_BEGIN, size);
+  } else if (addr >= SH4_PVR_VRAM32_BEGIN && last <= SH4_PVR_VRAM32_END) {
+    pvr_vram32_read_string(dc->pvr, dst, addr - SH4_PVR_VRAM32_BEGIN, size);
+  } else {
+    mmio_read_string(sh4, (mmio_read_cb)&sh4_area1_read, dst, addr, size);
+  }
+}
+
 void sh4_area0_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                      uint32_t mask) {
   struct dreamcast *dc = sh4->dc;
@@ -245,3 +289,200 @@ uint32_t sh4_area0_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
     LOG_FATAL("sh4_area0_read unexpected addr 0x%08x", addr);
   }
 }
+
+/* string accesses made by dma transfers resolve the device once for the entire
+   transfer, rather than once per byte as falling back to the scalar handlers
+   would. transfers spanning more than one device fall back to the scalar
+   handlers */
+void sh4_area0_write_string(struct sh4 *sh4, uint32_t addr,
+                            const uint8_t *src, int size) {
+  struct dreamcast *dc = sh4->dc;
+
+  /* mask off upper bits creating p0-p4 mirrors */
+  addr &= SH4_ADDR_MASK;
+
+  uint32_t phys = addr;
+  uint32_t last = addr + size - 1;
+
+  /* flash rom is not accessible in the area 0 mirror */
+  if (addr >= SH4_FLASH_ROM_BEGIN && last <= SH4_FLASH_ROM_END) {
+    mmio_write_string(dc->flash, (mmio_write_cb)&flash_rom_write,
+                      addr - SH4_FLASH_ROM_BEGIN, src, size);
+    return;
+  }
+
+  /* create the mirror */
+  addr &= SH4_AREA0_ADDR_MASK;
+  last = addr + size - 1;
+
+  if (/*addr >= SH4_BOOT_ROM_BEGIN*/ last <= SH4_BOOT_ROM_END) {
+    /* read-only */
+  } else if (addr >= SH4_HOLLY_REG_BEGIN && last <= SH4_HOLLY_REG_END) {
+    mmio_write_string(dc->holly, (mmio_write_cb)&holly_reg_write,
+                      addr - SH4_HOLLY_REG_BEGIN, src, size);
+  } else if (addr >= SH4_PVR_REG_BEGIN && last <= SH4_PVR_REG_END) {
+    mmio_write_string(dc->pvr, (mmio_write_cb)&pvr_reg_write,
+                      addr - SH4_PVR_REG_BEGIN, src, size);
+  } else if (addr >= SH4_MODEM_BEGIN && last <= SH4_MODEM_END) {
+    /* nop */
+  } else if (addr >= SH4_AICA_REG_BEGIN && last <= SH4_AICA_REG_END) {
+    mmio_write_string(dc->aica, (mmio_write_cb)&aica_reg_write,
+                      addr - SH4_AICA_REG_BEGIN, src, size);
+  } else if (addr >= SH4_AICA_MEM_BEGIN && last <= SH4_AICA_MEM_END) {
+    memcpy(mem_aram(dc->mem, addr - SH4_AICA_MEM_BEGIN), src, size);
+    mem_aram_dirty(dc->mem, addr - SH4_AICA_MEM_BEGIN, size);
+  } else if (addr >= SH4_HOLLY_EXT_BEGIN && last <= SH4_HOLLY_EXT_END) {
+    /* nop */
+  } else {
+    mmio_write_string(sh4, (mmio_write_cb)&sh4_area0_write, phys, src, size);
+  }
+}
+
+void sh4_area0_read_string(struct sh4 *sh4, uint8_t *dst, uint32_t addr,
+                           int size) {
+  struct dreamcast *dc = sh4->dc;
+
+  /* mask off upper bits creating p0-p4 mirrors */
+  addr &= SH4_ADDR_MASK;
+
+  uint32_t phys = addr;
+  uint32_t last = addr + size - 1;
+
+  /* boot / flash rom are not accessible in the area 0 mirror */
+  if (/*addr >= SH4_BOOT_ROM_BEGIN &&*/ last <= SH4_BOOT_ROM_END) {
+    boot_rom_read_string(dc->boot, dst, addr - SH4_BOOT_ROM_BEGIN, size);
+    return;
+  } else if (addr >= SH4_FLASH_ROM_BEGIN && last <= SH4_FLASH_ROM_END) {
+    flash_rom_read_string(dc->flash, dst, addr - SH4_FLASH_ROM_BEGIN, size);
+    return;
+  }
+
+  /* create the mirror */
+  addr &= SH4_AREA0_ADDR_MASK;
+  last = addr + size - 1;
+
+  if (/*addr >= SH4_BOOT_ROM_BEGIN*/ last <= SH4_FLASH_ROM_END &&
+      phys > SH4_FLASH_ROM_END) {
+    memset(dst, 0xff, size);
+  } else if (addr >= SH4_HOLLY_REG_BEGIN && last <= SH4_HOLLY_REG_END) {
+    mmio_read_string(dc->holly, (mmio_read_cb)&holly_reg_read, dst,
+                     addr - SH4_HOLLY_REG_BEGIN, size);
+  } else if (addr >= SH4_PVR_REG_BEGIN && last <= SH4_PVR_REG_END) {
+    mmio_read_string(dc->pvr, (mmio_read_cb)&pvr_reg_read, dst,
+                     addr - SH4_PVR_REG_BEGIN, size);
+  } else if (addr >= SH4_MODEM_BEGIN && last <= SH4_MODEM_END) {
+    memset(dst, 0, size);
+  } else if (addr >= SH4_AICA_REG_BEGIN && last <= SH4_AICA_REG_END) {
+    mmio_read_string(dc->aica, (mmio_read_cb)&aica_reg_read, dst,
+                     addr - SH4_AICA_REG_BEGIN, size);
+  } else if (addr >= SH4_AICA_MEM_BEGIN && last <= SH4_AICA_MEM_END) {
+    memcpy(dst, mem_aram(dc->mem, addr - SH4_AICA_MEM_BEGIN), size);
+  } else if (addr >= SH4_HOLLY_EXT_BEGIN && last <= SH4_HOLLY_EXT_END) {
+    memset(dst, 0, size);
+  } else {
+    mmio_read_string(sh4, (mmio_read_cb)&sh4_area0_read, dst, phys, size);
+  }
+}
+
+/*
+ * constant address resolution
+ *
+ * the jit uses this to resolve mmio accesses with a constant address at compile
+ * time, directly to the device handler servicing the register. this skips the
+ * page-level area callbacks above, and the cascade of range checks they
+ * perform on each access
+ */
+
+/* pure status registers. these are only updated by their owning device and have
+   no side effects when read, so the jit can inline loads from them straight
+   from the register storage. games frequently sit in polling loops on these.
+   note, entries here must not have a read callback registered */
+static uint32_t *sh4_holly_status_reg(struct holly *hl, uint32_t offset) {
+  switch (offset >> 2) {
+    case SB_ISTEXT:
+    case SB_ISTERR:
+    case SB_C2DST:
+    case SB_MDST:
+    case SB_GDST:
+    case SB_ADST:
+      return &hl->reg[offset >> 2];
+  }
+  return NULL;
+}
+
+int sh4_mem_lookup_mmio(struct sh4 *sh4, uint32_t addr, void **userdata,
+                        uint32_t *offset, mmio_read_cb *read,
+                        mmio_write_cb *write, uint32_t **reg) {
+  struct dreamcast *dc = sh4->dc;
+  uint32_t *status = NULL;
+
+  /* on-chip ram is only accessible from P0 and isn't a register block */
+  if (addr >= SH4_CACHE_BEGIN && addr <= SH4_CACHE_END) {
+    return 0;
+  }
+
+  /* area 7 is mirrored in P0-P4 */
+  uint32_t phys = addr & SH4_ADDR_MASK;
+
+  if (phys >= SH4_REG_BEGIN && phys <= SH4_REG_END) {
+    *userdata = sh4;
+    *offset = phys - SH4_REG_BEGIN;
+    if (read) {
+      *read = (mmio_read_cb)&sh4_reg_read;
+    }
+    if (write) {
+      *write = (mmio_write_cb)&sh4_reg_write;
+    }
+    if (reg) {
+      *reg = NULL;
+    }
+    return 1;
+  }
+
+  /* area 0 isn't mapped in P4, and the boot / flash rom are only accessible
+     outside of its mirror */
+  if (addr >= SH4_P4_BEGIN || phys > SH4_AREA0_END ||
+      phys <= SH4_FLASH_ROM_END) {
+    return 0;
+  }
+
+  phys &= SH4_AREA0_ADDR_MASK;
+
+  if (phys >= SH4_HOLLY_REG_BEGIN && phys <= SH4_HOLLY_REG_END) {
+    *userdata = dc->holly;
+    *offset = phys - SH4_HOLLY_REG_BEGIN;
+    if (read) {
+      *read = (mmio_read_cb)&holly_reg_read;
+    }
+    if (write) {
+      *write = (mmio_write_cb)&holly_reg_write;
+    }
+    status = sh4_holly_status_reg(dc->holly, *offset);
+  } else if (phys >= SH4_PVR_REG_BEGIN && phys <= SH4_PVR_REG_END) {
+    *userdata = dc->pvr;
+    *offset = phys - SH4_PVR_REG_BEGIN;
+    if (read) {
+      *read = (mmio_read_cb)&pvr_reg_read;
+    }
+    if (write) {
+      *write = (mmio_write_cb)&pvr_reg_write;
+    }
+  } else if (phys >= SH4_AICA_REG_BEGIN && phys <= SH4_AICA_REG_END) {
+    *userdata = dc->aica;
+    *offset = phys - SH4_AICA_REG_BEGIN;
+    if (read) {
+      *read = (mmio_read_cb)&aica_reg_read;
+    }
+    if (write) {
+      *write = (mmio_write_cb)&aica_reg_write;
+    }
+  } else {
+    return 0;
+  }
+
+  if (reg) {
+    *reg = status;
+  }
+
+  return 1;
+}
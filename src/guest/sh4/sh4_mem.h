@@ -1,6 +1,8 @@
 #ifndef SH4_MEM_H
 #define SH4_MEM_H
 
+#include "guest/memory.h"
+
 /* clang-format off */
 #define SH4_AREA_SIZE        0x20000000
 #define SH4_ADDR_MASK        (SH4_AREA_SIZE-1)
@@ -122,10 +124,18 @@
 uint32_t sh4_area0_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_area0_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                      uint32_t mask);
+void sh4_area0_read_string(struct sh4 *sh4, uint8_t *dst, uint32_t addr,
+                           int size);
+void sh4_area0_write_string(struct sh4 *sh4, uint32_t addr,
+                            const uint8_t *src, int size);
 
 uint32_t sh4_area1_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_area1_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                      uint32_t mask);
+void sh4_area1_read_string(struct sh4 *sh4, uint8_t *dst, uint32_t addr,
+                           int size);
+void sh4_area1_write_string(struct sh4 *sh4, uint32_t addr,
+                            const uint8_t *src, int size);
 
 uint32_t sh4_area4_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_area4_write(struct sh4 *sh4, uint32_t addr, const uint8_t *ptr,
@@ -138,4 +148,8 @@ void sh4_area7_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
 uint32_t sh4_p4_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_p4_write(struct sh4 *sh4, uint32_t addr, uint32_t data, uint32_t mask);
 
+int sh4_mem_lookup_mmio(struct sh4 *sh4, uint32_t addr, void **userdata,
+                        uint32_t *offset, mmio_read_cb *read,
+                        mmio_write_cb *write, uint32_t **reg);
+
 #endif
@@ -1,4 +1,28 @@
+/*
+ * memory management unit implementation
+ *
+ * while MMUCR.AT is set, addresses in the P0 / U0 and P3 areas are translated
+ * through the 64-entry UTLB (data accesses) and 4-entry ITLB (instruction
+ * fetches). searching the UTLB on every access is far too slow, so each
+ * successful translation is cached in a direct-mapped software tlb which the
+ * jit probes inline, only calling back into sh4_mmu_translate on a miss
+ *
+ * compiled code is keyed by virtual address. to keep it valid, the UTLB / ITLB
+ * entries code has been fetched through are tracked, and all code is thrown
+ * out when one of them changes or, for private pages, when the ASID changes
+ *
+ * accesses which aren't permitted fail to translate, leaving the backend to
+ * call sh4_mmu_fault once the context is synced to the faulting instruction.
+ * the fault raises the tlb miss, protection violation, initial page write or
+ * address error exception the access caused, and the guest's handler restarts
+ * the instruction once it has refilled the tlb
+ */
+
 #include "guest/sh4/sh4.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "jit/frontend/sh4/sh4_disasm.h"
+#include "jit/jit.h"
 
 #if 0
 #define LOG_MMU LOG_INFO
@@ -7,8 +31,12 @@
 #endif
 
 #define TLB_INDEX(addr) (((addr) >> 8) & 0x3f)
+#define ITLB_INDEX(addr) (((addr) >> 8) & 0x3)
+
+/* bits of the ptel format stored by the ITLB, it only stores bit 1 of PR */
+#define ITLB_DATA_MASK 0x1ffffdda
 
-/*#define PAGE_SIZE(entry) (((entry)->lo.SZ1 << 1) | (entry)->lo.SZ0)*/
+#define PAGE_SIZE(entry) (((entry)->lo.SZ1 << 1) | (entry)->lo.SZ0)
 
 enum {
   PAGE_SIZE_1KB,
@@ -17,6 +45,10 @@ enum {
   PAGE_SIZE_1MB,
 };
 
+static uint32_t sh4_page_masks[] = {
+    0xfffffc00, 0xfffff000, 0xffff0000, 0xfff00000,
+};
+
 static void sh4_mmu_utlb_sync(struct sh4 *sh4, struct sh4_tlb_entry *entry) {
   int n = (int)(entry - sh4->utlb);
 
@@ -30,31 +62,297 @@ static void sh4_mmu_utlb_sync(struct sh4 *sh4, struct sh4_tlb_entry *entry) {
     sh4->utlb_sq_map[vpn & 0x3f] = ppn;
 
     LOG_INFO("sh4_mmu_utlb_sync sq map (%d) 0x%x -> 0x%x", n, vpn, ppn);
+  }
+}
+
+static void sh4_mmu_invalidate_code(struct sh4 *sh4) {
+  jit_invalidate_code(sh4->jit);
+
+  sh4->utlb_code = 0;
+  sh4->itlb_code = 0;
+  sh4->asid_code = 0;
+}
+
+static void sh4_mmu_utlb_updated(struct sh4 *sh4, int n) {
+  sh4_mmu_utlb_sync(sh4, &sh4->utlb[n]);
+
+  if (!sh4->MMUCR->AT) {
+    return;
+  }
+
+  sh4_mmu_flush(sh4);
+
+  if (sh4->utlb_code & (UINT64_C(1) << n)) {
+    sh4_mmu_invalidate_code(sh4);
+  }
+}
+
+static void sh4_mmu_itlb_updated(struct sh4 *sh4, int n) {
+  /* entries written through the array don't come from the UTLB */
+  sh4->itlb_src[n] = -1;
+
+  if (sh4->itlb_code & (1u << n)) {
+    sh4_mmu_invalidate_code(sh4);
+  }
+}
+
+static int sh4_mmu_shared(struct sh4 *sh4, struct sh4_tlb_entry *entry) {
+  /* the asid is ignored for shared pages, and for privileged accesses in
+     single virtual memory mode */
+  return entry->lo.SH || (sh4->MMUCR->SV && (sh4->ctx.sr & MD_MASK));
+}
+
+static int sh4_mmu_match(struct sh4 *sh4, struct sh4_tlb_entry *entry,
+                         uint32_t addr, uint32_t asid) {
+  uint32_t mask = sh4_page_masks[PAGE_SIZE(entry)];
+
+  if (!entry->lo.V || ((entry->hi.VPN << 10) & mask) != (addr & mask)) {
+    return 0;
+  }
+
+  return sh4_mmu_shared(sh4, entry) || entry->hi.ASID == asid;
+}
+
+static int sh4_mmu_search(struct sh4 *sh4, struct sh4_tlb_entry *tlb,
+                          int num_entries, uint32_t addr) {
+  int found = -1;
+
+  for (int i = 0; i < num_entries; i++) {
+    if (!sh4_mmu_match(sh4, &tlb[i], addr, sh4->PTEH->ASID)) {
+      continue;
+    }
+
+    if (found != -1) {
+      LOG_FATAL("sh4_mmu_search multiple hit for 0x%08x", addr);
+    }
+
+    found = i;
+  }
+
+  return found;
+}
+
+static uint32_t sh4_mmu_entry_addr(struct sh4_tlb_entry *entry,
+                                   uint32_t addr) {
+  uint32_t mask = sh4_page_masks[PAGE_SIZE(entry)];
+  return ((entry->lo.PPN << 10) & mask) | (addr & ~mask);
+}
+
+static int sh4_mmu_translate_code(struct sh4 *sh4, uint32_t addr,
+                                  uint32_t *phys, enum sh4_exception *exc) {
+  int n = sh4_mmu_search(sh4, sh4->itlb, ARRAY_SIZE(sh4->itlb), addr);
+
+  /* on an ITLB miss, refill it from the UTLB */
+  if (n == -1) {
+    int m = sh4_mmu_search(sh4, sh4->utlb, ARRAY_SIZE(sh4->utlb), addr);
+
+    if (m == -1) {
+      *exc = SH4_EXC_ITLBMISS;
+      return 0;
+    }
+
+    n = sh4->itlb_next;
+    sh4->itlb_next = (n + 1) % ARRAY_SIZE(sh4->itlb);
+    sh4->itlb[n].hi = sh4->utlb[m].hi;
+    sh4->itlb[n].lo.full = sh4->utlb[m].lo.full & ITLB_DATA_MASK;
+    sh4->itlb_src[n] = m;
+  }
+
+  struct sh4_tlb_entry *entry = &sh4->itlb[n];
+
+  if (!(sh4->ctx.sr & MD_MASK) && !(entry->lo.PR & 2)) {
+    *exc = SH4_EXC_ITLBPROT;
+    return 0;
+  }
+
+  /* track the entry so the code can be invalidated if it's changed */
+  if (sh4->itlb_src[n] != -1) {
+    sh4->utlb_code |= UINT64_C(1) << sh4->itlb_src[n];
   } else {
-    LOG_WARNING("sh4_mmu_utlb_sync memory mapping not supported");
+    sh4->itlb_code |= 1u << n;
   }
+
+  if (!sh4_mmu_shared(sh4, entry)) {
+    sh4->asid_code = 1;
+  }
+
+  *phys = sh4_mmu_entry_addr(entry, addr);
+  return 1;
 }
 
-static void sh4_mmu_translate(struct sh4 *sh4, uint32_t addr) {}
+static int sh4_mmu_translate_data(struct sh4 *sh4, uint32_t addr, int write,
+                                  uint32_t *phys, enum sh4_exception *exc) {
+  int n = sh4_mmu_search(sh4, sh4->utlb, ARRAY_SIZE(sh4->utlb), addr);
+
+  if (n == -1) {
+    *exc = write ? SH4_EXC_DTLBMISSW : SH4_EXC_DTLBMISSR;
+    return 0;
+  }
+
+  struct sh4_tlb_entry *entry = &sh4->utlb[n];
+
+  /* bit 1 of PR grants user mode access, bit 0 grants write access */
+  if ((!(sh4->ctx.sr & MD_MASK) && !(entry->lo.PR & 2)) ||
+      (write && !(entry->lo.PR & 1))) {
+    *exc = write ? SH4_EXC_DTLBPROTW : SH4_EXC_DTLBPROTR;
+    return 0;
+  }
+
+  if (write && !entry->lo.D) {
+    *exc = SH4_EXC_PAGEWRITE;
+    return 0;
+  }
+
+  *phys = sh4_mmu_entry_addr(entry, addr);
+  return 1;
+}
+
+static int sh4_mmu_lookup(struct sh4 *sh4, uint32_t addr, int access,
+                          uint32_t *phys, enum sh4_exception *exc) {
+  /* P1, P2 and P4 aren't accessible from user mode, with the exception of the
+     store queues when MMUCR.SQMD is clear */
+  if ((addr & 0x80000000) && !(sh4->ctx.sr & MD_MASK)) {
+    int sq = addr >= 0xe0000000 && addr <= 0xe3ffffff;
+
+    if (!sq || sh4->MMUCR->SQMD) {
+      if (access == JIT_ACCESS_FETCH) {
+        *exc = SH4_EXC_IADR;
+      } else {
+        *exc = access == JIT_ACCESS_WRITE ? SH4_EXC_DADRWR : SH4_EXC_DADRRD;
+      }
+      return 0;
+    }
+  }
+
+  /* only P0 / U0 and P3 are translated */
+  if (addr < 0x80000000 || (addr >= 0xc0000000 && addr < 0xe0000000)) {
+    if (access == JIT_ACCESS_FETCH) {
+      return sh4_mmu_translate_code(sh4, addr, phys, exc);
+    }
+
+    return sh4_mmu_translate_data(sh4, addr, access == JIT_ACCESS_WRITE, phys,
+                                  exc);
+  }
+
+  *phys = addr;
+  return 1;
+}
+
+int sh4_mmu_translate(struct sh4 *sh4, uint32_t addr, int access,
+                      uint32_t *phys) {
+  enum sh4_exception exc;
+
+  if (!sh4_mmu_lookup(sh4, addr, access, phys, &exc)) {
+    LOG_MMU("sh4_mmu_translate 0x%08x faulted", addr);
+    return 0;
+  }
+
+  LOG_MMU("sh4_mmu_translate 0x%08x -> 0x%08x", addr, *phys);
+
+  /* cache data translations for the jit's inline probes */
+  if (access != JIT_ACCESS_FETCH) {
+    struct jit_tlb_entry *tlb =
+        access == JIT_ACCESS_WRITE ? sh4->tlb_write : sh4->tlb_read;
+    uint32_t vpn = addr >> SH4_SOFT_TLB_SHIFT;
+    struct jit_tlb_entry *entry = &tlb[vpn & (SH4_SOFT_TLB_SIZE - 1)];
+    entry->tag = vpn;
+    entry->addend = *phys - addr;
+  }
+
+  return 1;
+}
+
+void sh4_mmu_fault(struct sh4 *sh4, uint32_t addr, int access) {
+  uint32_t phys;
+  enum sh4_exception exc;
+  int res = sh4_mmu_lookup(sh4, addr, access, &phys, &exc);
+  CHECK(!res, "sh4_mmu_fault access to 0x%08x is permitted", addr);
+
+  LOG_MMU("sh4_mmu_fault 0x%08x raised 0x%x", addr,
+          sh4_exceptions[exc].expevt);
+
+  /* the faulting address is reported in TEA and, for tlb exceptions, its page
+     number in PTEH for the handler to load the missing entry with */
+  *sh4->TEA = addr;
+
+  if (exc != SH4_EXC_IADR && exc != SH4_EXC_DADRRD && exc != SH4_EXC_DADRWR) {
+    sh4->PTEH->VPN = addr >> 10;
+  }
+
+  sh4_raise_exception(sh4, exc);
+}
+
+int sh4_mmu_fetch(struct sh4 *sh4, uint32_t addr) {
+  struct memory *mem = sh4->dc->mem;
+  uint32_t phys;
+
+  if (!sh4_mmu_translate(sh4, addr, JIT_ACCESS_FETCH, &phys)) {
+    sh4_mmu_fault(sh4, addr, JIT_ACCESS_FETCH);
+    return 0;
+  }
+
+  /* a fault fetching the delay slot is raised for the branch */
+  struct jit_opdef *def = sh4_get_opdef(sh4_read16(mem, phys));
+
+  if ((def->flags & SH4_FLAG_DELAYED) &&
+      !sh4_mmu_translate(sh4, addr + 2, JIT_ACCESS_FETCH, &phys)) {
+    sh4_mmu_fault(sh4, addr + 2, JIT_ACCESS_FETCH);
+    return 0;
+  }
+
+  return 1;
+}
+
+void sh4_mmu_flush(struct sh4 *sh4) {
+  /* no address shifts down to a tag of all ones */
+  memset(sh4->tlb_read, 0xff, sizeof(sh4->tlb_read));
+  memset(sh4->tlb_write, 0xff, sizeof(sh4->tlb_write));
+}
+
+void sh4_mmu_reset(struct sh4 *sh4) {
+  memset(sh4->utlb_sq_map, 0, sizeof(sh4->utlb_sq_map));
+  memset(sh4->utlb, 0, sizeof(sh4->utlb));
+  memset(sh4->itlb, 0, sizeof(sh4->itlb));
+  memset(sh4->itlb_src, 0xff, sizeof(sh4->itlb_src));
+  sh4->itlb_next = 0;
+  sh4->utlb_code = 0;
+  sh4->itlb_code = 0;
+  sh4->asid_code = 0;
+
+  sh4->guest->tlb_enabled = 0;
+  sh4_mmu_flush(sh4);
+}
 
 void sh4_mmu_ltlb(struct sh4 *sh4) {
   uint32_t n = sh4->MMUCR->URC;
   struct sh4_tlb_entry *entry = &sh4->utlb[n];
   entry->lo = *sh4->PTEL;
   entry->hi = *sh4->PTEH;
+  entry->assist = *sh4->PTEA;
 
-  sh4_mmu_utlb_sync(sh4, entry);
+  sh4_mmu_utlb_updated(sh4, n);
 }
 
 uint32_t sh4_mmu_itlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
+  struct sh4_tlb_entry *entry = &sh4->itlb[ITLB_INDEX(addr)];
+
   if (addr < 0x01000000) {
     LOG_MMU("sh4_mmu_itlb_read address array %08x", addr);
+
+    uint32_t data = entry->hi.full;
+    data |= entry->lo.V << 8;
+    return data;
   } else {
-    LOG_MMU("sh4_mmu_itlb_read data array %08x", addr);
-  }
+    if (addr & 0x800000) {
+      LOG_MMU("sh4_mmu_itlb_read data array 2 %08x", addr);
+
+      return entry->assist;
+    } else {
+      LOG_MMU("sh4_mmu_itlb_read data array 1 %08x", addr);
 
-  /* return an invalid entry */
-  return 0;
+      return entry->lo.full;
+    }
+  }
 }
 
 uint32_t sh4_mmu_utlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
@@ -68,7 +366,10 @@ uint32_t sh4_mmu_utlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
     return data;
   } else {
     if (addr & 0x800000) {
-      LOG_FATAL("sh4_mmu_utlb_read data array 2 %08x", addr);
+      LOG_MMU("sh4_mmu_utlb_read data array 2 %08x", addr);
+
+      struct sh4_tlb_entry *entry = &sh4->utlb[TLB_INDEX(addr)];
+      return entry->assist;
     } else {
       LOG_MMU("sh4_mmu_utlb_read data array 1 %08x", addr);
 
@@ -81,21 +382,69 @@ uint32_t sh4_mmu_utlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
 
 void sh4_mmu_itlb_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                         uint32_t mask) {
+  int n = ITLB_INDEX(addr);
+  struct sh4_tlb_entry *entry = &sh4->itlb[n];
+
   if (addr < 0x01000000) {
     LOG_MMU("sh4_mmu_itlb_write address array %08x %08x", addr, data);
+
+    entry->hi.full = data & 0xfffffcff;
+    entry->lo.V = (data >> 8) & 1;
   } else {
-    LOG_MMU("sh4_mmu_itlb_write data array %08x %08x", addr, data);
+    if (addr & 0x800000) {
+      LOG_MMU("sh4_mmu_itlb_write data array 2 %08x %08x", addr, data);
+
+      entry->assist = data & 0xf;
+    } else {
+      LOG_MMU("sh4_mmu_itlb_write data array 1 %08x %08x", addr, data);
+
+      entry->lo.full = data & ITLB_DATA_MASK;
+    }
   }
 
-  /* ignore */
+  sh4_mmu_itlb_updated(sh4, n);
 }
 
 void sh4_mmu_utlb_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                         uint32_t mask) {
   if (addr < 0x01000000) {
     if (addr & 0x80) {
-      LOG_FATAL("sh4_mmu_utlb_write address array (associative) %08x %08x",
-                addr, data);
+      LOG_MMU("sh4_mmu_utlb_write address array (associative) %08x %08x", addr,
+              data);
+
+      /* update the dirty and valid bits of the entry matching the written vpn
+         and asid. matching ITLB entries also have their valid bit updated */
+      uint32_t vpn = data & 0xfffffc00;
+      uint32_t asid = data & 0xff;
+      int found = 0;
+
+      for (int i = 0; i < ARRAY_SIZE(sh4->utlb); i++) {
+        struct sh4_tlb_entry *entry = &sh4->utlb[i];
+
+        if (!sh4_mmu_match(sh4, entry, vpn, asid)) {
+          continue;
+        }
+
+        if (found) {
+          LOG_FATAL("sh4_mmu_utlb_write multiple hit for 0x%08x", vpn);
+        }
+
+        found = 1;
+        entry->lo.D = (data >> 9) & 1;
+        entry->lo.V = (data >> 8) & 1;
+        sh4_mmu_utlb_updated(sh4, i);
+      }
+
+      for (int i = 0; i < ARRAY_SIZE(sh4->itlb); i++) {
+        struct sh4_tlb_entry *entry = &sh4->itlb[i];
+
+        if (!sh4_mmu_match(sh4, entry, vpn, asid)) {
+          continue;
+        }
+
+        entry->lo.V = (data >> 8) & 1;
+        sh4_mmu_itlb_updated(sh4, i);
+      }
     } else {
       LOG_MMU("sh4_mmu_utlb_write address array %08x %08x", addr, data);
 
@@ -104,18 +453,74 @@ void sh4_mmu_utlb_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
       entry->lo.D = (data >> 9) & 1;
       entry->lo.V = (data >> 8) & 1;
 
-      sh4_mmu_utlb_sync(sh4, entry);
+      sh4_mmu_utlb_updated(sh4, TLB_INDEX(addr));
     }
   } else {
     if (addr & 0x800000) {
-      LOG_FATAL("sh4_mmu_utlb_write data array 2 %08x %08x", addr, data);
+      LOG_MMU("sh4_mmu_utlb_write data array 2 %08x %08x", addr, data);
+
+      struct sh4_tlb_entry *entry = &sh4->utlb[TLB_INDEX(addr)];
+      entry->assist = data & 0xf;
     } else {
       LOG_MMU("sh4_mmu_utlb_write data array 1 %08x %08x", addr, data);
 
       struct sh4_tlb_entry *entry = &sh4->utlb[TLB_INDEX(addr)];
       entry->lo.full = data;
 
-      sh4_mmu_utlb_sync(sh4, entry);
+      sh4_mmu_utlb_updated(sh4, TLB_INDEX(addr));
     }
   }
 }
+
+REG_W32(sh4_cb, PTEH) {
+  struct sh4 *sh4 = dc->sh4;
+  uint32_t old_asid = sh4->PTEH->ASID;
+
+  sh4->PTEH->full = value;
+
+  if (!sh4->MMUCR->AT || sh4->PTEH->ASID == old_asid) {
+    return;
+  }
+
+  /* translations for private pages belonged to the old asid */
+  sh4_mmu_flush(sh4);
+
+  if (sh4->asid_code) {
+    sh4_mmu_invalidate_code(sh4);
+  }
+}
+
+REG_W32(sh4_cb, MMUCR) {
+  struct sh4 *sh4 = dc->sh4;
+  union mmucr old = *sh4->MMUCR;
+
+  sh4->MMUCR->full = value;
+
+  /* invalidate all UTLB / ITLB entries */
+  if (sh4->MMUCR->TI) {
+    for (int i = 0; i < ARRAY_SIZE(sh4->utlb); i++) {
+      sh4->utlb[i].lo.V = 0;
+      sh4_mmu_utlb_updated(sh4, i);
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(sh4->itlb); i++) {
+      sh4->itlb[i].lo.V = 0;
+      sh4_mmu_itlb_updated(sh4, i);
+    }
+
+    /* TI is write-only */
+    sh4->MMUCR->TI = 0;
+  }
+
+  if (sh4->MMUCR->AT != old.AT) {
+    LOG_INFO("sh4 address translation %s",
+             sh4->MMUCR->AT ? "enabled" : "disabled");
+
+    /* compiled code accesses memory differently with translation enabled */
+    sh4->guest->tlb_enabled = sh4->MMUCR->AT;
+    sh4_mmu_invalidate_code(sh4);
+    sh4_mmu_flush(sh4);
+  } else if (sh4->MMUCR->SV != old.SV) {
+    sh4_mmu_flush(sh4);
+  }
+}
@@ -3,11 +3,27 @@
 
 #include "guest/sh4/sh4_types.h"
 
+struct sh4;
+
+/* the software tlb is direct-mapped by 1kb page, the smallest page size */
+#define SH4_SOFT_TLB_SHIFT 10
+#define SH4_SOFT_TLB_SIZE 4096
+
 struct sh4_tlb_entry {
   union pteh hi;
   union ptel lo;
+  /* timing control / space attribute bits from data array 2 (PTEA), only
+     relevant to pcmcia accesses */
+  uint32_t assist;
 };
 
+void sh4_mmu_reset(struct sh4 *sh4);
+void sh4_mmu_flush(struct sh4 *sh4);
+int sh4_mmu_translate(struct sh4 *sh4, uint32_t addr, int access,
+                      uint32_t *phys);
+void sh4_mmu_fault(struct sh4 *sh4, uint32_t addr, int access);
+int sh4_mmu_fetch(struct sh4 *sh4, uint32_t addr);
+
 void sh4_mmu_ltlb(struct sh4 *sh4);
 uint32_t sh4_mmu_itlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 uint32_t sh4_mmu_utlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
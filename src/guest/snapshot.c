@@ -0,0 +1,241 @@
+#include "guest/snapshot.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/md5.h"
+
+#define SNAPSHOT_NAME_SIZE 16
+/* stored in place of a null function pointer, as a valid offset may be 0 */
+#define SNAPSHOT_NULL_FN INT64_MIN
+#define SNAPSHOT_FILE_MAGIC 0x50414e53
+
+struct snapshot {
+  uint8_t *data;
+  int capacity;
+  int size;
+  int cursor;
+  int error;
+};
+
+struct snapshot_section {
+  char name[SNAPSHOT_NAME_SIZE];
+  int32_t size;
+};
+
+/* prefixes the buffer when written to a file. the sections only describe the
+   layout of the state, the checksum catches a file of the right shape whose
+   contents have been corrupted */
+struct snapshot_file_header {
+  uint32_t magic;
+  int32_t size;
+  char checksum[33];
+};
+
+static void snapshot_checksum(struct snapshot *ss, char *checksum) {
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+  MD5_Update(&md5_ctx, ss->data, ss->size);
+  MD5_Final(checksum, &md5_ctx);
+}
+
+static void snapshot_reserve(struct snapshot *ss, int size) {
+  if (ss->size + size <= ss->capacity) {
+    return;
+  }
+
+  int capacity = MAX(ss->capacity, 1024 * 1024);
+  while (capacity < ss->size + size) {
+    capacity *= 2;
+  }
+
+  ss->data = realloc(ss->data, capacity);
+  ss->capacity = capacity;
+}
+
+int snapshot_read_section(struct snapshot *ss, const char *name) {
+  struct snapshot_section section;
+  SNAPSHOT_READ(ss, section);
+
+  if (ss->error || strncmp(section.name, name, SNAPSHOT_NAME_SIZE) ||
+      section.size < 0 || section.size > ss->size - ss->cursor) {
+    ss->error = 1;
+    return -1;
+  }
+
+  return section.size;
+}
+
+snapshot_fn snapshot_read_fn(struct snapshot *ss) {
+  int64_t offset;
+  SNAPSHOT_READ(ss, offset);
+
+  if (offset == SNAPSHOT_NULL_FN) {
+    return NULL;
+  }
+
+  return (snapshot_fn)((intptr_t)&snapshot_create + (intptr_t)offset);
+}
+
+void snapshot_read(struct snapshot *ss, void *data, int size) {
+  if (ss->error || size > ss->size - ss->cursor) {
+    /* leave the destination in a known state */
+    memset(data, 0, size);
+    ss->error = 1;
+    return;
+  }
+
+  memcpy(data, ss->data + ss->cursor, size);
+  ss->cursor += size;
+}
+
+void snapshot_end_section(struct snapshot *ss, int section) {
+  struct snapshot_section *header =
+      (struct snapshot_section *)(ss->data + section);
+  header->size = ss->size - section - (int)sizeof(*header);
+}
+
+int snapshot_begin_section(struct snapshot *ss, const char *name) {
+  struct snapshot_section header = {0};
+  strncpy(header.name, name, sizeof(header.name));
+
+  int section = ss->size;
+  SNAPSHOT_WRITE(ss, header);
+  return section;
+}
+
+void snapshot_write_fn(struct snapshot *ss, snapshot_fn fn) {
+  int64_t offset = SNAPSHOT_NULL_FN;
+
+  if (fn) {
+    offset = (int64_t)((intptr_t)fn - (intptr_t)&snapshot_create);
+  }
+
+  SNAPSHOT_WRITE(ss, offset);
+}
+
+void snapshot_write(struct snapshot *ss, const void *data, int size) {
+  snapshot_reserve(ss, size);
+  memcpy(ss->data + ss->size, data, size);
+  ss->size += size;
+}
+
+int snapshot_error(struct snapshot *ss) {
+  return ss->error;
+}
+
+void snapshot_seek(struct snapshot *ss, int offset) {
+  if (offset < 0 || offset > ss->size) {
+    ss->error = 1;
+    return;
+  }
+
+  ss->cursor = offset;
+}
+
+int snapshot_tell(struct snapshot *ss) {
+  return ss->cursor;
+}
+
+int snapshot_size(struct snapshot *ss) {
+  return ss->size;
+}
+
+const uint8_t *snapshot_data(struct snapshot *ss) {
+  return ss->data;
+}
+
+void snapshot_rewind(struct snapshot *ss) {
+  ss->cursor = 0;
+  ss->error = 0;
+}
+
+void snapshot_reset(struct snapshot *ss) {
+  ss->size = 0;
+  snapshot_rewind(ss);
+}
+
+int snapshot_load(struct snapshot *ss, const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return 0;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp) - (long)sizeof(struct snapshot_file_header);
+  fseek(fp, 0, SEEK_SET);
+
+  struct snapshot_file_header header;
+  int n = (int)fread(&header, 1, sizeof(header), fp);
+
+  if (n != (int)sizeof(header) || header.magic != SNAPSHOT_FILE_MAGIC ||
+      header.size != size) {
+    fclose(fp);
+    return 0;
+  }
+
+  snapshot_reset(ss);
+  snapshot_reserve(ss, header.size);
+
+  n = (int)fread(ss->data, 1, header.size, fp);
+  fclose(fp);
+
+  if (n != header.size) {
+    return 0;
+  }
+
+  ss->size = header.size;
+
+  char checksum[33];
+  snapshot_checksum(ss, checksum);
+
+  if (memcmp(checksum, header.checksum, sizeof(checksum))) {
+    snapshot_reset(ss);
+    return 0;
+  }
+
+  return 1;
+}
+
+int snapshot_save(struct snapshot *ss, const char *path) {
+  /* write out to a temporary file and move it into place once complete, so a
+     partially written file is never picked up */
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  FILE *fp = fopen(tmp, "wb");
+  if (!fp) {
+    return 0;
+  }
+
+  struct snapshot_file_header header = {0};
+  header.magic = SNAPSHOT_FILE_MAGIC;
+  header.size = ss->size;
+  snapshot_checksum(ss, header.checksum);
+
+  int res = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            (int)fwrite(ss->data, 1, ss->size, fp) == ss->size;
+  res &= fclose(fp) == 0;
+
+#if PLATFORM_WINDOWS
+  /* rename won't replace an existing file */
+  if (res) {
+    remove(path);
+  }
+#endif
+
+  if (!res || rename(tmp, path)) {
+    remove(tmp);
+    return 0;
+  }
+
+  return 1;
+}
+
+void snapshot_destroy(struct snapshot *ss) {
+  free(ss->data);
+  free(ss);
+}
+
+struct snapshot *snapshot_create() {
+  struct snapshot *ss = calloc(1, sizeof(struct snapshot));
+  return ss;
+}
@@ -0,0 +1,57 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+/*
+ * in-memory buffer machine state is streamed to and from. the buffer is
+ * reused between snapshots, so once it has grown to fit the machine taking
+ * another snapshot doesn't allocate
+ *
+ * state is grouped into named sections prefixed by their size, letting a
+ * reader validate the layout of a snapshot before any state is touched
+ */
+
+struct snapshot;
+
+/* host function pointers are stored relative to a function in the same
+   binary, making them valid across processes running the same build */
+typedef void (*snapshot_fn)();
+
+struct snapshot *snapshot_create();
+void snapshot_destroy(struct snapshot *ss);
+
+/* write the buffer out to, or replace it with the contents of, a file. the
+   file carries a checksum of the buffer, loading fails if it doesn't match */
+int snapshot_save(struct snapshot *ss, const char *path);
+int snapshot_load(struct snapshot *ss, const char *path);
+
+/* clears the buffer for writing a new snapshot */
+void snapshot_reset(struct snapshot *ss);
+/* moves the read cursor back to the start of the buffer */
+void snapshot_rewind(struct snapshot *ss);
+
+const uint8_t *snapshot_data(struct snapshot *ss);
+int snapshot_size(struct snapshot *ss);
+int snapshot_tell(struct snapshot *ss);
+void snapshot_seek(struct snapshot *ss, int offset);
+
+/* set once a read runs past the end of the buffer, or a section doesn't
+   match what the reader expected */
+int snapshot_error(struct snapshot *ss);
+
+void snapshot_write(struct snapshot *ss, const void *data, int size);
+void snapshot_write_fn(struct snapshot *ss, snapshot_fn fn);
+int snapshot_begin_section(struct snapshot *ss, const char *name);
+void snapshot_end_section(struct snapshot *ss, int section);
+
+void snapshot_read(struct snapshot *ss, void *data, int size);
+snapshot_fn snapshot_read_fn(struct snapshot *ss);
+/* reads the header of the next section, returning its size or -1 if it isn't
+   named name */
+int snapshot_read_section(struct snapshot *ss, const char *name);
+
+#define SNAPSHOT_WRITE(ss, value) snapshot_write(ss, &(value), sizeof(value))
+#define SNAPSHOT_READ(ss, value) snapshot_read(ss, &(value), sizeof(value))
+
+#endif
@@ -20,17 +20,34 @@ static void interp_backend_run_code(struct jit_backend *base, int cycles) {
   int32_t *run_cycles = (int32_t *)(ctx + guest->offset_cycles);
   int32_t *ran_instrs = (int32_t *)(ctx + guest->offset_instrs);
 
+  jmp_buf fault_jmp;
+  guest->fault_jmp = &fault_jmp;
+
   *run_cycles = cycles;
   *ran_instrs = 0;
 
   while (*run_cycles > 0) {
     int RUN_SLICE = MIN(*run_cycles, 64);
-    int cycles = 0;
-    int instrs = 0;
+    volatile int cycles = 0;
+    volatile int instrs = 0;
+
+    /* a fallback whose access faulted unwinds back here, with the pc already
+       pointing at the guest's exception handler */
+    if (setjmp(fault_jmp)) {
+      cycles += 1;
+    }
 
     do {
       uint32_t addr = *pc;
-      uint32_t data = guest->r32(guest->mem, addr);
+      uint32_t phys;
+
+      if (!jit_guest_translate(guest, addr, JIT_ACCESS_FETCH, &phys)) {
+        guest->fault(guest->data, addr, JIT_ACCESS_FETCH);
+        cycles += 1;
+        continue;
+      }
+
+      uint32_t data = guest->r32(guest->mem, phys);
       const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
       def->fallback(guest, addr, data);
       cycles += def->cycles;
@@ -42,6 +59,8 @@ static void interp_backend_run_code(struct jit_backend *base, int cycles) {
 
     guest->check_interrupts(guest->data);
   }
+
+  guest->fault_jmp = NULL;
 }
 
 static int interp_backend_handle_exception(struct jit_backend *base,
@@ -84,6 +103,7 @@ struct jit_backend *interp_backend_create(struct jit_guest *guest,
   backend->invalidate_code = NULL;
   backend->patch_edge = NULL;
   backend->restore_edge = NULL;
+  backend->set_fpenv = NULL;
 
   return (struct jit_backend *)backend;
 }
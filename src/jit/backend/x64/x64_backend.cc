@@ -9,6 +9,7 @@ extern "C" {
 #include "jit/jit.h"
 #include "jit/jit_backend.h"
 #include "jit/jit_guest.h"
+#include "options.h"
 }
 
 /*
@@ -352,11 +353,80 @@ const Xbyak::Address x64_backend_xmm_constant(struct x64_backend *backend,
   return e.ptr[e.rip + backend->xmm_const[c]];
 }
 
+void x64_backend_load_mxcsr(struct x64_backend *backend, uint32_t *mxcsr,
+                            const Xbyak::Reg64 &tmp) {
+  auto &e = *backend->codegen;
+  e.mov(tmp, (uint64_t)mxcsr);
+  e.ldmxcsr(e.dword[tmp]);
+}
+
+/* compiled code runs with the guest's mxcsr, switch back to the host's for the
+   duration of calls out to the host. fallbacks and the memory access slow
+   paths execute guest operations, and are called directly to keep running
+   under the guest's. rax is never allocated nor used to pass arguments, and
+   rcx is clobbered by the call anyway */
+void x64_backend_call_host(struct x64_backend *backend, const void *fn) {
+  auto &e = *backend->codegen;
+  x64_backend_load_mxcsr(backend, &backend->host_mxcsr, e.rax);
+  e.call(fn);
+  x64_backend_load_mxcsr(backend, &backend->guest_mxcsr, e.rcx);
+}
+
+void x64_backend_call_host(struct x64_backend *backend, const Xbyak::Reg &fn) {
+  auto &e = *backend->codegen;
+  x64_backend_load_mxcsr(backend, &backend->host_mxcsr, e.rax);
+  e.call(fn);
+  x64_backend_load_mxcsr(backend, &backend->guest_mxcsr, e.rcx);
+}
+
+void x64_backend_translate_addr(struct x64_backend *backend,
+                                const struct ir_value *addr, int write) {
+  struct jit_guest *guest = backend->base.guest;
+  struct jit_tlb_entry *tlb = write ? guest->tlb_write : guest->tlb_read;
+
+  auto &e = *backend->codegen;
+
+  if (ir_is_constant(addr)) {
+    e.mov(e.edx, addr->i32);
+  } else {
+    e.mov(e.edx, x64_backend_reg(backend, addr).cvt32());
+  }
+
+  /* the tlb is addressed relative to the context it's stored alongside,
+     leaving eax free to hold the page number and ecx its index */
+  int64_t tlb_offset = (uint8_t *)tlb - (uint8_t *)guest->ctx;
+  CHECK(tlb_offset >= INT32_MIN && tlb_offset <= INT32_MAX);
+  int tag_offset = (int)tlb_offset + offsetof(struct jit_tlb_entry, tag);
+  int addend_offset = (int)tlb_offset + offsetof(struct jit_tlb_entry, addend);
+
+  /* find the software tlb entry for the address' page */
+  e.mov(e.eax, e.edx);
+  e.shr(e.eax, guest->tlb_shift);
+  e.mov(e.ecx, e.eax);
+  e.and_(e.ecx, guest->tlb_mask);
+  Xbyak::RegExp entry = guestctx + e.rcx * sizeof(struct jit_tlb_entry);
+
+  /* on a hit, offset the address by the entry's addend. on a miss, call out
+     to the guest to translate it and refill the entry, passing the address of
+     the accessing instruction in eax in case it faults */
+  Xbyak::Label miss, done;
+  e.cmp(e.dword[entry + tag_offset], e.eax);
+  e.jne(miss);
+  e.add(e.edx, e.dword[entry + addend_offset]);
+  e.jmp(done);
+  e.L(miss);
+  e.mov(e.eax, backend->guest_addr);
+  e.call((void *)backend->translate_thunk[write]);
+  e.L(done);
+}
+
 void x64_backend_block_label(char *name, size_t size, struct ir_block *block) {
   snprintf(name, size, ".%p", block);
 }
 
 static void x64_backend_emit_thunks(struct x64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+
   auto &e = *backend->codegen;
 
   {
@@ -410,6 +480,64 @@ static void x64_backend_emit_thunks(struct x64_backend *backend) {
     /* return to jit code */
     e.ret();
   }
+
+  if (guest->translate) {
+    for (int i = 0; i < 2; i++) {
+      e.align(32);
+
+      backend->translate_thunk[i] = e.getCurr<void (*)()>();
+
+      int access = i ? JIT_ACCESS_WRITE : JIT_ACCESS_READ;
+      const int ADDR_SLOT = X64_STACK_SHADOW_SPACE;
+      const int PC_SLOT = X64_STACK_SHADOW_SPACE + 4;
+      const int PHYS_SLOT = X64_STACK_SHADOW_SPACE + 8;
+      Xbyak::Label fault;
+
+      /* save caller-saved registers that our code uses and ensure stack is
+         16-byte aligned, leaving room for the address, pc and result */
+      int save_mask = JIT_ALLOCATE | JIT_CALLER_SAVE;
+      int offset = x64_backend_push_regs(backend, save_mask);
+      offset = ALIGN_UP(offset + X64_STACK_SHADOW_SPACE + 16 + 8, 16) - 8;
+      e.sub(e.rsp, offset);
+      e.mov(e.dword[e.rsp + ADDR_SLOT], e.edx);
+      e.mov(e.dword[e.rsp + PC_SLOT], e.eax);
+
+      /* translate the address passed in edx */
+      e.mov(arg1.cvt32(), e.edx);
+      e.mov(arg0, (uint64_t)guest->data);
+      e.mov(arg2, access);
+      e.lea(arg3, e.ptr[e.rsp + PHYS_SLOT]);
+      e.call((void *)guest->translate);
+      e.test(e.eax, e.eax);
+      e.jz(fault);
+
+      /* return the translated address in edx */
+      e.mov(e.edx, e.dword[e.rsp + PHYS_SLOT]);
+
+      /* restore caller-saved registers */
+      e.add(e.rsp, offset);
+      x64_backend_pop_regs(backend, save_mask);
+
+      /* return to jit code */
+      e.ret();
+
+      /* the access isn't permitted. sync the pc to the accessing instruction
+         and raise the guest's exception, abandoning the rest of the block to
+         continue at the exception handler */
+      e.L(fault);
+      e.mov(e.eax, e.dword[e.rsp + PC_SLOT]);
+      e.mov(e.dword[guestctx + guest->offset_pc], e.eax);
+      e.mov(arg1.cvt32(), e.dword[e.rsp + ADDR_SLOT]);
+      e.mov(arg0, (uint64_t)guest->data);
+      e.mov(arg2, access);
+      x64_backend_call_host(backend, (void *)guest->fault);
+
+      /* tear down the thunk's frame along with the return address into the
+         block */
+      e.add(e.rsp, offset + 8);
+      e.jmp(backend->dispatch_dynamic);
+    }
+  }
 }
 
 static void x64_backend_emit_constants(struct x64_backend *backend) {
@@ -757,6 +885,8 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   Xbyak::util::Cpu cpu;
 
   backend->base.guest = guest;
+  backend->base.code = (uint8_t *)code;
+  backend->base.code_size = code_size;
   backend->base.destroy = &x64_backend_destroy;
 
   /* compile interface */
@@ -776,11 +906,17 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   backend->base.invalidate_code = &x64_dispatch_invalidate_code;
   backend->base.patch_edge = &x64_dispatch_patch_edge;
   backend->base.restore_edge = &x64_dispatch_restore_edge;
+  backend->base.set_fpenv = &x64_dispatch_set_fpenv;
 
   /* setup codegen buffer */
   int r = protect_pages(code, code_size, ACC_READWRITEEXEC);
   CHECK(r);
 
+  if (OPTION_hugepages && !advise_huge_pages(code, code_size, 0)) {
+    LOG_INFO("x64_backend_create transparent huge pages unavailable for code "
+             "buffer, falling back to 4kb pages");
+  }
+
   int have_avx2 = cpu.has(Xbyak::util::Cpu::tAVX2);
   int have_sse2 = cpu.has(Xbyak::util::Cpu::tSSE2);
   CHECK(have_avx2 || have_sse2, "CPU must support either AVX2 or SSE2");
@@ -1,3 +1,4 @@
+#include <xmmintrin.h>
 #include "jit/backend/x64/x64_local.h"
 
 extern "C" {
@@ -6,6 +7,12 @@ extern "C" {
 #include "jit/jit_guest.h"
 }
 
+/* mxcsr bits controlling the host float environment */
+#define MXCSR_DAZ 0x40
+#define MXCSR_MASK_ALL 0x1f80
+#define MXCSR_RC_ZERO 0x6000
+#define MXCSR_FTZ 0x8000
+
 /* log out pc each time dispatch is entered for debugging */
 #define LOG_DISPATCH_EVERY_N 0
 
@@ -66,9 +73,31 @@ void *x64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr) {
   return *entry;
 }
 
+void x64_dispatch_set_fpenv(struct jit_backend *base, int fpenv) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  uint32_t mxcsr = MXCSR_MASK_ALL;
+  if (fpenv & JIT_FPENV_ROUND_ZERO) {
+    mxcsr |= MXCSR_RC_ZERO;
+  }
+  if (fpenv & JIT_FPENV_FLUSH_DENORMALS) {
+    mxcsr |= MXCSR_FTZ | MXCSR_DAZ;
+  }
+  backend->guest_mxcsr = mxcsr;
+
+  /* when called back from compiled code, fallbacks and memory handlers run
+     under the guest's mxcsr, update it immediately. host calls reload it from
+     guest_mxcsr once they return */
+  if (backend->in_code) {
+    _mm_setcsr(mxcsr);
+  }
+}
+
 void x64_dispatch_run_code(struct jit_backend *base, int cycles) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
+  backend->in_code = 1;
   backend->dispatch_enter(cycles);
+  backend->in_code = 0;
 }
 
 void x64_dispatch_emit_thunks(struct x64_backend *backend) {
@@ -87,7 +116,7 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
 
 #if LOG_DISPATCH_EVERY_N
     e.mov(arg0, guestctx);
-    e.call(&x64_dispatch_log);
+    x64_backend_call_host(backend, (void *)&x64_dispatch_log);
 #endif
 
     /* invasively look into the jit's cache */
@@ -109,11 +138,13 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     backend->dispatch_static = e.getCurr<void *>();
 
 #if LINK_STATIC_BRANCHES
+    x64_backend_load_mxcsr(backend, &backend->host_mxcsr, e.rax);
     e.mov(arg0, (uint64_t)guest->data);
     e.pop(arg1);
     e.sub(arg1, 5 /* sizeof jmp instr */);
     e.mov(arg2, e.qword[guestctx + guest->offset_pc]);
     e.call(guest->link_code);
+    x64_backend_load_mxcsr(backend, &backend->guest_mxcsr, e.rax);
 #else
     e.pop(arg1);
 #endif
@@ -127,9 +158,11 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
 
     backend->dispatch_compile = e.getCurr<void *>();
 
+    x64_backend_load_mxcsr(backend, &backend->host_mxcsr, e.rax);
     e.mov(arg0, (uint64_t)guest->data);
     e.mov(arg1, e.dword[guestctx + guest->offset_pc]);
     e.call(guest->compile_code);
+    x64_backend_load_mxcsr(backend, &backend->guest_mxcsr, e.rax);
     e.jmp(backend->dispatch_dynamic);
   }
 
@@ -140,8 +173,10 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
 
     backend->dispatch_interrupt = e.getCurr<void *>();
 
+    x64_backend_load_mxcsr(backend, &backend->host_mxcsr, e.rax);
     e.mov(arg0, (uint64_t)guest->data);
     e.call(guest->check_interrupts);
+    x64_backend_load_mxcsr(backend, &backend->guest_mxcsr, e.rax);
     e.jmp(backend->dispatch_dynamic);
   }
 
@@ -168,6 +203,11 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.mov(e.dword[guestctx + guest->offset_cycles], arg0);
     e.mov(e.dword[guestctx + guest->offset_instrs], 0);
 
+    /* save off the host's float environment and switch to the guest's */
+    e.mov(e.rax, (uint64_t)&backend->host_mxcsr);
+    e.stmxcsr(e.dword[e.rax]);
+    x64_backend_load_mxcsr(backend, &backend->guest_mxcsr, e.rax);
+
     e.jmp(backend->dispatch_dynamic);
   }
 
@@ -178,6 +218,9 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
 
     backend->dispatch_exit = e.getCurr<void *>();
 
+    /* restore the host's float environment */
+    x64_backend_load_mxcsr(backend, &backend->host_mxcsr, e.rax);
+
     /* destroy stack frame */
     e.add(e.rsp, stack_offset);
     x64_backend_pop_regs(backend, JIT_CALLEE_SAVE);
@@ -203,4 +246,7 @@ void x64_dispatch_init(struct x64_backend *backend) {
   backend->cache_shift = ctz32(guest->addr_mask);
   backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
   backend->cache = (void **)malloc(backend->cache_size * sizeof(void *));
+
+  /* until the guest describes its float environment, run with the host's */
+  backend->guest_mxcsr = _mm_getcsr();
 }
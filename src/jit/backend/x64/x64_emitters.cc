@@ -62,6 +62,10 @@ enum {
 struct jit_emitter x64_emitters[IR_NUM_OPS];
 
 EMITTER(SOURCE_INFO, CONSTRAINTS(NONE, IMM_I32, IMM_I32)) {
+  /* delay slots are emitted inside of their branch, so faults raised by them
+     are reported at the branch as the guest expects */
+  backend->guest_addr = ARG0->i32;
+
 #if 0
   /* encode the guest address of each instruction in the generated code for
      debugging purposes */
@@ -103,30 +107,43 @@ EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
   Xbyak::Reg dst = RES_REG;
   struct ir_value *addr = ARG0;
 
-  if (ir_is_constant(addr)) {
+  /* constant addresses can't be resolved at compile time when translation is
+     enabled, as the mapping may change after the code is compiled */
+  if (ir_is_constant(addr) && !guest->tlb_enabled) {
     /* peel away one layer of abstraction and directly access the backing
        memory or directly invoke the callback when the address is constant */
     void *userdata;
     uint8_t *ptr;
     mem_read_cb read;
+    uint32_t offset = addr->i32;
+    uint32_t *reg = NULL;
     guest->lookup(guest->mem, addr->i32, &userdata, &ptr, &read, NULL);
 
+    /* go one step further for mmio, resolving the device handler and register
+       offset at compile time */
+    if (!ptr && guest->lookup_mmio) {
+      guest->lookup_mmio(guest->data, addr->i32, &userdata, &offset, &read,
+                         NULL, &reg);
+    }
+
     if (ptr) {
       e.mov(e.rax, (uint64_t)ptr);
       x64_backend_load_mem(backend, RES, e.rax);
+    } else if (reg && RES->type == VALUE_I32) {
+      /* status registers with no read side effects are loaded inline */
+      e.mov(e.rax, (uint64_t)reg);
+      x64_backend_load_mem(backend, RES, e.rax);
     } else {
       int data_size = ir_type_size(RES->type);
       uint32_t data_mask = (1 << (data_size * 8)) - 1;
 
       e.mov(arg0, (uint64_t)userdata);
-      e.mov(arg1, (uint32_t)addr->i32);
+      e.mov(arg1, offset);
       e.mov(arg2, data_mask);
       e.call((void *)read);
       e.mov(dst, e.rax);
     }
   } else {
-    Xbyak::Reg ra = x64_backend_reg(backend, addr);
-
     void *fn = nullptr;
     switch (RES->type) {
       case VALUE_I8:
@@ -146,8 +163,13 @@ EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
         break;
     }
 
+    if (guest->tlb_enabled) {
+      x64_backend_translate_addr(backend, addr, 0);
+      e.mov(arg1.cvt32(), e.edx);
+    } else {
+      e.mov(arg1, x64_backend_reg(backend, addr));
+    }
     e.mov(arg0, (uint64_t)guest->mem);
-    e.mov(arg1, ra);
     e.call((void *)fn);
     e.mov(dst, e.rax);
   }
@@ -158,30 +180,42 @@ EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
   struct ir_value *addr = ARG0;
   struct ir_value *data = ARG1;
 
-  if (ir_is_constant(addr)) {
+  if (ir_is_constant(addr) && !guest->tlb_enabled) {
     /* peel away one layer of abstraction and directly access the backing
        memory or directly invoke the callback when the address is constant */
     void *userdata;
     uint8_t *ptr;
     mem_write_cb write;
+    uint32_t offset = addr->i32;
     guest->lookup(guest->mem, addr->i32, &userdata, &ptr, NULL, &write);
 
+    if (!ptr && guest->lookup_mmio) {
+      guest->lookup_mmio(guest->data, addr->i32, &userdata, &offset, NULL,
+                         &write, NULL);
+    }
+
     if (ptr) {
       e.mov(e.rax, (uint64_t)ptr);
       x64_backend_store_mem(backend, e.rax, data);
+
+      /* mark the page written in the guest's dirty map, as the slow path
+         would have */
+      if (guest->dirty_map) {
+        uint32_t page = (addr->i32 >> guest->dirty_shift) & guest->dirty_mask;
+        e.mov(e.rax, (uint64_t)&guest->dirty_map[page]);
+        e.mov(e.byte[e.rax], 0xff);
+      }
     } else {
       int data_size = ir_type_size(data->type);
       uint32_t data_mask = (1 << (data_size * 8)) - 1;
 
       e.mov(arg0, (uint64_t)userdata);
-      e.mov(arg1, (uint32_t)addr->i32);
+      e.mov(arg1, offset);
       x64_backend_mov_value(backend, arg2, data);
       e.mov(arg3, data_mask);
       e.call((void *)write);
     }
   } else {
-    Xbyak::Reg ra = x64_backend_reg(backend, addr);
-
     void *fn = nullptr;
     switch (data->type) {
       case VALUE_I8:
@@ -201,25 +235,51 @@ EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
         break;
     }
 
+    if (guest->tlb_enabled) {
+      x64_backend_translate_addr(backend, addr, 1);
+      e.mov(arg1.cvt32(), e.edx);
+    } else {
+      e.mov(arg1, x64_backend_reg(backend, addr));
+    }
     e.mov(arg0, (uint64_t)guest->mem);
-    e.mov(arg1, ra);
     x64_backend_mov_value(backend, arg2, data);
     e.call((void *)fn);
   }
 }
 
 EMITTER(LOAD_FAST, CONSTRAINTS(REG_ALL, REG_I64)) {
+  struct jit_guest *guest = backend->base.guest;
   struct ir_value *dst = RES;
   Xbyak::Reg addr = ARG0_REG;
 
+  if (guest->tlb_enabled) {
+    x64_backend_translate_addr(backend, ARG0, 0);
+    addr = e.edx;
+  }
+
   x64_backend_load_mem(backend, dst, addr.cvt64() + guestmem);
 }
 
 EMITTER(STORE_FAST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
+  struct jit_guest *guest = backend->base.guest;
   Xbyak::Reg addr = ARG0_REG;
   struct ir_value *data = ARG1;
 
+  if (guest->tlb_enabled) {
+    x64_backend_translate_addr(backend, ARG0, 1);
+    addr = e.edx;
+  }
+
   x64_backend_store_mem(backend, addr.cvt64() + guestmem, data);
+
+  /* mark the page written in the guest's dirty map */
+  if (guest->dirty_map) {
+    e.mov(e.eax, addr.cvt32());
+    e.shr(e.eax, guest->dirty_shift);
+    e.and_(e.eax, guest->dirty_mask);
+    e.mov(e.rcx, (uint64_t)guest->dirty_map);
+    e.mov(e.byte[e.rcx + e.rax], 0xff);
+  }
 }
 
 EMITTER(LOAD_CONTEXT, CONSTRAINTS(REG_ALL, IMM_I32)) {
@@ -945,6 +1005,21 @@ EMITTER(BRANCH_COND, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK,
   x64_backend_emit_branch(backend, ir, ARG1);
 }
 
+EMITTER(GUARD_EQ, CONSTRAINTS(NONE, REG_I64, REG_I64 | IMM_I32)) {
+  Xbyak::Reg ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.cmp(ra, (uint32_t)ir_zext_constant(ARG1));
+  } else {
+    Xbyak::Reg rb = ARG1_REG;
+    e.cmp(ra, rb);
+  }
+
+  /* the pc has already been written to the context by the branch that entered
+     this block, let the compile thunk select the correct code for it */
+  e.jne(backend->dispatch_compile);
+}
+
 EMITTER(CALL, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
   if (ARG1) {
     x64_backend_mov_value(backend, arg0, ARG1);
@@ -955,10 +1030,10 @@ EMITTER(CALL, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
 
   if (ir_is_constant(ARG0)) {
     void *addr = (void *)ARG0->i64;
-    e.call(addr);
+    x64_backend_call_host(backend, addr);
   } else {
     Xbyak::Reg addr = ARG0_REG;
-    e.call(addr);
+    x64_backend_call_host(backend, addr);
   }
 }
 
@@ -980,10 +1055,10 @@ EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
 
   if (ir_is_constant(ARG0)) {
     void *addr = (void *)ARG0->i64;
-    e.call(addr);
+    x64_backend_call_host(backend, addr);
   } else {
     const Xbyak::Reg addr = ARG0_REG;
-    e.call(addr);
+    x64_backend_call_host(backend, addr);
   }
 
   e.L(".skip");
@@ -1003,7 +1078,7 @@ EMITTER(DEBUG_LOG, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
   x64_backend_mov_value(backend, arg0, ARG0);
   x64_backend_mov_value(backend, arg1, ARG1);
   x64_backend_mov_value(backend, arg2, ARG2);
-  e.call(debug_log);
+  x64_backend_call_host(backend, (void *)debug_log);
 }
 
 EMITTER(ASSERT_EQ, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
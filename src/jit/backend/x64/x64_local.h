@@ -35,6 +35,9 @@ struct x64_backend {
   Xbyak::CodeGenerator *codegen;
   int use_avx;
   Xbyak::Label xmm_const[NUM_XMM_CONST];
+  /* guest address of the instruction being emitted, reported as the pc of
+     accesses which fault */
+  uint32_t guest_addr;
   void *dispatch_dynamic;
   void *dispatch_static;
   void *dispatch_compile;
@@ -43,6 +46,13 @@ struct x64_backend {
   void *dispatch_exit;
   void (*load_thunk[16])();
   void (*store_thunk)();
+  void (*translate_thunk[2])();
+
+  /* mxcsr the host runs with outside of compiled code, and the one mirroring
+     the guest's float environment used inside of it */
+  uint32_t host_mxcsr;
+  uint32_t guest_mxcsr;
+  int in_code;
 
   /* debug stats */
   csh capstone_handle;
@@ -89,6 +99,12 @@ void x64_backend_store_mem(struct x64_backend *backend,
                            const struct ir_value *src);
 void x64_backend_mov_value(struct x64_backend *backend, const Xbyak::Reg &dst,
                            const struct ir_value *v);
+void x64_backend_translate_addr(struct x64_backend *backend,
+                                const struct ir_value *addr, int write);
+void x64_backend_load_mxcsr(struct x64_backend *backend, uint32_t *mxcsr,
+                            const Xbyak::Reg64 &tmp);
+void x64_backend_call_host(struct x64_backend *backend, const void *fn);
+void x64_backend_call_host(struct x64_backend *backend, const Xbyak::Reg &fn);
 const Xbyak::Address x64_backend_xmm_constant(struct x64_backend *backend,
                                               enum xmm_constant c);
 void x64_backend_block_label(char *name, size_t size, struct ir_block *block);
@@ -109,6 +125,7 @@ void x64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr);
 void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst);
 void x64_dispatch_restore_edge(struct jit_backend *base, void *code,
                                uint32_t dst);
+void x64_dispatch_set_fpenv(struct jit_backend *base, int fpenv);
 
 /*
  * emitters
@@ -61,11 +61,13 @@ static void armv3_frontend_translate_code(struct jit_frontend *base,
 }
 
 static void armv3_frontend_analyze_code(struct jit_frontend *base,
-                                        uint32_t begin_addr, int *size) {
+                                        uint32_t begin_addr, int *size,
+                                        int *use_mode) {
   struct armv3_frontend *frontend = (struct armv3_frontend *)base;
   struct armv3_guest *guest = (struct armv3_guest *)frontend->guest;
 
   *size = 0;
+  *use_mode = 0;
 
   while (1) {
     uint32_t addr = begin_addr + *size;
@@ -28,6 +28,22 @@ static void store_fpscr(struct sh4_guest *guest, struct sh4_context *ctx,
   guest->fpscr_updated(guest->data, old_fpscr);
 }
 
+static uint32_t translate_addr(struct sh4_guest *guest, uint32_t addr,
+                               int access) {
+  uint32_t phys;
+
+  if (!jit_guest_translate((struct jit_guest *)guest, addr, access, &phys)) {
+    /* the pc is still that of the instruction, or of the branch when executing
+       its delay slot. raise the fault and abandon the rest of the instruction,
+       unwinding back to the backend */
+    CHECK_NOTNULL(guest->fault_jmp);
+    guest->fault(guest->data, addr, access);
+    longjmp(*guest->fault_jmp, 1);
+  }
+
+  return phys;
+}
+
 static inline int32_t vadd_f32_el(int32_t a, int32_t b) {
   float r = *(float *)&a + *(float *)&b;
   return *(int32_t *)&r;
@@ -58,9 +74,12 @@ typedef int32_t int128_t[4];
 #define FPU_DOUBLE_PR                (CTX->fpscr & PR_MASK)
 #define FPU_DOUBLE_SZ                (CTX->fpscr & SZ_MASK)
 
+#define TRANSLATE(addr, access)      translate_addr(guest, addr, access)
+
 #define DELAY_INSTR()                {                                                                   \
                                        uint32_t delay_addr = addr + 2;                                   \
-                                       uint16_t delay_data = guest->r16(guest->mem, delay_addr);       \
+                                       uint32_t delay_phys = TRANSLATE(delay_addr, JIT_ACCESS_FETCH);    \
+                                       uint16_t delay_data = guest->r16(guest->mem, delay_phys);         \
                                        const struct jit_opdef *def = sh4_get_opdef(delay_data);          \
                                        def->fallback((struct jit_guest *)guest, delay_addr, delay_data); \
                                      }
@@ -161,19 +180,19 @@ typedef int32_t int128_t[4];
 #define STORE_SSR_I32(v)             (CTX->ssr = v)
 #define STORE_SSR_IMM_I32(v)         STORE_SSR_I32(v)
 
-#define LOAD_I8(addr)                guest->r8(guest->mem, addr)
-#define LOAD_I16(addr)               guest->r16(guest->mem, addr)
-#define LOAD_I32(addr)               guest->r32(guest->mem, addr)
-#define LOAD_I64(addr)               guest->r64(guest->mem, addr)
+#define LOAD_I8(addr)                guest->r8(guest->mem, TRANSLATE(addr, JIT_ACCESS_READ))
+#define LOAD_I16(addr)               guest->r16(guest->mem, TRANSLATE(addr, JIT_ACCESS_READ))
+#define LOAD_I32(addr)               guest->r32(guest->mem, TRANSLATE(addr, JIT_ACCESS_READ))
+#define LOAD_I64(addr)               guest->r64(guest->mem, TRANSLATE(addr, JIT_ACCESS_READ))
 #define LOAD_IMM_I8(addr)            LOAD_I8(addr)
 #define LOAD_IMM_I16(addr)           LOAD_I16(addr)
 #define LOAD_IMM_I32(addr)           LOAD_I32(addr)
 #define LOAD_IMM_I64(addr)           LOAD_I64(addr)
 
-#define STORE_I8(addr, v)            guest->w8(guest->mem, addr, v)
-#define STORE_I16(addr, v)           guest->w16(guest->mem, addr, v)
-#define STORE_I32(addr, v)           guest->w32(guest->mem, addr, v)
-#define STORE_I64(addr, v)           guest->w64(guest->mem, addr, v)
+#define STORE_I8(addr, v)            guest->w8(guest->mem, TRANSLATE(addr, JIT_ACCESS_WRITE), v)
+#define STORE_I16(addr, v)           guest->w16(guest->mem, TRANSLATE(addr, JIT_ACCESS_WRITE), v)
+#define STORE_I32(addr, v)           guest->w32(guest->mem, TRANSLATE(addr, JIT_ACCESS_WRITE), v)
+#define STORE_I64(addr, v)           guest->w64(guest->mem, TRANSLATE(addr, JIT_ACCESS_WRITE), v)
 
 #define LOAD_HOST_F32(addr)          (*(float *)(uintptr_t)addr)
 #define LOAD_HOST_F64(addr)          (*(double *)(uintptr_t)addr)
@@ -24,15 +24,31 @@ static const struct jit_opdef *sh4_frontend_lookup_op(struct jit_frontend *base,
   return sh4_get_opdef(*(const uint16_t *)instr);
 }
 
+static int sh4_frontend_load_instr(struct sh4_frontend *frontend,
+                                   uint32_t addr, uint16_t *data) {
+  struct jit_guest *guest = frontend->guest;
+  uint32_t phys;
+
+  /* with address translation enabled, code is fetched through the itlb */
+  if (!jit_guest_translate(guest, addr, JIT_ACCESS_FETCH, &phys)) {
+    return 0;
+  }
+
+  *data = guest->r16(guest->mem, phys);
+  return 1;
+}
+
 static int sh4_frontend_is_terminator(struct jit_opdef *def) {
   /* stop emitting once a branch is hit */
   if (def->flags & SH4_FLAG_STORE_PC) {
     return 1;
   }
 
-  /* if fpscr changed, stop as the compile-time assumptions may be invalid */
+  /* if fpscr changed, stop as the compile-time assumptions may be invalid.
+     fschg and frchg are the exception, their effect on the assumptions is
+     known at compile time so translation can continue in the new mode */
   if (def->flags & SH4_FLAG_STORE_FPSCR) {
-    return 1;
+    return def->op != SH4_OP_FSCHG && def->op != SH4_OP_FRCHG;
   }
 
   return 0;
@@ -50,7 +66,12 @@ static int sh4_frontend_is_idle_loop(struct sh4_frontend *frontend,
 
   while (1) {
     uint32_t addr = begin_addr + offset;
-    uint16_t data = guest->r16(guest->mem, addr);
+    uint16_t data;
+
+    if (!sh4_frontend_load_instr(frontend, addr, &data)) {
+      return 0;
+    }
+
     struct jit_opdef *def = sh4_get_opdef(data);
 
     offset += 2;
@@ -58,7 +79,12 @@ static int sh4_frontend_is_idle_loop(struct sh4_frontend *frontend,
 
     if (def->flags & SH4_FLAG_DELAYED) {
       uint32_t delay_addr = begin_addr + offset;
-      uint16_t delay_data = guest->r16(guest->mem, delay_addr);
+      uint16_t delay_data;
+
+      if (!sh4_frontend_load_instr(frontend, delay_addr, &delay_data)) {
+        return 0;
+      }
+
       struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
 
       offset += 2;
@@ -103,7 +129,12 @@ static void sh4_frontend_dump_code(struct jit_frontend *base,
 
   while (offset < size) {
     uint32_t addr = begin_addr + offset;
-    uint16_t data = guest->r16(guest->mem, addr);
+    uint16_t data;
+
+    if (!sh4_frontend_load_instr(frontend, addr, &data)) {
+      break;
+    }
+
     union sh4_instr instr = {data};
     struct jit_opdef *def = sh4_get_opdef(data);
 
@@ -114,7 +145,12 @@ static void sh4_frontend_dump_code(struct jit_frontend *base,
 
     if (def->flags & SH4_FLAG_DELAYED) {
       uint32_t delay_addr = begin_addr + offset;
-      uint16_t delay_data = guest->r16(guest->mem, delay_addr);
+      uint16_t delay_data;
+
+      if (!sh4_frontend_load_instr(frontend, delay_addr, &delay_data)) {
+        break;
+      }
+
       union sh4_instr delay_instr = {delay_data};
 
       sh4_format(delay_addr, delay_instr, buffer, sizeof(buffer));
@@ -164,7 +200,10 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     }
 
     uint32_t addr = begin_addr + offset;
-    uint16_t data = guest->r16(guest->mem, addr);
+    uint16_t data;
+    int res = sh4_frontend_load_instr(frontend, addr, &data);
+    CHECK(res);
+
     union sh4_instr instr = {data};
     struct jit_opdef *def = sh4_get_opdef(data);
 
@@ -195,7 +234,10 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
 
       if (def->flags & SH4_FLAG_DELAYED) {
         uint32_t delay_addr = begin_addr + offset;
-        uint32_t delay_data = guest->r16(guest->mem, delay_addr);
+        uint16_t delay_data;
+        res = sh4_frontend_load_instr(frontend, delay_addr, &delay_data);
+        CHECK(res);
+
         union sh4_instr delay_instr = {delay_data};
         struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
 
@@ -265,10 +307,17 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
         ir_branch(ir, ir_alloc_i32(ir, next_addr));
       }
     }
+
+    /* fschg doesn't end the block, continue translating for the new size */
+    if (def->op == SH4_OP_FSCHG) {
+      flags ^= SH4_DOUBLE_SZ;
+    }
   }
 
-  /* if the block makes optimizations based on the fpscr state, assert that the
-     run-time fpscr state matches the compile-time state */
+  /* if the block makes optimizations based on the fpscr state, guard that the
+     run-time fpscr state matches the compile-time state. if it doesn't, the
+     block exits back to dispatch which selects the variant compiled for the
+     run-time state */
   if (use_fpscr) {
     /* insert after the first guest marker */
     struct ir_instr *after = NULL;
@@ -285,35 +334,52 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     actual = ir_and(ir, actual, ir_alloc_i32(ir, PR_MASK | SZ_MASK));
     struct ir_value *expected =
         ir_alloc_i32(ir, ctx->fpscr & (PR_MASK | SZ_MASK));
-    ir_assert_eq(ir, actual, expected);
+    ir_guard_eq(ir, actual, expected);
   }
 }
 
 static void sh4_frontend_analyze_code(struct jit_frontend *base,
-                                      uint32_t begin_addr, int *size) {
+                                      uint32_t begin_addr, int *size,
+                                      int *use_mode) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
   struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
 
   *size = 0;
+  *use_mode = 0;
 
   while (1) {
     uint32_t addr = begin_addr + *size;
-    uint16_t data = guest->r16(guest->mem, addr);
-    struct jit_opdef *def = sh4_get_opdef(data);
+    uint16_t data;
 
-    *size += 2;
+    /* end the block early at an instruction which can't be fetched. the next
+       block starts with it, raising the fault once it's compiled */
+    if (!sh4_frontend_load_instr(frontend, addr, &data)) {
+      break;
+    }
+
+    struct jit_opdef *def = sh4_get_opdef(data);
 
     if (def->flags & SH4_FLAG_DELAYED) {
-      uint32_t delay_addr = begin_addr + *size;
-      uint16_t delay_data = guest->r16(guest->mem, delay_addr);
+      uint32_t delay_addr = addr + 2;
+      uint16_t delay_data;
+
+      if (!sh4_frontend_load_instr(frontend, delay_addr, &delay_data)) {
+        break;
+      }
+
       struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
 
       *size += 2;
+      *use_mode |=
+          (delay_def->flags & SH4_FLAG_USE_FPSCR) == SH4_FLAG_USE_FPSCR;
 
       /* delay slots can't have another delay slot */
       CHECK(!(delay_def->flags & SH4_FLAG_DELAYED));
     }
 
+    *size += 2;
+    *use_mode |= (def->flags & SH4_FLAG_USE_FPSCR) == SH4_FLAG_USE_FPSCR;
+
     if (sh4_frontend_is_terminator(def)) {
       break;
     }
@@ -87,13 +87,13 @@ INSTR(MOVBS_DEC) {
   /* load Rm before decrementing Rn in case Rm == Rn */
   I8 v = LOAD_GPR_I8(i.def.rm);
 
-  /* decrease Rn by 1 */
+  /* store Rm at (Rn - 1) */
   I32 ea = LOAD_GPR_I32(i.def.rn);
   ea = SUB_IMM_I32(ea, 1);
-  STORE_GPR_I32(i.def.rn, ea);
-
-  /* store Rm at (Rn) */
   STORE_I8(ea, v);
+
+  /* decrease Rn by 1, only once the store can no longer fault */
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -102,13 +102,13 @@ INSTR(MOVWS_DEC) {
   /* load Rm before decrementing Rn in case Rm == Rn */
   I16 v = LOAD_GPR_I16(i.def.rm);
 
-  /* decrease Rn by 2 */
+  /* store Rm at (Rn - 2) */
   I32 ea = LOAD_GPR_I32(i.def.rn);
   ea = SUB_IMM_I32(ea, 2);
-  STORE_GPR_I32(i.def.rn, ea);
-
-  /* store Rm at (Rn) */
   STORE_I16(ea, v);
+
+  /* decrease Rn by 2, only once the store can no longer fault */
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -117,13 +117,13 @@ INSTR(MOVLS_DEC) {
   /* load Rm before decrementing Rn in case Rm == Rn */
   I32 v = LOAD_GPR_I32(i.def.rm);
 
-  /* decrease Rn by 4 */
+  /* store Rm at (Rn - 4) */
   I32 ea = LOAD_GPR_I32(i.def.rn);
   ea = SUB_IMM_I32(ea, 4);
-  STORE_GPR_I32(i.def.rn, ea);
-
-  /* store Rm at (Rn) */
   STORE_I32(ea, v);
+
+  /* decrease Rn by 4, only once the store can no longer fault */
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -1315,6 +1315,7 @@ INSTR(LDSMPR) {
 /* LDTLB */
 INSTR(LDTLB) {
   LDTLB();
+  NEXT_INSTR();
 }
 
 /* MOVCA.L     R0,@Rn */
@@ -1451,63 +1452,63 @@ INSTR(STCRBANK) {
 /* STC.L   SR,@-Rn */
 INSTR(STCMSR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_SR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   GBR,@-Rn */
 INSTR(STCMGBR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_GBR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   VBR,@-Rn */
 INSTR(STCMVBR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_VBR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   SSR,@-Rn */
 INSTR(STCMSSR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_SSR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   SPC,@-Rn */
 INSTR(STCMSPC) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_SPC_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   SGR,@-Rn */
 INSTR(STCMSGR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_SGR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   DBR,@-Rn */
 INSTR(STCMDBR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_DBR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -1515,9 +1516,9 @@ INSTR(STCMDBR) {
 INSTR(STCMRBANK) {
   int reg = i.def.rm & 0x7;
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_GPR_ALT_I32(reg);
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -1545,27 +1546,27 @@ INSTR(STSPR) {
 /* STS.L   MACH,@-Rn */
 INSTR(STSMMACH) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_MACH_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STS.L   MACL,@-Rn */
 INSTR(STSMMACL) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_MACL_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STS.L   PR,@-Rn */
 INSTR(STSMPR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_PR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -1718,8 +1719,6 @@ INSTR(FMOV_INDEX_STORE) {
 INSTR(FMOV_SAVE) {
   if (FPU_DOUBLE_SZ) {
     I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 8);
-    STORE_GPR_I32(i.def.rn, ea);
-
     I32 ea_lo = ea;
     I32 ea_hi = ADD_IMM_I32(ea_lo, 4);
 
@@ -1730,10 +1729,12 @@ INSTR(FMOV_SAVE) {
       STORE_I32(ea_lo, LOAD_FPR_I32(i.def.rm));
       STORE_I32(ea_hi, LOAD_FPR_I32(i.def.rm | 0x1));
     }
+
+    STORE_GPR_I32(i.def.rn, ea);
   } else {
     I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-    STORE_GPR_I32(i.def.rn, ea);
     STORE_I32(ea, LOAD_FPR_I32(i.def.rm));
+    STORE_GPR_I32(i.def.rn, ea);
   }
 
   NEXT_INSTR();
@@ -2085,18 +2086,18 @@ INSTR(STSFPUL) {
 /* STS.L   FPSCR,@-Rn */
 INSTR(STSMFPSCR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_FPSCR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STS.L   FPUL,@-Rn */
 INSTR(STSMFPUL) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_FPUL_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -949,6 +949,14 @@ void ir_branch_cond(struct ir *ir, struct ir_value *cond, struct ir_value *t,
   ir_set_arg2(ir, instr, cond);
 }
 
+void ir_guard_eq(struct ir *ir, struct ir_value *a, struct ir_value *b) {
+  CHECK(ir_is_int(a->type) && a->type == b->type);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_GUARD_EQ, VALUE_V);
+  ir_set_arg0(ir, instr, a);
+  ir_set_arg1(ir, instr, b);
+}
+
 void ir_call(struct ir *ir, struct ir_value *fn) {
   struct ir_instr *instr = ir_append_instr(ir, OP_CALL, VALUE_V);
   ir_set_arg0(ir, instr, fn);
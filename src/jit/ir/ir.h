@@ -404,6 +404,10 @@ void ir_branch_false(struct ir *ir, struct ir_value *cond,
                      struct ir_value *dst);
 void ir_branch_true(struct ir *ir, struct ir_value *cond, struct ir_value *dst);
 
+/* exits the block back to dispatch without executing it if a != b. used to
+   validate the compile-time assumptions a block was specialized for */
+void ir_guard_eq(struct ir *ir, struct ir_value *a, struct ir_value *b);
+
 /* calls */
 void ir_call(struct ir *ir, struct ir_value *fn);
 void ir_call_1(struct ir *ir, struct ir_value *fn, struct ir_value *arg0);
@@ -1,10 +1,15 @@
 #include "jit/jit.h"
+#include "core/constructor.h"
 #include "core/core.h"
 #include "core/exception_handler.h"
 #include "core/filesystem.h"
+#include "core/thread.h"
+#include "core/time.h"
 #include "jit/ir/ir.h"
 #include "jit/jit_backend.h"
+#include "jit/jit_debug.h"
 #include "jit/jit_frontend.h"
+#include "jit/jit_guest.h"
 #include "jit/passes/constant_propagation_pass.h"
 #include "jit/passes/control_flow_analysis_pass.h"
 #include "jit/passes/dead_code_elimination_pass.h"
@@ -12,6 +17,7 @@
 #include "jit/passes/load_store_elimination_pass.h"
 #include "jit/passes/register_allocation_pass.h"
 #include "options.h"
+#include "stats.h"
 
 #if PLATFORM_DARWIN || PLATFORM_LINUX
 #include <unistd.h>
@@ -28,6 +34,10 @@ static int block_map_cmp(const struct rb_node *rb_lhs,
     return -1;
   } else if (lhs->guest_addr > rhs->guest_addr) {
     return 1;
+  } else if (lhs->guest_mode < rhs->guest_mode) {
+    return -1;
+  } else if (lhs->guest_mode > rhs->guest_mode) {
+    return 1;
   } else {
     return 0;
   }
@@ -57,14 +67,49 @@ static struct rb_callbacks reverse_block_map_cb = {
     &reverse_block_map_cmp, NULL, NULL,
 };
 
-static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr) {
+static uint32_t jit_guest_mode(struct jit *jit) {
+  struct jit_guest *guest = jit->frontend->guest;
+
+  if (!guest->mode_mask) {
+    return 0;
+  }
+
+  uint32_t mode = *(uint32_t *)((uint8_t *)guest->ctx + guest->offset_mode);
+  return mode & guest->mode_mask;
+}
+
+static struct jit_block *jit_find_block(struct jit *jit, uint32_t guest_addr,
+                                       uint32_t guest_mode) {
   struct jit_block search;
   search.guest_addr = guest_addr;
+  search.guest_mode = guest_mode;
 
   return rb_find_entry(&jit->blocks, &search, struct jit_block, it,
                        &block_map_cb);
 }
 
+static int jit_is_stale(struct jit *jit, struct jit_block *block) {
+  return block->state != JIT_STATE_VALID;
+}
+
+static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr) {
+  /* prefer the variant specialized for the current guest mode, falling back
+     to a block which isn't specialized at all. stale variants are skipped, so
+     they don't hide a valid one */
+  struct jit_block *block =
+      jit_find_block(jit, guest_addr, jit_guest_mode(jit));
+
+  if (!block || jit_is_stale(jit, block)) {
+    block = jit_find_block(jit, guest_addr, JIT_MODE_ANY);
+  }
+
+  if (block && jit_is_stale(jit, block)) {
+    return NULL;
+  }
+
+  return block;
+}
+
 static struct jit_block *jit_lookup_block_reverse(struct jit *jit,
                                                   void *host_addr) {
   struct jit_block search;
@@ -91,10 +136,6 @@ static struct jit_block *jit_lookup_block_reverse(struct jit *jit,
   return block;
 }
 
-static int jit_is_stale(struct jit *jit, struct jit_block *block) {
-  return block->state != JIT_STATE_VALID;
-}
-
 static void jit_patch_edges(struct jit *jit, struct jit_block *block) {
   /* patch incoming edges to this block to directly jump to it instead of
      going through dispatch */
@@ -160,6 +201,8 @@ static void jit_cache_block(struct jit *jit, struct jit_block *block) {
 static void jit_free_block(struct jit *jit, struct jit_block *block) {
   jit_invalidate_block(jit, block, 0);
 
+  jit_debug_remove_block(block);
+
   free(block->source_map);
   free(block->fastmem);
 
@@ -182,11 +225,12 @@ static void jit_finalize_block(struct jit *jit, struct jit_block *block) {
 }
 
 static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr,
-                                         int guest_size) {
+                                         int guest_size, uint32_t guest_mode) {
   struct jit_block *block = calloc(1, sizeof(struct jit_block));
 
   block->guest_addr = guest_addr;
   block->guest_size = guest_size;
+  block->guest_mode = guest_mode;
 
   /* allocate meta data structs for the original guest code */
   block->source_map = calloc(block->guest_size, sizeof(void *));
@@ -318,21 +362,38 @@ static void jit_promote_fastmem(struct jit *jit, struct jit_block *block,
   }
 }
 
-void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
+static void jit_compile_block(struct jit *jit, uint32_t guest_addr) {
 #if 0
   LOG_INFO("jit_compile_block %s 0x%08x", jit->tag, guest_addr);
 #endif
 
+  /* dispatch may still point at a variant of this block compiled for another
+     guest mode */
+  jit->backend->invalidate_code(jit->backend, guest_addr);
+
+  /* if a valid variant for the current mode already exists, just switch
+     dispatch over to it */
+  struct jit_block *existing = jit_get_block(jit, guest_addr);
+
+  if (existing) {
+    jit->backend->cache_code(jit->backend, guest_addr, existing->host_addr);
+    return;
+  }
+
   /* analyze the guest code to get its extents */
   int guest_size;
-  jit->frontend->analyze_code(jit->frontend, guest_addr, &guest_size);
+  int use_mode;
+  jit->frontend->analyze_code(jit->frontend, guest_addr, &guest_size,
+                              &use_mode);
 
   /* create block */
-  struct jit_block *block = jit_alloc_block(jit, guest_addr, guest_size);
+  uint32_t guest_mode = use_mode ? jit_guest_mode(jit) : JIT_MODE_ANY;
+  struct jit_block *block =
+      jit_alloc_block(jit, guest_addr, guest_size, guest_mode);
   jit->curr_block = block;
 
   /* if the block had previously been invalidated, finish removing it now */
-  struct jit_block *existing = jit_get_block(jit, guest_addr);
+  existing = jit_find_block(jit, guest_addr, guest_mode);
 
   if (existing) {
     /* if the block was invalidated due to a fastmem exception, persist its
@@ -346,6 +407,16 @@ void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
     jit_free_block(jit, existing);
   }
 
+  /* neither variant is valid at this point, don't leave the one for the
+     other mode behind */
+  uint32_t other_mode =
+      guest_mode == JIT_MODE_ANY ? jit_guest_mode(jit) : JIT_MODE_ANY;
+  existing = jit_find_block(jit, guest_addr, other_mode);
+
+  if (existing) {
+    jit_free_block(jit, existing);
+  }
+
   /* translate guest code into ir */
   struct ir ir = {0};
   ir.buffer = jit->ir_buffer;
@@ -360,7 +431,7 @@ void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
   /* run optimization passes */
   jit_promote_fastmem(jit, block, &ir);
   cfa_run(jit->cfa, &ir);
-  lse_run(jit->lse, &ir);
+  lse_run(jit->lse, &ir, jit->frontend->guest->tlb_enabled);
   cprop_run(jit->cprop, &ir);
   esimp_run(jit->esimp, &ir);
   dce_run(jit->dce, &ir);
@@ -393,6 +464,107 @@ void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
             (uintptr_t)block->host_addr, block->host_size, jit->tag,
             block->guest_addr);
   }
+
+  /* expose to external profilers and debuggers if enabled */
+  jit_debug_add_block(jit->tag, block);
+
+  prof_counter_add(COUNTER_jit_compiles, 1);
+}
+
+void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
+  int64_t start = time_nanoseconds();
+
+  jit_compile_block(jit, guest_addr);
+
+  prof_counter_add(COUNTER_jit_compile_time, time_nanoseconds() - start);
+}
+
+/*
+ * code buffer pool
+ */
+static uint8_t ALIGNED(JIT_CODE_BUFFER_ALIGN)
+    code_buffers[JIT_MAX_CODE_BUFFERS][JIT_CODE_BUFFER_SIZE];
+static int code_buffers_used[JIT_MAX_CODE_BUFFERS];
+static mutex_t code_buffers_mutex;
+
+CONSTRUCTOR(jit_code_buffers_init) {
+  code_buffers_mutex = mutex_create();
+}
+
+uint8_t *jit_alloc_code_buffer() {
+  uint8_t *code = NULL;
+
+  mutex_lock(code_buffers_mutex);
+
+  for (int i = 0; i < JIT_MAX_CODE_BUFFERS; i++) {
+    if (!code_buffers_used[i]) {
+      code_buffers_used[i] = 1;
+      code = code_buffers[i];
+      break;
+    }
+  }
+
+  mutex_unlock(code_buffers_mutex);
+
+  CHECK_NOTNULL(code, "jit_alloc_code_buffer no free code buffers");
+
+  return code;
+}
+
+void jit_free_code_buffer(uint8_t *code) {
+  int i = (int)((code - code_buffers[0]) / JIT_CODE_BUFFER_SIZE);
+  CHECK(i >= 0 && i < JIT_MAX_CODE_BUFFERS && code == code_buffers[i]);
+
+  mutex_lock(code_buffers_mutex);
+  code_buffers_used[i] = 0;
+  mutex_unlock(code_buffers_mutex);
+}
+
+static void jit_count_fault(struct jit *jit, uint32_t guest_addr) {
+  for (int i = 0; i < jit->num_faults; i++) {
+    if (jit->faults[i].guest_addr == guest_addr) {
+      jit->faults[i].count++;
+      return;
+    }
+  }
+
+  if (jit->num_faults == JIT_MAX_FAULTS) {
+    return;
+  }
+
+  struct jit_fault *fault = &jit->faults[jit->num_faults++];
+  fault->guest_addr = guest_addr;
+  fault->count = 1;
+}
+
+static void jit_dump_faults(struct jit *jit) {
+  const char *appdir = fs_appdir();
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename),
+           "%s" PATH_SEPARATOR "%s_fastmem_faults.csv", appdir, jit->tag);
+
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    LOG_WARNING("jit_dump_faults failed to open %s", filename);
+    return;
+  }
+
+  if (jit->num_faults == JIT_MAX_FAULTS) {
+    LOG_WARNING("jit_dump_faults only the first %d faulting instructions were "
+                "recorded",
+                JIT_MAX_FAULTS);
+  }
+
+  fprintf(fp, "address,faults\n");
+
+  for (int i = 0; i < jit->num_faults; i++) {
+    struct jit_fault *fault = &jit->faults[i];
+    fprintf(fp, "0x%08x,%d\n", fault->guest_addr, fault->count);
+  }
+
+  fclose(fp);
+
+  LOG_INFO("jit_dump_faults wrote %s", filename);
 }
 
 static int jit_handle_exception(void *data, struct exception_state *ex) {
@@ -424,6 +596,10 @@ static int jit_handle_exception(void *data, struct exception_state *ex) {
   }
   block->fastmem[found] = 0;
 
+  if (OPTION_mmio_stats) {
+    jit_count_fault(jit, block->guest_addr + found);
+  }
+
   /* invalidate the block so it's recompiled on the next access */
   jit_invalidate_block(jit, block, 1);
 
@@ -434,13 +610,28 @@ void jit_run(struct jit *jit, int cycles) {
   jit->backend->run_code(jit->backend, cycles);
 }
 
+void jit_set_fpenv(struct jit *jit, int fpenv) {
+  /* backends which don't execute native float code have nothing to mirror */
+  if (!jit->backend->set_fpenv) {
+    return;
+  }
+
+  jit->backend->set_fpenv(jit->backend, fpenv);
+}
+
 void jit_destroy(struct jit *jit) {
+  if (OPTION_mmio_stats) {
+    jit_dump_faults(jit);
+  }
+
   if (OPTION_perf) {
     if (jit->perf_map) {
       fclose(jit->perf_map);
     }
   }
 
+  jit_debug_shutdown();
+
   if (jit->backend) {
     jit_free_code(jit);
   }
@@ -493,6 +684,12 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
      related exceptions */
   jit->exc_handler = exception_handler_add(jit, &jit_handle_exception);
 
+  if (backend->code) {
+    uintptr_t code_begin = (uintptr_t)backend->code;
+    uintptr_t code_end = code_begin + backend->code_size - 1;
+    exception_handler_set_range(jit->exc_handler, code_begin, code_end);
+  }
+
   /* open perf map if enabled */
   if (OPTION_perf) {
 #if PLATFORM_DARWIN || PLATFORM_LINUX
@@ -504,5 +701,7 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
 #endif
   }
 
+  jit_debug_init();
+
   return jit;
 }
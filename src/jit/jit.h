@@ -14,6 +14,9 @@ struct lse;
 struct ra;
 struct val;
 
+#define JIT_MODE_ANY 0xffffffff
+#define JIT_MAX_FAULTS 1024
+
 enum {
   JIT_STATE_VALID,
   JIT_STATE_INVALID,
@@ -27,6 +30,9 @@ struct jit_block {
   uint32_t guest_addr;
   int guest_size;
 
+  /* guest mode the block was specialized for, or JIT_MODE_ANY */
+  uint32_t guest_mode;
+
   /* maps guest instructions to host instructions */
   void **source_map;
 
@@ -37,6 +43,9 @@ struct jit_block {
   uint8_t *host_addr;
   int host_size;
 
+  /* entry registered with external debuggers, see jit_debug.c */
+  void *debug_entry;
+
   /* edges to other blocks */
   struct list in_edges;
   struct list out_edges;
@@ -61,6 +70,13 @@ struct jit_edge {
   struct list_node out_it;
 };
 
+/* number of times a guest instruction's fastmem access faulted, forcing its
+   block to be recompiled */
+struct jit_fault {
+  uint32_t guest_addr;
+  int count;
+};
+
 struct jit {
   char tag[32];
 
@@ -89,6 +105,12 @@ struct jit {
 
   /* dump ir to application directory as blocks compile */
   int dump_code;
+
+  /* fastmem faults per guest instruction, recorded when --mmio_stats is
+     enabled. faults are recorded from the exception handler, so the table is
+     fixed in size rather than grown */
+  struct jit_fault faults[JIT_MAX_FAULTS];
+  int num_faults;
 };
 
 struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
@@ -96,6 +118,7 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
 void jit_destroy(struct jit *jit);
 
 void jit_run(struct jit *jit, int cycles);
+void jit_set_fpenv(struct jit *jit, int fpenv);
 
 void jit_compile_code(struct jit *jit, uint32_t guest_addr);
 void jit_link_code(struct jit *jit, void *code, uint32_t target);
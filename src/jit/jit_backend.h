@@ -9,23 +9,37 @@ struct exception_state;
 struct jit_block;
 struct jit_guest;
 
-/* macro to help declare a code buffer for the backends to use
+/* code buffers for the backends to use
 
-   note, the code buffer needs to be placed in the data segment (as opposed to
-   allocating on the heap) to keep it within 2 GB of the code segment, enabling
-   the x64 backend to use RIP-relative offsets when calling functions
+   note, the code buffers need to be placed in the data segment (as opposed to
+   allocating on the heap) to keep them within 2 GB of the code segment,
+   enabling the x64 backend to use RIP-relative offsets when calling functions.
+   a fixed pool of them is reserved there, with each backend instance claiming
+   its own so multiple emulator instances can exist in the same process
 
-   further, the code buffer needs to be no greater than 1 MB in size so the a64
+   further, each code buffer needs to be no greater than 1 MB in size so the a64
    backend can use conditional branches to thunks without trampolining
 
-   finally, the code buffer needs to be aligned to a 4kb page so it's easy to
-   mprotect */
+   finally, each code buffer needs to be aligned to a 4kb page so it's easy to
+   mprotect. where the compiler allows it, it's aligned to a 2mb boundary
+   instead, so the entire buffer can be backed by huge pages */
+#if PLATFORM_WINDOWS
+#define JIT_CODE_BUFFER_ALIGN 4096
+#else
+#define JIT_CODE_BUFFER_ALIGN 0x200000
+#endif
+
 #if ARCH_A64
-#define DEFINE_JIT_CODE_BUFFER(name) static uint8_t ALIGNED(4096) name[0x100000]
+#define JIT_CODE_BUFFER_SIZE 0x100000
 #else
-#define DEFINE_JIT_CODE_BUFFER(name) static uint8_t ALIGNED(4096) name[0x800000]
+#define JIT_CODE_BUFFER_SIZE 0x800000
 #endif
 
+#define JIT_MAX_CODE_BUFFERS 32
+
+uint8_t *jit_alloc_code_buffer();
+void jit_free_code_buffer(uint8_t *code);
+
 enum {
   /* allocate to this register */
   JIT_ALLOCATE = 0x1,
@@ -71,6 +85,13 @@ enum {
 
 typedef void (*jit_emit_cb)(void *, int, uint32_t, uint8_t *);
 
+/* float environment the compiled code should execute under, used to mirror the
+   guest's rounding and denormal modes on the host */
+enum {
+  JIT_FPENV_ROUND_ZERO = 0x1,
+  JIT_FPENV_FLUSH_DENORMALS = 0x2,
+};
+
 /* backend-specific register definition */
 struct jit_register {
   const char *name;
@@ -88,6 +109,11 @@ struct jit_emitter {
 struct jit_backend {
   struct jit_guest *guest;
 
+  /* code buffer compiled blocks are emitted to, if any. exceptions raised from
+     within it are routed to this backend's jit */
+  uint8_t *code;
+  int code_size;
+
   const struct jit_register *registers;
   int num_registers;
 
@@ -110,6 +136,7 @@ struct jit_backend {
   void (*invalidate_code)(struct jit_backend *, uint32_t);
   void (*patch_edge)(struct jit_backend *, void *, void *);
   void (*restore_edge)(struct jit_backend *, void *, uint32_t);
+  void (*set_fpenv)(struct jit_backend *, int);
 };
 
 #endif
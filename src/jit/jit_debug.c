@@ -0,0 +1,467 @@
+#include "jit/jit_debug.h"
+#include "core/constructor.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "jit/jit.h"
+#include "options.h"
+
+#if PLATFORM_LINUX
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if PLATFORM_LINUX
+
+/*
+ * gdb jit interface. gdb places a breakpoint in __jit_debug_register_code, and
+ * reads the in-memory object file for the entry described by the descriptor
+ * each time it's hit. these symbol names are what gdb looks for and must not
+ * be changed
+ */
+enum {
+  JIT_NOACTION,
+  JIT_REGISTER_FN,
+  JIT_UNREGISTER_FN,
+};
+
+struct jit_code_entry {
+  struct jit_code_entry *next_entry;
+  struct jit_code_entry *prev_entry;
+  const char *symfile_addr;
+  uint64_t symfile_size;
+};
+
+struct jit_descriptor {
+  uint32_t version;
+  uint32_t action_flag;
+  struct jit_code_entry *relevant_entry;
+  struct jit_code_entry *first_entry;
+};
+
+void __attribute__((noinline)) __jit_debug_register_code() {
+  __asm__ volatile("");
+}
+
+struct jit_descriptor __jit_debug_descriptor = {1, JIT_NOACTION, NULL, NULL};
+
+/*
+ * perf jitdump format
+ */
+#define JITDUMP_MAGIC 0x4a695444
+#define JITDUMP_VERSION 1
+
+enum {
+  JIT_CODE_LOAD = 0,
+  JIT_CODE_DEBUG_INFO = 2,
+};
+
+struct jitdump_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct jitdump_record {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+struct jitdump_code_load {
+  struct jitdump_record rec;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+  /* followed by the null-terminated function name and the code itself */
+};
+
+struct jitdump_debug_info {
+  struct jitdump_record rec;
+  uint64_t code_addr;
+  uint64_t nr_entry;
+  /* followed by nr_entry debug entries */
+};
+
+struct jitdump_debug_entry {
+  uint64_t addr;
+  int lineno;
+  int discrim;
+  /* followed by the null-terminated source file name */
+};
+
+#if ARCH_X64
+#define JITDUMP_ELF_MACH EM_X86_64
+#else
+#define JITDUMP_ELF_MACH EM_NONE
+#endif
+
+/* the symfile registered with gdb for each block */
+#define GDB_SHDR_TEXT 1
+#define GDB_SHDR_SYMTAB 2
+#define GDB_SHDR_STRTAB 3
+#define GDB_SHDR_SHSTRTAB 4
+#define GDB_NUM_SHDRS 5
+
+static const char gdb_shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+
+/* the jitdump file and gdb entries are process-wide resources shared by each
+   jit instance, as both tools expect a single one per process. instances may
+   be running on separate threads, so all access goes through the mutex */
+static struct {
+  int refs;
+  FILE *jitdump;
+  void *jitdump_marker;
+  uint64_t code_index;
+} jdbg;
+
+static mutex_t jdbg_mutex;
+
+CONSTRUCTOR(jit_debug_mutex_init) {
+  jdbg_mutex = mutex_create();
+}
+
+static void jit_debug_symbol_name(char *name, size_t size, const char *tag,
+                                  uint32_t guest_addr) {
+  snprintf(name, size, "%s_0x%08x", tag, guest_addr);
+}
+
+/*
+ * jitdump
+ */
+static void jit_debug_write_jitdump(const char *tag, struct jit_block *block) {
+  FILE *file = jdbg.jitdump;
+  uint64_t timestamp = (uint64_t)time_nanoseconds();
+  const char *filename = tag;
+
+  /* debug info has to precede the code load record for the same address. each
+     guest instruction is mapped to a "line" equal to its address in a "file"
+     named after the jit. the top bit is masked off as lineno is signed */
+  int nr_entry = 0;
+  uint32_t entries_size = 0;
+
+  for (int i = 0; i < block->guest_size; i++) {
+    if (!block->source_map[i]) {
+      continue;
+    }
+    nr_entry++;
+    entries_size += sizeof(struct jitdump_debug_entry) + strlen(filename) + 1;
+  }
+
+  struct jitdump_debug_info info = {0};
+  info.rec.id = JIT_CODE_DEBUG_INFO;
+  info.rec.total_size = sizeof(info) + entries_size;
+  info.rec.timestamp = timestamp;
+  info.code_addr = (uint64_t)(uintptr_t)block->host_addr;
+  info.nr_entry = nr_entry;
+  fwrite(&info, sizeof(info), 1, file);
+
+  for (int i = 0; i < block->guest_size; i++) {
+    if (!block->source_map[i]) {
+      continue;
+    }
+
+    struct jitdump_debug_entry entry = {0};
+    entry.addr = (uint64_t)(uintptr_t)block->source_map[i];
+    entry.lineno = (int)((block->guest_addr + i) & 0x7fffffff);
+    fwrite(&entry, sizeof(entry), 1, file);
+    fwrite(filename, strlen(filename) + 1, 1, file);
+  }
+
+  /* write out the code itself */
+  char name[128];
+  jit_debug_symbol_name(name, sizeof(name), tag, block->guest_addr);
+
+  struct jitdump_code_load load = {0};
+  load.rec.id = JIT_CODE_LOAD;
+  load.rec.total_size = sizeof(load) + strlen(name) + 1 + block->host_size;
+  load.rec.timestamp = timestamp;
+  load.pid = (uint32_t)getpid();
+  load.tid = (uint32_t)syscall(SYS_gettid);
+  load.vma = (uint64_t)(uintptr_t)block->host_addr;
+  load.code_addr = (uint64_t)(uintptr_t)block->host_addr;
+  load.code_size = block->host_size;
+  load.code_index = jdbg.code_index++;
+  fwrite(&load, sizeof(load), 1, file);
+  fwrite(name, strlen(name) + 1, 1, file);
+  fwrite(block->host_addr, block->host_size, 1, file);
+
+  fflush(file);
+}
+
+static void jit_debug_open_jitdump() {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+
+  jdbg.jitdump = fopen(path, "w+");
+  CHECK_NOTNULL(jdbg.jitdump);
+
+  struct jitdump_header header = {0};
+  header.magic = JITDUMP_MAGIC;
+  header.version = JITDUMP_VERSION;
+  header.total_size = sizeof(header);
+  header.elf_mach = JITDUMP_ELF_MACH;
+  header.pid = (uint32_t)getpid();
+  header.timestamp = (uint64_t)time_nanoseconds();
+  fwrite(&header, sizeof(header), 1, jdbg.jitdump);
+  fflush(jdbg.jitdump);
+
+  /* perf discovers the file through an executable mapping of it being
+     recorded in the trace */
+  long page_size = sysconf(_SC_PAGESIZE);
+  jdbg.jitdump_marker = mmap(NULL, page_size, PROT_READ | PROT_EXEC,
+                             MAP_PRIVATE, fileno(jdbg.jitdump), 0);
+  CHECK_NE(jdbg.jitdump_marker, MAP_FAILED);
+
+  LOG_INFO("jit_debug_open_jitdump writing to %s", path);
+}
+
+static void jit_debug_close_jitdump() {
+  long page_size = sysconf(_SC_PAGESIZE);
+  munmap(jdbg.jitdump_marker, page_size);
+  fclose(jdbg.jitdump);
+
+  jdbg.jitdump_marker = NULL;
+  jdbg.jitdump = NULL;
+}
+
+/*
+ * gdb
+ */
+static struct jit_code_entry *jit_debug_create_symfile(const char *tag,
+                                                       struct jit_block *blk) {
+  /* build up the string table first. the block gets a function symbol, and
+     each guest instruction after the first a local label inside of it */
+  int num_syms = 2;
+  int strtab_size = 1;
+  char name[128];
+
+  for (int i = 0; i < blk->guest_size; i++) {
+    if (!blk->source_map[i]) {
+      continue;
+    }
+    jit_debug_symbol_name(name, sizeof(name), tag, blk->guest_addr + i);
+    strtab_size += (int)strlen(name) + 1;
+    num_syms += i ? 1 : 0;
+  }
+
+  if (!blk->source_map[0]) {
+    jit_debug_symbol_name(name, sizeof(name), tag, blk->guest_addr);
+    strtab_size += (int)strlen(name) + 1;
+  }
+
+  int shdrs_offset = sizeof(Elf64_Ehdr);
+  int symtab_offset = shdrs_offset + GDB_NUM_SHDRS * sizeof(Elf64_Shdr);
+  int strtab_offset = symtab_offset + num_syms * sizeof(Elf64_Sym);
+  int shstrtab_offset = strtab_offset + strtab_size;
+  int symfile_size = shstrtab_offset + sizeof(gdb_shstrtab);
+
+  struct jit_code_entry *entry =
+      calloc(1, sizeof(struct jit_code_entry) + symfile_size);
+  uint8_t *symfile = (uint8_t *)(entry + 1);
+  entry->symfile_addr = (const char *)symfile;
+  entry->symfile_size = symfile_size;
+
+  /* elf header */
+  Elf64_Ehdr *ehdr = (Elf64_Ehdr *)symfile;
+  memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr->e_type = ET_REL;
+  ehdr->e_machine = JITDUMP_ELF_MACH;
+  ehdr->e_version = EV_CURRENT;
+  ehdr->e_shoff = shdrs_offset;
+  ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+  ehdr->e_shentsize = sizeof(Elf64_Shdr);
+  ehdr->e_shnum = GDB_NUM_SHDRS;
+  ehdr->e_shstrndx = GDB_SHDR_SHSTRTAB;
+
+  /* section headers. the code isn't copied, .text just describes where it
+     lives in memory */
+  Elf64_Shdr *shdrs = (Elf64_Shdr *)(symfile + shdrs_offset);
+
+  Elf64_Shdr *text = &shdrs[GDB_SHDR_TEXT];
+  text->sh_name = 1;
+  text->sh_type = SHT_NOBITS;
+  text->sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+  text->sh_addr = (Elf64_Addr)(uintptr_t)blk->host_addr;
+  text->sh_size = blk->host_size;
+  text->sh_addralign = 16;
+
+  Elf64_Shdr *symtab = &shdrs[GDB_SHDR_SYMTAB];
+  symtab->sh_name = 7;
+  symtab->sh_type = SHT_SYMTAB;
+  symtab->sh_offset = symtab_offset;
+  symtab->sh_size = num_syms * sizeof(Elf64_Sym);
+  symtab->sh_link = GDB_SHDR_STRTAB;
+  /* index of the first non-local symbol */
+  symtab->sh_info = num_syms - 1;
+  symtab->sh_addralign = 8;
+  symtab->sh_entsize = sizeof(Elf64_Sym);
+
+  Elf64_Shdr *strtab = &shdrs[GDB_SHDR_STRTAB];
+  strtab->sh_name = 15;
+  strtab->sh_type = SHT_STRTAB;
+  strtab->sh_offset = strtab_offset;
+  strtab->sh_size = strtab_size;
+  strtab->sh_addralign = 1;
+
+  Elf64_Shdr *shstrtab = &shdrs[GDB_SHDR_SHSTRTAB];
+  shstrtab->sh_name = 23;
+  shstrtab->sh_type = SHT_STRTAB;
+  shstrtab->sh_offset = shstrtab_offset;
+  shstrtab->sh_size = sizeof(gdb_shstrtab);
+  shstrtab->sh_addralign = 1;
+
+  memcpy(symfile + shstrtab_offset, gdb_shstrtab, sizeof(gdb_shstrtab));
+
+  /* symbols, locals have to precede globals. symbol values are relative to
+     the .text section */
+  Elf64_Sym *syms = (Elf64_Sym *)(symfile + symtab_offset);
+  char *strs = (char *)(symfile + strtab_offset);
+  int str_offset = 1;
+  int sym = 1;
+
+  for (int i = 1; i < blk->guest_size; i++) {
+    if (!blk->source_map[i]) {
+      continue;
+    }
+
+    jit_debug_symbol_name(name, sizeof(name), tag, blk->guest_addr + i);
+    strcpy(strs + str_offset, name);
+
+    Elf64_Sym *local = &syms[sym++];
+    local->st_name = str_offset;
+    local->st_info = ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE);
+    local->st_shndx = GDB_SHDR_TEXT;
+    local->st_value = (uint8_t *)blk->source_map[i] - blk->host_addr;
+
+    str_offset += (int)strlen(name) + 1;
+  }
+
+  jit_debug_symbol_name(name, sizeof(name), tag, blk->guest_addr);
+  strcpy(strs + str_offset, name);
+
+  Elf64_Sym *func = &syms[sym++];
+  func->st_name = str_offset;
+  func->st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+  func->st_shndx = GDB_SHDR_TEXT;
+  func->st_value = 0;
+  func->st_size = blk->host_size;
+
+  CHECK_EQ(sym, num_syms);
+
+  return entry;
+}
+
+static void jit_debug_register_gdb(const char *tag, struct jit_block *block) {
+  struct jit_code_entry *entry = jit_debug_create_symfile(tag, block);
+
+  /* link into the descriptor's list and notify gdb */
+  entry->next_entry = __jit_debug_descriptor.first_entry;
+  if (entry->next_entry) {
+    entry->next_entry->prev_entry = entry;
+  }
+  __jit_debug_descriptor.first_entry = entry;
+  __jit_debug_descriptor.relevant_entry = entry;
+  __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+  __jit_debug_register_code();
+
+  block->debug_entry = entry;
+}
+
+static void jit_debug_unregister_gdb(struct jit_block *block) {
+  struct jit_code_entry *entry = block->debug_entry;
+
+  if (!entry) {
+    return;
+  }
+
+  /* unlink from the descriptor's list and notify gdb */
+  if (entry->prev_entry) {
+    entry->prev_entry->next_entry = entry->next_entry;
+  } else {
+    __jit_debug_descriptor.first_entry = entry->next_entry;
+  }
+  if (entry->next_entry) {
+    entry->next_entry->prev_entry = entry->prev_entry;
+  }
+  __jit_debug_descriptor.relevant_entry = entry;
+  __jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+  __jit_debug_register_code();
+
+  free(entry);
+  block->debug_entry = NULL;
+}
+
+void jit_debug_remove_block(struct jit_block *block) {
+  if (!OPTION_gdbjit) {
+    return;
+  }
+
+  mutex_lock(jdbg_mutex);
+  jit_debug_unregister_gdb(block);
+  mutex_unlock(jdbg_mutex);
+}
+
+void jit_debug_add_block(const char *tag, struct jit_block *block) {
+  if (!OPTION_jitdump && !OPTION_gdbjit) {
+    return;
+  }
+
+  mutex_lock(jdbg_mutex);
+
+  if (OPTION_jitdump) {
+    jit_debug_write_jitdump(tag, block);
+  }
+
+  if (OPTION_gdbjit) {
+    jit_debug_register_gdb(tag, block);
+  }
+
+  mutex_unlock(jdbg_mutex);
+}
+
+void jit_debug_shutdown() {
+  mutex_lock(jdbg_mutex);
+
+  if (--jdbg.refs == 0 && jdbg.jitdump) {
+    jit_debug_close_jitdump();
+  }
+
+  mutex_unlock(jdbg_mutex);
+}
+
+void jit_debug_init() {
+  mutex_lock(jdbg_mutex);
+
+  if (jdbg.refs++ == 0 && OPTION_jitdump) {
+    jit_debug_open_jitdump();
+  }
+
+  mutex_unlock(jdbg_mutex);
+}
+
+#else
+
+void jit_debug_remove_block(struct jit_block *block) {}
+
+void jit_debug_add_block(const char *tag, struct jit_block *block) {}
+
+void jit_debug_shutdown() {}
+
+void jit_debug_init() {}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef JIT_DEBUG_H
+#define JIT_DEBUG_H
+
+/* exposes compiled code to external tools. when enabled, each block is written
+   to a perf jitdump file (see tools/perf/Documentation/jitdump-specification)
+   and / or registered with gdb through its jit interface, mapping each host
+   instruction back to the guest instruction it was compiled from */
+
+struct jit_block;
+
+void jit_debug_init();
+void jit_debug_shutdown();
+
+void jit_debug_add_block(const char *tag, struct jit_block *block);
+void jit_debug_remove_block(struct jit_block *block);
+
+#endif
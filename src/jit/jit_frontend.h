@@ -26,7 +26,9 @@ struct jit_frontend {
 
   void (*destroy)(struct jit_frontend *);
 
-  void (*analyze_code)(struct jit_frontend *, uint32_t, int *);
+  /* returns the size of the block and if its translation depends on the
+     guest mode bits described by jit_guest's mode_mask */
+  void (*analyze_code)(struct jit_frontend *, uint32_t, int *, int *);
   void (*translate_code)(struct jit_frontend *, uint32_t, int, struct ir *);
   void (*dump_code)(struct jit_frontend *, uint32_t, int, FILE *output);
 
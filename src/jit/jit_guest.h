@@ -1,14 +1,33 @@
 #ifndef JIT_GUEST_H
 #define JIT_GUEST_H
 
+#include <setjmp.h>
 #include <stdint.h>
 
 typedef uint32_t (*mem_read_cb)(void *, uint32_t, uint32_t);
 typedef void (*mem_write_cb)(void *, uint32_t, uint32_t, uint32_t);
+typedef int (*mem_lookup_mmio_cb)(void *, uint32_t, void **, uint32_t *,
+                                  mem_read_cb *, mem_write_cb *, uint32_t **);
 
 typedef void (*jit_compile_cb)(void *, uint32_t);
 typedef void (*jit_link_cb)(void *, uint32_t);
 typedef void (*jit_interrupt_cb)(void *);
+typedef int (*jit_translate_cb)(void *, uint32_t, int, uint32_t *);
+typedef void (*jit_fault_cb)(void *, uint32_t, int);
+
+/* access types passed to translate */
+enum {
+  JIT_ACCESS_READ,
+  JIT_ACCESS_WRITE,
+  JIT_ACCESS_FETCH,
+};
+
+/* software tlb entry, mapping the page addr >> tlb_shift to the page at
+   addr + addend. empty entries have a tag no address can shift down to */
+struct jit_tlb_entry {
+  uint32_t tag;
+  uint32_t addend;
+};
 
 struct memory;
 
@@ -31,15 +50,78 @@ struct jit_guest {
   void (*w32)(struct memory *, uint32_t, uint32_t);
   void (*w64)(struct memory *, uint32_t, uint64_t);
 
+  /* optional, resolves a constant mmio address at compile time directly to the
+     device handler servicing it, avoiding the page-level callback and its
+     address decoding. on success, the handler is returned along with the
+     device-relative address it expects, and optionally a pointer to the
+     register's backing storage if loads from it may be inlined */
+  mem_lookup_mmio_cb lookup_mmio;
+
+  /* optional, map of dirty flags which fast stores are to mark. a store to
+     addr sets all bits of dirty_map[(addr >> dirty_shift) & dirty_mask] */
+  uint8_t *dirty_map;
+  int dirty_shift;
+  uint32_t dirty_mask;
+
+  /* optional, address translation. while tlb_enabled is set, each guest
+     address is translated before being accessed. an access to addr hits when
+     tlb[(addr >> tlb_shift) & tlb_mask].tag equals addr >> tlb_shift, in which
+     case the translated address is addr plus the entry's addend. misses are
+     resolved by translate, which is expected to refill the entry. code must be
+     invalidated whenever tlb_enabled is toggled
+
+     translate fails for accesses which aren't permitted, without side effects.
+     the backend then syncs the context's pc to the accessing instruction and
+     calls fault to raise the guest's exception. fallbacks can't return early,
+     so instead they unwind to fault_jmp, set by the backend running them */
+  int tlb_enabled;
+  struct jit_tlb_entry *tlb_read;
+  struct jit_tlb_entry *tlb_write;
+  int tlb_shift;
+  uint32_t tlb_mask;
+  jit_translate_cb translate;
+  jit_fault_cb fault;
+  jmp_buf *fault_jmp;
+
   /* runtime interface used by the backend and dispatch */
   void *data;
   int offset_pc;
   int offset_cycles;
   int offset_instrs;
   int offset_interrupts;
+
+  /* optional, mask of the bits in the 32-bit context word at offset_mode which
+     blocks may be specialized for. specialized blocks are keyed by both their
+     address and these bits, letting dispatch pick between several variants of
+     the same code */
+  int offset_mode;
+  uint32_t mode_mask;
+
   jit_compile_cb compile_code;
   jit_link_cb link_code;
   jit_interrupt_cb check_interrupts;
 };
 
+static inline int jit_guest_translate(struct jit_guest *guest, uint32_t addr,
+                                      int access, uint32_t *phys) {
+  if (!guest->tlb_enabled) {
+    *phys = addr;
+    return 1;
+  }
+
+  if (access != JIT_ACCESS_FETCH) {
+    struct jit_tlb_entry *tlb =
+        access == JIT_ACCESS_WRITE ? guest->tlb_write : guest->tlb_read;
+    uint32_t vpn = addr >> guest->tlb_shift;
+    struct jit_tlb_entry *entry = &tlb[vpn & guest->tlb_mask];
+
+    if (entry->tag == vpn) {
+      *phys = addr + entry->addend;
+      return 1;
+    }
+  }
+
+  return guest->translate(guest->data, addr, access, phys);
+}
+
 #endif
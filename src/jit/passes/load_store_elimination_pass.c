@@ -133,14 +133,24 @@ static void lse_eliminate_loads(struct lse *lse, struct ir *ir,
   }
 }
 
+static int lse_may_fault(struct ir_instr *instr) {
+  return instr->op == OP_LOAD_GUEST || instr->op == OP_STORE_GUEST ||
+         instr->op == OP_LOAD_FAST || instr->op == OP_STORE_FAST;
+}
+
 static void lse_eliminate_stores(struct lse *lse, struct ir *ir,
-                                 struct ir_block *block) {
+                                 struct ir_block *block, int guest_faults) {
   lse_clear_available(lse);
 
   list_for_each_entry_safe_reverse(instr, &block->instrs, struct ir_instr, it) {
     if (instr->op == OP_FALLBACK || instr->op == OP_CALL) {
       lse_clear_available(lse);
-    } else if (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND) {
+    } else if (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND ||
+               instr->op == OP_GUARD_EQ) {
+      lse_clear_available(lse);
+    } else if (guest_faults && lse_may_fault(instr)) {
+      /* the guest's exception handler observes the context as of the
+         faulting access, stores before it can't be deferred past it */
       lse_clear_available(lse);
     } else if (instr->op == OP_LOAD_CONTEXT) {
       int offset = instr->arg[0]->i32;
@@ -164,13 +174,13 @@ static void lse_eliminate_stores(struct lse *lse, struct ir *ir,
   }
 }
 
-void lse_run(struct lse *lse, struct ir *ir) {
+void lse_run(struct lse *lse, struct ir *ir, int guest_faults) {
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
     lse_eliminate_loads(lse, ir, block);
   }
 
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
-    lse_eliminate_stores(lse, ir, block);
+    lse_eliminate_stores(lse, ir, block, guest_faults);
   }
 }
 
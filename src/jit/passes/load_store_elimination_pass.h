@@ -6,6 +6,6 @@ struct lse;
 
 struct lse *lse_create();
 void lse_destroy(struct lse *lse);
-void lse_run(struct lse *lse, struct ir *ir);
+void lse_run(struct lse *lse, struct ir *ir, int guest_faults);
 
 #endif
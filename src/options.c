@@ -101,6 +101,14 @@ DEFINE_PERSISTENT_OPTION_INT(deadzone_3,   DEFAULT_DEADZONE,  "Deadzone for cont
 
 /* emulator */
 DEFINE_PERSISTENT_OPTION_STRING(aspect,    "4:3",             "Video aspect ratio");
+DEFINE_OPTION_INT(hugepages,               0,                 "Back guest memory and compiled code with huge pages");
+DEFINE_OPTION_INT(mmio_stats,              0,                 "Count mmio accesses per register and page, writing them to mmio_stats.csv on exit");
+DEFINE_OPTION_INT(sched_stats,             0,                 "Accumulate host time spent in each device and timer callback");
+DEFINE_OPTION_INT(tr_threads,              2,                 "Worker threads converting ta contexts alongside the video thread");
+DEFINE_OPTION_INT(boot_snapshot,           0,                 "Snapshot each disc once booted, restoring it on later launches to skip the boot");
+DEFINE_OPTION_INT(rewind,                  0,                 "Memory budget in mb for rewind history, 0 to disable");
+DEFINE_OPTION_INT(rewind_interval,         6,                 "Frames between each rewind capture");
+DEFINE_OPTION_STRING(input_log,           "",                "Record controller input to this path, for replaying with rebench");
 
 /* bios */
 DEFINE_PERSISTENT_OPTION_STRING(region,    "usa",             "System region");
@@ -109,6 +117,8 @@ DEFINE_PERSISTENT_OPTION_STRING(broadcast, "ntsc",            "System broadcast
 
 /* jit */
 DEFINE_OPTION_INT(perf,                    0,                 "Create maps for compiled code for use with perf");
+DEFINE_OPTION_INT(jitdump,                 0,                 "Write compiled code to a jitdump file for use with perf inject");
+DEFINE_OPTION_INT(gdbjit,                  0,                 "Register compiled code with gdb's jit interface");
 
 /* ui */
 DEFINE_PERSISTENT_OPTION_STRING(gamedir,   "",                "Directories to scan for games");
@@ -62,6 +62,14 @@ DECLARE_OPTION_INT(deadzone_3);
 
 /* emulator */
 DECLARE_OPTION_STRING(aspect);
+DECLARE_OPTION_INT(hugepages);
+DECLARE_OPTION_INT(mmio_stats);
+DECLARE_OPTION_INT(sched_stats);
+DECLARE_OPTION_INT(tr_threads);
+DECLARE_OPTION_INT(boot_snapshot);
+DECLARE_OPTION_INT(rewind);
+DECLARE_OPTION_INT(rewind_interval);
+DECLARE_OPTION_STRING(input_log);
 
 /* bios */
 DECLARE_OPTION_STRING(region);
@@ -70,6 +78,8 @@ DECLARE_OPTION_STRING(broadcast);
 
 /* jit */
 DECLARE_OPTION_INT(perf);
+DECLARE_OPTION_INT(jitdump);
+DECLARE_OPTION_INT(gdbjit);
 
 /* ui */
 DECLARE_OPTION_STRING(gamedir);
@@ -6,5 +6,11 @@ DEFINE_AGGREGATE_COUNTER(arm7_instrs);
 DEFINE_AGGREGATE_COUNTER(pvr_vblanks);
 DEFINE_AGGREGATE_COUNTER(ta_renders);
 DEFINE_AGGREGATE_COUNTER(sh4_instrs);
+DEFINE_AGGREGATE_COUNTER(sh4_idle);
 DEFINE_AGGREGATE_COUNTER(mmio_read);
 DEFINE_AGGREGATE_COUNTER(mmio_write);
+DEFINE_AGGREGATE_COUNTER(sched_tick_time);
+DEFINE_AGGREGATE_COUNTER(sched_device_time);
+DEFINE_AGGREGATE_COUNTER(sched_timer_time);
+DEFINE_AGGREGATE_COUNTER(jit_compile_time);
+DEFINE_AGGREGATE_COUNTER(jit_compiles);
@@ -9,7 +9,13 @@ DECLARE_COUNTER(arm7_instrs);
 DECLARE_COUNTER(pvr_vblanks);
 DECLARE_COUNTER(ta_renders);
 DECLARE_COUNTER(sh4_instrs);
+DECLARE_COUNTER(sh4_idle);
 DECLARE_COUNTER(mmio_read);
 DECLARE_COUNTER(mmio_write);
+DECLARE_COUNTER(sched_tick_time);
+DECLARE_COUNTER(sched_device_time);
+DECLARE_COUNTER(sched_timer_time);
+DECLARE_COUNTER(jit_compile_time);
+DECLARE_COUNTER(jit_compiles);
 
 #endif
@@ -105,6 +105,7 @@ struct tracer {
   int scroll_to_param;
 
   /* render state */
+  struct tr *tr;
   struct tr_context rc;
   int debug_depth;
   struct tracer_texture textures[1024];
@@ -687,8 +688,7 @@ void tracer_render_frame(struct tracer *tracer) {
     end_surf = rp->last_surf;
   }
 
-  tr_convert_context(tracer->r, tracer, &tracer_find_texture, &tracer->ctx,
-                     &tracer->rc);
+  tr_convert_context(tracer->tr, tracer->r, &tracer->ctx, &tracer->rc);
 
   for (int i = 0; i < rc->num_surfs; i++) {
     struct ta_surface *surf = &rc->surfs[i];
@@ -751,6 +751,8 @@ void tracer_destroy(struct tracer *tracer) {
 
   tracer_vid_destroyed(tracer);
 
+  tr_destroy(tracer->tr);
+
   free(tracer);
 }
 
@@ -758,6 +760,7 @@ struct tracer *tracer_create(struct host *host) {
   struct tracer *tracer = calloc(1, sizeof(struct tracer));
 
   tracer->host = host;
+  tracer->tr = tr_create(tracer, &tracer_find_texture, 0);
 
   /* add all textures to free list */
   for (int i = 0, n = ARRAY_SIZE(tracer->textures); i < n; i++) {
@@ -0,0 +1,250 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/scheduler.h"
+#include "guest/sh4/sh4.h"
+
+#define BYTES_PER_REGION (8 * 1024 * 1024)
+
+static uint8_t buffer[1024 * 1024];
+
+struct dma_region {
+  const char *name;
+  uint32_t addr;
+  int size;
+  int write;
+};
+
+static struct dma_region dma_regions[] = {
+    {"boot rom", SH4_BOOT_ROM_BEGIN, 0x10000, 0},
+    {"flash rom", SH4_FLASH_ROM_BEGIN, 0x10000, 0},
+    {"holly regs", SH4_HOLLY_REG_BEGIN + 0x6800, 0x100, 0},
+    {"pvr regs", SH4_PVR_REG_BEGIN + 0x1000, 0x1000, 0},
+    {"aica regs", SH4_AICA_REG_BEGIN, 0x2000, 0},
+    {"aica mem", SH4_AICA_MEM_BEGIN, 0x10000, 1},
+    {"vram 64-bit", SH4_PVR_VRAM64_BEGIN, 0x10000, 1},
+    {"vram 32-bit", SH4_PVR_VRAM32_BEGIN, 0x10000, 1},
+};
+
+TEST(dma_throughput) {
+  struct dreamcast *dc = dc_create();
+  sh4_reset(dc->sh4, 0xa0000000);
+
+  for (int i = 0; i < ARRAY_SIZE(dma_regions); i++) {
+    struct dma_region *region = &dma_regions[i];
+    int n = BYTES_PER_REGION / region->size;
+
+    int64_t start = time_nanoseconds();
+
+    for (int j = 0; j < n; j++) {
+      if (region->write) {
+        sh4_memcpy_to_guest(dc->mem, region->addr, buffer, region->size);
+      } else {
+        sh4_memcpy_to_host(dc->mem, buffer, region->addr, region->size);
+      }
+    }
+
+    int64_t end = time_nanoseconds();
+
+    float elapsed = (end - start) / (float)NS_PER_SEC;
+    LOG_INFO("dma %s %s: %.2f mb/s", region->write ? "to" : "from",
+             region->name, (n * region->size) / elapsed / (1024.0f * 1024.0f));
+  }
+
+  dc_destroy(dc);
+}
+
+TEST(dma_ddt_async) {
+  struct dreamcast *dc = dc_create();
+  struct sh4 *sh4 = dc->sh4;
+  sh4_reset(sh4, 0xa0000000);
+
+  /* only run the scheduler's timers, there's no code to execute */
+  sh4->runif.running = 0;
+  dc_resume(dc);
+
+  const uint32_t src = 0x0c010000;
+  const uint32_t dst = 0x0c100000;
+  const int size = 0x10000;
+
+  for (int i = 0; i < size; i++) {
+    buffer[i] = (uint8_t)i;
+  }
+  sh4_memcpy_to_guest(dc->mem, src, buffer, size);
+
+  *sh4->DAR1 = dst;
+  *sh4->DMATCR1 = size / 32;
+
+  struct sh4_dtr dtr = {0};
+  dtr.channel = 1;
+  dtr.dir = SH4_DMA_FROM_ADDR;
+  dtr.addr = src;
+  sh4_dmac_ddt(sh4, &dtr);
+
+  /* nothing lands until the first burst's time has elapsed */
+  CHECK_EQ(*sh4->DMATCR1, size / 32);
+  CHECK_EQ(sh4->CHCR1->TE, 0);
+
+  dc_tick(dc, NS_PER_MS);
+
+  CHECK_EQ(*sh4->DMATCR1, 0);
+  CHECK_EQ(*sh4->DAR1, dst + size);
+  CHECK_EQ(sh4->CHCR1->TE, 1);
+
+  static uint8_t result[0x10000];
+  sh4_memcpy_to_host(dc->mem, result, dst, size);
+  CHECK_EQ(memcmp(result, buffer, size), 0);
+
+  dc_destroy(dc);
+}
+
+TEST(dma_ddt_restart) {
+  struct dreamcast *dc = dc_create();
+  struct sh4 *sh4 = dc->sh4;
+  sh4_reset(sh4, 0xa0000000);
+
+  sh4->runif.running = 0;
+  dc_resume(dc);
+
+  const uint32_t src = 0x0c010000;
+  const uint32_t dst = 0x0c100000;
+  const int size = 0x10000;
+
+  /* enable the channel through the registers, such that disabling it below
+     goes through their write handlers */
+  union chcr chcr = {0};
+  chcr.DE = 1;
+  sh4_write32(dc->mem, 0xffa00040, 0x8001);
+  sh4_write32(dc->mem, 0xffa0001c, chcr.full);
+
+  /* restarting a busy channel replaces the in-flight transfer */
+  struct sh4_dtr dtr = {0};
+  dtr.channel = 1;
+  dtr.dir = SH4_DMA_FROM_ADDR;
+  dtr.addr = src;
+
+  *sh4->DAR1 = dst;
+  *sh4->DMATCR1 = size / 32;
+  sh4_dmac_ddt(sh4, &dtr);
+
+  *sh4->DAR1 = dst + size;
+  *sh4->DMATCR1 = size / 32;
+  sh4_dmac_ddt(sh4, &dtr);
+
+  dc_tick(dc, NS_PER_MS);
+
+  CHECK_EQ(*sh4->DMATCR1, 0);
+  CHECK_EQ(*sh4->DAR1, dst + size * 2);
+  CHECK_EQ(sh4->CHCR1->TE, 1);
+
+  /* clearing DE halts the transfer after the bursts already landed */
+  *sh4->DAR1 = dst;
+  *sh4->DMATCR1 = size / 32;
+  sh4->CHCR1->TE = 0;
+  sh4_dmac_ddt(sh4, &dtr);
+
+  chcr.DE = 0;
+  sh4_write32(dc->mem, 0xffa0001c, chcr.full);
+  dc_tick(dc, NS_PER_MS);
+
+  CHECK_EQ(*sh4->DMATCR1, size / 32);
+  CHECK_EQ(*sh4->DAR1, dst);
+  CHECK_EQ(sh4->CHCR1->TE, 0);
+
+  dc_destroy(dc);
+}
+
+TEST(dma_vram32_interleave) {
+  struct dreamcast *dc = dc_create();
+  struct memory *mem = dc->mem;
+  sh4_reset(dc->sh4, 0xa0000000);
+
+  /* an unaligned span crossing from the first 4mb bank into the second */
+  const uint32_t offset = 0x003ff002;
+  const int size = 0x2003;
+  static uint8_t result[0x2003];
+
+  for (int i = 0; i < size; i++) {
+    buffer[i] = (uint8_t)(i * 13 + 1);
+  }
+
+  /* data written through the string helpers reads back the same one word at
+     a time, and lands where the 64-bit path expects each bank's words */
+  sh4_memcpy_to_guest(mem, SH4_PVR_VRAM32_BEGIN + offset, buffer, size);
+
+  for (int i = 0; i < size; i++) {
+    uint32_t addr = offset + i;
+    uint32_t bank = (addr >> 22) & 1;
+    uint32_t addr64 = ((addr & 0x3ffffc) << 1) | (bank << 2) | (addr & 3);
+
+    CHECK_EQ(sh4_read8(mem, SH4_PVR_VRAM64_BEGIN + addr64), buffer[i]);
+
+    if (addr & 3 || i + 4 > size) {
+      continue;
+    }
+
+    uint32_t expected;
+    memcpy(&expected, &buffer[i], 4);
+    CHECK_EQ(sh4_read32(mem, SH4_PVR_VRAM32_BEGIN + addr), expected);
+  }
+
+  /* and vice versa for data written one word at a time */
+  const uint32_t begin = offset & ~3;
+
+  for (uint32_t addr = begin; addr < offset + size; addr += 4) {
+    sh4_write32(mem, SH4_PVR_VRAM32_BEGIN + addr, addr * 0x9e3779b9);
+  }
+
+  sh4_memcpy_to_host(mem, result, SH4_PVR_VRAM32_BEGIN + offset, size);
+
+  for (int i = 0; i < size; i++) {
+    uint32_t addr = offset + i;
+    uint32_t word = (addr & ~3) * 0x9e3779b9;
+    CHECK_EQ(result[i], (uint8_t)(word >> ((addr & 3) * 8)));
+  }
+
+  dc_destroy(dc);
+}
+
+TEST(dma_string_span) {
+  struct dreamcast *dc = dc_create();
+  struct sh4 *sh4 = dc->sh4;
+  sh4_reset(sh4, 0xa0000000);
+
+  /* spans from the end of one device into the start of the next */
+  static const uint32_t spans[] = {
+      SH4_FLASH_ROM_BEGIN - 8,
+      SH4_PVR_REG_BEGIN - 8,
+  };
+
+  /* string reads crossing the boundary match the scalar handlers */
+  for (int i = 0; i < ARRAY_SIZE(spans); i++) {
+    uint32_t words[4];
+    sh4_area0_read_string(sh4, (uint8_t *)words, spans[i], sizeof(words));
+
+    for (int j = 0; j < ARRAY_SIZE(words); j++) {
+      uint32_t addr = spans[i] + j * 4;
+      CHECK_EQ(words[j], sh4_area0_read(sh4, addr, 0xffffffff));
+    }
+  }
+
+  /* as do writes, the pvr's ID register ignoring them */
+  const uint32_t addr = SH4_PVR_REG_BEGIN - 8;
+  uint32_t expected[4];
+
+  for (int i = 0; i < ARRAY_SIZE(expected); i++) {
+    expected[i] = sh4_area0_read(sh4, addr + i * 4, 0xffffffff);
+  }
+
+  uint32_t words[4] = {0x11111111, 0x22222222, 0x33333333, 0x44444444};
+  sh4_area0_write_string(sh4, addr, (uint8_t *)words, sizeof(words));
+
+  CHECK_EQ(sh4_area0_read(sh4, addr, 0xffffffff), words[0]);
+  CHECK_EQ(sh4_area0_read(sh4, addr + 4, 0xffffffff), words[1]);
+  CHECK_EQ(sh4_area0_read(sh4, addr + 8, 0xffffffff), expected[2]);
+  CHECK_EQ(sh4_area0_read(sh4, addr + 12, 0xffffffff), words[3]);
+
+  dc_destroy(dc);
+}
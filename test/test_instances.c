@@ -0,0 +1,84 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+
+#define NUM_INSTANCES 2
+#define CODE_ADDR 0x8c001000
+#define DATA_ADDR 0x8c100000
+#define NUM_WORDS 1024
+
+struct instance {
+  uint32_t seed;
+  int ok;
+};
+
+static void *instance_thread(void *data) {
+  struct instance *inst = data;
+  struct dreamcast *dc = dc_create();
+  struct memory *mem = dc->mem;
+  struct sh4 *sh4 = dc->sh4;
+
+  /* store r8 to @r9, increment it and loop */
+  static const uint16_t code[] = {
+      0x2982, /* mov.l r8, @r9 */
+      0xaffd, /* bra 0x8c001000 */
+      0x7801, /* add #1, r8 */
+  };
+
+  sh4_reset(sh4, CODE_ADDR);
+
+  for (int i = 0; i < ARRAY_SIZE(code); i++) {
+    sh4_write16(mem, CODE_ADDR + i * 2, code[i]);
+  }
+
+  for (int i = 0; i < NUM_WORDS; i++) {
+    sh4_write32(mem, DATA_ADDR + i * 4, inst->seed + i);
+  }
+
+  sh4->ctx.r[8] = inst->seed;
+  sh4->ctx.r[9] = DATA_ADDR + NUM_WORDS * 4;
+
+  dc_resume(dc);
+
+  for (int i = 0; i < 10; i++) {
+    dc_tick(dc, NS_PER_MS);
+  }
+
+  /* each instance ran its own code, and its ram is only visible to itself */
+  uint32_t counter = sh4->ctx.r[8];
+  uint32_t stored = sh4_read32(mem, DATA_ADDR + NUM_WORDS * 4);
+  inst->ok = counter > inst->seed && (stored >> 24) == (inst->seed >> 24);
+
+  for (int i = 0; i < NUM_WORDS; i++) {
+    inst->ok &= sh4_read32(mem, DATA_ADDR + i * 4) == inst->seed + i;
+  }
+
+  dc_destroy(dc);
+
+  return NULL;
+}
+
+TEST(instances_threaded) {
+  struct instance instances[NUM_INSTANCES];
+  thread_t threads[NUM_INSTANCES];
+
+  /* create, run and destroy the instances concurrently. do so twice, reusing
+     the resources released by the first set of instances */
+  for (int run = 0; run < 2; run++) {
+    for (int i = 0; i < NUM_INSTANCES; i++) {
+      instances[i].seed = (run * NUM_INSTANCES + i + 1) << 24;
+      instances[i].ok = 0;
+      threads[i] = thread_create(&instance_thread, "instance", &instances[i]);
+      CHECK_NOTNULL(threads[i]);
+    }
+
+    for (int i = 0; i < NUM_INSTANCES; i++) {
+      thread_join(threads[i], NULL);
+      CHECK(instances[i].ok);
+    }
+  }
+}
@@ -67,7 +67,7 @@ static char scratch_buffer[1024 * 1024];
   CHECK(res);
 
   struct lse *lse = lse_create();
-  lse_run(lse, &ir);
+  lse_run(lse, &ir, 0);
   lse_destroy(lse);
 
   FILE *output = tmpfile();
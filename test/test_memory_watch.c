@@ -0,0 +1,134 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/memory.h"
+#include "core/time.h"
+
+#define NUM_PAGES 1000
+
+static int num_fired;
+
+static void watch_fired(const struct exception_state *ex, void *data) {
+  num_fired++;
+}
+
+static uint8_t *alloc_watched_pages(struct memory_watcher *watcher,
+                                    size_t page_size) {
+  uint8_t *pages = reserve_pages(NULL, page_size * NUM_PAGES);
+  CHECK_NOTNULL(pages);
+  CHECK(protect_pages(pages, page_size * NUM_PAGES, ACC_READWRITE));
+
+  for (int i = 0; i < NUM_PAGES; i++) {
+    add_single_write_watch(watcher, pages + i * page_size, page_size,
+                           &watch_fired, NULL);
+  }
+
+  return pages;
+}
+
+/* writes to each watched page, returning the time spent writing and
+   harvesting the writes */
+static int64_t write_watched_pages(struct memory_watcher *watcher,
+                                   uint8_t *pages, size_t page_size) {
+  num_fired = 0;
+
+  int64_t start = time_nanoseconds();
+
+  for (int i = 0; i < NUM_PAGES; i++) {
+    *(volatile uint8_t *)(pages + i * page_size) = 1;
+  }
+
+  /* second write to each page must not fire the single write watch again */
+  for (int i = 0; i < NUM_PAGES; i++) {
+    *(volatile uint8_t *)(pages + i * page_size) = 2;
+  }
+
+  poll_dirty_ranges(watcher);
+
+  int64_t end = time_nanoseconds();
+
+  CHECK_EQ(num_fired, NUM_PAGES);
+
+  return end - start;
+}
+
+TEST(memory_watch_fault) {
+  size_t page_size = get_page_size();
+  struct memory_watcher *watcher = create_memory_watcher();
+  CHECK(set_memory_watch_backend(watcher, WATCH_BACKEND_FAULT));
+
+  uint8_t *pages = alloc_watched_pages(watcher, page_size);
+  int64_t elapsed = write_watched_pages(watcher, pages, page_size);
+  release_pages(pages, page_size * NUM_PAGES);
+  destroy_memory_watcher(watcher);
+
+  LOG_INFO("fault backend: %d pages in %.3f ms", NUM_PAGES,
+           elapsed / (float)NS_PER_MS);
+}
+
+TEST(memory_watch_soft_dirty) {
+  size_t page_size = get_page_size();
+  struct memory_watcher *watcher = create_memory_watcher();
+
+  if (!set_memory_watch_backend(watcher, WATCH_BACKEND_SOFT_DIRTY)) {
+    LOG_INFO("soft-dirty backend not supported, skipping");
+    destroy_memory_watcher(watcher);
+    return;
+  }
+
+  uint8_t *pages = alloc_watched_pages(watcher, page_size);
+
+  /* pages untouched since the last poll don't fire */
+  num_fired = 0;
+  poll_dirty_ranges(watcher);
+  CHECK_EQ(num_fired, 0);
+
+  int64_t elapsed = write_watched_pages(watcher, pages, page_size);
+  release_pages(pages, page_size * NUM_PAGES);
+  destroy_memory_watcher(watcher);
+
+  LOG_INFO("soft-dirty backend: %d pages in %.3f ms", NUM_PAGES,
+           elapsed / (float)NS_PER_MS);
+}
+
+static void watch_counted(const struct exception_state *ex, void *data) {
+  (*(int *)data)++;
+}
+
+TEST(memory_watch_instances) {
+  size_t page_size = get_page_size();
+  struct memory_watcher *watchers[2];
+  int fired[2] = {0};
+
+  uint8_t *pages = reserve_pages(NULL, page_size * NUM_PAGES);
+  CHECK_NOTNULL(pages);
+  CHECK(protect_pages(pages, page_size * NUM_PAGES, ACC_READWRITE));
+
+  /* interleave the pages watched by each watcher, so their claimed ranges
+     overlap and faults must be told apart by the watches themselves */
+  for (int i = 0; i < 2; i++) {
+    watchers[i] = create_memory_watcher();
+  }
+
+  for (int i = 0; i < NUM_PAGES; i++) {
+    add_single_write_watch(watchers[i & 1], pages + i * page_size, page_size,
+                           &watch_counted, &fired[i & 1]);
+  }
+
+  for (int i = 0; i < NUM_PAGES; i++) {
+    *(volatile uint8_t *)(pages + i * page_size) = 1;
+  }
+
+  CHECK_EQ(fired[0], NUM_PAGES / 2);
+  CHECK_EQ(fired[1], NUM_PAGES / 2);
+
+  /* only one watcher at a time can own the process-wide soft-dirty bits */
+  if (set_memory_watch_backend(watchers[0], WATCH_BACKEND_SOFT_DIRTY)) {
+    CHECK(!set_memory_watch_backend(watchers[1], WATCH_BACKEND_SOFT_DIRTY));
+  }
+
+  for (int i = 0; i < 2; i++) {
+    destroy_memory_watcher(watchers[i]);
+  }
+
+  release_pages(pages, page_size * NUM_PAGES);
+}
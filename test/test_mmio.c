@@ -0,0 +1,187 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/holly/holly.h"
+#include "guest/memory.h"
+#include "guest/pvr/pvr.h"
+#include "guest/pvr/pvr_types.h"
+#include "guest/sh4/sh4.h"
+
+#define NUM_POLLS 10000000
+
+/* registers commonly polled by games while waiting on the hardware, spread
+   across the devices sharing area 0 as well as the sh4's own registers */
+static const uint32_t polled_regs[] = {
+    0xa05f6900, /* SB_ISTNRM */
+    0xa05f810c, /* SPG_STATUS */
+    0xa05f6c18, /* SB_MDST */
+    0xa0702c00, /* ARMRST */
+    0xa05f7c18, /* SB_ADST */
+    0xffd8000c, /* TCNT0 */
+    0xa05f8000, /* ID */
+    0xa0200000, /* flash rom */
+};
+
+TEST(mmio_polling) {
+  struct dreamcast *dc = dc_create();
+  sh4_reset(dc->sh4, 0xa0000000);
+
+  /* report the best of several rounds to filter out noise from the host */
+  int64_t best = INT64_MAX;
+  uint32_t sum = 0;
+
+  for (int round = 0; round < 5; round++) {
+    int64_t start = time_nanoseconds();
+
+    for (int i = 0; i < NUM_POLLS; i++) {
+      sum += sh4_read32(dc->mem, polled_regs[i % ARRAY_SIZE(polled_regs)]);
+    }
+
+    int64_t end = time_nanoseconds();
+    best = MIN(best, end - start);
+  }
+
+  float elapsed = best / (float)NS_PER_SEC;
+  LOG_INFO("mixed register polling: %.2f mreads/s (sum 0x%08x)",
+           NUM_POLLS / elapsed / 1000000.0f, sum);
+
+  dc_destroy(dc);
+}
+
+/* ranges straddling the device boundaries inside the first 2mb page of area
+   0: the last holly and first pvr subpages, the end of the modem area, left
+   to the page-level handler, and the first aica subpage */
+static const struct {
+  uint32_t begin;
+  uint32_t end;
+} boundaries[] = {
+    {SH4_PVR_REG_BEGIN - 0x1000, SH4_PVR_REG_BEGIN + 0x1000},
+    {SH4_MODEM_BEGIN + 0x7f000, SH4_MODEM_BEGIN + 0x80000},
+    {SH4_AICA_REG_BEGIN, SH4_AICA_REG_BEGIN + 0x1000},
+};
+
+static void check_dispatch(struct sh4 *sh4, uint32_t addr) {
+  /* skip the gdrom's registers, reading them advances its state */
+  if (addr >= SH4_HOLLY_REG_BEGIN && addr <= SH4_HOLLY_REG_END &&
+      holly_cb[(addr - SH4_HOLLY_REG_BEGIN) >> 2].read) {
+    return;
+  }
+
+  /* the direct mapped area 0 and one of its mirrors */
+  uint32_t expected = sh4_area0_read(sh4, addr, 0xffffffff);
+  CHECK_EQ(sh4_read32(sh4->dc->mem, 0xa0000000 | addr), expected);
+  CHECK_EQ(sh4_read32(sh4->dc->mem, 0x82000000 | addr), expected);
+}
+
+TEST(mmio_subpage_dispatch) {
+  struct dreamcast *dc = dc_create();
+  struct holly *hl = dc->holly;
+  struct pvr *pvr = dc->pvr;
+  struct sh4 *sh4 = dc->sh4;
+  sh4_reset(sh4, 0xa0000000);
+
+  const uint32_t subpage_size = 0x1000;
+  const uint32_t holly_tag = 0x11000000;
+  const uint32_t pvr_tag = 0x22000000;
+
+  /* tag each device's backing storage, such that a read routed to the wrong
+     device returns the other's tag */
+  for (int i = 0; i < NUM_HOLLY_REGS; i++) {
+    hl->reg[i] = holly_tag | i;
+  }
+  for (int i = 0; i < PVR_NUM_REGS; i++) {
+    pvr->reg[i] = pvr_tag | i;
+  }
+
+  /* subpage dispatch returns the same values as the page-level handler on
+     either side of each boundary */
+  for (int i = 0; i < ARRAY_SIZE(boundaries); i++) {
+    uint32_t begin = boundaries[i].begin;
+    uint32_t end = boundaries[i].end;
+
+    for (uint32_t addr = begin; addr < end; addr += 4) {
+      check_dispatch(sh4, addr);
+    }
+  }
+
+  /* registers without handlers of their own return their tagged storage,
+     which must belong to the device mapped at the address */
+  for (uint32_t addr = SH4_PVR_REG_BEGIN - subpage_size;
+       addr < SH4_PVR_REG_BEGIN + subpage_size; addr += 4) {
+    if (addr < SH4_PVR_REG_BEGIN &&
+        holly_cb[(addr - SH4_HOLLY_REG_BEGIN) >> 2].read) {
+      continue;
+    }
+
+    uint32_t data = sh4_read32(dc->mem, 0xa0000000 | addr);
+    uint32_t tag = data & 0xff000000;
+
+    if (addr < SH4_PVR_REG_BEGIN) {
+      CHECK_NE(tag, pvr_tag);
+    } else {
+      CHECK_NE(tag, holly_tag);
+    }
+  }
+
+  /* writes are routed the same way */
+  for (uint32_t addr = SH4_HOLLY_REG_END + 1 - subpage_size;
+       addr <= SH4_HOLLY_REG_END; addr += 4) {
+    int offset = (addr - SH4_HOLLY_REG_BEGIN) >> 2;
+
+    if (holly_cb[offset].read || holly_cb[offset].write) {
+      continue;
+    }
+
+    sh4_write32(dc->mem, 0xa0000000 | addr, ~addr);
+    CHECK_EQ(hl->reg[offset], ~addr);
+    CHECK_EQ(sh4_area0_read(sh4, addr, 0xffffffff), ~addr);
+  }
+
+  dc_destroy(dc);
+}
+
+static int num_vblanks;
+
+static void count_vblank_in(void *userdata, int video_disabled) {
+  num_vblanks++;
+}
+
+TEST(mmio_spg_status) {
+  struct dreamcast *dc = dc_create();
+  dc->vblank_in = &count_vblank_in;
+  dc_resume(dc);
+  num_vblanks = 0;
+
+  /* the scanline is derived from the scheduler's time when read, and must
+     step through every line of the frame even though only a few of them are
+     scheduled */
+  union spg_status status;
+  uint32_t last_line = 0;
+  int num_wraps = 0;
+  int num_vsyncs = 0;
+  int was_vsync = 0;
+
+  for (int i = 0; i < 20000; i++) {
+    dc_tick(dc, 20000);
+
+    status.full = sh4_read32(dc->mem, 0xa05f810c);
+
+    if (status.scanline < last_line) {
+      num_wraps++;
+    }
+    if (status.vsync && !was_vsync) {
+      num_vsyncs++;
+    }
+
+    last_line = status.scanline;
+    was_vsync = status.vsync;
+  }
+
+  /* 400ms of ntsc video */
+  CHECK(num_wraps >= 23 && num_wraps <= 25);
+  CHECK(num_vsyncs >= 23 && num_vsyncs <= 25);
+  CHECK(num_vblanks >= 23 && num_vblanks <= 25);
+
+  dc_destroy(dc);
+}
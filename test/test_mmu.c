@@ -0,0 +1,69 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+
+#define CODE_ADDR 0x8c001000
+#define VBR_ADDR 0x8c002000
+#define DATA_ADDR 0x8c200000
+
+/* 4kb page with full access mapping to DATA_ADDR */
+#define DATA_PTEL 0x0c20017c
+
+static void write_code(struct memory *mem, uint32_t addr, const uint16_t *code,
+                       int num_instrs) {
+  for (int i = 0; i < num_instrs; i++) {
+    sh4_write16(mem, addr + i * 2, code[i]);
+  }
+}
+
+TEST(mmu_tlb_miss) {
+  struct dreamcast *dc = dc_create();
+  struct memory *mem = dc->mem;
+  struct sh4 *sh4 = dc->sh4;
+
+  /* read through one unmapped page and write through another, then spin */
+  static const uint16_t code[] = {
+      0x6012, /* mov.l @r1, r0 */
+      0x2202, /* mov.l r0, @r2 */
+      0xaffe, /* bra . */
+      0x0009, /* nop */
+  };
+
+  /* the tlb miss handler maps the page latched in PTEH and retries */
+  static const uint16_t handler[] = {
+      0x0038, /* ldtlb */
+      0x7801, /* add #1, r8 */
+      0x002b, /* rte */
+      0x0009, /* nop */
+  };
+
+  sh4_reset(sh4, CODE_ADDR);
+  write_code(mem, CODE_ADDR, code, ARRAY_SIZE(code));
+  write_code(mem, VBR_ADDR + 0x400, handler, ARRAY_SIZE(handler));
+  sh4_write32(mem, DATA_ADDR, 0xdeadbeef);
+  sh4_write32(mem, DATA_ADDR + 4, 0);
+
+  sh4->ctx.vbr = VBR_ADDR;
+  sh4->ctx.r[1] = 0x00100000;
+  sh4->ctx.r[2] = 0x00101004;
+  sh4->ctx.r[8] = 0;
+  sh4->PTEL->full = DATA_PTEL;
+  sh4_write32(mem, 0xff000010, 0x1);
+
+  dc_resume(dc);
+  dc_tick(dc, NS_PER_MS);
+
+  /* each access faulted once, raising the exception with the address latched
+     for the handler, and was then restarted */
+  CHECK_EQ(sh4->ctx.r[8], 2);
+  CHECK_EQ(sh4->ctx.r[0], 0xdeadbeef);
+  CHECK_EQ(sh4_read32(mem, DATA_ADDR + 4), 0xdeadbeef);
+  CHECK_EQ(*sh4->EXPEVT, (uint32_t)sh4_exceptions[SH4_EXC_DTLBMISSW].expevt);
+  CHECK_EQ(*sh4->TEA, 0x00101004);
+  CHECK_EQ(sh4->PTEH->VPN, 0x00101004 >> 10);
+
+  dc_destroy(dc);
+}
@@ -0,0 +1,175 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/rewind.h"
+#include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
+#include "jit/jit.h"
+#include "jit/jit_backend.h"
+
+#define NUM_RUNS 100
+#define NUM_PAGES 256
+#define CODE_ADDR 0x8c001000
+#define DATA_ADDR 0x8c000000
+
+static void scribble(struct dreamcast *dc, uint32_t seed) {
+  struct memory *mem = dc->mem;
+
+  /* ram, vram through its 32-bit access area, and aram */
+  for (int i = 0; i < 64; i++) {
+    sh4_write32(mem, 0x8c100000 + i * 0x1000, seed + i);
+    sh4_write32(mem, 0xa5000000 + i * 0x800, seed ^ i);
+    sh4_write32(mem, 0xa0800000 + i * 0x400, seed - i);
+  }
+}
+
+static void check_state(struct dreamcast *dc, struct snapshot *expected,
+                        struct snapshot *ss) {
+  dc_snapshot(dc, ss);
+  CHECK_EQ(snapshot_size(ss), snapshot_size(expected));
+  CHECK(!memcmp(snapshot_data(ss), snapshot_data(expected),
+                snapshot_size(expected)));
+}
+
+TEST(rewind_step) {
+  struct dreamcast *dc = dc_create();
+  struct sh4 *sh4 = dc->sh4;
+  struct rewind *rw = rewind_create(dc, INT64_C(256) * 1024 * 1024);
+  struct snapshot *first = snapshot_create();
+  struct snapshot *second = snapshot_create();
+  struct snapshot *ss = snapshot_create();
+
+  sh4_reset(sh4, 0xa0000000);
+
+  /* only run the scheduler's timers, there's no code to execute */
+  sh4->runif.running = 0;
+  dc_resume(dc);
+
+  scribble(dc, 0x1000);
+  rewind_capture(rw);
+  dc_snapshot(dc, first);
+
+  /* the first capture holds no history, fitting in the minimum budget */
+  CHECK_EQ(rewind_depth(rw), 0);
+  CHECK_LE(rewind_size(rw), rewind_min_budget(dc));
+
+  scribble(dc, 0x2000);
+  dc_tick(dc, NS_PER_MS);
+  rewind_capture(rw);
+  dc_snapshot(dc, second);
+  CHECK_EQ(rewind_depth(rw), 1);
+
+  /* writes made after the latest capture are reverted along with it */
+  scribble(dc, 0x3000);
+  dc_tick(dc, NS_PER_MS);
+  rewind_capture(rw);
+  scribble(dc, 0x4000);
+
+  CHECK(rewind_step(rw));
+  check_state(dc, second, ss);
+
+  CHECK(rewind_step(rw));
+  check_state(dc, first, ss);
+
+  CHECK(!rewind_step(rw));
+
+  /* capture pages written sparsely, the common case for game state */
+  int64_t capture_time = 0;
+  int64_t delta_size = rewind_size(rw);
+
+  for (int i = 0; i < NUM_RUNS; i++) {
+    for (int j = 0; j < NUM_PAGES; j++) {
+      sh4_write32(dc->mem, 0x8c000000 + j * 0x1000 + (i & 0x3ff) * 4, i);
+    }
+
+    int64_t start = time_nanoseconds();
+    rewind_capture(rw);
+    capture_time += time_nanoseconds() - start;
+  }
+
+  delta_size = rewind_size(rw) - delta_size;
+
+  LOG_INFO("rewind: %d pages captured in %.3f ms, %.2f kb per capture",
+           NUM_PAGES, capture_time / (float)(NUM_RUNS * NS_PER_MS),
+           delta_size / (1024.0f * NUM_RUNS));
+
+  snapshot_destroy(ss);
+  snapshot_destroy(second);
+  snapshot_destroy(first);
+  rewind_destroy(rw);
+  dc_destroy(dc);
+}
+
+static void force_slow_path(struct jit *jit, uint32_t addr) {
+  /* recompile the blocks containing addr without fastmem for it, as if its
+     access had faulted */
+  for (struct rb_node *it = rb_first(&jit->blocks); it; it = rb_next(it)) {
+    struct jit_block *block = container_of(it, struct jit_block, it);
+
+    if (addr < block->guest_addr ||
+        addr >= block->guest_addr + block->guest_size) {
+      continue;
+    }
+
+    block->fastmem[addr - block->guest_addr] = 0;
+    block->state = JIT_STATE_RECOMPILE;
+    jit->backend->invalidate_code(jit->backend, block->guest_addr);
+  }
+}
+
+TEST(rewind_constant_store) {
+  struct dreamcast *dc = dc_create();
+  struct memory *mem = dc->mem;
+  struct sh4 *sh4 = dc->sh4;
+  struct rewind *rw = rewind_create(dc, INT64_C(256) * 1024 * 1024);
+  struct snapshot *first = snapshot_create();
+  struct snapshot *ss = snapshot_create();
+
+  /* store r8 to a constant address and increment it. the loop goes through
+     dispatch, there are no edges to restore when forcing a recompile */
+  static const uint16_t code[] = {
+      0xe28c, /* mov #-116, r2 */
+      0x4228, /* shll16 r2 */
+      0x4218, /* shll8 r2 */
+      0x2282, /* mov.l r8, @r2 */
+      0x492b, /* jmp @r9 */
+      0x7801, /* add #1, r8 */
+  };
+
+  sh4_reset(sh4, CODE_ADDR);
+
+  for (int i = 0; i < ARRAY_SIZE(code); i++) {
+    sh4_write16(mem, CODE_ADDR + i * 2, code[i]);
+  }
+
+  sh4->ctx.r[8] = 0;
+  sh4->ctx.r[9] = CODE_ADDR;
+
+  dc_resume(dc);
+  dc_tick(dc, NS_PER_MS);
+
+  /* with the address constant, the slow path stores straight to the backing
+     memory */
+  force_slow_path(sh4->jit, CODE_ADDR + 6);
+
+  dc_tick(dc, NS_PER_MS);
+  rewind_capture(rw);
+  dc_snapshot(dc, first);
+  uint32_t data = sh4_read32(mem, DATA_ADDR);
+
+  dc_tick(dc, NS_PER_MS);
+  rewind_capture(rw);
+  CHECK_NE(sh4_read32(mem, DATA_ADDR), data);
+
+  /* the stores were captured, and are reverted */
+  CHECK(rewind_step(rw));
+  check_state(dc, first, ss);
+  CHECK_EQ(sh4_read32(mem, DATA_ADDR), data);
+
+  snapshot_destroy(ss);
+  snapshot_destroy(first);
+  rewind_destroy(rw);
+  dc_destroy(dc);
+}
@@ -0,0 +1,113 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/scheduler.h"
+
+#define NUM_ORDERED 300
+#define NUM_PERIODIC 256
+#define BENCH_NS (int64_t)NS_PER_SEC
+
+static struct scheduler *sched;
+static int fired_order[NUM_ORDERED];
+static int num_fired;
+
+static void ordered_fired(void *data) {
+  int n = (int)(intptr_t)data;
+  fired_order[num_fired++] = n;
+}
+
+TEST(scheduler_order) {
+  struct dreamcast dc = {0};
+  dc.running = 1;
+  sched = sched_create(&dc);
+  num_fired = 0;
+
+  /* start more timers than fit in the initial pool, with many sharing the
+     same expire time */
+  struct timer *timers[NUM_ORDERED];
+
+  for (int i = 0; i < NUM_ORDERED; i++) {
+    int64_t expire = 1000 + (i % 7) * 100;
+    timers[i] = sched_start_timer(sched, &ordered_fired, (void *)(intptr_t)i,
+                                  expire);
+    CHECK_EQ(sched_remaining_time(sched, timers[i]), expire);
+  }
+
+  /* cancel every fifth timer */
+  for (int i = 0; i < NUM_ORDERED; i += 5) {
+    sched_cancel_timer(sched, timers[i]);
+  }
+
+  sched_tick(sched, 2000);
+
+  CHECK_EQ(num_fired, NUM_ORDERED - NUM_ORDERED / 5);
+
+  /* timers must fire in order of expire time, and in the order they were
+     started when they expire at the same time */
+  for (int i = 1; i < num_fired; i++) {
+    int a = fired_order[i - 1];
+    int b = fired_order[i];
+    CHECK(a % 7 < b % 7 || (a % 7 == b % 7 && a < b));
+  }
+
+  sched_destroy(sched);
+}
+
+struct periodic {
+  struct timer *timer;
+  int64_t period;
+  int64_t count;
+};
+
+static struct periodic periodics[NUM_PERIODIC];
+
+static void periodic_fired(void *data) {
+  struct periodic *p = data;
+  p->count++;
+  p->timer = sched_start_timer(sched, &periodic_fired, p, p->period);
+}
+
+TEST(scheduler_bench) {
+  struct dreamcast dc = {0};
+  dc.running = 1;
+  sched = sched_create(&dc);
+
+  /* mimic the mix of short, constantly rescheduled timers (aica samples,
+     pvr scanlines) and longer ones (tmu channels, dma) */
+  for (int i = 0; i < NUM_PERIODIC; i++) {
+    struct periodic *p = &periodics[i];
+    p->period = (i & 3) ? 20000 + i * 1000 : 22675;
+    p->count = 0;
+    p->timer = sched_start_timer(sched, &periodic_fired, p, p->period);
+  }
+
+  int64_t start = time_nanoseconds();
+
+  /* tick in small slices like the main loop does, restarting a timer each
+     slice to model guest code reprogramming a channel */
+  int64_t num_ticks = 0;
+  for (int64_t t = 0; t < BENCH_NS; t += 10000) {
+    struct periodic *p = &periodics[num_ticks++ % NUM_PERIODIC];
+    int64_t remaining = sched_remaining_time(sched, p->timer);
+    sched_cancel_timer(sched, p->timer);
+    p->timer = sched_start_timer(sched, &periodic_fired, p, remaining);
+
+    sched_tick(sched, 10000);
+  }
+
+  int64_t end = time_nanoseconds();
+
+  int64_t total = 0;
+  for (int i = 0; i < NUM_PERIODIC; i++) {
+    total += periodics[i].count;
+  }
+
+  CHECK_GT(total, 0);
+
+  sched_destroy(sched);
+
+  LOG_INFO("scheduler: %" PRId64 " timers fired, %" PRId64
+           " restarted in %.3f ms",
+           total, num_ticks, (end - start) / (float)NS_PER_MS);
+}
@@ -0,0 +1,143 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
+
+#define NUM_RUNS 10
+
+static uint8_t buffer[0x10000];
+
+static void start_dma(struct sh4 *sh4, uint32_t src, uint32_t dst, int size) {
+  *sh4->DAR1 = dst;
+  *sh4->DMATCR1 = size / 32;
+
+  struct sh4_dtr dtr = {0};
+  dtr.channel = 1;
+  dtr.dir = SH4_DMA_FROM_ADDR;
+  dtr.addr = src;
+  sh4_dmac_ddt(sh4, &dtr);
+}
+
+TEST(snapshot_restore) {
+  struct dreamcast *dc = dc_create();
+  struct sh4 *sh4 = dc->sh4;
+  struct snapshot *before = snapshot_create();
+  struct snapshot *after = snapshot_create();
+  struct snapshot *replayed = snapshot_create();
+
+  sh4_reset(sh4, 0xa0000000);
+
+  /* only run the scheduler's timers, there's no code to execute */
+  sh4->runif.running = 0;
+  dc_resume(dc);
+
+  const uint32_t src = 0x0c010000;
+  const uint32_t dst = 0x0c100000;
+  const int size = (int)sizeof(buffer);
+
+  for (int i = 0; i < size; i++) {
+    buffer[i] = (uint8_t)i;
+  }
+  sh4_memcpy_to_guest(dc->mem, src, buffer, size);
+
+  /* snapshot with a transfer in flight, so the pending burst's timer and the
+     channel's completion callback must both survive the restore */
+  start_dma(sh4, src, dst, size);
+  dc_snapshot(dc, before);
+
+  dc_tick(dc, NS_PER_MS);
+  CHECK_EQ(*sh4->DMATCR1, 0);
+  dc_snapshot(dc, after);
+
+  /* clobber the results of the transfer and restore */
+  memset(mem_ram(dc->mem, dst & 0xffffff), 0xff, size);
+  CHECK(dc_restore(dc, before));
+  CHECK_EQ(*sh4->DMATCR1, size / 32);
+  CHECK_EQ(sh4->CHCR1->TE, 0);
+
+  /* running the same slice again must land on the exact same state */
+  dc_tick(dc, NS_PER_MS);
+  dc_snapshot(dc, replayed);
+
+  CHECK_EQ(snapshot_size(replayed), snapshot_size(after));
+  CHECK(!memcmp(snapshot_data(replayed), snapshot_data(after),
+                snapshot_size(after)));
+
+  static uint8_t result[0x10000];
+  sh4_memcpy_to_host(dc->mem, result, dst, size);
+  CHECK_EQ(memcmp(result, buffer, size), 0);
+
+  /* snapshots from a different build, or that aren't snapshots at all, are
+     rejected without touching the machine */
+  snapshot_reset(replayed);
+  snapshot_write(replayed, buffer, 256);
+  CHECK(!dc_restore(dc, replayed));
+
+  int64_t snapshot_time = 0;
+  int64_t restore_time = 0;
+
+  for (int i = 0; i < NUM_RUNS; i++) {
+    int64_t start = time_nanoseconds();
+    dc_snapshot(dc, before);
+    int64_t mid = time_nanoseconds();
+    CHECK(dc_restore(dc, before));
+    int64_t end = time_nanoseconds();
+
+    snapshot_time += mid - start;
+    restore_time += end - mid;
+  }
+
+  LOG_INFO("snapshot: %.2f mb, taken in %.3f ms, restored in %.3f ms",
+           snapshot_size(before) / (1024.0f * 1024.0f),
+           snapshot_time / (float)(NUM_RUNS * NS_PER_MS),
+           restore_time / (float)(NUM_RUNS * NS_PER_MS));
+
+  snapshot_destroy(replayed);
+  snapshot_destroy(after);
+  snapshot_destroy(before);
+  dc_destroy(dc);
+}
+
+TEST(snapshot_file) {
+  const char *path = "test_snapshot_file.snap";
+  struct snapshot *ss = snapshot_create();
+  struct snapshot *loaded = snapshot_create();
+
+  for (int i = 0; i < (int)sizeof(buffer); i++) {
+    buffer[i] = (uint8_t)(i * 7);
+  }
+  snapshot_write(ss, buffer, sizeof(buffer));
+
+  CHECK(snapshot_save(ss, path));
+  CHECK(snapshot_load(loaded, path));
+  CHECK_EQ(snapshot_size(loaded), snapshot_size(ss));
+  CHECK(!memcmp(snapshot_data(loaded), snapshot_data(ss), snapshot_size(ss)));
+
+  /* a file of the right size whose contents have been corrupted is rejected */
+  FILE *fp = fopen(path, "r+b");
+  CHECK_NOTNULL(fp);
+  fseek(fp, -1, SEEK_END);
+  fputc(~buffer[sizeof(buffer) - 1], fp);
+  fclose(fp);
+  CHECK(!snapshot_load(loaded, path));
+
+  /* as is a truncated one */
+  uint8_t head[64];
+  CHECK(snapshot_save(ss, path));
+  fp = fopen(path, "rb");
+  CHECK_NOTNULL(fp);
+  CHECK_EQ(fread(head, 1, sizeof(head), fp), sizeof(head));
+  fclose(fp);
+  fp = fopen(path, "wb");
+  CHECK_NOTNULL(fp);
+  fwrite(head, 1, sizeof(head), fp);
+  fclose(fp);
+  CHECK(!snapshot_load(loaded, path));
+
+  remove(path);
+  snapshot_destroy(loaded);
+  snapshot_destroy(ss);
+}
@@ -0,0 +1,168 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/pvr/ta.h"
+#include "guest/sh4/sh4.h"
+
+#define NUM_LISTS 64
+#define NUM_VERTS 60000
+#define STRIP_LEN 16
+
+static void sq_flush(struct sh4 *sh4, const void *param) {
+  /* fill store queue 0 and flush it to the ta fifo, the way games submit
+     geometry */
+  memcpy(sh4->sq[0], param, 32);
+  sh4_ccn_pref(sh4, 0xe0000000);
+}
+
+TEST(ta_vertex_throughput) {
+  struct dreamcast *dc = dc_create();
+  struct sh4 *sh4 = dc->sh4;
+  sh4_reset(sh4, 0xa0000000);
+
+  /* point store queue 0 at the ta's polygon fifo */
+  *sh4->QACR0 = 0x10;
+  sh4_ccn_sq_remap(sh4);
+
+  uint32_t poly[8] = {0};
+  union pcw *poly_pcw = (union pcw *)&poly[0];
+  poly_pcw->para_type = TA_PARAM_POLY_OR_VOL;
+  poly_pcw->list_type = TA_LIST_OPAQUE;
+
+  uint32_t vert[8] = {0};
+  union pcw *vert_pcw = (union pcw *)&vert[0];
+  vert_pcw->para_type = TA_PARAM_VERTEX;
+
+  uint32_t eol[8] = {0};
+  union pcw *eol_pcw = (union pcw *)&eol[0];
+  eol_pcw->para_type = TA_PARAM_END_OF_LIST;
+
+  int64_t start = time_nanoseconds();
+
+  for (int i = 0; i < NUM_LISTS; i++) {
+    ta_list_init(dc->ta);
+
+    sq_flush(sh4, poly);
+
+    for (int j = 0; j < NUM_VERTS; j++) {
+      vert_pcw->end_of_strip = (j % STRIP_LEN) == (STRIP_LEN - 1);
+      sq_flush(sh4, vert);
+    }
+
+    sq_flush(sh4, eol);
+  }
+
+  int64_t end = time_nanoseconds();
+
+  float elapsed = (end - start) / (float)NS_PER_SEC;
+  LOG_INFO("ta vertex throughput: %.2f mverts/s",
+           (NUM_LISTS * NUM_VERTS) / elapsed / 1000000.0f);
+
+  dc_destroy(dc);
+}
+
+static struct ta_context *rendered_ctx;
+
+static void capture_render(void *userdata, struct ta_context *ctx) {
+  rendered_ctx = ctx;
+}
+
+TEST(ta_texture_refs) {
+  struct dreamcast *dc = dc_create();
+  struct sh4 *sh4 = dc->sh4;
+  sh4_reset(sh4, 0xa0000000);
+
+  *sh4->QACR0 = 0x10;
+  sh4_ccn_sq_remap(sh4);
+
+  dc->start_render = &capture_render;
+  rendered_ctx = NULL;
+
+  union poly_param poly = {0};
+  union pcw *poly_pcw = &poly.type0.pcw;
+  poly_pcw->para_type = TA_PARAM_POLY_OR_VOL;
+  poly_pcw->list_type = TA_LIST_OPAQUE;
+
+  uint32_t vert[8] = {0};
+  union pcw *vert_pcw = (union pcw *)&vert[0];
+  vert_pcw->para_type = TA_PARAM_VERTEX;
+  vert_pcw->end_of_strip = 1;
+
+  uint32_t eol[8] = {0};
+  union pcw *eol_pcw = (union pcw *)&eol[0];
+  eol_pcw->para_type = TA_PARAM_END_OF_LIST;
+
+  ta_list_init(dc->ta);
+
+  /* cycle through three textures, with every fourth param untextured */
+  for (int i = 0; i < 30; i++) {
+    poly_pcw->texture = (i & 3) != 3;
+    poly.type0.tsp.full = 0x100 + (i % 3);
+    poly.type0.tcw.full = 0x200;
+    sq_flush(sh4, &poly);
+    sq_flush(sh4, vert);
+  }
+
+  sq_flush(sh4, eol);
+
+  ta_start_render(dc->ta);
+  CHECK_NOTNULL(rendered_ctx);
+
+  /* each texture is reported once, in order of first use */
+  CHECK_EQ(rendered_ctx->num_textures, 3);
+  for (int i = 0; i < 3; i++) {
+    CHECK_EQ(rendered_ctx->textures[i].tsp.full, (uint32_t)(0x100 + i));
+    CHECK_EQ(rendered_ctx->textures[i].tcw.full, 0x200u);
+  }
+
+  dc_destroy(dc);
+}
+
+TEST(ta_texture_refs_overflow) {
+  struct dreamcast *dc = dc_create();
+  struct sh4 *sh4 = dc->sh4;
+  sh4_reset(sh4, 0xa0000000);
+
+  *sh4->QACR0 = 0x10;
+  sh4_ccn_sq_remap(sh4);
+
+  dc->start_render = &capture_render;
+  rendered_ctx = NULL;
+
+  union poly_param poly = {0};
+  union pcw *poly_pcw = &poly.type0.pcw;
+  poly_pcw->para_type = TA_PARAM_POLY_OR_VOL;
+  poly_pcw->list_type = TA_LIST_OPAQUE;
+  poly_pcw->texture = 1;
+
+  uint32_t vert[8] = {0};
+  union pcw *vert_pcw = (union pcw *)&vert[0];
+  vert_pcw->para_type = TA_PARAM_VERTEX;
+  vert_pcw->end_of_strip = 1;
+
+  uint32_t eol[8] = {0};
+  union pcw *eol_pcw = (union pcw *)&eol[0];
+  eol_pcw->para_type = TA_PARAM_END_OF_LIST;
+
+  ta_list_init(dc->ta);
+
+  /* reference one more unique texture than the set holds */
+  for (int i = 0; i <= TA_MAX_TEXTURES; i++) {
+    poly.type0.tsp.full = 0x100;
+    poly.type0.tcw.full = i;
+    sq_flush(sh4, &poly);
+    sq_flush(sh4, vert);
+  }
+
+  sq_flush(sh4, eol);
+
+  ta_start_render(dc->ta);
+  CHECK_NOTNULL(rendered_ctx);
+
+  /* the set stops collecting once full, flagging the params to be walked */
+  CHECK(rendered_ctx->textures_overflow);
+  CHECK_EQ(rendered_ctx->num_textures, TA_MAX_TEXTURES);
+
+  dc_destroy(dc);
+}
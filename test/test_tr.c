@@ -0,0 +1,206 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "guest/pvr/ta.h"
+#include "guest/pvr/tr.h"
+
+#define NUM_STRIPS 1500
+#define STRIP_LEN 8
+#define NUM_SPRITES 3000
+#define NUM_RUNS 10
+
+static struct tr_texture *find_texture(void *userdata, union tsp tsp,
+                                       union tcw tcw) {
+  /* return a non-zero handle so it doesn't try to create a texture with
+     the render backend (which is NULL) */
+  static struct tr_texture tex;
+  tex.handle = 1;
+  return &tex;
+}
+
+static uint32_t next_rand(uint32_t *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 16;
+}
+
+static uint8_t *write_param(struct ta_context *ctx, union pcw pcw,
+                            int vert_type) {
+  uint8_t *param = &ctx->params[ctx->size];
+  int size = ta_param_size(pcw, vert_type);
+  CHECK_LE(ctx->size + size, (int)sizeof(ctx->params));
+  memset(param, 0, size);
+  *(union pcw *)param = pcw;
+  ctx->size += size;
+  return param;
+}
+
+static void write_eol(struct ta_context *ctx) {
+  union pcw pcw = {0};
+  pcw.para_type = TA_PARAM_END_OF_LIST;
+  write_param(ctx, pcw, TA_NUM_VERTS);
+}
+
+static void write_strips(struct ta_context *ctx, int list_type,
+                         uint32_t *seed) {
+  for (int i = 0; i < NUM_STRIPS; i++) {
+    /* alternate between intensity strips that set the face color and ones
+       that reuse the previous face color, so the global state carries over
+       between params */
+    union pcw pcw = {0};
+    pcw.para_type = TA_PARAM_POLY_OR_VOL;
+    pcw.list_type = list_type;
+    pcw.col_type = (i & 1) ? 3 : ((i & 2) ? 2 : 0);
+
+    int vert_type = ta_vert_type(pcw);
+    uint8_t *data = write_param(ctx, pcw, vert_type);
+
+    if (ta_poly_type(pcw) == 1) {
+      union poly_param *param = (union poly_param *)data;
+      param->type1.face_color_a = 1.0f;
+      param->type1.face_color_r = (next_rand(seed) & 0xff) / 255.0f;
+      param->type1.face_color_g = (next_rand(seed) & 0xff) / 255.0f;
+      param->type1.face_color_b = (next_rand(seed) & 0xff) / 255.0f;
+    }
+
+    for (int j = 0; j < STRIP_LEN; j++) {
+      union pcw vert_pcw = {0};
+      vert_pcw.para_type = TA_PARAM_VERTEX;
+      vert_pcw.end_of_strip = j == STRIP_LEN - 1;
+
+      union vert_param *vert =
+          (union vert_param *)write_param(ctx, vert_pcw, vert_type);
+      vert->type0.xyz[0] = (float)(j / 2);
+      vert->type0.xyz[1] = (float)(j & 1);
+      vert->type0.xyz[2] = (next_rand(seed) & 0xfff) / 4096.0f;
+
+      if (vert_type == 2) {
+        vert->type2.base_intensity = (next_rand(seed) & 0xff) / 255.0f;
+      } else {
+        vert->type0.base_color = next_rand(seed) | 0xff000000;
+      }
+    }
+  }
+}
+
+static void write_sprites(struct ta_context *ctx, int list_type,
+                          uint32_t *seed) {
+  for (int i = 0; i < NUM_SPRITES; i++) {
+    union pcw pcw = {0};
+    pcw.para_type = TA_PARAM_SPRITE;
+    pcw.list_type = list_type;
+
+    int vert_type = ta_vert_type(pcw);
+    union poly_param *param =
+        (union poly_param *)write_param(ctx, pcw, vert_type);
+    param->sprite.base_color = next_rand(seed) | 0xff000000;
+
+    /* follow a degenerate sprite with one that isn't, the second inherits its
+       surface from the last committed one */
+    for (int j = 0; j < 2; j++) {
+      union pcw vert_pcw = {0};
+      vert_pcw.para_type = TA_PARAM_VERTEX;
+      vert_pcw.end_of_strip = 1;
+
+      union vert_param *vert =
+          (union vert_param *)write_param(ctx, vert_pcw, vert_type);
+      float size = j ? 1.0f : 0.0f;
+      float z = (next_rand(seed) & 0xfff) / 4096.0f;
+      vert->sprite1.xyz[0][0] = 0.0f;
+      vert->sprite1.xyz[0][1] = size;
+      vert->sprite1.xyz[0][2] = z;
+      vert->sprite1.xyz[1][0] = 0.0f;
+      vert->sprite1.xyz[1][1] = 0.0f;
+      vert->sprite1.xyz[1][2] = z;
+      vert->sprite1.xyz[2][0] = size;
+      vert->sprite1.xyz[2][1] = 0.0f;
+      vert->sprite1.xyz[2][2] = z * 0.5f;
+      vert->sprite1.xyz[3][0] = size;
+      vert->sprite1.xyz[3][1] = size;
+    }
+  }
+}
+
+static void check_contexts_equal(const struct tr_context *a,
+                                 const struct tr_context *b) {
+  CHECK_EQ(a->num_surfs, b->num_surfs);
+  CHECK_EQ(a->num_verts, b->num_verts);
+  CHECK_EQ(a->num_indices, b->num_indices);
+  CHECK_EQ(a->num_params, b->num_params);
+
+  for (int i = 0; i < a->num_surfs; i++) {
+    const struct ta_surface *sa = &a->surfs[i];
+    const struct ta_surface *sb = &b->surfs[i];
+    CHECK_EQ(sa->params.full, sb->params.full);
+    CHECK_EQ(sa->first_vert, sb->first_vert);
+    CHECK_EQ(sa->num_verts, sb->num_verts);
+    CHECK_EQ(sa->strip_offset, sb->strip_offset);
+  }
+
+  CHECK(!memcmp(a->verts, b->verts, a->num_verts * sizeof(a->verts[0])));
+  CHECK(!memcmp(a->indices, b->indices,
+                a->num_indices * sizeof(a->indices[0])));
+  CHECK(!memcmp(a->params, b->params, a->num_params * sizeof(a->params[0])));
+
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    const struct tr_list *la = &a->lists[i];
+    const struct tr_list *lb = &b->lists[i];
+    CHECK_EQ(la->num_surfs, lb->num_surfs);
+    CHECK_EQ(la->num_orig_surfs, lb->num_orig_surfs);
+    CHECK(!memcmp(la->surfs, lb->surfs, la->num_surfs * sizeof(la->surfs[0])));
+  }
+}
+
+static int64_t convert_context(struct tr *tr, const struct ta_context *ctx,
+                               struct tr_context *rc) {
+  int64_t start = time_nanoseconds();
+
+  for (int i = 0; i < NUM_RUNS; i++) {
+    tr_convert_context(tr, NULL, ctx, rc);
+  }
+
+  int64_t end = time_nanoseconds();
+
+  return (end - start) / NUM_RUNS;
+}
+
+TEST(tr_convert_parallel) {
+  struct ta_context *ctx = calloc(1, sizeof(struct ta_context));
+  struct tr_context *serial_rc = calloc(1, sizeof(struct tr_context));
+  struct tr_context *parallel_rc = calloc(1, sizeof(struct tr_context));
+  uint32_t seed = 1;
+
+  ta_init_tables();
+
+  ctx->autosort = 1;
+  ctx->video_width = 640;
+  ctx->video_height = 480;
+
+  write_strips(ctx, TA_LIST_OPAQUE, &seed);
+  write_eol(ctx);
+  write_strips(ctx, TA_LIST_PUNCH_THROUGH, &seed);
+  write_eol(ctx);
+  write_sprites(ctx, TA_LIST_TRANSLUCENT, &seed);
+  write_strips(ctx, TA_LIST_TRANSLUCENT, &seed);
+  write_eol(ctx);
+
+  struct tr *serial = tr_create(NULL, &find_texture, 0);
+  struct tr *parallel = tr_create(NULL, &find_texture, 3);
+
+  int64_t serial_time = convert_context(serial, ctx, serial_rc);
+  int64_t parallel_time = convert_context(parallel, ctx, parallel_rc);
+
+  /* output must be identical no matter how the stream was split up */
+  check_contexts_equal(serial_rc, parallel_rc);
+
+  tr_destroy(parallel);
+  tr_destroy(serial);
+
+  LOG_INFO("tr: %d surfs, %d verts converted in %.3f ms serially, %.3f ms "
+           "with 3 workers",
+           serial_rc->num_surfs, serial_rc->num_verts,
+           serial_time / (float)NS_PER_MS, parallel_time / (float)NS_PER_MS);
+
+  free(parallel_rc);
+  free(serial_rc);
+  free(ctx);
+}
@@ -0,0 +1,189 @@
+#include <time.h>
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/option.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+#include "guest/scheduler.h"
+#include "stats.h"
+
+/*
+ * headless benchmark. runs a disc as fast as the host allows, with no video,
+ * audio or frame pacing, and reports throughput as json. logs are printed to
+ * stdout, so the report is written to --output, or stderr if not set
+ *
+ * input can be replayed from a log recorded with redream's --input_log. each
+ * line of the log is "frame port button value", frame being the number of
+ * vblanks since the disc was loaded
+ */
+
+DEFINE_OPTION_INT(frames, 0, "Number of frames to run, 0 to run for --seconds");
+DEFINE_OPTION_INT(seconds, 60, "Number of guest seconds to run");
+DEFINE_OPTION_STRING(replay, "", "Input log to replay");
+DEFINE_OPTION_STRING(output, "", "Path to write the report to");
+
+struct input_event {
+  int frame;
+  int port;
+  int button;
+  int16_t value;
+};
+
+static struct {
+  struct dreamcast *dc;
+
+  struct input_event *events;
+  int num_events;
+  int next_event;
+
+  int frames;
+} bench;
+
+static int load_replay(const char *path) {
+  FILE *fp = fopen(path, "r");
+
+  if (!fp) {
+    LOG_WARNING("load_replay failed to open %s", path);
+    return 0;
+  }
+
+  int max_events = 0;
+  int frame, port, button, value;
+
+  while (fscanf(fp, "%d %d %d %d", &frame, &port, &button, &value) == 4) {
+    if (bench.num_events >= max_events) {
+      max_events = MAX(max_events * 2, 1024);
+      bench.events =
+          realloc(bench.events, max_events * sizeof(struct input_event));
+    }
+
+    struct input_event *ev = &bench.events[bench.num_events++];
+    ev->frame = frame;
+    ev->port = port;
+    ev->button = button;
+    ev->value = (int16_t)value;
+  }
+
+  fclose(fp);
+
+  LOG_INFO("load_replay %d events from %s", bench.num_events, path);
+
+  return 1;
+}
+
+static void bench_vblank_in(void *userdata, int video_disabled) {
+  bench.frames++;
+
+  /* the log is recorded in order, apply everything up to this frame */
+  while (bench.next_event < bench.num_events) {
+    struct input_event *ev = &bench.events[bench.next_event];
+
+    if (ev->frame > bench.frames) {
+      break;
+    }
+
+    dc_input(bench.dc, ev->port, ev->button, ev->value);
+    bench.next_event++;
+  }
+}
+
+int main(int argc, char **argv) {
+  /* set application directory */
+  char appdir[PATH_MAX];
+  char userdir[PATH_MAX];
+  int r = fs_userdir(userdir, sizeof(userdir));
+  CHECK(r);
+  snprintf(appdir, sizeof(appdir), "%s" PATH_SEPARATOR ".redream", userdir);
+  fs_set_appdir(appdir);
+
+  if (!options_parse(&argc, &argv)) {
+    return EXIT_FAILURE;
+  }
+
+  const char *path = argc > 1 ? argv[1] : NULL;
+
+  if (OPTION_replay[0] && !load_replay(OPTION_replay)) {
+    return EXIT_FAILURE;
+  }
+
+  FILE *fp = stderr;
+
+  if (OPTION_output[0] && !(fp = fopen(OPTION_output, "w"))) {
+    LOG_WARNING("failed to open %s", OPTION_output);
+    return EXIT_FAILURE;
+  }
+
+  bench.dc = dc_create();
+  CHECK_NOTNULL(bench.dc);
+  bench.dc->vblank_in = &bench_vblank_in;
+
+  if (!dc_load(bench.dc, path)) {
+    LOG_WARNING("failed to load %s", path);
+    dc_destroy(bench.dc);
+    if (fp != stderr) {
+      fclose(fp);
+    }
+    return EXIT_FAILURE;
+  }
+
+  const int64_t MACHINE_STEP = HZ_TO_NANO(1000);
+  int64_t guest_time = 0;
+  int64_t guest_end = (int64_t)OPTION_seconds * NS_PER_SEC;
+
+  int64_t sh4_instrs = prof_counter_total(COUNTER_sh4_instrs);
+  int64_t arm7_instrs = prof_counter_total(COUNTER_arm7_instrs);
+  int64_t compile_time = prof_counter_total(COUNTER_jit_compile_time);
+  int64_t compiles = prof_counter_total(COUNTER_jit_compiles);
+  int64_t start = time_nanoseconds();
+  int64_t start_cpu = time_thread_nanoseconds();
+  clock_t start_clock = clock();
+
+  while (dc_running(bench.dc)) {
+    if (OPTION_frames > 0 ? bench.frames >= OPTION_frames
+                          : guest_time >= guest_end) {
+      break;
+    }
+
+    dc_tick(bench.dc, MACHINE_STEP);
+    guest_time += MACHINE_STEP;
+  }
+
+  /* the guest runs entirely on this thread, the process time covers anything
+     else the host spun up */
+  double elapsed = (time_nanoseconds() - start) / (double)NS_PER_SEC;
+  double cpu = (time_thread_nanoseconds() - start_cpu) / (double)NS_PER_SEC;
+  double process_cpu = (clock() - start_clock) / (double)CLOCKS_PER_SEC;
+
+  sh4_instrs = prof_counter_total(COUNTER_sh4_instrs) - sh4_instrs;
+  arm7_instrs = prof_counter_total(COUNTER_arm7_instrs) - arm7_instrs;
+  compile_time = prof_counter_total(COUNTER_jit_compile_time) - compile_time;
+  compiles = prof_counter_total(COUNTER_jit_compiles) - compiles;
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"frames\": %d,\n", bench.frames);
+  fprintf(fp, "  \"guest_seconds\": %.3f,\n",
+          guest_time / (double)NS_PER_SEC);
+  fprintf(fp, "  \"host_seconds\": %.3f,\n", elapsed);
+  fprintf(fp, "  \"fps\": %.2f,\n", bench.frames / elapsed);
+  fprintf(fp, "  \"sh4_mips\": %.2f,\n", sh4_instrs / (elapsed * 1000000.0));
+  fprintf(fp, "  \"arm7_mips\": %.2f,\n",
+          arm7_instrs / (elapsed * 1000000.0));
+  fprintf(fp, "  \"jit_compiles\": %" PRId64 ",\n", compiles);
+  fprintf(fp, "  \"jit_compile_ms\": %.3f,\n",
+          compile_time / (double)NS_PER_MS);
+  fprintf(fp, "  \"input_events\": %d,\n", bench.next_event);
+  fprintf(fp, "  \"cpu_seconds\": {\n");
+  fprintf(fp, "    \"emu\": %.3f,\n", cpu);
+  fprintf(fp, "    \"process\": %.3f\n", process_cpu);
+  fprintf(fp, "  }\n");
+  fprintf(fp, "}\n");
+
+  if (fp != stderr) {
+    fclose(fp);
+  }
+
+  dc_destroy(bench.dc);
+  free(bench.events);
+
+  return EXIT_SUCCESS;
+}
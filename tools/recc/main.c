@@ -19,7 +19,7 @@ DEFINE_OPTION_STRING(pass, "cfa,lse,cprop,esimp,dce,ra",
 DEFINE_PASS_STAT(ir_instrs_total, "total ir instructions");
 DEFINE_PASS_STAT(ir_instrs_removed, "removed ir instructions");
 
-DEFINE_JIT_CODE_BUFFER(code);
+static uint8_t *code;
 static uint8_t ir_buffer[1024 * 1024];
 
 static int get_num_instrs(const struct ir *ir) {
@@ -80,7 +80,7 @@ static void process_file(struct jit_backend *backend, const char *filename,
       cfa_destroy(cfa);
     } else if (!strcmp(name, "lse")) {
       struct lse *lse = lse_create();
-      lse_run(lse, &ir);
+      lse_run(lse, &ir, 0);
       lse_destroy(lse);
     } else if (!strcmp(name, "cprop")) {
       struct cprop *cprop = cprop_create();
@@ -175,7 +175,9 @@ int main(int argc, char **argv) {
   struct jit_guest guest = {0};
   guest.addr_mask = 0xff;
 
-  struct jit_backend *backend = x64_backend_create(&guest, code, sizeof(code));
+  code = jit_alloc_code_buffer();
+  struct jit_backend *backend =
+      x64_backend_create(&guest, code, JIT_CODE_BUFFER_SIZE);
 
   if (fs_isfile(path)) {
     process_file(backend, path, 0);
@@ -187,6 +189,7 @@ int main(int argc, char **argv) {
   pass_stats_dump();
 
   backend->destroy(backend);
+  jit_free_code_buffer(code);
 
   return EXIT_SUCCESS;
 }
@@ -53,10 +53,11 @@ static void test_context(struct trace_cmd *cmd, struct test *tests,
 
   struct ta_context *ctx = calloc(1, sizeof(struct ta_context));
   struct tr_context *rc = calloc(1, sizeof(struct tr_context));
+  struct tr *tr = tr_create(NULL, &find_texture, 0);
 
   /* parse the context */
   trace_copy_context(cmd, ctx);
-  tr_convert_context(NULL, NULL, &find_texture, ctx, rc);
+  tr_convert_context(tr, NULL, ctx, rc);
 
   /* sort each vertex by the original w */
   struct depth_entry *original =
@@ -105,6 +106,7 @@ static void test_context(struct trace_cmd *cmd, struct test *tests,
   }
 
   free(original);
+  tr_destroy(tr);
   free(rc);
   free(ctx);
 }